@@ -40,6 +40,7 @@ set(OBKM_SRC
 	${OBK_SRCS}httpserver/new_http.c
 	${OBK_SRCS}httpserver/rest_interface.c
 	${OBK_SRCS}mqtt/new_mqtt_deduper.c
+	${OBK_SRCS}mqtt/new_mqtt_spool.c
 	${OBK_SRCS}jsmn/jsmn.c
 	${OBK_SRCS}logging/logging.c
 	${OBK_SRCS}mqtt/new_mqtt.c
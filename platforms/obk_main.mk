@@ -54,6 +54,7 @@ OBKM_SRC  += $(OBK_SRCS)httpserver/json_interface.c
 OBKM_SRC  += $(OBK_SRCS)httpserver/new_http.c
 OBKM_SRC  += $(OBK_SRCS)httpserver/rest_interface.c
 OBKM_SRC  += $(OBK_SRCS)mqtt/new_mqtt_deduper.c
+OBKM_SRC  += $(OBK_SRCS)mqtt/new_mqtt_spool.c
 OBKM_SRC  += $(OBK_SRCS)jsmn/jsmn.c
 OBKM_SRC  += $(OBK_SRCS)logging/logging.c
 OBKM_SRC  += $(OBK_SRCS)mqtt/new_mqtt.c
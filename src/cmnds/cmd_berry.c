@@ -33,10 +33,46 @@ typedef struct berryInstance_s
 	bool bFire;
 
 	struct berryInstance_s* next;
+	// next thread on the same event wait list
+	struct berryInstance_s* nextWaiting;
 } berryInstance_t;
 
 berryInstance_t *g_berryThreads = 0;
 
+// Threads with an event closure are kept on a list for their event, so firing
+// an event only looks at threads that wait for it. Raw numeric event codes
+// above the known ones share the last list. Threads are never freed, so an
+// unlinked thread keeps its nextWaiting and a list being walked stays valid.
+#define BERRY_WAIT_LISTS	(CMD_EVENT_MAX_TYPES + 1)
+static berryInstance_t *g_berryWaiters[BERRY_WAIT_LISTS];
+
+static int Berry_WaitList(int eventCode) {
+	if (eventCode >= CMD_EVENT_MAX_TYPES)
+		return CMD_EVENT_MAX_TYPES;
+	return eventCode;
+}
+static void Berry_ParkThread(berryInstance_t *t) {
+	berryInstance_t **list;
+
+	list = &g_berryWaiters[Berry_WaitList(t->wait.waitingForEvent)];
+	t->nextWaiting = *list;
+	*list = t;
+}
+static void Berry_UnparkThread(berryInstance_t *t) {
+	berryInstance_t **p;
+
+	if (t->wait.waitingForEvent == 0)
+		return;
+	p = &g_berryWaiters[Berry_WaitList(t->wait.waitingForEvent)];
+	while (*p) {
+		if (*p == t) {
+			*p = t->nextWaiting;
+			break;
+		}
+		p = &(*p)->nextWaiting;
+	}
+}
+
 berryInstance_t *Berry_RegisterThread() {
 	berryInstance_t *r;
 
@@ -61,25 +97,30 @@ berryInstance_t *Berry_RegisterThread() {
 
 void CMD_Berry_ProcessWaitersForEvent(byte eventCode, int argument) {
 	berryInstance_t *t;
+	berryInstance_t *next;
 
 
-	t = g_berryThreads;
+	t = g_berryWaiters[Berry_WaitList(eventCode)];
 
 	while (t) {
+		next = t->nextWaiting;
 		if (CheckEventCondition(&t->wait, eventCode, argument)) {
 			t->bFire = true;
 		}
-		t = t->next;
+		t = next;
 	}
 	// TODO: better
 	CMD_Berry_RunEventHandlers_IntInt(eventCode, argument, 0);
 }
 void CMD_Berry_RunEventHandlers_IntInt(byte eventCode, int argument, int argument2) {
 	berryInstance_t *t;
+	berryInstance_t *next;
 
-	t = g_berryThreads;
+	t = g_berryWaiters[Berry_WaitList(eventCode)];
 
 	while (t) {
+		// closures may park or unpark threads
+		next = t->nextWaiting;
 		if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'a') {
 			berryRunClosureIntInt(g_vm, t->closureId, argument, argument2);
@@ -88,17 +129,20 @@ void CMD_Berry_RunEventHandlers_IntInt(byte eventCode, int argument, int argumen
 			&& t->wait.waitingForArgument == argument) {
 			berryRunClosureInt(g_vm, t->closureId, argument2);
 		}
-		t = t->next;
+		t = next;
 	}
 }
 
 int CMD_Berry_RunEventHandlers_StrPtr(byte eventCode, const char *argument, void* argument2) {
 	berryInstance_t *t;
+	berryInstance_t *next;
 
-	t = g_berryThreads;
+	t = g_berryWaiters[Berry_WaitList(eventCode)];
 
 	int calls = 0;
 	while (t) {
+		// closures may park or unpark threads
+		next = t->nextWaiting;
 		if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'a') {
 			berryRunClosureStr(g_vm, t->closureId, argument, argument2);
@@ -109,17 +153,20 @@ int CMD_Berry_RunEventHandlers_StrPtr(byte eventCode, const char *argument, void
 			berryRunClosurePtr(g_vm, t->closureId, argument2);
 			calls++;
 		}
-		t = t->next;
+		t = next;
 	}
 	return calls;
 }
 
 void CMD_Berry_RunEventHandlers_IntBytes(byte eventCode, int argument, const byte *data, int size) {
 	berryInstance_t *t;
+	berryInstance_t *next;
 
-	t = g_berryThreads;
+	t = g_berryWaiters[Berry_WaitList(eventCode)];
 
 	while (t) {
+		// closures may park or unpark threads
+		next = t->nextWaiting;
 		if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'a') {
 			berryRunClosureIntBytes(g_vm, t->closureId, argument, data, size);
@@ -129,16 +176,19 @@ void CMD_Berry_RunEventHandlers_IntBytes(byte eventCode, int argument, const byt
 			&& t->wait.waitingForArgument == argument) {
 			berryRunClosureBytes(g_vm, t->closureId, data, size);
 		}
-		t = t->next;
+		t = next;
 	}
 }
 int CMD_Berry_RunEventHandlers_Str(byte eventCode, const char *argument, const char *argument2) {
 	berryInstance_t *t;
+	berryInstance_t *next;
 
-	t = g_berryThreads;
+	t = g_berryWaiters[Berry_WaitList(eventCode)];
 
 	int c_run = 0;
 	while (t) {
+		// closures may park or unpark threads
+		next = t->nextWaiting;
 		if (t->wait.waitingForEvent == eventCode
 			&& t->wait.waitingForRelation == 'a') {
 			berryRunClosureStr(g_vm, t->closureId, argument, argument2);
@@ -150,7 +200,7 @@ int CMD_Berry_RunEventHandlers_Str(byte eventCode, const char *argument, const c
 			berryRunClosureStr(g_vm, t->closureId, argument2, "");
 			c_run++;
 		}
-		t = t->next;
+		t = next;
 	}
 	return c_run;
 }
@@ -182,6 +232,7 @@ int be_addClosure(bvm *vm, const char *eventName, int relation, int reqArg, cons
 		int thread_id = 5000 + closure_id; // TODO: alloc IDs?
 		th->uniqueID = thread_id;
 		th->currentDelayMS = 0;
+		Berry_UnparkThread(th);
 		th->wait.waitingForEvent = eventCode;
 		th->wait.waitingForArgument = reqArg;
 		if (reqArgStr) {
@@ -193,6 +244,7 @@ int be_addClosure(bvm *vm, const char *eventName, int relation, int reqArg, cons
 		}
 		th->wait.waitingForRelation = relation;
 		th->closureId = closure_id;
+		Berry_ParkThread(th);
 
 		// remove the 2 values we pushed on the stack
 		be_pop(vm, 2);
@@ -400,6 +452,7 @@ void berryThreadComplete(berryInstance_t *thread) {
 	thread->closureId = -1;
 	thread->uniqueID = 0;
 	thread->currentDelayMS = 0;
+	Berry_UnparkThread(thread);
 	thread->wait.waitingForArgument = 0;
 	thread->wait.waitingForEvent = 0;
 	thread->wait.waitingForRelation = 0;
@@ -233,6 +233,22 @@ static commandResult_t CMD_ToggleChannel(const void *context, const char *cmd, c
 
 	return CMD_RES_OK;
 }
+static commandResult_t CMD_BeginChannelBatch(const void *context, const char *cmd, const char *args, int cmdFlags){
+
+	CHANNEL_BeginBatch();
+
+	return CMD_RES_OK;
+}
+static commandResult_t CMD_CommitChannelBatch(const void *context, const char *cmd, const char *args, int cmdFlags){
+
+	if (CHANNEL_IsBatchActive() == false) {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "%s: no channel batch is active", cmd);
+		return CMD_RES_ERROR;
+	}
+	CHANNEL_CommitBatch();
+
+	return CMD_RES_OK;
+}
 static commandResult_t CMD_ClampChannel(const void *context, const char *cmd, const char *args, int cmdFlags){
 	int ch, max, min;
 	int bWrapInsteadOfClamp;
@@ -448,7 +464,7 @@ static commandResult_t CMD_GetReadings(const void *context, const char *cmd, con
 	snprintf(tmp, sizeof(tmp), "%f %f %f %f %f",v,c,p,e,elh);
 
 	if(cmdFlags & COMMAND_FLAG_SOURCE_TCP) {
-		ADDLOG_INFO(LOG_FEATURE_RAW, tmp);
+		ADDLOG_INFO(LOG_FEATURE_RAW, "%s", tmp);
 	} else {
 		ADDLOG_INFO(LOG_FEATURE_CMD, "Readings are %s",tmp);
 	}
@@ -462,7 +478,7 @@ static commandResult_t CMD_ShortName(const void *context, const char *cmd, const
 	s = CFG_GetShortDeviceName();
 	if (Tokenizer_GetArgsCount() == 0) {
 		if (cmdFlags & COMMAND_FLAG_SOURCE_TCP) {
-			ADDLOG_INFO(LOG_FEATURE_RAW, s);
+			ADDLOG_INFO(LOG_FEATURE_RAW, "%s", s);
 		}
 		else {
 			ADDLOG_INFO(LOG_FEATURE_CMD, "Name is %s", s);
@@ -480,7 +496,7 @@ static commandResult_t CMD_FriendlyName(const void *context, const char *cmd, co
 	s = CFG_GetDeviceName();
 	if (Tokenizer_GetArgsCount() == 0) {
 		if (cmdFlags & COMMAND_FLAG_SOURCE_TCP) {
-			ADDLOG_INFO(LOG_FEATURE_RAW, s);
+			ADDLOG_INFO(LOG_FEATURE_RAW, "%s", s);
 		}
 		else {
 			ADDLOG_INFO(LOG_FEATURE_CMD, "FriendlyName is %s", s);
@@ -542,6 +558,16 @@ void CMD_InitChannelCommands(){
 	//cmddetail:"fn":"CMD_ToggleChannel","file":"cmnds/cmd_channels.c","requires":"",
 	//cmddetail:"examples":""}
     CMD_RegisterCommand("ToggleChannel", CMD_ToggleChannel, NULL);
+	//cmddetail:{"name":"BeginChannelBatch","args":"",
+	//cmddetail:"descr":"Starts a batch of channel changes. Channels set inside the batch are applied to pins at once, but MQTT publish, change events and flash save are done once per changed channel by CommitChannelBatch. Batch that is not committed within 5 seconds is committed automatically.",
+	//cmddetail:"fn":"CMD_BeginChannelBatch","file":"cmnds/cmd_channels.c","requires":"",
+	//cmddetail:"examples":"BeginChannelBatch\nSetChannel 1 1\nSetChannel 2 0\nCommitChannelBatch"}
+	CMD_RegisterCommand("BeginChannelBatch", CMD_BeginChannelBatch, NULL);
+	//cmddetail:{"name":"CommitChannelBatch","args":"",
+	//cmddetail:"descr":"Ends a batch started with BeginChannelBatch, publishes changed channels, fires their change events and saves them to flash with a single write.",
+	//cmddetail:"fn":"CMD_CommitChannelBatch","file":"cmnds/cmd_channels.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("CommitChannelBatch", CMD_CommitChannelBatch, NULL);
 	//cmddetail:{"name":"AddChannel","args":"[ChannelIndex][ValueToAdd][ClampMin][ClampMax][bWrapInsteadOfClamp]",
 	//cmddetail:"descr":"Adds a given value to the channel. Can be used to change PWM brightness. Clamp min and max arguments are optional.",
 	//cmddetail:"fn":"CMD_AddChannel","file":"cmnds/cmd_channels.c","requires":"",
@@ -288,28 +288,85 @@ typedef struct eventHandler_s {
 	int requiredArgument3;
 	// command to execute when it happens
 	char *command;
+	// resolved command for the above
+	cmdCache_t commandCache;
 	// for UART event handlers?
 	char *requiredArgumentText;
+	// key of g_eventHandlersByArg chain, made from eventCode and
+	// requiredArgument (or case insensitive hash of requiredArgumentText)
+	unsigned int argKey;
 
+	// all handlers, newest first
 	struct eventHandler_s *next;
+	// handlers with the same eventCode bucket, newest first
+	struct eventHandler_s *nextForCode;
+	// handlers with the same argKey bucket, newest first
+	struct eventHandler_s *nextForArg;
 } eventHandler_t;
 
+// Handlers are kept on three lists. Firing an event with an argument only
+// walks the bucket for its eventCode and argument, change handlers walk
+// the bucket for their eventCode. Raw numeric event codes above the known
+// ones share the last code bucket.
+#define EVENT_CODE_BUCKETS		(CMD_EVENT_MAX_TYPES + 1)
+#ifndef EVENT_ARG_BUCKETS
+#define EVENT_ARG_BUCKETS		64
+#endif
+
 static eventHandler_t *g_eventHandlers = 0;
+static eventHandler_t *g_eventHandlersByCode[EVENT_CODE_BUCKETS];
+static eventHandler_t *g_eventHandlersByArg[EVENT_ARG_BUCKETS];
+
+static int EVENT_CodeBucket(byte eventCode) {
+	if (eventCode >= CMD_EVENT_MAX_TYPES)
+		return CMD_EVENT_MAX_TYPES;
+	return eventCode;
+}
+static unsigned int EVENT_MakeArgKey(byte eventCode, int argument) {
+	return (unsigned int)argument * 2654435761u + eventCode * 40503u;
+}
+static unsigned int EVENT_MakeTextKey(byte eventCode, const char *s) {
+	unsigned int hash = 5381;
+	while (*s) {
+		hash = ((hash << 5) + hash) + (byte)tolower((unsigned char)*s);
+		s++;
+	}
+	return EVENT_MakeArgKey(eventCode, hash);
+}
+static int EVENT_ArgBucket(unsigned int argKey) {
+	return (argKey ^ (argKey >> 15)) % EVENT_ARG_BUCKETS;
+}
+static eventHandler_t *EVENT_FirstForArg(unsigned int argKey) {
+	return g_eventHandlersByArg[EVENT_ArgBucket(argKey)];
+}
+static void EVENT_LinkHandler(eventHandler_t *ev) {
+	eventHandler_t **slot;
 
+	ev->next = g_eventHandlers;
+	g_eventHandlers = ev;
+
+	slot = &g_eventHandlersByCode[EVENT_CodeBucket(ev->eventCode)];
+	ev->nextForCode = *slot;
+	*slot = ev;
+
+	slot = &g_eventHandlersByArg[EVENT_ArgBucket(ev->argKey)];
+	ev->nextForArg = *slot;
+	*slot = ev;
+}
 
 void EventHandlers_ProcessVariableChange_Integer(byte eventCode, int oldValue, int newValue) {
 	struct eventHandler_s *ev;
 
-	ev = g_eventHandlers;
+	ev = g_eventHandlersByCode[EVENT_CodeBucket(eventCode)];
 
 	while(ev) {
 		if(eventCode==ev->eventCode) {
 			if(EVENT_EvaluateChangeCondition(ev->eventType, ev->requiredArgument, oldValue, newValue)) {
 				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_ProcessVariableChange_Integer: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+				CMD_ExecuteCommandCached(&ev->commandCache, ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
 			}
 		}
-		ev = ev->next;
+		ev = ev->nextForCode;
 	}
 
 #if ENABLE_OBK_SCRIPTING
@@ -322,9 +379,6 @@ void EventHandlers_AddEventHandler_Integer(byte eventCode, int type, int require
 	eventHandler_t *ev = malloc(sizeof(eventHandler_t));
 	memset(ev,0,sizeof(eventHandler_t));
 
-	ev->next = g_eventHandlers;
-	g_eventHandlers = ev;
-
 	ev->requiredArgumentText = NULL;
 	ev->eventType = type;
 	ev->command = strdup(commandToRun);
@@ -332,6 +386,9 @@ void EventHandlers_AddEventHandler_Integer(byte eventCode, int type, int require
 	ev->requiredArgument = requiredArgument;
 	ev->requiredArgument2 = requiredArgument2;
 	ev->requiredArgument3 = requiredArgument3;
+	ev->argKey = EVENT_MakeArgKey(eventCode, requiredArgument);
+
+	EVENT_LinkHandler(ev);
 }
 
 void EventHandlers_AddEventHandler_String(byte eventCode, int type, const char *requiredArgument, const char *commandToRun)
@@ -339,61 +396,67 @@ void EventHandlers_AddEventHandler_String(byte eventCode, int type, const char *
 	eventHandler_t *ev = malloc(sizeof(eventHandler_t));
 	memset(ev,0,sizeof(eventHandler_t));
 
-	ev->next = g_eventHandlers;
-	g_eventHandlers = ev;
-
 	ev->requiredArgumentText = strdup(requiredArgument);
 	ev->eventType = type;
 	ev->command = strdup(commandToRun);
 	ev->eventCode = eventCode;
 	ev->requiredArgument = 0;
 	ev->requiredArgument2 = 0;
+	ev->argKey = EVENT_MakeTextKey(eventCode, requiredArgument);
+
+	EVENT_LinkHandler(ev);
 }
 void EventHandlers_FireEvent3(byte eventCode, int argument, int argument2, int argument3) {
 	struct eventHandler_s *ev;
+	unsigned int argKey;
 
-	ev = g_eventHandlers;
+	argKey = EVENT_MakeArgKey(eventCode, argument);
+	ev = EVENT_FirstForArg(argKey);
 
 	while (ev) {
-		if (eventCode == ev->eventCode) {
+		if (argKey == ev->argKey && eventCode == ev->eventCode && ev->requiredArgumentText == 0) {
 			if (argument == ev->requiredArgument && argument2 == ev->requiredArgument2 && argument3 == ev->requiredArgument3) {
 				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent3: executing command %s", ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+				CMD_ExecuteCommandCached(&ev->commandCache, ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
 			}
 		}
-		ev = ev->next;
+		ev = ev->nextForArg;
 	}
 }
 void EventHandlers_FireEvent2(byte eventCode, int argument, int argument2) {
 	struct eventHandler_s *ev;
+	unsigned int argKey;
 
-	ev = g_eventHandlers;
+	argKey = EVENT_MakeArgKey(eventCode, argument);
+	ev = EVENT_FirstForArg(argKey);
 
 	while(ev) {
-		if(eventCode==ev->eventCode) {
+		if(argKey == ev->argKey && eventCode==ev->eventCode && ev->requiredArgumentText == 0) {
 			if(argument == ev->requiredArgument && argument2 == ev->requiredArgument2) {
 				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent2: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+				CMD_ExecuteCommandCached(&ev->commandCache, ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
 			}
 		}
-		ev = ev->next;
+		ev = ev->nextForArg;
 	}
 }
 
 
 void EventHandlers_FireEvent(byte eventCode, int argument) {
 	struct eventHandler_s *ev;
+	unsigned int argKey;
 
-	ev = g_eventHandlers;
+	argKey = EVENT_MakeArgKey(eventCode, argument);
+	ev = EVENT_FirstForArg(argKey);
 
 	while(ev) {
-		if(eventCode==ev->eventCode) {
+		if(argKey == ev->argKey && eventCode==ev->eventCode && ev->requiredArgumentText == 0) {
 			if(argument == ev->requiredArgument) {
 				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+				CMD_ExecuteCommandCached(&ev->commandCache, ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
 			}
 		}
-		ev = ev->next;
+		ev = ev->nextForArg;
 	}
 
 #if ENABLE_OBK_SCRIPTING
@@ -402,19 +465,21 @@ void EventHandlers_FireEvent(byte eventCode, int argument) {
 }
 void EventHandlers_FireEvent_String(byte eventCode, const char *argument) {
 	struct eventHandler_s *ev;
+	unsigned int argKey;
 
-	ev = g_eventHandlers;
+	argKey = EVENT_MakeTextKey(eventCode, argument);
+	ev = EVENT_FirstForArg(argKey);
 
 	while(ev) {
-		if(eventCode==ev->eventCode) {
+		if(argKey == ev->argKey && eventCode==ev->eventCode) {
 			if(ev->requiredArgumentText != 0) {
 				if(!stricmp(argument,ev->requiredArgumentText)) {
 					ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent_String: executing command %s",ev->command);
-					CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
+					CMD_ExecuteCommandCached(&ev->commandCache, ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
 				}
 			}
 		}
-		ev = ev->next;
+		ev = ev->nextForArg;
 	}
 
 }
@@ -494,6 +559,9 @@ commandResult_t CMD_ClearAllHandlers(const void *context, const char *cmd, const
 		next = ev->next;
 
 		free(ev->command);
+		if (ev->requiredArgumentText) {
+			free(ev->requiredArgumentText);
+		}
 		free(ev);
 
 		ev = next;
@@ -502,6 +570,8 @@ commandResult_t CMD_ClearAllHandlers(const void *context, const char *cmd, const
 
 	addLogAdv(LOG_INFO, LOG_FEATURE_CMD, "Fried %i handlers", c);
 	g_eventHandlers = 0;
+	memset(g_eventHandlersByCode, 0, sizeof(g_eventHandlersByCode));
+	memset(g_eventHandlersByArg, 0, sizeof(g_eventHandlersByArg));
 
 	return CMD_RES_OK;
 }
@@ -574,22 +574,106 @@ static int g_totalConstants = sizeof(g_constants) / sizeof(g_constants[0]);
 // Etc etc
 // Returns true if constant matches
 // Returns false if no constants found
-const char *CMD_ExpandConstant(const char *s, const char *stop, float *out) {
 #if ENABLE_EXPAND_CONSTANT
-	const constant_t *var;
+// Lookup index over g_constants, built on first use.
+// Constants are bucketed by their first two characters (case insensitive),
+// chains keep the table order so the first matching entry still wins
+// (this matters for $CH*** vs $CH** vs $CH* and $rand01 vs $rand).
+// Wildcards are only used as a numeric suffix, so each name is split
+// into a literal prefix and a count of trailing digits.
+#define CONSTANT_BUCKETS		32
+#define CONSTANT_NONE			0xFF
+
+static byte g_constantBuckets[CONSTANT_BUCKETS];
+static byte g_constantNext[sizeof(g_constants) / sizeof(g_constants[0])];
+static byte g_constantPrefixLen[sizeof(g_constants) / sizeof(g_constants[0])];
+static byte g_constantDigits[sizeof(g_constants) / sizeof(g_constants[0])];
+static bool g_constantIndexBuilt = false;
+
+static int CMD_ConstantBucket(const char *s) {
+	return (tolower((unsigned char)s[0]) * 31 + tolower((unsigned char)s[1])) % CONSTANT_BUCKETS;
+}
+static void CMD_BuildConstantIndex() {
+	byte *tail[CONSTANT_BUCKETS];
+	const char *name;
+	const char *star;
+	int i;
+
+	for (i = 0; i < CONSTANT_BUCKETS; i++) {
+		g_constantBuckets[i] = CONSTANT_NONE;
+		tail[i] = &g_constantBuckets[i];
+	}
+	for (i = 0; i < g_totalConstants; i++) {
+		int b;
+
+		name = g_constants[i].constantName;
+		star = strchr(name, '*');
+		if (star) {
+			g_constantPrefixLen[i] = star - name;
+			g_constantDigits[i] = strlen(star);
+		}
+		else {
+			g_constantPrefixLen[i] = strlen(name);
+			g_constantDigits[i] = 0;
+		}
+		b = CMD_ConstantBucket(name);
+		g_constantNext[i] = CONSTANT_NONE;
+		*tail[b] = i;
+		tail[b] = &g_constantNext[i];
+	}
+	g_constantIndexBuilt = true;
+}
+// same result as strCompareBound with the wildcard flag for names with trailing '*'
+static const char *CMD_MatchConstant(const char *s, const char *stop, int i) {
+	const char *name = g_constants[i].constantName;
+	int j;
+
+	for (j = 0; j < g_constantPrefixLen[i]; j++, s++) {
+		if (*s == 0)
+			return 0;
+		if (tolower((unsigned char)*s) != tolower((unsigned char)name[j]))
+			return 0;
+	}
+	for (j = 0; j < g_constantDigits[i]; j++, s++) {
+		if (!isdigit((int)*s))
+			return 0;
+	}
+	if (stop == 0 || s == stop || *s == 0)
+		return s;
+	return 0;
+}
+#endif
+static const constant_t *CMD_FindConstant(const char *s, const char *stop, const char **after) {
+#if ENABLE_EXPAND_CONSTANT
+	const char *ret;
 	int i;
-	var = g_constants;
-	for (i = 0; i < g_totalConstants; i++, var++) {
-		bool bAllowWildCard = strstr(var->constantName, "*") != 0;
-		const char *ret = strCompareBound(s, var->constantName, stop, bAllowWildCard);
+
+	if (g_constantIndexBuilt == false) {
+		CMD_BuildConstantIndex();
+	}
+	// all names have at least two characters
+	if (s[0] == 0 || s[1] == 0 || (stop && stop <= s + 1))
+		return 0;
+	for (i = g_constantBuckets[CMD_ConstantBucket(s)]; i != CONSTANT_NONE; i = g_constantNext[i]) {
+		ret = CMD_MatchConstant(s, stop, i);
 		if (ret) {
-			*out = var->getValue(s);
-			ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_ExpandConstant: %s", var->name);
-			return ret;
+			*after = ret;
+			return &g_constants[i];
 		}
 	}
 #endif
-	return false;
+	return 0;
+}
+const char *CMD_ExpandConstant(const char *s, const char *stop, float *out) {
+	const constant_t *var;
+	const char *ret;
+
+	var = CMD_FindConstant(s, stop, &ret);
+	if (var == 0)
+		return false;
+	*out = var->getValue(s);
+	ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_ExpandConstant: %s", var->constantName);
+	return ret;
 }
 
 byte CMD_ParseOrExpandHexByte(const char **p) {
@@ -844,44 +928,84 @@ const char *CMD_FindMatchingBrace(const char *s) {
 	return s;
 
 }
-float CMD_EvaluateExpression(const char *s, const char *stop) {
-	byte opCode;
-	const char *op;
-	float a, b, c;
-	int idx;
-
-	if (s == 0)
-		return 0;
-	if (*s == 0)
-		return 0;
+static float CMD_ApplyOperator(byte opCode, float a, float b) {
+	switch (opCode)
+	{
+	case OP_EQUAL:
+		return a == b;
+	case OP_EQUAL_OR_GREATER:
+		return a >= b;
+	case OP_EQUAL_OR_LESS:
+		return a <= b;
+	case OP_NOT_EQUAL:
+		return a != b;
+	case OP_GREATER:
+		return a > b;
+	case OP_LESS:
+		return a < b;
+	case OP_AND:
+		return ((int)a) && ((int)b);
+	case OP_OR:
+		return ((int)a) || ((int)b);
+	case OP_ADD:
+		return a + b;
+	case OP_SUB:
+		return a - b;
+	case OP_MUL:
+		return a * b;
+	case OP_DIV:
+		return a / b;
+	case OP_MODULO:
+		return ((int)a) % ((int)b);
+	}
+	return 0;
+}
+// cuts whitespaces on both sides and redundant enclosing braces,
+// returns false if nothing is left
+static bool CMD_TrimExpression(const char **ps, const char **pstop) {
+	const char *s = *ps;
+	const char *stop = *pstop;
 
-	// cull whitespaces at the end of expression
 	if (stop == 0) {
 		stop = s + strlen(s);
 	}
 	while (stop > s && isspace(((int)stop[-1]))) {
 		stop--;
 	}
-	// cull whitespaces at the start
 	while (isspace(((int)*s))) {
 		s++;
 		if (s >= stop) {
-			return 0;
+			return false;
 		}
 	}
-	while (*s == '(' && stop[-1] == ')' && CMD_FindMatchingBrace(s) == (stop-1)) {
+	while (*s == '(' && stop[-1] == ')' && CMD_FindMatchingBrace(s) == (stop - 1)) {
 		s++;
 		stop--;
 	}
+	*ps = s;
+	*pstop = stop;
+	return true;
+}
+// Reference tree-walking evaluator. It re-parses the text on every call,
+// so CMD_EvaluateExpression only falls back to it for expressions that
+// do not fit into the compiled program limits below.
+float CMD_EvaluateExpression_Interpreted(const char *s, const char *stop) {
+	byte opCode;
+	const char *op;
+	float a, b, c;
+	int idx;
+
+	if (s == 0)
+		return 0;
+	if (*s == 0)
+		return 0;
+
+	if (CMD_TrimExpression(&s, &stop) == false) {
+		return 0;
+	}
 	if (g_expDebugBuffer == 0) {
 		g_expDebugBuffer = malloc(EXPRESSION_DEBUG_BUFFER_SIZE);
 	}
-	if (1) {
-		idx = stop - s;
-		memcpy(g_expDebugBuffer, s, idx);
-		g_expDebugBuffer[idx] = 0;
-		ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will run '%s'", g_expDebugBuffer);
-	}
 	op = CMD_FindOperator(s, stop, &opCode);
 	if (op) {
 		const char *p2;
@@ -892,76 +1016,363 @@ float CMD_EvaluateExpression(const char *s, const char *stop) {
 		// second token block begins at 'p2' and ends at NULL
 		p2 = op + g_operators[opCode].len;
 
-		a = CMD_EvaluateExpression(s, op);
-		b = CMD_EvaluateExpression(p2, stop);
+		a = CMD_EvaluateExpression_Interpreted(s, op);
+		b = CMD_EvaluateExpression_Interpreted(p2, stop);
 
-		// Why, again, %f crashes?
-		//ADDLOG_INFO(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: a = %f, b = %f", a, b);
-		// It crashes even on sprintf.
-		//sprintf(g_expDebugBuffer,"CMD_EvaluateExpression: a = %f, b = %f", a, b);
-		//ADDLOG_INFO(LOG_FEATURE_EVENT, g_expDebugBuffer);
+		return CMD_ApplyOperator(opCode, a, b);
+	}
+	if (s[0] == '!') {
+		return !CMD_EvaluateExpression_Interpreted(s + 1, stop);
+	}
+	if (CMD_ExpandConstant(s, stop, &c)) {
+		return c;
+	}
 
-		switch (opCode)
-		{
-		case OP_EQUAL:
-			c = a == b;
-			break;
-		case OP_EQUAL_OR_GREATER:
-			c = a >= b;
-			break;
-		case OP_EQUAL_OR_LESS:
-			c = a <= b;
-			break;
-		case OP_NOT_EQUAL:
-			c = a != b;
-			break;
-		case OP_GREATER:
-			c = a > b;
-			break;
-		case OP_LESS:
-			c = a < b;
-			break;
-		case OP_AND:
-			c = ((int)a) && ((int)b);
-			break;
-		case OP_OR:
-			c = ((int)a) || ((int)b);
-			break;
-		case OP_ADD:
-			c = a + b;
-			break;
-		case OP_SUB:
-			c = a - b;
+	idx = stop - s;
+	if (idx >= EXPRESSION_DEBUG_BUFFER_SIZE)
+		idx = EXPRESSION_DEBUG_BUFFER_SIZE - 1;
+	memcpy(g_expDebugBuffer, s, idx);
+	g_expDebugBuffer[idx] = 0;
+	ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will call atof for %s", g_expDebugBuffer);
+	return atof(g_expDebugBuffer);
+}
+
+/*
+Compiled expressions.
+
+Expressions are usually evaluated over and over again with the same text
+(if conditions in scripts, addChannel arguments, change handlers), so each
+expression is parsed once into a postfix (RPN) program which is kept in
+a small direct-mapped cache keyed by the expression text. Running a
+program is a simple loop over a float stack, there is no string scanning
+left except for constant getters that need their original text.
+
+The compiler walks the text exactly like CMD_EvaluateExpression_Interpreted,
+so operator priority, '!' handling and constant matching stay identical.
+Numeric literals are converted once and constant subexpressions are folded.
+Expressions that are just a number are converted at once, without the cache.
+
+Expressions are evaluated from main, script and HTTP threads. Cache is guarded
+by a mutex, and programs are reference counted, so a program replaced in the
+cache is freed by the last thread that is still running it.
+*/
+#ifndef EXPRESSION_CACHE_SIZE
+#define EXPRESSION_CACHE_SIZE		16
+#endif
+#ifndef EXPRESSION_MAX_COMPILED_LEN
+#define EXPRESSION_MAX_COMPILED_LEN	96
+#endif
+#define EXPRESSION_MAX_OPS			32
+
+typedef enum {
+	EXP_NUMBER,
+	EXP_CHANNEL,
+	EXP_CONSTANT,
+	EXP_NOT,
+	EXP_BINARY,
+} expOpType_t;
+
+typedef struct expOp_s {
+	byte type;
+	byte opCode;
+	unsigned short textOfs;
+	union {
+		float number;
+		int channel;
+		float(*getValue)(const char *s);
+	} u;
+} expOp_t;
+
+typedef struct expProgram_s {
+	unsigned int hash;
+	unsigned short len;
+	byte numOps;
+	// one for the cache slot, one for each running evaluation
+	byte refs;
+	expOp_t *ops;
+	// private copy of the source, constant getters are called with a pointer into it
+	char *text;
+} expProgram_t;
+
+typedef struct expCompiler_s {
+	const char *base;
+	expOp_t ops[EXPRESSION_MAX_OPS];
+	int numOps;
+	bool bOverflow;
+} expCompiler_t;
+
+static expProgram_t *g_expCache[EXPRESSION_CACHE_SIZE];
+static SemaphoreHandle_t g_expCacheMutex = 0;
+static int g_expCacheHits = 0;
+static int g_expCacheMisses = 0;
+
+void CMD_InitExpressionCache() {
+	// simulator runs init again for each test
+	if (g_expCacheMutex) {
+		return;
+	}
+	g_expCacheMutex = xSemaphoreCreateMutex();
+}
+static void CMD_ExpCache_Lock() {
+	// held only for lookup and insert, so it's just waited for
+	while (xSemaphoreTake(g_expCacheMutex, 1000) != pdTRUE) {
+	}
+}
+static void CMD_ExpCache_Unlock() {
+	xSemaphoreGive(g_expCacheMutex);
+}
+// drops one reference, called with cache locked
+static void CMD_ExpRelease(expProgram_t *p) {
+	p->refs--;
+	if (p->refs == 0) {
+		free(p->ops);
+		free(p);
+	}
+}
+
+static expOp_t *CMD_ExpEmit(expCompiler_t *c, byte type) {
+	expOp_t *o;
+
+	if (c->numOps >= EXPRESSION_MAX_OPS) {
+		c->bOverflow = true;
+		return 0;
+	}
+	o = &c->ops[c->numOps++];
+	memset(o, 0, sizeof(*o));
+	o->type = type;
+	return o;
+}
+static void CMD_ExpEmitNumber(expCompiler_t *c, float f) {
+	expOp_t *o = CMD_ExpEmit(c, EXP_NUMBER);
+	if (o) {
+		o->u.number = f;
+	}
+}
+static void CMD_ExpCompile(expCompiler_t *c, const char *s, const char *stop) {
+	byte opCode;
+	const char *op;
+	const constant_t *var;
+	const char *after;
+	expOp_t *o;
+	char tmp[EXPRESSION_MAX_COMPILED_LEN + 1];
+	int idx;
+
+	if (c->bOverflow)
+		return;
+	if (*s == 0 || s >= stop || CMD_TrimExpression(&s, &stop) == false) {
+		CMD_ExpEmitNumber(c, 0);
+		return;
+	}
+	op = CMD_FindOperator(s, stop, &opCode);
+	if (op) {
+		CMD_ExpCompile(c, s, op);
+		CMD_ExpCompile(c, op + g_operators[opCode].len, stop);
+		if (c->bOverflow)
+			return;
+		// fold if both sides are known already
+		if (c->ops[c->numOps - 1].type == EXP_NUMBER && c->ops[c->numOps - 2].type == EXP_NUMBER) {
+			c->numOps--;
+			o = &c->ops[c->numOps - 1];
+			o->u.number = CMD_ApplyOperator(opCode, o->u.number, c->ops[c->numOps].u.number);
+			return;
+		}
+		o = CMD_ExpEmit(c, EXP_BINARY);
+		if (o) {
+			o->opCode = opCode;
+		}
+		return;
+	}
+	if (s[0] == '!') {
+		CMD_ExpCompile(c, s + 1, stop);
+		if (c->bOverflow)
+			return;
+		o = &c->ops[c->numOps - 1];
+		if (o->type == EXP_NUMBER) {
+			o->u.number = !o->u.number;
+			return;
+		}
+		CMD_ExpEmit(c, EXP_NOT);
+		return;
+	}
+	var = CMD_FindConstant(s, stop, &after);
+	if (var) {
+		if (var->getValue == getChannelValue) {
+			o = CMD_ExpEmit(c, EXP_CHANNEL);
+			if (o) {
+				o->u.channel = atoi(s + 3);
+			}
+		}
+		else {
+			o = CMD_ExpEmit(c, EXP_CONSTANT);
+			if (o) {
+				o->u.getValue = var->getValue;
+				o->textOfs = s - c->base;
+			}
+		}
+		return;
+	}
+	idx = stop - s;
+	memcpy(tmp, s, idx);
+	tmp[idx] = 0;
+	CMD_ExpEmitNumber(c, atof(tmp));
+}
+static float CMD_ExpRun(const expProgram_t *p) {
+	float stack[EXPRESSION_MAX_OPS];
+	const expOp_t *o;
+	int sp;
+	int i;
+
+	sp = 0;
+	for (i = 0, o = p->ops; i < p->numOps; i++, o++) {
+		switch (o->type) {
+		case EXP_NUMBER:
+			stack[sp++] = o->u.number;
 			break;
-		case OP_MUL:
-			c = a * b;
+		case EXP_CHANNEL:
+			stack[sp++] = CHANNEL_Get(o->u.channel);
 			break;
-		case OP_DIV:
-			c = a / b;
+		case EXP_CONSTANT:
+			stack[sp++] = o->u.getValue(p->text + o->textOfs);
 			break;
-		case OP_MODULO:
-			c = ((int)a) % ((int)b);
+		case EXP_NOT:
+			stack[sp - 1] = !stack[sp - 1];
 			break;
-		default:
-			c = 0;
+		case EXP_BINARY:
+			sp--;
+			stack[sp - 1] = CMD_ApplyOperator(o->opCode, stack[sp - 1], stack[sp]);
 			break;
 		}
-		return c;
 	}
-	if (s[0] == '!') {
-		return !CMD_EvaluateExpression(s + 1, stop);
+	return stack[0];
+}
+static unsigned int CMD_ExpHash(const char *s, int len) {
+	unsigned int hash = 5381;
+	while (len--) {
+		hash = ((hash << 5) + hash) + (byte)*s++;
 	}
-	if (CMD_ExpandConstant(s, stop, &c)) {
-		return c;
+	return hash;
+}
+// returns program with reference taken for the caller, see CMD_ExpPutProgram
+static expProgram_t *CMD_ExpGetProgram(const char *s, int len) {
+	expProgram_t *p;
+	expProgram_t **slot;
+	expCompiler_t c;
+	unsigned int hash;
+	int opsSize;
+
+	hash = CMD_ExpHash(s, len);
+	slot = &g_expCache[hash % EXPRESSION_CACHE_SIZE];
+	CMD_ExpCache_Lock();
+	p = *slot;
+	if (p && p->hash == hash && p->len == len && !memcmp(p->text, s, len)) {
+		g_expCacheHits++;
+		p->refs++;
+		CMD_ExpCache_Unlock();
+		return p;
 	}
+	g_expCacheMisses++;
+	CMD_ExpCache_Unlock();
 
-	if (1) {
-		idx = stop - s;
-		memcpy(g_expDebugBuffer, s, idx);
-		g_expDebugBuffer[idx] = 0;
+	// compile against the final text copy so constant offsets are valid there
+	p = malloc(sizeof(expProgram_t) + len + 1);
+	if (p == 0)
+		return 0;
+	p->text = (char*)(p + 1);
+	memcpy(p->text, s, len);
+	p->text[len] = 0;
+
+	c.base = p->text;
+	c.numOps = 0;
+	c.bOverflow = false;
+	CMD_ExpCompile(&c, p->text, p->text + len);
+	if (c.bOverflow) {
+		free(p);
+		return 0;
 	}
-	ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will call atof for %s", g_expDebugBuffer);
-	return atof(g_expDebugBuffer);
+	opsSize = c.numOps * sizeof(expOp_t);
+	p->ops = malloc(opsSize);
+	if (p->ops == 0) {
+		free(p);
+		return 0;
+	}
+	memcpy(p->ops, c.ops, opsSize);
+	p->hash = hash;
+	p->len = len;
+	p->numOps = c.numOps;
+	// cache and caller
+	p->refs = 2;
+
+	CMD_ExpCache_Lock();
+	if (*slot) {
+		CMD_ExpRelease(*slot);
+	}
+	*slot = p;
+	CMD_ExpCache_Unlock();
+	return p;
+}
+static void CMD_ExpPutProgram(expProgram_t *p) {
+	CMD_ExpCache_Lock();
+	CMD_ExpRelease(p);
+	CMD_ExpCache_Unlock();
+}
+// true for plain numbers like "12" or "-0.5"
+static bool CMD_ExpIsNumber(const char *s, int len) {
+	bool bDigits = false;
+	bool bDot = false;
+	int i = 0;
+
+	if (len > 0 && s[0] == '-') {
+		i++;
+	}
+	for (; i < len; i++) {
+		if (isdigit((int)s[i])) {
+			bDigits = true;
+		}
+		else if (s[i] == '.' && bDot == false) {
+			bDot = true;
+		}
+		else {
+			return false;
+		}
+	}
+	return bDigits;
+}
+void CMD_GetExpressionCacheStats(int *hits, int *misses) {
+	*hits = g_expCacheHits;
+	*misses = g_expCacheMisses;
+}
+float CMD_EvaluateExpression(const char *s, const char *stop) {
+	expProgram_t *p;
+	char tmp[24];
+	float f;
+	int len;
+
+	if (s == 0)
+		return 0;
+	if (*s == 0)
+		return 0;
+	if (stop == 0) {
+		len = strlen(s);
+	}
+	else {
+		len = stop - s;
+	}
+	// changing numbers (for example from expanded script variables)
+	// would only churn the cache
+	if (len < (int)sizeof(tmp) && CMD_ExpIsNumber(s, len)) {
+		memcpy(tmp, s, len);
+		tmp[len] = 0;
+		return atof(tmp);
+	}
+	if (len <= EXPRESSION_MAX_COMPILED_LEN && g_expCacheMutex) {
+		p = CMD_ExpGetProgram(s, len);
+		if (p) {
+			f = CMD_ExpRun(p);
+			CMD_ExpPutProgram(p);
+			return f;
+		}
+	}
+	return CMD_EvaluateExpression_Interpreted(s, stop);
 }
 
 // if MQTTOnline then "qq" else "qq"
@@ -12,6 +12,8 @@ typedef struct command_s {
 	const void *context;
 	struct command_s *next;
 	int commandFlags;
+	// full (unmasked) name hash, compared before stricmp
+	unsigned int nameHash;
 } command_t;
 
 command_t *CMD_Find(const char *name);
@@ -21,6 +23,11 @@ int get_cmd(const char *s, char *dest, int maxlen, int stripnum);
 
 
 float CMD_EvaluateExpression(const char *s, const char *stop);
+float CMD_EvaluateExpression_Interpreted(const char *s, const char *stop);
+// creates expression cache mutex, called once on start
+void CMD_InitExpressionCache();
+void CMD_GetExpressionCacheStats(int *hits, int *misses);
+void SVM_GetSchedulerStats(int *wakeups, int *lateWakeups, int *maxLateMS, int *budgetHits);
 commandResult_t CMD_If(const void *context, const char *cmd, const char *args, int cmdFlags);
 void CMD_ExpandConstantsWithinString(const char *in, char *out, int outLen);
 void CMD_Script_ProcessWaitersForEvent(byte eventCode, int argument);
@@ -66,9 +66,12 @@ int g_sleepfactor = 1;
 
 #define HASH_SIZE 128
 
-static int generateHashValue(const char* fname) {
+// Returns full case-folded hash of the command name.
+// Lower bits select the bucket, the whole value is kept in command_t
+// so most of mismatches are rejected without calling stricmp.
+static unsigned int generateHashValue(const char* fname) {
 	int		i;
-	int		hash;
+	unsigned int	hash;
 	int		letter;
 	unsigned char* f = (unsigned char*)fname;
 
@@ -80,11 +83,13 @@ static int generateHashValue(const char* fname) {
 		i++;
 	}
 	hash = (hash ^ (hash >> 10) ^ (hash >> 20));
-	hash &= (HASH_SIZE - 1);
 	return hash;
 }
 
 command_t* g_commands[HASH_SIZE] = { NULL };
+// bumped every time the set of commands changes, so cmdCache_t entries
+// can tell that their resolved command pointer may be stale
+static int g_commandsGeneration = 1;
 bool g_powersave;
 
 #if defined(PLATFORM_LN882H)
@@ -469,11 +474,11 @@ static commandResult_t CMD_ClearIO(const void* context, const char* cmd, const c
 static commandResult_t CMD_Echo(const void* context, const char* cmd, const char* args, int cmdFlags) {
 
 #if 0
-	ADDLOG_INFO(LOG_FEATURE_CMD, args);
+	ADDLOG_INFO(LOG_FEATURE_CMD, "%s", args);
 #else
 	// we want $CH40 etc expanded
 	Tokenizer_TokenizeString(args, TOKENIZER_ALTERNATE_EXPAND_AT_START | TOKENIZER_FORCE_SINGLE_ARGUMENT_MODE);
-	ADDLOG_INFO(LOG_FEATURE_CMD, Tokenizer_GetArg(0));
+	ADDLOG_INFO(LOG_FEATURE_CMD, "%s", Tokenizer_GetArg(0));
 #endif
 
 	return CMD_RES_OK;
@@ -651,9 +656,16 @@ void CMD_RunUartCmndIfRequired() {
 #endif
 }
 
+// alias context - aliased command text with its resolution cache,
+// allocated as a single block so it can be freed with CMD_FLAG_FREE_CONTEXT
+typedef struct cmdAlias_s {
+	cmdCache_t cache;
+	char command[1];
+} cmdAlias_t;
+
 // run an aliased command
 static commandResult_t runcmd(const void* context, const char* cmd, const char* args, int cmdFlags) {
-	char* c = (char*)context;
+	cmdAlias_t* a = (cmdAlias_t*)context;
 	//   char *p = c;
 
 	//   while (*p && !isWhiteSpace(*p)) {
@@ -661,13 +673,13 @@ static commandResult_t runcmd(const void* context, const char* cmd, const char*
 	   //}
 	//   if (*p) p++;
 	if (*args) {
-		return CMD_ExecuteCommandArgs(c, args, cmdFlags);
+		return CMD_ExecuteCommandArgs(a->command, args, cmdFlags);
 	}
-	return CMD_ExecuteCommand(c, cmdFlags);
+	return CMD_ExecuteCommandCached(&a->cache, a->command, cmdFlags);
 }
 
 commandResult_t CMD_CreateAliasHelper(const char *alias, const char *ocmd) {
-	char* cmdMem;
+	cmdAlias_t* cmdMem;
 	char* aliasMem;
 	command_t* existing;
 
@@ -677,7 +689,9 @@ commandResult_t CMD_CreateAliasHelper(const char *alias, const char *ocmd) {
 		return CMD_RES_BAD_ARGUMENT;
 	}
 
-	cmdMem = strdup(ocmd);
+	cmdMem = (cmdAlias_t*)malloc(sizeof(cmdAlias_t) + strlen(ocmd));
+	memset(&cmdMem->cache, 0, sizeof(cmdMem->cache));
+	strcpy(cmdMem->command, ocmd);
 	aliasMem = strdup(alias);
 
 	ADDLOG_INFO(LOG_FEATURE_CMD, "New alias has been set: %s runs %s", alias, ocmd);
@@ -910,6 +924,8 @@ static commandResult_t CMD_WebServer(const void* context, const char* cmd, const
 #endif
 
 void CMD_Init_Early() {
+	CMD_InitExpressionCache();
+	Tokenizer_Init();
 	//cmddetail:{"name":"alias","args":"[Alias][Command with spaces]",
 	//cmddetail:"descr":"add an aliased command, so a command with spaces can be called with a short, nospaced alias",
 	//cmddetail:"fn":"alias","file":"cmnds/cmd_test.c","requires":"",
@@ -1113,10 +1129,10 @@ void CMD_FreeAllCommands() {
 		}
 		g_commands[i] = 0;
 	}
-
+	g_commandsGeneration++;
 }
 command_t *CMD_RegisterCommand(const char* name, commandHandler_t handler, void* context) {
-	int hash;
+	unsigned int hash;
 	command_t* newCmd;
 
 	// check
@@ -1135,27 +1151,48 @@ command_t *CMD_RegisterCommand(const char* name, commandHandler_t handler, void*
 	newCmd->commandFlags = 0;
 	newCmd->handler = handler;
 	newCmd->name = name;
-	newCmd->next = g_commands[hash];
+	newCmd->nameHash = hash;
+	newCmd->next = g_commands[hash & (HASH_SIZE - 1)];
 	newCmd->context = context;
-	g_commands[hash] = newCmd;
+	g_commands[hash & (HASH_SIZE - 1)] = newCmd;
+	g_commandsGeneration++;
 	return newCmd;
 }
 
 command_t* CMD_Find(const char* name) {
-	int hash;
+	unsigned int hash;
 	command_t* newCmd;
 
 	hash = generateHashValue(name);
 
-	newCmd = g_commands[hash];
+	newCmd = g_commands[hash & (HASH_SIZE - 1)];
 	while (newCmd != 0) {
-		if (!stricmp(newCmd->name, name)) {
+		if (newCmd->nameHash == hash && !stricmp(newCmd->name, name)) {
 			return newCmd;
 		}
 		newCmd = newCmd->next;
 	}
 	return 0;
 }
+// like CMD_Find, but also accepts indexed names like "POWER1"
+// by falling back to the name with trailing number stripped
+static command_t* CMD_FindWithIndex(const char* name) {
+	command_t* newCmd;
+	char nonums[32];
+	int len;
+
+	newCmd = CMD_Find(name);
+	if (newCmd) {
+		return newCmd;
+	}
+	// get the complete string up to numbers.
+	len = get_cmd(name, nonums, sizeof(nonums), 1);
+	if (name[len] == 0 && len < (int)sizeof(nonums) - 1) {
+		// there were no numbers, so second lookup would be the same
+		return 0;
+	}
+	return CMD_Find(nonums);
+}
 
 // get a string up to whitespace.
 // if stripnum is set, stop at numbers.
@@ -1185,38 +1222,30 @@ commandResult_t CMD_ExecuteCommandArgs(const char* cmd, const char* args, int cm
 	command_t* newCmd;
 	//int len;
 
-	// look for complete commmand
-	newCmd = CMD_Find(cmd);
+	// look for complete commmand, then for command without index
+	newCmd = CMD_FindWithIndex(cmd);
 	if (!newCmd) {
-		// not found, so...
-		char nonums[32];
-		// get the complete string up to numbers.
-		//len =
-		get_cmd(cmd, nonums, 32, 1);
-		newCmd = CMD_Find(nonums);
-		if (!newCmd) {
 #if ENABLE_OBK_BERRY
-			static int g_guard = 0;
-			if (g_guard == 0) {
-				g_guard = 1;
-				int c_run = CMD_Berry_RunEventHandlers_Str(CMD_EVENT_ON_CMD, cmd, args);
-				g_guard = 0;
-				if (c_run > 0) {
-					return CMD_RES_OK;
-				}
+		static int g_guard = 0;
+		if (g_guard == 0) {
+			g_guard = 1;
+			int c_run = CMD_Berry_RunEventHandlers_Str(CMD_EVENT_ON_CMD, cmd, args);
+			g_guard = 0;
+			if (c_run > 0) {
+				return CMD_RES_OK;
 			}
-#endif
-			// if still not found, then error
-			ADDLOG_ERROR(LOG_FEATURE_CMD, "cmd %s NOT found (args %s)", cmd, args);
-			return CMD_RES_UNKNOWN_COMMAND;
 		}
-	}
-	else {
+#endif
+		// if still not found, then error
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "cmd %s NOT found (args %s)", cmd, args);
+		return CMD_RES_UNKNOWN_COMMAND;
 	}
 
 	if (newCmd->handler) {
 		commandResult_t res;
+		Tokenizer_PushContext();
 		res = newCmd->handler(newCmd->context, cmd, args, cmdFlags);
+		Tokenizer_PopContext();
 		return res;
 	}
 	return CMD_RES_UNKNOWN_COMMAND;
@@ -1261,4 +1290,59 @@ commandResult_t CMD_ExecuteCommand(const char* s, int cmdFlags) {
 	return CMD_ExecuteCommandArgs(copy, args, cmdFlags);
 }
 
+// execute a raw command, but remember where the command name and arguments are
+// and which command_t they resolve to, so next call with the same (unchanged)
+// line can skip the whitespace scan, the copy and the hash lookup
+commandResult_t CMD_ExecuteCommandCached(cmdCache_t* cache, const char* s, int cmdFlags) {
+	char name[CMD_CACHE_MAX_NAME];
+	const char* p;
+	commandResult_t res;
+	int len;
 
+	if (cache == 0) {
+		return CMD_ExecuteCommand(s, cmdFlags);
+	}
+	if (s == 0 || *s == 0) {
+		return CMD_RES_EMPTY_STRING;
+	}
+	if (cache->line != s || cache->generation != g_commandsGeneration || cache->cmd == 0) {
+		cache->line = 0;
+		p = s;
+		while (isWhiteSpace(*p)) {
+			p++;
+		}
+		len = get_cmd(p, name, sizeof(name), 0);
+		if (len == 0 || (p[len] != 0 && isWhiteSpace(p[len]) == false) || (p - s) > 255) {
+			// empty, or does not fit in cache fields
+			return CMD_ExecuteCommand(s, cmdFlags);
+		}
+		cache->cmd = CMD_FindWithIndex(name);
+		if (cache->cmd == 0 || cache->cmd->handler == 0) {
+			// let the generic path handle Berry fallback and error reporting
+			return CMD_ExecuteCommand(s, cmdFlags);
+		}
+		cache->nameOfs = p - s;
+		cache->nameLen = len;
+		p += len;
+		while (*p && isWhiteSpace(*p)) {
+			p++;
+		}
+		if ((p - s) > 0xFFFF) {
+			return CMD_ExecuteCommand(s, cmdFlags);
+		}
+		cache->argsOfs = p - s;
+		cache->generation = g_commandsGeneration;
+		cache->line = s;
+	}
+	else {
+		memcpy(name, s + cache->nameOfs, cache->nameLen);
+		name[cache->nameLen] = 0;
+	}
+	if ((cmdFlags & COMMAND_FLAG_SOURCE_TCP) == 0) {
+		ADDLOG_DEBUG(LOG_FEATURE_CMD, "cmd [%s]", s + cache->nameOfs);
+	}
+	Tokenizer_PushContext();
+	res = cache->cmd->handler(cache->cmd->context, name, s + cache->argsOfs, cmdFlags);
+	Tokenizer_PopContext();
+	return res;
+}
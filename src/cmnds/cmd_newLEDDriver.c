@@ -861,6 +861,10 @@ static commandResult_t temperature(const void *context, const char *cmd, const c
         ADDLOG_DEBUG(LOG_FEATURE_CMD, " temperature (%s) received with args %s",cmd,args);
 
 		Tokenizer_TokenizeString(args, 0);
+		// no args means just a query (Tasmota style), reply is done by the caller
+		if (Tokenizer_GetArgsCount() == 0) {
+			return CMD_RES_OK;
+		}
 
 		tmp = Tokenizer_GetArgInteger(0);
 
@@ -1174,6 +1178,10 @@ static commandResult_t dimmer(const void *context, const char *cmd, const char *
 			}
 		} else {
 			Tokenizer_TokenizeString(args, 0);
+			// no args means just a query (Tasmota style), reply is done by the caller
+			if (Tokenizer_GetArgsCount() == 0) {
+				return CMD_RES_OK;
+			}
 
 			iVal = Tokenizer_GetArgInteger(0);
 
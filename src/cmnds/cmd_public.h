@@ -13,10 +13,48 @@ typedef enum commandResult_e {
 
 } commandResult_t;
 
+typedef struct command_s command_t;
+
+#define CMD_CACHE_MAX_NAME 64
+
+// Per-call-site command resolution cache, see CMD_ExecuteCommandCached.
+// Must be zeroed before first use. It is only valid for the exact line
+// pointer it was filled for, and that line must not be modified later.
+typedef struct cmdCache_s {
+	const char *line;
+	command_t *cmd;
+	int generation;
+	unsigned short argsOfs;
+	byte nameOfs;
+	byte nameLen;
+} cmdCache_t;
+
+// single executable line of precompiled script
+typedef struct scriptLine_s {
+	// trimmed, null-terminated command text (points into scriptFile_t::data)
+	const char *text;
+	// how many source lines (comments, labels, etc) are consumed by reaching
+	// this line, so per-frame line budget works as for plain text
+	unsigned short cost;
+	cmdCache_t cache;
+} scriptLine_t;
+
+typedef struct scriptLabel_s {
+	unsigned int hash;
+	const char *name;
+	// index of the first line after the label
+	int line;
+} scriptLabel_t;
+
 typedef struct scriptFile_s
 {
 	char* fname;
 	char* data;
+	// compiled once by SVM_CompileFile
+	scriptLine_t* lines;
+	int numLines;
+	scriptLabel_t* labels;
+	int numLabels;
 
 	struct scriptFile_s* next;
 } scriptFile_t;
@@ -32,13 +70,27 @@ typedef struct scriptInstance_s
 {
 	scriptFile_t* curFile;
 	int uniqueID;
-	const char* curLine;
+	// index into curFile->lines, thread is free when curFile is NULL
+	int curLine;
 	int totalDelayMS;
 	int currentDelayMS;
 	eventWait_t wait;
 	int delayRepeats;
 
+	// absolute SVM time when a sleeping thread is due
+	unsigned int wakeTimeMS;
+	// SVM_SCHED_* - which scheduler queue holds the thread
+	byte schedState;
+	// slot in the sleep heap while sleeping
+	int heapIndex;
+	// set when the thread was made ready by its delay running out
+	byte bTimerWake;
+
 	struct scriptInstance_s* next;
+	// next thread parked on the same waitFor event list
+	struct scriptInstance_s* nextWaiting;
+	// next thread in the ready queue
+	struct scriptInstance_s* nextReady;
 } scriptInstance_t;
 
 scriptInstance_t *SVM_RegisterThread();
@@ -62,7 +114,6 @@ typedef commandResult_t(*commandHandler_t)(const void* context, const char* cmd,
 #define COMMAND_FLAG_SOURCE_TELESENDER	64
 
 extern bool g_powersave;
-typedef struct command_s command_t;
 
 //
 void CMD_Init_Early();
@@ -72,6 +123,7 @@ void CMD_RunUartCmndIfRequired();
 command_t*CMD_RegisterCommand(const char* name, commandHandler_t handler, void* context);
 commandResult_t CMD_ExecuteCommand(const char* s, int cmdFlags);
 commandResult_t CMD_ExecuteCommandArgs(const char* cmd, const char* args, int cmdFlags);
+commandResult_t CMD_ExecuteCommandCached(cmdCache_t* cache, const char* s, int cmdFlags);
 // like a strdup, but will expand constants.
 // Please remember to free the returned string
 char* CMD_ExpandingStrdup(const char* in);
@@ -207,7 +259,51 @@ enum LightMode {
 #define TOKENIZER_ALLOW_ESCAPING_QUOTATIONS		16
 #define TOKENIZER_EXPAND_EARLY					32
 
+#define TOKENIZER_MAX_CMD_LEN					512
+#define TOKENIZER_MAX_ARGS						32
+#define TOKENIZER_MAX_EXPANDED_ARG_LEN			40
+
+// Tokenizer state. Arguments point into the private copy in 'buffer',
+// expansion of constants is done lazily, on the first access to given arg.
+// Callers that need their own state (other threads, code that keeps args
+// across a nested CMD_ExecuteCommand) can keep it on stack or in a pool
+// and use the TokenizerCtx_* functions. The Tokenizer_* API works on an
+// implicit context, a separate one for each command nesting level.
+typedef struct tokenizer_s {
+	char buffer[TOKENIZER_MAX_CMD_LEN];
+	char *args[TOKENIZER_MAX_ARGS];
+	// points into original string given to the tokenizer
+	const char *argsFrom[TOKENIZER_MAX_ARGS];
+	union {
+		char perArg[TOKENIZER_MAX_ARGS][TOKENIZER_MAX_EXPANDED_ARG_LEN];
+		// TOKENIZER_FORCE_SINGLE_ARGUMENT_MODE expands over whole area
+		char single[TOKENIZER_MAX_ARGS * TOKENIZER_MAX_EXPANDED_ARG_LEN];
+	} expanded;
+	// bit set if expanded.perArg[i] holds valid data
+	unsigned int expandedMask;
+	int numArgs;
+	int flags;
+} tokenizer_t;
+
 // cmd_tokenizer.c
+void TokenizerCtx_TokenizeString(tokenizer_t *t, const char* s, int flags);
+int TokenizerCtx_GetArgsCount(tokenizer_t *t);
+bool TokenizerCtx_CheckArgsCountAndPrintWarning(tokenizer_t *t, const char* cmdStr, int reqCount);
+const char* TokenizerCtx_GetArg(tokenizer_t *t, int i);
+const char* TokenizerCtx_GetArgExpanding(tokenizer_t *t, int i);
+const char* TokenizerCtx_GetArgFrom(tokenizer_t *t, int i);
+int TokenizerCtx_GetArgInteger(tokenizer_t *t, int i);
+int TokenizerCtx_GetPin(tokenizer_t *t, int i, int def);
+int TokenizerCtx_GetArgIntegerDefault(tokenizer_t *t, int i, int def);
+float TokenizerCtx_GetArgFloatDefault(tokenizer_t *t, int i, float def);
+bool TokenizerCtx_IsArgInteger(tokenizer_t *t, int i);
+float TokenizerCtx_GetArgFloat(tokenizer_t *t, int i);
+int TokenizerCtx_GetArgIntegerRange(tokenizer_t *t, int i, int rangeMin, int rangeMax);
+// implicit context, one per thread and command nesting level
+void Tokenizer_Init();
+void Tokenizer_PushContext();
+void Tokenizer_PopContext();
+tokenizer_t *Tokenizer_GetCurrentContext();
 int Tokenizer_GetArgsCount();
 bool Tokenizer_CheckArgsCountAndPrintWarning(const char* cmdStr, int reqCount);
 const char* Tokenizer_GetArg(int i);
@@ -222,7 +318,8 @@ int Tokenizer_GetArgIntegerRange(int i, int rangeMax, int rangeMin);
 void Tokenizer_TokenizeString(const char* s, int flags);
 // cmd_repeatingEvents.c
 void RepeatingEvents_Init();
-void RepeatingEvents_RunUpdate(float deltaTimeSeconds);
+void RepeatingEvents_RunUpdate(int deltaTimeMS);
+int RepeatingEvents_GetNextFireMS();
 void SIM_GenerateRepeatingEventsDesc(char *o, int outLen);
 void SIM_GeneratePowerStateDesc(char *o, int outLen);
 // cmd_eventHandlers.c
@@ -16,148 +16,251 @@ typedef struct repeatingEvent_s {
 	char *command;
 	//char *condition;
 	// how often event repeats
-	float intervalSeconds;
-	// current value until next repeat (decremented every second)
-	float currentInterval;
+	int intervalMS;
+	// absolute time (on g_repeatingTimeMS clock) of next run
+	unsigned int deadlineMS;
 	// number of times to repeat.
 	// If set to -1, then it's infinite repeater
 	// If set to EVENT_CANCELED_TIMES, then event structure is ready to be reused
 	int times;
 	// user can set an ID and then cancel repeating event by ID
 	int userID;
+	// slot in g_eventHeap, -1 when not queued
+	int heapIndex;
+	// next entry in the pool of free events
 	struct repeatingEvent_s *next;
 } repeatingEvent_t;
 
 #define EVENT_CANCELED_TIMES -999
 
-static repeatingEvent_t *g_repeatingEvents = 0;
+// Active events are kept in a binary min-heap ordered by absolute deadline,
+// so the next deadline is always g_eventHeap[0]. Deadlines are integer ms and
+// advance by exact intervals, so repeating events do not drift.
+// Finished and cancelled events go back to a free pool for reuse.
+static repeatingEvent_t **g_eventHeap = 0;
+static int g_eventHeapCount = 0;
+static int g_eventHeapSize = 0;
+static repeatingEvent_t *g_freeEvents = 0;
+// event whose command is being executed right now, it's out of the heap
+static repeatingEvent_t *g_firingEvent = 0;
+// monotonic ms clock, advanced by RepeatingEvents_RunUpdate
+static unsigned int g_repeatingTimeMS = 0;
+
+// wrap-safe deadline comparison
+static bool RepeatingEvents_IsEarlier(unsigned int a, unsigned int b) {
+	return (int)(a - b) < 0;
+}
+static void RepeatingEvents_HeapSet(int i, repeatingEvent_t *ev) {
+	g_eventHeap[i] = ev;
+	ev->heapIndex = i;
+}
+static void RepeatingEvents_SiftUp(int i) {
+	repeatingEvent_t *ev;
+	int parent;
+
+	ev = g_eventHeap[i];
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!RepeatingEvents_IsEarlier(ev->deadlineMS, g_eventHeap[parent]->deadlineMS))
+			break;
+		RepeatingEvents_HeapSet(i, g_eventHeap[parent]);
+		i = parent;
+	}
+	RepeatingEvents_HeapSet(i, ev);
+}
+static void RepeatingEvents_SiftDown(int i) {
+	repeatingEvent_t *ev;
+	int child;
+
+	ev = g_eventHeap[i];
+	while (1) {
+		child = i * 2 + 1;
+		if (child >= g_eventHeapCount)
+			break;
+		if (child + 1 < g_eventHeapCount
+			&& RepeatingEvents_IsEarlier(g_eventHeap[child + 1]->deadlineMS, g_eventHeap[child]->deadlineMS)) {
+			child++;
+		}
+		if (!RepeatingEvents_IsEarlier(g_eventHeap[child]->deadlineMS, ev->deadlineMS))
+			break;
+		RepeatingEvents_HeapSet(i, g_eventHeap[child]);
+		i = child;
+	}
+	RepeatingEvents_HeapSet(i, ev);
+}
+static bool RepeatingEvents_HeapPush(repeatingEvent_t *ev) {
+	repeatingEvent_t **heap;
+
+	if (g_eventHeapCount >= g_eventHeapSize) {
+		heap = realloc(g_eventHeap, (g_eventHeapSize + 8) * sizeof(repeatingEvent_t*));
+		if (heap == 0) {
+			return false;
+		}
+		g_eventHeap = heap;
+		g_eventHeapSize += 8;
+	}
+	RepeatingEvents_HeapSet(g_eventHeapCount, ev);
+	g_eventHeapCount++;
+	RepeatingEvents_SiftUp(g_eventHeapCount - 1);
+	return true;
+}
+static void RepeatingEvents_HeapRemove(repeatingEvent_t *ev) {
+	int i;
+
+	i = ev->heapIndex;
+	g_eventHeapCount--;
+	if (i != g_eventHeapCount) {
+		RepeatingEvents_HeapSet(i, g_eventHeap[g_eventHeapCount]);
+		if (i > 0 && RepeatingEvents_IsEarlier(g_eventHeap[i]->deadlineMS, g_eventHeap[(i - 1) / 2]->deadlineMS)) {
+			RepeatingEvents_SiftUp(i);
+		}
+		else {
+			RepeatingEvents_SiftDown(i);
+		}
+	}
+	ev->heapIndex = -1;
+}
+// returns event to the pool
+static void RepeatingEvents_Release(repeatingEvent_t *ev) {
+	free(ev->command);
+	ev->command = 0;
+	ev->times = EVENT_CANCELED_TIMES;
+	ev->heapIndex = -1;
+	ev->next = g_freeEvents;
+	g_freeEvents = ev;
+}
 
 void RepeatingEvents_CancelRepeatingEvents(int userID)
 {
 	repeatingEvent_t *ev;
+	int i;
 
-	// reuse existing
-	for(ev = g_repeatingEvents; ev; ev = ev->next) {
-		if(ev->userID == userID) {
-			// mark as finished
-			ev->times = EVENT_CANCELED_TIMES;
+	i = 0;
+	while (i < g_eventHeapCount) {
+		ev = g_eventHeap[i];
+		if (ev->userID == userID) {
 			addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"Event with id %i and cmd %s has been canceled",ev->userID,ev->command);
+			RepeatingEvents_HeapRemove(ev);
+			RepeatingEvents_Release(ev);
+			// slot i now holds another event, check it again
+			continue;
 		}
+		i++;
+	}
+	// event may cancel itself from its own command
+	if (g_firingEvent && g_firingEvent->userID == userID) {
+		g_firingEvent->times = EVENT_CANCELED_TIMES;
 	}
-
 }
 void RepeatingEvents_AddRepeatingEvent(const char *command, float secondsInterval, int times, int userID)
 {
 	repeatingEvent_t *ev;
 	char *cmd_copy;
 
-	// reuse existing
-	for(ev = g_repeatingEvents; ev; ev = ev->next) {
-		// is this event canceled/empty?
-		if(ev->times == EVENT_CANCELED_TIMES) {
-			if(!strcmp(ev->command,command)) {
-				ev->intervalSeconds = secondsInterval;
-				// fire after delay
-				ev->currentInterval = secondsInterval;
-				ev->times = times;
-				return;
-			}
-		}
-	}
-	// create new
-	ev = malloc(sizeof(repeatingEvent_t));
-	if(ev == 0) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: failed to malloc new event");
-		return;
-	}
 	cmd_copy = strdup(command);
 	if(cmd_copy == 0) {
 		addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: failed to malloc command text copy");
-		free(ev);
 		return;
 	}
-
-	ev->next = g_repeatingEvents;
-	g_repeatingEvents = ev;
+	// reuse pooled
+	ev = g_freeEvents;
+	if (ev) {
+		g_freeEvents = ev->next;
+	}
+	else {
+		// create new
+		ev = malloc(sizeof(repeatingEvent_t));
+		if(ev == 0) {
+			addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: failed to malloc new event");
+			free(cmd_copy);
+			return;
+		}
+	}
+	ev->next = 0;
 	ev->command = cmd_copy;
-	ev->intervalSeconds = secondsInterval;
+	ev->intervalMS = (int)(secondsInterval * 1000.0f + 0.5f);
+	if (ev->intervalMS < 1) {
+		ev->intervalMS = 1;
+	}
 	ev->times = times;
 	ev->userID = userID;
-	// fire next frame
-	// TODO: is this what we want? or do we want to fire after full interval?
-	//ev->currentInterval = 1;
 	// fire after full interval
-	ev->currentInterval = secondsInterval;
+	ev->deadlineMS = g_repeatingTimeMS + ev->intervalMS;
+	if (RepeatingEvents_HeapPush(ev) == false) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: failed to grow event queue");
+		RepeatingEvents_Release(ev);
+	}
 }
 void SIM_GenerateRepeatingEventsDesc(char *o, int outLen) {
 	repeatingEvent_t *cur;
 	//int ci = 0;
 	char buffer[32];
-	cur = g_repeatingEvents;
-	while (cur) {
-		// -1 means 'forever'
-		if (cur->times > 0 || cur->times == -1) {
-			//ci++;
-			snprintf(buffer, outLen,"ID %i, repeats %i",(int) cur->userID, (int)cur->times);
-			strcat_safe(o, buffer, outLen);
-			snprintf(buffer, outLen, ", interval %i", (int)cur->intervalSeconds);
-			snprintf(buffer, outLen, " (cur left %i), cmd: ", (int)cur->currentInterval);
-			strcat_safe(o, buffer, outLen);
-			strcat_safe(o, cur->command, outLen);
-		}
-		cur = cur->next;
+	int i;
+
+	for (i = 0; i < g_eventHeapCount; i++) {
+		cur = g_eventHeap[i];
+		//ci++;
+		snprintf(buffer, sizeof(buffer),"ID %i, repeats %i",(int) cur->userID, (int)cur->times);
+		strcat_safe(o, buffer, outLen);
+		snprintf(buffer, sizeof(buffer), ", interval %i", cur->intervalMS / 1000);
+		strcat_safe(o, buffer, outLen);
+		snprintf(buffer, sizeof(buffer), " (cur left %i), cmd: ", (int)(cur->deadlineMS - g_repeatingTimeMS) / 1000);
+		strcat_safe(o, buffer, outLen);
+		strcat_safe(o, cur->command, outLen);
 	}
 }
 int RepeatingEvents_GetActiveCount() {
-	repeatingEvent_t *cur;
-	int c_active;
-	
-	c_active = 0;
-	cur = g_repeatingEvents;
-	while (cur) {
-		// -1 means 'forever'
-		if (cur->times > 0 || cur->times == -1) {
-			c_active++;
-		}
-		cur = cur->next;
+	return g_eventHeapCount;
+}
+// Returns ms left until the earliest repeating event is due, or -1 if there are none.
+// Main loop may use it to know how long it can sleep.
+int RepeatingEvents_GetNextFireMS() {
+	int left;
+
+	if (g_eventHeapCount == 0) {
+		return -1;
 	}
-	return c_active;
+	left = (int)(g_eventHeap[0]->deadlineMS - g_repeatingTimeMS);
+	if (left < 0) {
+		return 0;
+	}
+	return left;
 }
-void RepeatingEvents_RunUpdate(float deltaTimeSeconds) {
+void RepeatingEvents_RunUpdate(int deltaTimeMS) {
 	repeatingEvent_t *cur;
-	int c_checked = 0;
 	int c_ran = 0;
 
-	cur = g_repeatingEvents;
-	while(cur) {
-		c_checked++;
-		// debug only check
-		if(cur == cur->next) {
-			addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: single linked list was broken?");
-			cur->next = 0;
-			return;
-		}
+	g_repeatingTimeMS += deltaTimeMS;
+
+	// only due events are touched; rescheduled deadline is always in the
+	// future, so each event fires at most once per update
+	while (g_eventHeapCount > 0 && !RepeatingEvents_IsEarlier(g_repeatingTimeMS, g_eventHeap[0]->deadlineMS)) {
+		cur = g_eventHeap[0];
+		RepeatingEvents_HeapRemove(cur);
+		c_ran++;
 		// -1 means 'forever'
-		if(cur->times > 0 || cur->times == -1) {
-			cur->currentInterval-= deltaTimeSeconds;
-			if(cur->currentInterval<=0){
-				c_ran++;
-				// -1 means 'forever'
-				if(cur->times != -1) {
-					cur->times -= 1;
-					if (cur->times <= 0) {
-						// if finished all calls, mark as empty so we can reuse later
-						cur->times = EVENT_CANCELED_TIMES;
-					}
-				}
-				cur->currentInterval = cur->intervalSeconds;
-				CMD_ExecuteCommand(cur->command, COMMAND_FLAG_SOURCE_SCRIPT);
+		if(cur->times != -1) {
+			cur->times -= 1;
+			if (cur->times <= 0) {
+				// if finished all calls, mark so it's released after run
+				cur->times = EVENT_CANCELED_TIMES;
 			}
 		}
-		cur = cur->next;
+		// next deadline is counted from the previous one, not from now,
+		// but if we are late by more than an interval, skip missed runs
+		cur->deadlineMS += cur->intervalMS;
+		if (!RepeatingEvents_IsEarlier(g_repeatingTimeMS, cur->deadlineMS)) {
+			cur->deadlineMS = g_repeatingTimeMS + cur->intervalMS;
+		}
+		g_firingEvent = cur;
+		CMD_ExecuteCommand(cur->command, COMMAND_FLAG_SOURCE_SCRIPT);
+		g_firingEvent = 0;
+		if (cur->times == EVENT_CANCELED_TIMES || RepeatingEvents_HeapPush(cur) == false) {
+			RepeatingEvents_Release(cur);
+		}
 	}
 
-	//addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond checked %i events, ran %i\n",c_checked,c_ran);
+	//addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond ran %i, next in %i ms\n",c_ran,RepeatingEvents_GetNextFireMS());
 }
 // addRepeatingEventID 1234 5 -1 DGR_SendPower "testgr" 1 1 
 // cancelRepeatingEvent 1234
@@ -200,17 +303,28 @@ commandResult_t RepeatingEvents_Cmd_ClearRepeatingEvents(const void *context, co
 	repeatingEvent_t *cur;
 	repeatingEvent_t *rem;
 	int c = 0;
+	int i;
 
-	cur = g_repeatingEvents;
+	for (i = 0; i < g_eventHeapCount; i++) {
+		rem = g_eventHeap[i];
+		free(rem->command);
+		free(rem);
+		c++;
+	}
+	g_eventHeapCount = 0;
+	cur = g_freeEvents;
 	while (cur) {
 		rem = cur;
 		cur = cur->next;
-		free(rem->command);
 		free(rem);
+	}
+	g_freeEvents = 0;
+	// event that is running now is released by RunUpdate
+	if (g_firingEvent) {
+		g_firingEvent->times = EVENT_CANCELED_TIMES;
 		c++;
 	}
 	addLogAdv(LOG_INFO, LOG_FEATURE_CMD, "Fried %i rep. events", c);
-	g_repeatingEvents = 0;
 	return CMD_RES_OK;
 }
 commandResult_t RepeatingEvents_Cmd_CancelRepeatingEvent(const void *context, const char *cmd, const char *args, int cmdFlags) {
@@ -236,15 +350,12 @@ static commandResult_t RepeatingEvents_Cmd_ListRepeatingEvents(const void *conte
 	repeatingEvent_t *ev;
 	int c;
 
-	ev = g_repeatingEvents;
-	c = 0;
-
-	while (ev) {
-		ADDLOG_INFO(LOG_FEATURE_EVENT, "Repeater %i has ID %i, interval %i, reps %i, and command %s",
-			c,  ev->userID, ev->intervalSeconds, ev->times, ev->command);
-		ev = ev->next;
-		c++;
+	for (c = 0; c < g_eventHeapCount; c++) {
+		ev = g_eventHeap[c];
+		ADDLOG_INFO(LOG_FEATURE_EVENT, "Repeater %i has ID %i, interval %i ms, next in %i ms, reps %i, and command %s",
+			c, ev->userID, ev->intervalMS, (int)(ev->deadlineMS - g_repeatingTimeMS), ev->times, ev->command);
 	}
+	ADDLOG_INFO(LOG_FEATURE_EVENT, "Next repeating event in %i ms", RepeatingEvents_GetNextFireMS());
 
 	return CMD_RES_OK;
 }
@@ -4,6 +4,7 @@
 #include "../new_cfg.h"
 #include "../obk_config.h"
 #include "../driver/drv_public.h"
+#include "../quicktick.h"
 #include <ctype.h>
 #include "cmd_local.h"
 
@@ -225,37 +226,318 @@ addEventHandler OnHold 20 backlog AddChannel 10 2 0 255; DGR_SendBrightness room
 
 */
 
-int g_scrBufferSize = 0;
-char *g_scrBuffer = NULL;
 int svm_deltaMS;
 scriptFile_t *g_scriptFiles = 0;
 scriptInstance_t *g_scriptThreads = 0;
 scriptInstance_t *g_activeThread = 0;
 
+// Script threads are scheduled, not polled. Threads sleeping in delay_s/delay_ms
+// are kept in a min-heap keyed by absolute wake time, runnable threads are kept
+// in a FIFO ready queue and threads blocked in waitFor are parked on the per-event
+// wait lists, so a tick only touches the threads that have something to do.
+#define SVM_SCHED_NONE		0
+#define SVM_SCHED_READY		1
+#define SVM_SCHED_SLEEPING	2
+
+// max cost of script lines executed by a thread in one slice
+#define SVM_SLICE_LINES		20
+
+// SVM time, advanced by deltaMS of each SVM_RunThreads call
+static unsigned int svm_timeMS = 0;
+// per-tick time budget for running script threads, 0 means no limit
+static int svm_budgetMS = 10;
+static scriptInstance_t **g_sleepHeap = 0;
+static int g_sleepHeapCount = 0;
+static int g_sleepHeapSize = 0;
+static int g_threadCount = 0;
+static scriptInstance_t *g_readyHead = 0;
+static scriptInstance_t *g_readyTail = 0;
+static int g_readyCount = 0;
+// scheduler statistics
+static int svm_wakeups = 0;
+static int svm_lateWakeups = 0;
+static int svm_maxLateMS = 0;
+static int svm_budgetHits = 0;
+
+static int SVM_GetTimeMS() {
+	return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+// wrap-safe comparison of SVM times
+static bool SVM_IsEarlier(unsigned int a, unsigned int b) {
+	return (int)(a - b) < 0;
+}
+static void SVM_HeapSet(int i, scriptInstance_t *t) {
+	g_sleepHeap[i] = t;
+	t->heapIndex = i;
+}
+static void SVM_HeapSiftUp(int i) {
+	scriptInstance_t *t;
+	int parent;
+
+	t = g_sleepHeap[i];
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!SVM_IsEarlier(t->wakeTimeMS, g_sleepHeap[parent]->wakeTimeMS))
+			break;
+		SVM_HeapSet(i, g_sleepHeap[parent]);
+		i = parent;
+	}
+	SVM_HeapSet(i, t);
+}
+static void SVM_HeapSiftDown(int i) {
+	scriptInstance_t *t;
+	int child;
+
+	t = g_sleepHeap[i];
+	while (1) {
+		child = i * 2 + 1;
+		if (child >= g_sleepHeapCount)
+			break;
+		if (child + 1 < g_sleepHeapCount
+			&& SVM_IsEarlier(g_sleepHeap[child + 1]->wakeTimeMS, g_sleepHeap[child]->wakeTimeMS)) {
+			child++;
+		}
+		if (!SVM_IsEarlier(g_sleepHeap[child]->wakeTimeMS, t->wakeTimeMS))
+			break;
+		SVM_HeapSet(i, g_sleepHeap[child]);
+		i = child;
+	}
+	SVM_HeapSet(i, t);
+}
+// heap has room for every thread, see SVM_RegisterThread
+static void SVM_HeapPush(scriptInstance_t *t) {
+	t->schedState = SVM_SCHED_SLEEPING;
+	SVM_HeapSet(g_sleepHeapCount, t);
+	g_sleepHeapCount++;
+	SVM_HeapSiftUp(g_sleepHeapCount - 1);
+}
+static void SVM_HeapRemove(scriptInstance_t *t) {
+	int i;
+
+	i = t->heapIndex;
+	g_sleepHeapCount--;
+	if (i != g_sleepHeapCount) {
+		SVM_HeapSet(i, g_sleepHeap[g_sleepHeapCount]);
+		if (i > 0 && SVM_IsEarlier(g_sleepHeap[i]->wakeTimeMS, g_sleepHeap[(i - 1) / 2]->wakeTimeMS)) {
+			SVM_HeapSiftUp(i);
+		}
+		else {
+			SVM_HeapSiftDown(i);
+		}
+	}
+	t->heapIndex = -1;
+	t->schedState = SVM_SCHED_NONE;
+}
+static void SVM_RemoveReady(scriptInstance_t *t) {
+	scriptInstance_t **p;
+	scriptInstance_t *prev;
+
+	prev = 0;
+	p = &g_readyHead;
+	while (*p) {
+		if (*p == t) {
+			*p = t->nextReady;
+			if (g_readyTail == t) {
+				g_readyTail = prev;
+			}
+			g_readyCount--;
+			break;
+		}
+		prev = *p;
+		p = &prev->nextReady;
+	}
+	t->nextReady = 0;
+	t->schedState = SVM_SCHED_NONE;
+}
+static void SVM_MakeReady(scriptInstance_t *t) {
+	if (t->schedState == SVM_SCHED_READY)
+		return;
+	if (t->schedState == SVM_SCHED_SLEEPING)
+		SVM_HeapRemove(t);
+	t->schedState = SVM_SCHED_READY;
+	t->nextReady = 0;
+	if (g_readyTail) {
+		g_readyTail->nextReady = t;
+	}
+	else {
+		g_readyHead = t;
+	}
+	g_readyTail = t;
+	g_readyCount++;
+}
+static scriptInstance_t *SVM_PopReady() {
+	scriptInstance_t *t;
+
+	t = g_readyHead;
+	if (t == 0)
+		return 0;
+	g_readyHead = t->nextReady;
+	if (g_readyHead == 0) {
+		g_readyTail = 0;
+	}
+	g_readyCount--;
+	t->nextReady = 0;
+	t->schedState = SVM_SCHED_NONE;
+	return t;
+}
+// takes thread out of the ready queue or sleep heap
+static void SVM_Deschedule(scriptInstance_t *t) {
+	if (t->schedState == SVM_SCHED_SLEEPING) {
+		SVM_HeapRemove(t);
+	}
+	else if (t->schedState == SVM_SCHED_READY) {
+		SVM_RemoveReady(t);
+	}
+	t->bTimerWake = 0;
+}
+// puts thread back into the right queue after it has run a slice
+static void SVM_ScheduleThread(scriptInstance_t *t) {
+	// already queued again, for example woken while running
+	if (t->schedState != SVM_SCHED_NONE)
+		return;
+	// finished, or parked on a waitFor list
+	if (t->curFile == 0 || t->wait.waitingForEvent)
+		return;
+	if (t->currentDelayMS > 0) {
+		t->wakeTimeMS = svm_timeMS + t->currentDelayMS;
+		t->currentDelayMS = 0;
+		SVM_HeapPush(t);
+	}
+	else {
+		SVM_MakeReady(t);
+	}
+}
 
 scriptInstance_t *SVM_RegisterThread() {
 	scriptInstance_t *r;
+	scriptInstance_t **heap;
 
 	r = g_scriptThreads;
 
 	while(r) {
-		if(r->curLine == 0) {
+		if(r->curFile == 0) {
 			break;
 		}
 		r = r->next;
 	}
 	if(r == 0) {
+		// make sure every thread fits into sleep heap, so pushing never fails
+		if (g_threadCount >= g_sleepHeapSize) {
+			heap = realloc(g_sleepHeap, (g_sleepHeapSize + 8) * sizeof(scriptInstance_t*));
+			if (heap == 0) {
+				return 0;
+			}
+			g_sleepHeap = heap;
+			g_sleepHeapSize += 8;
+		}
 		r = malloc(sizeof(scriptInstance_t));
+		if (r == 0) {
+			return 0;
+		}
 		memset(r,0,sizeof(scriptInstance_t));
+		r->heapIndex = -1;
 		r->next = g_scriptThreads;
 		g_scriptThreads = r;
+		g_threadCount++;
 	}
+	SVM_Deschedule(r);
 	r->uniqueID = 0;
 	r->curLine = 0;
 	r->curFile = 0;
 	r->currentDelayMS = 0;
 	return r;
 }
+void SVM_GetSchedulerStats(int *wakeups, int *lateWakeups, int *maxLateMS, int *budgetHits) {
+	*wakeups = svm_wakeups;
+	*lateWakeups = svm_lateWakeups;
+	*maxLateMS = svm_maxLateMS;
+	*budgetHits = svm_budgetHits;
+}
+const char *SVM_SkipWS(const char *p);
+const char *SVM_SkipLine(const char *p);
+
+static unsigned int SVM_HashLabel(const char *s) {
+	unsigned int hash = 5381;
+
+	while (*s) {
+		hash = hash * 33 + (unsigned char)*s;
+		s++;
+	}
+	return hash;
+}
+// finds next line of script text, returns start of the following one
+static char *SVM_GetLine(char *p, char **start, char **end) {
+	*start = (char*)SVM_SkipWS(p);
+	p = (char*)SVM_SkipLine(*start);
+	*end = p;
+	while (*end > *start && ((*end)[-1] == ' ' || (*end)[-1] == '\r' || (*end)[-1] == '\n' || (*end)[-1] == '\t')) {
+		(*end)--;
+	}
+	return p;
+}
+// Splits file data (in place) into the table of executable lines and
+// the table of labels, so running script does not need to rescan the text
+// and 'goto' does not need to search whole file.
+static void SVM_CompileFile(scriptFile_t *f) {
+	char *p, *start, *end;
+	int pass, numLines, numLabels, cost;
+
+	if (f->data == 0) {
+		return;
+	}
+	// first pass counts, second one fills
+	for (pass = 0; pass < 2; pass++) {
+		numLines = 0;
+		numLabels = 0;
+		cost = 0;
+		p = f->data;
+		while (*p) {
+			p = SVM_GetLine(p, &start, &end);
+			if (cost < 0xFFFF) {
+				cost++;
+			}
+			if (start[0] == '/' && start[1] == '/') {
+				// comment
+				continue;
+			}
+			if (end == start) {
+				// empty line
+				continue;
+			}
+			if (end[-1] == ':') {
+				if (pass) {
+					end[-1] = 0;
+					f->labels[numLabels].name = start;
+					f->labels[numLabels].hash = SVM_HashLabel(start);
+					f->labels[numLabels].line = numLines;
+				}
+				numLabels++;
+				continue;
+			}
+			if (pass) {
+				*end = 0;
+				f->lines[numLines].text = start;
+				f->lines[numLines].cost = cost;
+				memset(&f->lines[numLines].cache, 0, sizeof(f->lines[numLines].cache));
+			}
+			numLines++;
+			cost = 0;
+		}
+		if (pass == 0) {
+			f->lines = (scriptLine_t*)malloc(sizeof(scriptLine_t) * (numLines + 1));
+			f->labels = (scriptLabel_t*)malloc(sizeof(scriptLabel_t) * (numLabels + 1));
+			if (f->lines == 0 || f->labels == 0) {
+				free(f->lines);
+				free(f->labels);
+				f->lines = 0;
+				f->labels = 0;
+				return;
+			}
+		}
+	}
+	f->numLines = numLines;
+	f->numLabels = numLabels;
+}
 scriptFile_t *SVM_RegisterFile(const char *fname) {
 	scriptFile_t *r;
 
@@ -285,6 +567,7 @@ scriptFile_t *SVM_RegisterFile(const char *fname) {
 	else {
 		r->data = (char*)LFS_ReadFile(fname);
 	}
+	SVM_CompileFile(r);
 	r->next = g_scriptFiles;
 	g_scriptFiles = r;
 	if(r->data == 0)
@@ -314,6 +597,7 @@ scriptFile_t *SVM_RegisterFileForText(const char *txt) {
 		}
 		p++;
 	}
+	SVM_CompileFile(r);
 	r->next = g_scriptFiles;
 	g_scriptFiles = r;
 	if (r->data == 0)
@@ -342,137 +626,109 @@ const char *SVM_SkipLine(const char *p) {
 	return p;
 }
 
-const char *SVM_FindLabel(const char *text, const char *label, const char *fname) {
-	int labLen;
+int SVM_FindLabel(scriptFile_t *f, const char *label) {
+	unsigned int hash;
+	int i;
 
 	if(label == 0)
-		return text;
+		return 0;
 	if (!strcmp(label, "*"))
-		return text;
+		return 0;
 	if (*label == 0)
-		return text;
-
-	labLen = strlen(label);
+		return 0;
 
-	while(*text) {
-		text = SVM_SkipWS(text); 
-		if(strncmp(text,label,labLen) == 0 && text[labLen] == ':') {
-			return text;
-		}
-		if(text[0] == '/' && text[1] == '/') {
-			text = SVM_SkipLine(text); 
-			text = SVM_SkipWS(text); 
-		} else {
-			text = SVM_SkipLine(text); 
-			text = SVM_SkipWS(text); 
+	hash = SVM_HashLabel(label);
+	for (i = 0; i < f->numLabels; i++) {
+		if (f->labels[i].hash == hash && !strcmp(f->labels[i].name, label)) {
+			return f->labels[i].line;
 		}
 	}
-	ADDLOG_INFO(LOG_FEATURE_CMD, "Label %s not found in %s - will go to the start of file",label,fname);
-	return text;
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Label %s not found in %s - will go to the start of file",label,f->fname);
+	return f->numLines;
 }
 void SVM_RunThread(scriptInstance_t *t, int maxLoops) {
 	int loop = 0;
-	const char *start, *end;
-	int len, p;
-	
-	if(g_scrBuffer == NULL) {
-		g_scrBufferSize = 256;
-		g_scrBuffer = malloc(g_scrBufferSize + 1);
-	}
-
+	scriptLine_t *line;
 
 	while(1) {
-		loop++;
 		// check if "waitFor" was executed last frame
 		if (t->wait.waitingForEvent) {
 			return;
 		}
-		if(t->curLine == 0) {
+		if(t->curFile == 0) {
 			t->curLine = 0;
-			t->curFile = 0;
-			return;
-		}
-		if (loop > maxLoops) {
 			return;
 		}
-		t->curLine = SVM_SkipWS(t->curLine); 
-		if(t->curLine[0] == 0) {
+		if(t->curLine >= t->curFile->numLines) {
 			t->curLine = 0;
 			t->curFile = 0;
 			return;
 		}
-		if(t->curLine[0] == '/' && t->curLine[1] == '/') {
-			t->curLine = SVM_SkipLine(t->curLine); 
-			t->curLine = SVM_SkipWS(t->curLine); 
-		} else {
-			start = t->curLine;
-			end = SVM_SkipLine(start);
-			t->curLine = SVM_SkipWS(end); 
-
-			while(end > start && (end[-1]==' '||end[-1]=='\r'||end[-1]=='\n'||end[-1]=='\t')) {
-				end--;
-			}
-			len = (end - start);
-			//ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "Script len: %i",len);
-
-			// skip empty lines and skip labels
-			if(len > 0 && start[len-1] != ':') {
-				if(len >= g_scrBufferSize) {
-					g_scrBufferSize = len + 256;
-					g_scrBuffer = (char*)realloc(g_scrBuffer, g_scrBufferSize+1);
-				}
-				if (g_scrBuffer == NULL) {
-					return;
-				}
-				memcpy(g_scrBuffer,start,len);
-				g_scrBuffer[len] = 0;
-
-				p = start-t->curFile->data;
-				///ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "[Loop %i] Script line: %s, char index %i",loop,g_scrBuffer,p);
-				CMD_ExecuteCommand(g_scrBuffer,0);
+		line = &t->curFile->lines[t->curLine];
+		loop += line->cost;
+		if (loop > maxLoops) {
+			return;
+		}
+		t->curLine++;
+		//ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "[Loop %i] Script line: %s",loop,line->text);
+		CMD_ExecuteCommandCached(&line->cache, line->text, 0);
 
-				// did we get a sleep?
-				if(t->currentDelayMS > 0) {
-					return;
-				}	
-			}
+		// did we get a sleep?
+		if(t->currentDelayMS > 0) {
+			return;
 		}
 	}
 }
 
 void SVM_RunThreads(int deltaMS) {
-	int c_sleep, c_run;
+	scriptInstance_t *t;
+	int toRun, ran, startMS, lateMS;
 
-	c_sleep = 0;
-	c_run = 0;
 	svm_deltaMS = deltaMS;
+	svm_timeMS += deltaMS;
+
+	// move threads whose delay has passed to the ready queue
+	while (g_sleepHeapCount > 0 && !SVM_IsEarlier(svm_timeMS, g_sleepHeap[0]->wakeTimeMS)) {
+		t = g_sleepHeap[0];
+		SVM_HeapRemove(t);
+		t->bTimerWake = 1;
+		SVM_MakeReady(t);
+	}
 
-
-	g_activeThread = g_scriptThreads;
-	while(g_activeThread) {
-		if (g_activeThread->wait.waitingForEvent) {
-			// do nothing
-			c_sleep++;
+	// every thread that is ready now gets one slice, threads made ready
+	// by these slices wait for the next tick. When time budget runs out,
+	// the rest stays at the front of the queue and goes first next time.
+	toRun = g_readyCount;
+	ran = 0;
+	startMS = SVM_GetTimeMS();
+	while (toRun > 0) {
+		if (ran > 0 && svm_budgetMS > 0 && SVM_GetTimeMS() - startMS >= svm_budgetMS) {
+			svm_budgetHits++;
+			break;
 		}
-		else {
-			if (g_activeThread->currentDelayMS > 0) {
-				g_activeThread->currentDelayMS -= deltaMS;
-				// the following block is needed to handle with long freezes on simulator
-				if (g_activeThread->currentDelayMS <= 0) {
-					g_activeThread->currentDelayMS = 0;
-					SVM_RunThread(g_activeThread, 20);
-				}
-				c_sleep++;
+		t = SVM_PopReady();
+		if (t == 0)
+			break;
+		toRun--;
+		ran++;
+		if (t->bTimerWake) {
+			t->bTimerWake = 0;
+			lateMS = svm_timeMS - t->wakeTimeMS;
+			svm_wakeups++;
+			if (lateMS > QUICK_TMR_DURATION) {
+				svm_lateWakeups++;
 			}
-			else {
-				SVM_RunThread(g_activeThread, 20);
-				c_run++;
+			if (lateMS > svm_maxLateMS) {
+				svm_maxLateMS = lateMS;
 			}
 		}
-		g_activeThread = g_activeThread->next;
+		g_activeThread = t;
+		SVM_RunThread(t, SVM_SLICE_LINES);
+		SVM_ScheduleThread(t);
 	}
+	g_activeThread = 0;
 
-	//ADDLOG_INFO(LOG_FEATURE_CMD, "SCR sleep %i, ran %i",c_sleep,c_run);
+	//ADDLOG_INFO(LOG_FEATURE_CMD, "SCR ran %i, ready %i, sleeping %i",ran,g_readyCount,g_sleepHeapCount);
 }
 bool CheckEventCondition(eventWait_t *w, byte eventCode, int argument) {
 	if (w->waitingForEvent != eventCode) {
@@ -511,22 +767,68 @@ bool CheckEventCondition(eventWait_t *w, byte eventCode, int argument) {
 	}
 	return bMatch;
 }
+// Threads blocked in waitFor are parked on a list for their event,
+// so firing an event only looks at threads waiting for it.
+// Raw numeric event codes above the known ones share the last list.
+#define SVM_WAIT_LISTS	(CMD_EVENT_MAX_TYPES + 1)
+static scriptInstance_t *g_waitingThreads[SVM_WAIT_LISTS];
+
+static int SVM_WaitList(int eventCode) {
+	if (eventCode >= CMD_EVENT_MAX_TYPES)
+		return CMD_EVENT_MAX_TYPES;
+	return eventCode;
+}
+static void SVM_ParkThread(scriptInstance_t *t, int eventCode, int argument, char relation) {
+	scriptInstance_t **list;
+
+	t->wait.waitingForEvent = eventCode;
+	t->wait.waitingForArgument = argument;
+	t->wait.waitingForRelation = relation;
+
+	list = &g_waitingThreads[SVM_WaitList(eventCode)];
+	t->nextWaiting = *list;
+	*list = t;
+}
+static void SVM_UnparkThread(scriptInstance_t *t) {
+	scriptInstance_t **p;
+
+	if (t->wait.waitingForEvent == 0)
+		return;
+	p = &g_waitingThreads[SVM_WaitList(t->wait.waitingForEvent)];
+	while (*p) {
+		if (*p == t) {
+			*p = t->nextWaiting;
+			break;
+		}
+		p = &(*p)->nextWaiting;
+	}
+	t->nextWaiting = 0;
+	t->wait.waitingForArgument = 0;
+	t->wait.waitingForEvent = 0;
+}
 void CMD_Script_ProcessWaitersForEvent(byte eventCode, int argument) {
+	scriptInstance_t **p;
 	scriptInstance_t *t;
 
 #if ENABLE_OBK_BERRY
 	extern void CMD_Berry_ProcessWaitersForEvent(byte eventCode, int argument);
 	CMD_Berry_ProcessWaitersForEvent(eventCode, argument);
 #endif
-	t = g_scriptThreads;
+	p = &g_waitingThreads[SVM_WaitList(eventCode)];
 
-	while (t) {
+	while (*p) {
+		t = *p;
 		if(CheckEventCondition(&t->wait,eventCode,argument)) {
 			// unlock!
+			*p = t->nextWaiting;
+			t->nextWaiting = 0;
 			t->wait.waitingForArgument = 0;
 			t->wait.waitingForEvent = 0;
+			SVM_MakeReady(t);
+		}
+		else {
+			p = &t->nextWaiting;
 		}
-		t = t->next;
 	}
 }
 void SVM_GoTo(scriptInstance_t *th, const char *fname, const char *label) {
@@ -546,7 +848,7 @@ void SVM_GoTo(scriptInstance_t *th, const char *fname, const char *label) {
 		return;
 	}
 	th->curFile = f;
-	th->curLine = SVM_FindLabel(f->data,label,f->fname);
+	th->curLine = SVM_FindLabel(f,label);
 
 	return;
 }
@@ -560,6 +862,8 @@ void SVM_FreeAllFiles() {
 		n = f->next;
 
 		free(f->data);
+		free(f->lines);
+		free(f->labels);
 		free(f->fname);
 		free(f);
 
@@ -572,12 +876,21 @@ void SVM_StopAllScripts() {
 
 	t = g_scriptThreads;
 	while(t) {
+		SVM_UnparkThread(t);
 		t->curLine = 0;
 		t->curFile = 0;
 		t->uniqueID = 0;
 		t->currentDelayMS = 0;
+		t->schedState = SVM_SCHED_NONE;
+		t->heapIndex = -1;
+		t->nextReady = 0;
+		t->bTimerWake = 0;
 		t = t->next;
 	}
+	g_readyHead = 0;
+	g_readyTail = 0;
+	g_readyCount = 0;
+	g_sleepHeapCount = 0;
 }
 
 void SVM_StopScripts(int id, int bExcludeSelf) {
@@ -589,6 +902,8 @@ void SVM_StopScripts(int id, int bExcludeSelf) {
 			// excluded
 		} else {
 			if(t->uniqueID == id) {
+				SVM_UnparkThread(t);
+				SVM_Deschedule(t);
 				t->curLine = 0;
 				t->curFile = 0;
 				t->uniqueID = 0;
@@ -604,7 +919,7 @@ void SVM_GoToLocal(scriptInstance_t *th, const char *label) {
 
 		return;
 	}
-	th->curLine = SVM_FindLabel(th->curFile->data,label,th->curFile->fname);
+	th->curLine = SVM_FindLabel(th->curFile,label);
 
 	return;
 }
@@ -633,7 +948,8 @@ void SVM_StartBacklog(const char *command) {
 	}
 	th->uniqueID = 0;
 	th->curFile = f;
-	th->curLine = f->data;
+	th->curLine = 0;
+	SVM_MakeReady(th);
 	//return th;
 }
 scriptInstance_t *SVM_StartScript(const char *fname, const char *label, int uniqueID) {
@@ -677,7 +993,8 @@ scriptInstance_t *SVM_StartScript(const char *fname, const char *label, int uniq
 	}
 	th->uniqueID = uniqueID;
 	th->curFile = f;
-	th->curLine = SVM_FindLabel(f->data,label,f->fname);
+	th->curLine = SVM_FindLabel(f,label);
+	SVM_MakeReady(th);
 
 	if(label==0) {
 		ADDLOG_INFO(LOG_FEATURE_CMD, "CMD_StartScript: started %s at the beginning",fname);
@@ -693,7 +1010,9 @@ void SVM_RunStartupCommandAsScript() {
 		//ADDLOG_INFO(LOG_FEATURE_CMD, "SVM_RunStartupCommandAsScript: started command run");
 		// Hacky as hell?
 		g_activeThread = th;
+		SVM_Deschedule(th);
 		SVM_RunThread(g_activeThread, 200);
+		SVM_ScheduleThread(th);
 		g_activeThread = 0;
 	}
 	else {
@@ -874,6 +1193,32 @@ static commandResult_t CMD_ListScripts(const void *context, const char *cmd, con
 
 	return CMD_RES_OK;
 }
+static commandResult_t CMD_SetScriptBudget(const void *context, const char *cmd, const char *args, int cmdFlags){
+
+	Tokenizer_TokenizeString(args,0);
+	// following check must be done after 'Tokenizer_TokenizeString',
+	// so we know arguments count in Tokenizer. 'cmd' argument is
+	// only for warning display
+	if (Tokenizer_CheckArgsCountAndPrintWarning(cmd, 1)) {
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+	svm_budgetMS = Tokenizer_GetArgInteger(0);
+	if (svm_budgetMS < 0) {
+		svm_budgetMS = 0;
+	}
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Script time budget per tick is now %i ms",svm_budgetMS);
+
+	return CMD_RES_OK;
+}
+static commandResult_t CMD_ScriptStats(const void *context, const char *cmd, const char *args, int cmdFlags){
+
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Scripts: %i ready, %i sleeping, budget %i ms",
+		g_readyCount, g_sleepHeapCount, svm_budgetMS);
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Wakeups: %i, late %i, max late %i ms, budget exceeded %i times",
+		svm_wakeups, svm_lateWakeups, svm_maxLateMS, svm_budgetHits);
+
+	return CMD_RES_OK;
+}
 static commandResult_t CMD_StopAllScripts(const void *context, const char *cmd, const char *args, int cmdFlags){
 
 
@@ -938,9 +1283,7 @@ commandResult_t CMD_waitFor(const void *context, const char *cmd, const char *ar
 	}
 	reqArg = atoi(s);
 	
-	g_activeThread->wait.waitingForEvent = eventCode;
-	g_activeThread->wait.waitingForArgument = reqArg;
-	g_activeThread->wait.waitingForRelation = relation;
+	SVM_ParkThread(g_activeThread, eventCode, reqArg, relation);
 
 	return CMD_RES_OK;
 }
@@ -966,6 +1309,16 @@ void CMD_InitScripting(){
 	//cmddetail:"fn":"CMD_ListScripts","file":"cmnds/cmd_script.c","requires":"",
 	//cmddetail:"examples":""}
     CMD_RegisterCommand("listScripts", CMD_ListScripts, NULL);
+	//cmddetail:{"name":"setScriptBudget","args":"[TimeMS]",
+	//cmddetail:"descr":"Sets how many miliseconds script threads may run in a single tick. Threads that did not fit run first in the next tick. 0 means no limit. Default is 10.",
+	//cmddetail:"fn":"CMD_SetScriptBudget","file":"cmnds/cmd_script.c","requires":"",
+	//cmddetail:"examples":"setScriptBudget 5"}
+    CMD_RegisterCommand("setScriptBudget", CMD_SetScriptBudget, NULL);
+	//cmddetail:{"name":"scriptStats","args":"",
+	//cmddetail:"descr":"Prints script scheduler statistics: ready and sleeping threads, delay wakeups, late wakeups (more than one quick tick after their time) and how often time budget was exceeded.",
+	//cmddetail:"fn":"CMD_ScriptStats","file":"cmnds/cmd_script.c","requires":"",
+	//cmddetail:"examples":""}
+    CMD_RegisterCommand("scriptStats", CMD_ScriptStats, NULL);
 	//cmddetail:{"name":"goto","args":"[LabelStr]",
 	//cmddetail:"descr":"Script-only command. IF single argument is given, then goes to given label from within current script file. If two arguments are given, then jumps to any other script file by label - first argument is file, second label",
 	//cmddetail:"fn":"CMD_GoTo","file":"cmnds/cmd_script.c","requires":"",
@@ -8,18 +8,152 @@
 #include "../logging/logging.h"
 #include "../hal/hal_pins.h"
 
-#define MAX_CMD_LEN 512
-#define MAX_ARGS 32
+#ifndef TOKENIZER_MAX_DEPTH
+#define TOKENIZER_MAX_DEPTH 4
+#endif
+#ifndef TOKENIZER_MAX_THREADS
+#define TOKENIZER_MAX_THREADS 4
+#endif
+
+// Implicit context of Tokenizer_* functions is kept per thread.
+// Depth is the number of command handlers given thread is currently running.
+// The static context is used by top level of one thread and by code outside of any command,
+// other levels and threads get contexts allocated on first use,
+// they are freed when outermost command of that thread returns.
+// Nesting beyond TOKENIZER_MAX_DEPTH shares the last level.
+typedef struct tokenizerThread_s {
+	void *owner;
+	int depth;
+	tokenizer_t *levels[TOKENIZER_MAX_DEPTH];
+} tokenizerThread_t;
+
+static tokenizer_t g_tokenizerRoot;
+static bool g_tokenizerRootUsed = false;
+static tokenizerThread_t g_tokenizerThreads[TOKENIZER_MAX_THREADS];
+static SemaphoreHandle_t g_tokenizerMutex = 0;
+
+#if WINDOWS
+// simulator is single threaded
+#define Tokenizer_GetCaller() ((void*)1)
+#else
+#define Tokenizer_GetCaller() ((void*)xTaskGetCurrentTaskHandle())
+#endif
 
-static char g_buffer[MAX_CMD_LEN];
-static char *g_args[MAX_ARGS];
-static char g_argsExpanded[MAX_ARGS][40];
-static const char *g_argsFrom[MAX_ARGS];
-static int g_numArgs = 0;
-static int tok_flags = 0;
+#define g_bAllowQuotes (t->flags&TOKENIZER_ALLOW_QUOTES)
+#define g_bAllowExpand (!(t->flags&TOKENIZER_DONT_EXPAND))
 
-#define g_bAllowQuotes (tok_flags&TOKENIZER_ALLOW_QUOTES)
-#define g_bAllowExpand (!(tok_flags&TOKENIZER_DONT_EXPAND))
+void Tokenizer_Init() {
+	// simulator runs init again for each test
+	if (g_tokenizerMutex) {
+		return;
+	}
+	g_tokenizerMutex = xSemaphoreCreateMutex();
+}
+static void Tokenizer_Lock() {
+	if (g_tokenizerMutex == 0) {
+		return;
+	}
+	// held only for a few assignments, so it's just waited for
+	while (xSemaphoreTake(g_tokenizerMutex, 1000) != pdTRUE) {
+	}
+}
+static void Tokenizer_Unlock() {
+	if (g_tokenizerMutex == 0) {
+		return;
+	}
+	xSemaphoreGive(g_tokenizerMutex);
+}
+// owner 0 finds a free slot
+static tokenizerThread_t *Tokenizer_FindThread(void *owner) {
+	int i;
+
+	for (i = 0; i < TOKENIZER_MAX_THREADS; i++) {
+		if (g_tokenizerThreads[i].owner == owner) {
+			return &g_tokenizerThreads[i];
+		}
+	}
+	return 0;
+}
+void Tokenizer_PushContext() {
+	void *caller = Tokenizer_GetCaller();
+	tokenizerThread_t *th;
+	tokenizer_t *t;
+	int level;
+
+	Tokenizer_Lock();
+	th = Tokenizer_FindThread(caller);
+	if (th == 0) {
+		th = Tokenizer_FindThread(0);
+		if (th == 0) {
+			// too many threads, this one shares the static context, like it was before
+			Tokenizer_Unlock();
+			return;
+		}
+		th->owner = caller;
+	}
+	level = th->depth;
+	th->depth++;
+	if (level < TOKENIZER_MAX_DEPTH && th->levels[level] == 0) {
+		if (level == 0 && g_tokenizerRootUsed == false) {
+			g_tokenizerRootUsed = true;
+			th->levels[0] = &g_tokenizerRoot;
+		}
+		else {
+			// if out of memory, parent level is shared
+			t = (tokenizer_t*)malloc(sizeof(tokenizer_t));
+			if (t) {
+				t->numArgs = 0;
+				t->expandedMask = 0;
+				t->flags = 0;
+			}
+			th->levels[level] = t;
+		}
+	}
+	Tokenizer_Unlock();
+}
+void Tokenizer_PopContext() {
+	tokenizerThread_t *th;
+	int i;
+
+	Tokenizer_Lock();
+	th = Tokenizer_FindThread(Tokenizer_GetCaller());
+	if (th != 0 && th->depth > 0) {
+		th->depth--;
+		if (th->depth == 0) {
+			for (i = 0; i < TOKENIZER_MAX_DEPTH; i++) {
+				if (th->levels[i] == &g_tokenizerRoot) {
+					g_tokenizerRootUsed = false;
+				}
+				else if (th->levels[i]) {
+					free(th->levels[i]);
+				}
+				th->levels[i] = 0;
+			}
+			th->owner = 0;
+		}
+	}
+	Tokenizer_Unlock();
+}
+tokenizer_t *Tokenizer_GetCurrentContext() {
+	tokenizerThread_t *th;
+	int i;
+
+	// no lock needed, only the owner thread changes its own slot
+	th = Tokenizer_FindThread(Tokenizer_GetCaller());
+	if (th == 0) {
+		return &g_tokenizerRoot;
+	}
+	i = th->depth - 1;
+	if (i >= TOKENIZER_MAX_DEPTH)
+		i = TOKENIZER_MAX_DEPTH - 1;
+	while (i >= 0 && th->levels[i] == 0) {
+		i--;
+	}
+	if (i < 0) {
+		return &g_tokenizerRoot;
+	}
+	return th->levels[i];
+}
 
 int str_to_ip(const char *s, byte *ip) {
 #if PLATFORM_W600 || PLATFORM_LN882H || PLATFORM_REALTEK || PLATFORM_ECR6600 || PLATFORM_TR6260 || PLATFORM_XRADIO
@@ -54,33 +188,36 @@ bool isWhiteSpace(char ch) {
 		return true;
 	return false;
 }
-bool Tokenizer_CheckArgsCountAndPrintWarning(const char *cmdString, int reqCount) {
-	if (g_numArgs >= reqCount)
+bool TokenizerCtx_CheckArgsCountAndPrintWarning(tokenizer_t *t, const char *cmdString, int reqCount) {
+	if (t->numArgs >= reqCount)
 		return false;
-	ADDLOG_ERROR(LOG_FEATURE_CMD, "Cant run '%s', expected at least %i args (given %i)", cmdString, reqCount, g_numArgs);
+	ADDLOG_ERROR(LOG_FEATURE_CMD, "Cant run '%s', expected at least %i args (given %i)", cmdString, reqCount, t->numArgs);
 	return true;
 }
-int Tokenizer_GetArgsCount() {
-	return g_numArgs;
+int TokenizerCtx_GetArgsCount(tokenizer_t *t) {
+	return t->numArgs;
 }
-bool Tokenizer_IsArgInteger(int i) {
-	if(i >= g_numArgs)
+bool TokenizerCtx_IsArgInteger(tokenizer_t *t, int i) {
+	if(i >= t->numArgs)
 		return false;
-	if (*g_args[i] == '$') {
+	if (*t->args[i] == '$') {
 		return true;
 	}
-	return strIsInteger(g_args[i]);
+	return strIsInteger(t->args[i]);
 }
-const char *Tokenizer_GetArgExpanding(int i) {
+const char *TokenizerCtx_GetArgExpanding(tokenizer_t *t, int i) {
 	const char *s;
-	char tokLine[sizeof(g_argsExpanded[i])];
-	char Templine[sizeof(g_argsExpanded[i])];
+	char *expanded;
+	char tokLine[TOKENIZER_MAX_EXPANDED_ARG_LEN];
+	char Templine[TOKENIZER_MAX_EXPANDED_ARG_LEN];
 	char convert[10];
 
-	if (i >= g_numArgs)
+	if (i >= t->numArgs)
 		return 0;
 
-	s = g_args[i];
+	s = t->args[i];
+	expanded = t->expanded.perArg[i];
+	t->expandedMask |= (1u << i);
 
 	//séparators for strtok to detect constants
 	const char * separators = "${}";
@@ -88,7 +225,7 @@ const char *Tokenizer_GetArgExpanding(int i) {
 	char *ptrConst;
 
 	//copy input string before manipulations
-	strcpy_safe(g_argsExpanded[i], s, sizeof(g_argsExpanded[i]));
+	strcpy_safe(expanded, s, TOKENIZER_MAX_EXPANDED_ARG_LEN);
 	strcpy_safe(tokLine, s, sizeof(tokLine));
 
 	//start strtok
@@ -98,18 +235,18 @@ const char *Tokenizer_GetArgExpanding(int i) {
 		char tconst[20] = "${";
 		strcat(tconst, strToken);
 		strcat(tconst, "}");
-		ptrConst = strstr(g_argsExpanded[i], tconst);
+		ptrConst = strstr(expanded, tconst);
 		if (ptrConst == NULL) {
 			// we didn't find ${<token>} so we try with $<token>
 			strcpy(tconst, "$");
 			strcat(tconst, strToken);
-			ptrConst = strstr(g_argsExpanded[i], tconst);
+			ptrConst = strstr(expanded, tconst);
 		}
 		// if we found ${<token>} or $<token> it means we found a constant
 		if (ptrConst != NULL) {
 			//put 0 on the start of the constant to copy the left part of the input string
 			ptrConst[0] = 0;
-			strcpy_safe(Templine, g_argsExpanded[i], sizeof(Templine));
+			strcpy_safe(Templine, expanded, sizeof(Templine));
 			//analyse the constant found to replace it with it's value/string and concat it with the left part of the input string
 			if (!strcmp(tconst, "${IP}") || !strcmp(tconst, "$IP")) {
 				strcat_safe(Templine, HAL_GetMyIPString(), sizeof(Templine));
@@ -131,75 +268,66 @@ const char *Tokenizer_GetArgExpanding(int i) {
 			//concat with the right part, after the constant
 			strcat_safe(Templine, ptrConst + strlen(tconst), sizeof(Templine));
 			//update the input string with the replaced constant
-			strcpy_safe(g_argsExpanded[i], Templine, sizeof(g_argsExpanded[i]));
+			strcpy_safe(expanded, Templine, TOKENIZER_MAX_EXPANDED_ARG_LEN);
 		}
 		//look for next token
 		strToken = strtok(NULL, separators);
 
 	}
 
-	return g_argsExpanded[i];
+	return expanded;
 
 }
-const char *Tokenizer_GetArg(int i) {
+const char *TokenizerCtx_GetArg(tokenizer_t *t, int i) {
 	const char *s;
+	char *expanded;
 
-	if (i >= g_numArgs)
+	if (i >= t->numArgs)
 		return 0;
 
-	if (g_argsExpanded[i][0] != 0) {
-		return g_argsExpanded[i];
+	expanded = t->expanded.perArg[i];
+	if ((t->expandedMask & (1u << i)) && expanded[0] != 0) {
+		return expanded;
 	}
 
-	s = g_args[i];
-
-#if 0
-	if (g_bAllowExpand && s[0] == '$' && s[1] == 'C' && s[2] == 'H') {
-		int channelIndex;
-		int value;
-
-		channelIndex = atoi(s + 3);
-		value = CHANNEL_Get(channelIndex);
-
-		sprintf(g_argsExpanded[i], "%i", value);
+	s = t->args[i];
 
-		return g_argsExpanded[i];
-	}
-#else
-	if (g_bAllowExpand && (tok_flags & TOKENIZER_ALTERNATE_EXPAND_AT_START)) {
-		CMD_ExpandConstantsWithinString(s, g_argsExpanded[i], sizeof(g_argsExpanded[i]));
-		return g_argsExpanded[i];
+	if (g_bAllowExpand && (t->flags & TOKENIZER_ALTERNATE_EXPAND_AT_START)) {
+		t->expandedMask |= (1u << i);
+		CMD_ExpandConstantsWithinString(s, expanded, TOKENIZER_MAX_EXPANDED_ARG_LEN);
+		return expanded;
 	}
 	else if (g_bAllowExpand && s[0] == '$') {
+		t->expandedMask |= (1u << i);
 		// quick hack for str expansion here, may do it in a better way later
 		if (!strcmp(s + 1, "IP")) {
-			strcpy_safe(g_argsExpanded[i], HAL_GetMyIPString(), sizeof(g_argsExpanded[i]));
+			strcpy_safe(expanded, HAL_GetMyIPString(), TOKENIZER_MAX_EXPANDED_ARG_LEN);
 		}
 		else if (!strcmp(s + 1, "ShortName")) {
-			strcpy_safe(g_argsExpanded[i], CFG_GetShortDeviceName(), sizeof(g_argsExpanded[i]));
+			strcpy_safe(expanded, CFG_GetShortDeviceName(), TOKENIZER_MAX_EXPANDED_ARG_LEN);
 		}
 		else if (!strcmp(s + 1, "Name")) {
-			strcpy_safe(g_argsExpanded[i], CFG_GetDeviceName(), sizeof(g_argsExpanded[i]));
+			strcpy_safe(expanded, CFG_GetDeviceName(), TOKENIZER_MAX_EXPANDED_ARG_LEN);
 		}
 		else {
 			float f;
 			int iValue;
 			CMD_ExpandConstant(s, 0, &f);
 			iValue = f;
-			sprintf(g_argsExpanded[i], "%i", iValue);
+			sprintf(expanded, "%i", iValue);
 		}
-		return g_argsExpanded[i];
+		return expanded;
 	}
 
-#endif
-
-	return g_args[i];
+	return t->args[i];
 }
-const char *Tokenizer_GetArgFrom(int i) {
-	return g_argsFrom[i];
+const char *TokenizerCtx_GetArgFrom(tokenizer_t *t, int i) {
+	if (i >= t->numArgs)
+		return 0;
+	return t->argsFrom[i];
 }
-int Tokenizer_GetArgIntegerRange(int i, int rangeMin, int rangeMax) {
-	int ret = Tokenizer_GetArgInteger(i);
+int TokenizerCtx_GetArgIntegerRange(tokenizer_t *t, int i, int rangeMin, int rangeMax) {
+	int ret = TokenizerCtx_GetArgInteger(t, i);
 	if(ret < rangeMin) {
 		ret = rangeMin;
 		ADDLOG_ERROR(LOG_FEATURE_CMD, "Argument %i (val=%i) was out of range [%i,%i], clamped",i,ret,rangeMax,rangeMin);
@@ -210,39 +338,39 @@ int Tokenizer_GetArgIntegerRange(int i, int rangeMin, int rangeMax) {
 	}
 	return ret;
 }
-int Tokenizer_GetPin(int i, int def) {
-	int r;
-
-	if (g_numArgs <= i) {
+int TokenizerCtx_GetPin(tokenizer_t *t, int i, int def) {
+	if (t->numArgs <= i) {
 		return def;
 	}
-	return HAL_PIN_Find(g_args[i]);
+	return HAL_PIN_Find(t->args[i]);
 }
-int Tokenizer_GetArgIntegerDefault(int i, int def) {
+int TokenizerCtx_GetArgIntegerDefault(tokenizer_t *t, int i, int def) {
 	int r;
 
-	if (g_numArgs <= i) {
+	if (t->numArgs <= i) {
 		return def;
 	}
-	r = Tokenizer_GetArgInteger(i);
+	r = TokenizerCtx_GetArgInteger(t, i);
 
 	return r;
 }
-float Tokenizer_GetArgFloatDefault(int i, float def) {
+float TokenizerCtx_GetArgFloatDefault(tokenizer_t *t, int i, float def) {
 	float r;
 
-	if (g_numArgs <= i) {
+	if (t->numArgs <= i) {
 		return def;
 	}
-	r = Tokenizer_GetArgFloat(i);
+	r = TokenizerCtx_GetArgFloat(t, i);
 
 	return r;
 }
-int Tokenizer_GetArgInteger(int i) {
+int TokenizerCtx_GetArgInteger(tokenizer_t *t, int i) {
 	const char *s;
 	int ret;
 
-	s = g_args[i];
+	if (i >= t->numArgs)
+		return 0;
+	s = t->args[i];
 	if (s == 0)
 		return 0;
 	if(s[0] == '0' && s[1] == 'x') {
@@ -271,12 +399,15 @@ int Tokenizer_GetArgInteger(int i) {
 #endif
 	return atoi(s);
 }
-float Tokenizer_GetArgFloat(int i) {
+float TokenizerCtx_GetArgFloat(tokenizer_t *t, int i) {
 #if !ENABLE_EXPAND_CONSTANT
 	int channelIndex;
 #endif
 	const char *s;
-	s = g_args[i];
+
+	if (i >= t->numArgs)
+		return 0;
+	s = t->args[i];
 #if !ENABLE_EXPAND_CONSTANT
 	if(g_bAllowExpand && s[0] == '$') {
 		// constant
@@ -297,6 +428,44 @@ float Tokenizer_GetArgFloat(int i) {
 #endif
 	return atof(s);
 }
+
+// legacy API, works on the context of current command nesting level
+bool Tokenizer_CheckArgsCountAndPrintWarning(const char *cmdString, int reqCount) {
+	return TokenizerCtx_CheckArgsCountAndPrintWarning(Tokenizer_GetCurrentContext(), cmdString, reqCount);
+}
+int Tokenizer_GetArgsCount() {
+	return Tokenizer_GetCurrentContext()->numArgs;
+}
+bool Tokenizer_IsArgInteger(int i) {
+	return TokenizerCtx_IsArgInteger(Tokenizer_GetCurrentContext(), i);
+}
+const char *Tokenizer_GetArgExpanding(int i) {
+	return TokenizerCtx_GetArgExpanding(Tokenizer_GetCurrentContext(), i);
+}
+const char *Tokenizer_GetArg(int i) {
+	return TokenizerCtx_GetArg(Tokenizer_GetCurrentContext(), i);
+}
+const char *Tokenizer_GetArgFrom(int i) {
+	return TokenizerCtx_GetArgFrom(Tokenizer_GetCurrentContext(), i);
+}
+int Tokenizer_GetArgIntegerRange(int i, int rangeMin, int rangeMax) {
+	return TokenizerCtx_GetArgIntegerRange(Tokenizer_GetCurrentContext(), i, rangeMin, rangeMax);
+}
+int Tokenizer_GetPin(int i, int def) {
+	return TokenizerCtx_GetPin(Tokenizer_GetCurrentContext(), i, def);
+}
+int Tokenizer_GetArgIntegerDefault(int i, int def) {
+	return TokenizerCtx_GetArgIntegerDefault(Tokenizer_GetCurrentContext(), i, def);
+}
+float Tokenizer_GetArgFloatDefault(int i, float def) {
+	return TokenizerCtx_GetArgFloatDefault(Tokenizer_GetCurrentContext(), i, def);
+}
+int Tokenizer_GetArgInteger(int i) {
+	return TokenizerCtx_GetArgInteger(Tokenizer_GetCurrentContext(), i);
+}
+float Tokenizer_GetArgFloat(int i) {
+	return TokenizerCtx_GetArgFloat(Tokenizer_GetCurrentContext(), i);
+}
 void expandQuotes(char* str) {
 	size_t len = strlen(str);
 	size_t readIndex = 0;
@@ -317,11 +486,12 @@ void expandQuotes(char* str) {
 	str[writeIndex] = 0;
 }
 
-void Tokenizer_TokenizeString(const char *s, int flags) {
+void TokenizerCtx_TokenizeString(tokenizer_t *t, const char *s, int flags) {
 	char *p;
 
-	tok_flags = flags;
-	g_numArgs = 0;
+	t->flags = flags;
+	t->numArgs = 0;
+	t->expandedMask = 0;
 
 	if(s == 0) {
 		return;
@@ -335,35 +505,34 @@ void Tokenizer_TokenizeString(const char *s, int flags) {
 		return;
 	}
 
-	// not really needed, but nice for testing
-	memset(g_args, 0, sizeof(g_args)); // backing buffer is g_buffer, which is mutated where spaces on arg boundaries are set to null char
-	memset(g_argsFrom, 0, sizeof(g_argsFrom)); // backing buffer is s, original unmutated string
-	memset(g_argsExpanded, 0, sizeof(g_argsExpanded));
-
+	// args backing buffer is t->buffer, which is mutated where spaces on arg boundaries are set to null char,
+	// argsFrom backing buffer is s, original unmutated string.
+	// Nothing is cleared here, only entries below numArgs and expansions marked in expandedMask are valid
 	if (flags & TOKENIZER_EXPAND_EARLY) {
-		CMD_ExpandConstantsWithinString(s, g_buffer, sizeof(g_buffer) - 1);
+		CMD_ExpandConstantsWithinString(s, t->buffer, sizeof(t->buffer) - 1);
 	}
 	else {
-		strcpy_safe(g_buffer, s, sizeof(g_buffer));
+		strcpy_safe(t->buffer, s, sizeof(t->buffer));
 	}
 
 	if (flags & TOKENIZER_FORCE_SINGLE_ARGUMENT_MODE) {
-		g_args[g_numArgs] = g_buffer;
-		g_argsFrom[g_numArgs] = g_buffer;
-		// some hack, but we fored to have only have one arg, so we can extend the string over array bondaries.
-		// probably better: introducing an union containing g_argsExpanded[][] and one sole string in the same memory area ...
-		CMD_ExpandConstantsWithinString(g_buffer,g_argsExpanded,sizeof(g_argsExpanded)-1);
-		g_numArgs = 1;
+		t->args[t->numArgs] = t->buffer;
+		t->argsFrom[t->numArgs] = t->buffer;
+		// we are forced to have only one arg, so expansion can use the whole per-arg area
+		t->expanded.single[0] = 0;
+		CMD_ExpandConstantsWithinString(t->buffer, t->expanded.single, sizeof(t->expanded.single)-1);
+		t->expandedMask = 1;
+		t->numArgs = 1;
 		return;
 	}
-	p = g_buffer;
+	p = t->buffer;
 	// we need to rewrite this function and check it well with unit tests
 	if (*p == '"') {
 		goto quote;
 	}
-	g_args[g_numArgs] = p;
-	g_argsFrom[g_numArgs] = (s+(p-g_buffer));
-	g_numArgs++;
+	t->args[t->numArgs] = p;
+	t->argsFrom[t->numArgs] = (s+(p-t->buffer));
+	t->numArgs++;
 	while(*p != 0) {
 		if(isWhiteSpace(*p)) {
 			*p = 0;
@@ -373,24 +542,24 @@ void Tokenizer_TokenizeString(const char *s, int flags) {
 					p++;
 					goto quote;
 				}
-				g_args[g_numArgs] = p+1;
-				g_argsFrom[g_numArgs] = (s+((p+1)-g_buffer));
-				g_numArgs++;
+				t->args[t->numArgs] = p+1;
+				t->argsFrom[t->numArgs] = (s+((p+1)-t->buffer));
+				t->numArgs++;
 			}
 		}
 		//if(*p == ',') {
 		//	*p = 0;
-		//	g_args[g_numArgs] = p+1;
-		//	g_argsFrom[g_numArgs] = (s+((p+1)-g_buffer));
-		//	g_numArgs++;
+		//	t->args[t->numArgs] = p+1;
+		//	t->argsFrom[t->numArgs] = (s+((p+1)-t->buffer));
+		//	t->numArgs++;
 		//}
-		if(g_bAllowQuotes && *p == '"' && ((p <= g_buffer) || isWhiteSpace(p[-1]))) {
+		if(g_bAllowQuotes && *p == '"' && ((p <= t->buffer) || isWhiteSpace(p[-1]))) {
 quote:
 			*p = 0;
-			g_argsFrom[g_numArgs] = (s+((p+1)-g_buffer));
+			t->argsFrom[t->numArgs] = (s+((p+1)-t->buffer));
 			p++;
-			g_args[g_numArgs] = p;
-			g_numArgs++;
+			t->args[t->numArgs] = p;
+			t->numArgs++;
 			while(*p != 0) {
 				if (flags & TOKENIZER_ALLOW_ESCAPING_QUOTATIONS) {
 					if (*p == '"' && p[-1] != '\\') {
@@ -407,10 +576,10 @@ quote:
 				p++;
 			}
 			if (flags & TOKENIZER_ALLOW_ESCAPING_QUOTATIONS) {
-				expandQuotes(g_args[g_numArgs - 1]);
+				expandQuotes(t->args[t->numArgs - 1]);
 			}
 		}
-		if(g_numArgs>=MAX_ARGS) {
+		if(t->numArgs>=TOKENIZER_MAX_ARGS) {
 			ADDLOG_ERROR(LOG_FEATURE_CMD, "Too many args, skipped all after 32nd.");
 			break;
 		}
@@ -419,3 +588,6 @@ quote:
 
 
 }
+void Tokenizer_TokenizeString(const char *s, int flags) {
+	TokenizerCtx_TokenizeString(Tokenizer_GetCurrentContext(), s, flags);
+}
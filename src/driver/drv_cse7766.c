@@ -197,7 +197,7 @@ int CSE7766_TryToGetNextCSE7766Packet() {
 		char res[128];
 		// V=245.107925,I=109.921143,P=0.035618
 		snprintf(res, sizeof(res), "V=%f,I=%f,P=%f\n",lastReadings[OBK_VOLTAGE],lastReadings[OBK_CURRENT],lastReadings[OBK_POWER]);
-		addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER,res );
+		addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "%s", res);
 	}
 #endif
 
@@ -787,12 +787,12 @@ extern "C" void DRV_IR_Init() {
 void dump(decode_results *results) {
 	// Dumps out the decode_results structure.
 	// Call this after IRrecv::decode()
-	ADDLOG_INFO(LOG_FEATURE_IR, resultToHumanReadableBasic(results).c_str());
+	ADDLOG_INFO(LOG_FEATURE_IR, "%s", resultToHumanReadableBasic(results).c_str());
 
 	#ifdef ENABLE_IRAC
 	if (hasACState(results->decode_type))
 	{
-		ADDLOG_INFO(LOG_FEATURE_IR, IRAcUtils::resultAcToString(results).c_str());
+		ADDLOG_INFO(LOG_FEATURE_IR, "%s", IRAcUtils::resultAcToString(results).c_str());
 	}
 	#endif
 }
@@ -851,14 +851,14 @@ extern "C" void DRV_IR_RunFrame() {
 				if (results.decode_type == decode_type_t::UNKNOWN) {
 					//snprintf(out, sizeof(out), "IR_RAW 0x%lX %d", (unsigned long)results.decodedRawData, repeat);
 					snprintf(out, sizeof(out), "IR %s %s", "Unknown", lastIrReceived.c_str());
-					ADDLOG_INFO(LOG_FEATURE_IR, (char *)out);
+					ADDLOG_INFO(LOG_FEATURE_IR, "%s", (char *)out);
 				}
 				else if (!hasACState(results.decode_type)) {
 					snprintf(out, sizeof(out), "IR %s %lX %lX %d", proto_name.c_str(), (long int)results.address, (long int)results.command, repeat);
-					ADDLOG_INFO(LOG_FEATURE_IR, (char *)out);
+					ADDLOG_INFO(LOG_FEATURE_IR, "%s", (char *)out);
 					// show new format too
 					snprintf(out, sizeof(out), "IR %s,%d,%s", proto_name.c_str(), (int)results.bits, resultToHexidecimal(&results).c_str());
-					ADDLOG_INFO(LOG_FEATURE_IR, (char *)out);
+					ADDLOG_INFO(LOG_FEATURE_IR, "%s", (char *)out);
 				} else {
 					#ifdef ENABLE_IRAC
 					String description = IRAcUtils::resultAcToString(&results);
@@ -880,7 +880,7 @@ extern "C" void DRV_IR_RunFrame() {
 						ADDLOG_INFO(LOG_FEATURE_IR, (char *)"IR MQTT publish %s took %dms", out, counter_dur);
 					}
 					else {
-						ADDLOG_INFO(LOG_FEATURE_IR, (char *)out);
+						ADDLOG_INFO(LOG_FEATURE_IR, "%s", (char *)out);
 					}
 				}
 
@@ -27,6 +27,7 @@ int NTP_PrintEventList();
 int NTP_GetEventTime(int id);
 int NTP_RemoveClockEvent(int id);
 int NTP_ClearEvents();
+unsigned int NTP_GetNextEventTime();
 #if ENABLE_NTP_DST
 int Time_IsDST();
 // usually we want to set/correct g_ntpTime inside setDST()	--> call setDST(1)
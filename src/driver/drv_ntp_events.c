@@ -30,10 +30,23 @@ typedef struct ntpEvent_s {
 #endif
 	int id;
 	char *command;
+	// next time (on ntp_eventsTime clock) when this event is due, if bScheduled
+	time_t nextTime;
+	byte bScheduled;
+	// events added later run first within the same second
+	unsigned int seq;
 	struct ntpEvent_s *next;
 } ntpEvent_t;
 
+// Events are kept sorted by their precomputed next occurrence, so checking a second
+// only looks at the list head and catching up after a time jump is a range walk.
+// Events that can never fire (bad time or no weekday) are kept unscheduled at the end.
 ntpEvent_t *ntp_events = 0;
+static unsigned int ntp_eventsSeq = 0;
+// event whose command is running, it's out of the list meanwhile
+static ntpEvent_t *ntp_firingEvent = 0;
+static time_t ntp_firingTime = 0;
+static bool ntp_firingEventRemoved = false;
 
 #if ENABLE_NTP_SUNRISE_SUNSET
 /* Sunrise/sunset algorithm, somewhat based on https://edwilliams.org/sunrise_sunset_algorithm.htm and tasmota code */
@@ -166,50 +179,124 @@ void NTP_CalculateSunset(byte *outHour, byte *outMinute) {
 }
 #endif
 
-void NTP_RunEventsForSecond(time_t runTime) {
-	ntpEvent_t *e;
+// finds first time >= from at which event matches its hour, minute, second and weekday
+static void NTP_ScheduleEvent(ntpEvent_t *e, time_t from) {
 	struct tm *ltm;
+	time_t dayStart, when;
+	int wday, d;
 
+	e->bScheduled = 0;
+	if (from == 0) {
+		return;
+	}
+	if (e->hour > 23 || e->minute > 59 || e->second > 59) {
+		return;
+	}
 	// NOTE: on windows, you need _USE_32BIT_TIME_T 
-	ltm = gmtime(&runTime);
-	
+	ltm = gmtime(&from);
 	if (ltm == 0) {
 		return;
 	}
+	wday = ltm->tm_wday;
+	dayStart = from - (ltm->tm_hour * 3600 + ltm->tm_min * 60 + ltm->tm_sec);
+	// today, the next six days, and same weekday next week
+	for (d = 0; d < 8; d++) {
+		when = dayStart + d * 86400 + e->hour * 3600 + e->minute * 60 + e->second;
+		if (when >= from && BIT_CHECK(e->weekDayFlags, (wday + d) % 7)) {
+			e->nextTime = when;
+			e->bScheduled = 1;
+			return;
+		}
+	}
+}
+static bool NTP_IsEventBefore(ntpEvent_t *a, ntpEvent_t *b) {
+	if (a->bScheduled == 0)
+		return false;
+	if (b->bScheduled == 0)
+		return true;
+	if (a->nextTime != b->nextTime)
+		return a->nextTime < b->nextTime;
+	return a->seq > b->seq;
+}
+static void NTP_InsertEvent(ntpEvent_t *e) {
+	ntpEvent_t **p;
 
-	e = ntp_events;
+	p = &ntp_events;
+	while (*p && NTP_IsEventBefore(*p, e)) {
+		p = &(*p)->next;
+	}
+	e->next = *p;
+	*p = e;
+}
+// recalculates whole queue, used when time was set or went backwards
+static void NTP_RescheduleAllEvents(time_t from) {
+	ntpEvent_t *e, *list;
 
-	while (e) {
-		if (e->command) {
-			// base check
-			if (e->hour == ltm->tm_hour && e->second == ltm->tm_sec && e->minute == ltm->tm_min) {
-				// weekday check
-				if (BIT_CHECK(e->weekDayFlags, ltm->tm_wday)) {
+	list = ntp_events;
+	ntp_events = 0;
+	while (list) {
+		e = list;
+		list = list->next;
+		NTP_ScheduleEvent(e, from);
+		NTP_InsertEvent(e);
+	}
+}
+static void NTP_RunEvent(ntpEvent_t *e, time_t runTime) {
 #if ENABLE_NTP_SUNRISE_SUNSET
-					if (e->sunflags & (SUNRISE_FLAG || SUNSET_FLAG)) {
-						if (e->lastDay != ltm->tm_wday) {
-							e->lastDay = ltm->tm_wday;  /* stop any further sun events today */
-							dusk2Dawn(&sun_data, e->sunflags, &e->hour, &e->minute,
-								calc_day_offset(ltm->tm_wday + 1, e->weekDayFlags));  /* setup for tomorrow */
-							CMD_ExecuteCommand(e->command, 0);
-							}
-						else {
-							e->lastDay = -1;  /* mark with anything but a valid day of week */
-							}
-						}
-					else
+	struct tm *ltm;
+
+	// NOTE: on windows, you need _USE_32BIT_TIME_T 
+	ltm = gmtime(&runTime);
+	if (ltm == 0) {
+		return;
+	}
+	if (e->sunflags & (SUNRISE_FLAG || SUNSET_FLAG)) {
+		if (e->lastDay != ltm->tm_wday) {
+			e->lastDay = ltm->tm_wday;  /* stop any further sun events today */
+			dusk2Dawn(&sun_data, e->sunflags, &e->hour, &e->minute,
+				calc_day_offset(ltm->tm_wday + 1, e->weekDayFlags));  /* setup for tomorrow */
+			CMD_ExecuteCommand(e->command, 0);
+			}
+		else {
+			e->lastDay = -1;  /* mark with anything but a valid day of week */
+			}
+		return;
+		}
 #endif
-					CMD_ExecuteCommand(e->command, 0);
-				}
+	CMD_ExecuteCommand(e->command, 0);
+}
+// runs events due before given time, in time order; queue never holds
+// times earlier than ntp_eventsTime
+static void NTP_RunEventsUntil(time_t to) {
+	ntpEvent_t *e;
+
+	while (ntp_events && ntp_events->bScheduled && ntp_events->nextTime < to) {
+		e = ntp_events;
+		ntp_events = e->next;
+		e->next = 0;
+
+		ntp_firingTime = e->nextTime;
+		if (e->command) {
+			ntp_firingEvent = e;
+			ntp_firingEventRemoved = false;
+			NTP_RunEvent(e, e->nextTime);
+			ntp_firingEvent = 0;
+			if (ntp_firingEventRemoved) {
+				free(e->command);
+				free(e);
+				continue;
 			}
 		}
-		e = e->next;
+		// sunrise events may have moved, so always search from the next second
+		NTP_ScheduleEvent(e, ntp_firingTime + 1);
+		NTP_InsertEvent(e);
 	}
+	ntp_firingTime = 0;
 }
 
 void NTP_RunEvents(unsigned int newTime, bool bTimeValid) {
 	unsigned int delta;
-	unsigned int i;
+	ntpEvent_t *e;
 
 	// new time invalid?
 	if (bTimeValid == false) {
@@ -219,11 +306,13 @@ void NTP_RunEvents(unsigned int newTime, bool bTimeValid) {
 	// old time invalid, but new one ok?
 	if (ntp_eventsTime == 0) {
 		ntp_eventsTime = (time_t)newTime;
+		NTP_RescheduleAllEvents(ntp_eventsTime);
 		return;
 	}
 	// time went backwards
 	if (newTime < ntp_eventsTime) {
 		ntp_eventsTime = (time_t)newTime;
+		NTP_RescheduleAllEvents(ntp_eventsTime);
 		return;
 	}
 	if (ntp_events) {
@@ -232,12 +321,24 @@ void NTP_RunEvents(unsigned int newTime, bool bTimeValid) {
 		// a large shift in time is not expected, so limit to a constant number of seconds
 		if (delta > 100)
 			delta = 100;
-		for (i = 0; i < delta; i++) {
-			NTP_RunEventsForSecond(ntp_eventsTime + i);
+		NTP_RunEventsUntil(ntp_eventsTime + delta);
+		// seconds past the limit are skipped, move events due in them to their next time
+		while (ntp_events && ntp_events->bScheduled && ntp_events->nextTime < (time_t)newTime) {
+			e = ntp_events;
+			ntp_events = e->next;
+			NTP_ScheduleEvent(e, (time_t)newTime);
+			NTP_InsertEvent(e);
 		}
 	}
 	ntp_eventsTime = (time_t)newTime;
 }
+// Returns time (on ntp_eventsTime clock) of the next clock event, or 0 if none is scheduled
+unsigned int NTP_GetNextEventTime() {
+	if (ntp_events && ntp_events->bScheduled) {
+		return (unsigned int)ntp_events->nextTime;
+	}
+	return 0;
+}
 
 #if ENABLE_NTP_SUNRISE_SUNSET
 void NTP_AddClockEvent(int hour, int minute, int second, int weekDayFlags, int id, int sunflags, const char* command) {
@@ -260,9 +361,15 @@ void NTP_AddClockEvent(int hour, int minute, int second, int weekDayFlags, int i
 #endif
 	newEvent->id = id;
 	newEvent->command = strdup(command);
-	newEvent->next = ntp_events;
-
-	ntp_events = newEvent;
+	newEvent->seq = ++ntp_eventsSeq;
+	// event added by a running event is checked from the next second on
+	if (ntp_firingTime) {
+		NTP_ScheduleEvent(newEvent, ntp_firingTime + 1);
+	}
+	else {
+		NTP_ScheduleEvent(newEvent, ntp_eventsTime);
+	}
+	NTP_InsertEvent(newEvent);
 }
 int NTP_RemoveClockEvent(int id) {
 	int ret = 0;
@@ -292,6 +399,10 @@ int NTP_RemoveClockEvent(int id) {
 			curr = curr->next;
 		}
 	}
+	if (ntp_firingEvent && ntp_firingEvent->id == id && !ntp_firingEventRemoved) {
+		ntp_firingEventRemoved = true;
+		ret++;
+	}
 	return ret;
 }
 // addClockEvent [Time] [WeekDayFlags] [UniqueIDForRemoval]
@@ -469,6 +580,10 @@ int NTP_ClearEvents() {
 		free(p);
 	}
 	ntp_events = 0;
+	if (ntp_firingEvent && !ntp_firingEventRemoved) {
+		ntp_firingEventRemoved = true;
+		t++;
+	}
 	addLogAdv(LOG_INFO, LOG_FEATURE_CMD, "Removed %i events", t);
 	return t;
 }
@@ -129,7 +129,7 @@ static void sendQueryThreadInternal() {
 	if (recv_size > 0) {
 		buffer[recv_size] = '\0';
 		Weather_SetReply(buffer);
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, buffer);
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "%s", buffer);
 	}
 
 	HAL_TCP_Destroy(s);
@@ -174,7 +174,7 @@ static void sendQueryThreadInternal() {
 	if (recv_size > 0) {
 		buffer[recv_size] = '\0';
 		Weather_SetReply(buffer);
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, buffer);
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "%s", buffer);
 	}
 
 	//HAL_TCP_Destroy(s);
@@ -231,7 +231,7 @@ static commandResult_t CMD_OWM_Setup(const void *context, const char *cmd, const
 		"Connection: close\r\n\r\n",
 		lat, lng, key);
 
-	ADDLOG_ERROR(LOG_FEATURE_HTTP, g_request);
+	ADDLOG_ERROR(LOG_FEATURE_HTTP, "%s", g_request);
 
 	return CMD_RES_OK;
 }
@@ -541,7 +541,7 @@ void DRV_SSDP_RunQuickTick() {
 				|| strcasestr(udp_msgbuf, "ssdpsearch:all")
 				|| strcasestr(udp_msgbuf, "ssdp:all")) {
 				addLogAdv(LOG_ALL, LOG_FEATURE_HTTP, "SSDP has received HUE PACKET");
-				addLogAdv(LOG_ALL, LOG_FEATURE_HTTP, udp_msgbuf);
+				addLogAdv(LOG_ALL, LOG_FEATURE_HTTP, "%s", udp_msgbuf);
 				DRV_HUE_Send_Advert_To(&addr);
 				return;
 			}
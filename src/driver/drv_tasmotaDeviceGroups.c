@@ -351,6 +351,8 @@ void DRV_DGR_processPower(int relayStates, byte relaysCount) {
 		} else {
 			startIndex = 1;
 		}
+		// single publish/flash save pass for all relays
+		CHANNEL_BeginBatch();
 		for(i = 0; i < relaysCount; i++) {
 			int bOn;
 			bOn = BIT_CHECK(relayStates,i);
@@ -365,6 +367,7 @@ void DRV_DGR_processPower(int relayStates, byte relaysCount) {
 				CHANNEL_Set(ch,0,0);
 			}
 		}
+		CHANNEL_CommitBatch();
 	}
 }
 #if ENABLE_LED_BASIC
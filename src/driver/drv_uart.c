@@ -266,7 +266,7 @@ int UART_InitUART(int baud, int parity, bool hwflowc) {
 
 void UART_LogBufState(int auartindex) {
   uartbuf_t* fuartbuf = UART_GetBufFromPort(auartindex);
-  ADDLOG_WARN(LOG_INFO,
+  ADDLOG_WARN(LOG_FEATURE_DRV,
     "Uart ix %d inbuf %i inptr %i outptr %i \n",
     auartindex, UART_GetDataSizeEx(auartindex), fuartbuf->g_recvBufIn, fuartbuf->g_recvBufOut
   );
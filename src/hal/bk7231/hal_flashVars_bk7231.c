@@ -517,6 +517,26 @@ void HAL_FlashVars_IncreaseBootCount() {
 		data.boot_count - data.boot_success_count);
 #endif
 }
+void HAL_FlashVars_SaveChannels(const int* indices, const int* values, int count) {
+#ifndef DISABLE_FLASH_VARS_VARS
+	int i;
+	int changed = 0;
+
+	flash_vars_init();
+	for (i = 0; i < count; i++) {
+		if (indices[i] < 0 || indices[i] >= MAX_RETAIN_CHANNELS) {
+			ADDLOG_INFO(LOG_FEATURE_CFG, "####### Flash Save Can't Save Channel %d as %d (not enough space in array) #######", indices[i], values[i]);
+			continue;
+		}
+		flash_vars.savedValues[indices[i]] = values[i];
+		changed++;
+	}
+	if (changed == 0)
+		return;
+	ADDLOG_INFO(LOG_FEATURE_CFG, "####### Flash Save %d Channels #######", changed);
+	flash_vars_write();
+#endif
+}
 void HAL_FlashVars_SaveChannel(int index, int value) {
 #ifndef DISABLE_FLASH_VARS_VARS
 	FLASH_VARS_STRUCTURE data;
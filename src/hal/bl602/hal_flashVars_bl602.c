@@ -92,6 +92,18 @@ void HAL_FlashVars_SaveChannel(int index, int value) {
 	// save after increase
 	BL602_SaveFlashVars(&g_bootCounts,sizeof(g_bootCounts));
 }
+void HAL_FlashVars_SaveChannels(const int* indices, const int* values, int count) {
+	int i;
+	if(g_loaded==0) {
+		BL602_ReadFlashVars(&g_bootCounts,sizeof(g_bootCounts));
+	}
+	for(i = 0; i < count; i++) {
+		if(indices[i]<0||indices[i]>=BL602_SAVED_CHANNELS_MAX)
+			continue;
+		g_bootCounts.channelStates[indices[i]] = values[i];
+	}
+	BL602_SaveFlashVars(&g_bootCounts,sizeof(g_bootCounts));
+}
 void HAL_FlashVars_SaveLED(byte mode, short brightness, short temperature, byte r, byte g, byte b, byte bEnableAll) {
 
 }
@@ -46,6 +46,22 @@ void HAL_FlashVars_SaveChannel(int index, int value)
 	nvs_close(handle);
 }
 
+void HAL_FlashVars_SaveChannels(const int* indices, const int* values, int count)
+{
+	char channel[4];
+	int i;
+	InitFlashIfNeeded();
+	nvs_handle_t handle = 0;
+	nvs_open("config", NVS_READWRITE, &handle);
+	for(i = 0; i < count; i++)
+	{
+		sprintf(channel, "ch%i", indices[i]);
+		nvs_set_i16(handle, channel, values[i]);
+	}
+	nvs_commit(handle);
+	nvs_close(handle);
+}
+
 void HAL_FlashVars_ReadLED(byte* mode, short* brightness, short* temperature, byte* rgb, byte* bEnableAll)
 {
 	InitFlashIfNeeded();
@@ -13,6 +13,14 @@ void __attribute__((weak)) HAL_FlashVars_SaveChannel(int index, int value)
 
 }
 
+void __attribute__((weak)) HAL_FlashVars_SaveChannels(const int* indices, const int* values, int count)
+{
+	int i;
+	for (i = 0; i < count; i++) {
+		HAL_FlashVars_SaveChannel(indices[i], values[i]);
+	}
+}
+
 void __attribute__((weak)) HAL_FlashVars_ReadLED(byte* mode, short* brightness, short* temperature, byte* rgb, byte* bEnableAll)
 {
 
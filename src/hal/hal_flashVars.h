@@ -53,6 +53,8 @@ void HAL_FlashVars_SaveBootComplete();
 int HAL_FlashVars_GetBootFailures();
 int HAL_FlashVars_GetBootCount();
 void HAL_FlashVars_SaveChannel(int index, int value);
+// saves several channels with a single flash write
+void HAL_FlashVars_SaveChannels(const int* indices, const int* values, int count);
 void HAL_FlashVars_SaveLED(byte mode, short brightness, short temperature, byte r, byte g, byte b, byte bEnableAll);
 void HAL_FlashVars_ReadLED(byte* mode, short* brightness, short* temperature, byte* rgb, byte* bEnableAll);
 int HAL_FlashVars_GetChannelValue(int ch);
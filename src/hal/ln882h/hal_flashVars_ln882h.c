@@ -80,6 +80,21 @@ void HAL_FlashVars_SaveChannel(int index, int value) {
 	}
 #endif
 
+}
+void HAL_FlashVars_SaveChannels(const int* indices, const int* values, int count) {
+#ifndef DISABLE_FLASH_VARS_VARS
+	int i;
+	if (flash_vars_init()) {
+		for (i = 0; i < count; i++) {
+			if (indices[i] < 0 || indices[i] >= MAX_RETAIN_CHANNELS) {
+				LOG(LOG_LVL_ERROR, "####### Flash Save Can't Save Channel %d as %d (not enough space in array) #######", indices[i], values[i]);
+				continue;
+			}
+			flash_vars.savedValues[indices[i]] = values[i];
+		}
+		flash_vars_store();
+	}
+#endif
 }
 void HAL_FlashVars_ReadLED(byte* mode, short* brightness, short* temperature, byte* rgb, byte* bEnableAll) {
 #ifndef DISABLE_FLASH_VARS_VARS
@@ -70,6 +70,22 @@ void HAL_FlashVars_SaveChannel(int index, int value)
 	SaveFlashVars(&flash_vars, sizeof(flash_vars));
 }
 
+void HAL_FlashVars_SaveChannels(const int* indices, const int* values, int count)
+{
+	int i;
+	if(g_loaded == 0)
+	{
+		ReadFlashVars(&flash_vars, sizeof(flash_vars));
+	}
+	for(i = 0; i < count; i++)
+	{
+		if(indices[i] < 0 || indices[i] >= MAX_RETAIN_CHANNELS)
+			continue;
+		flash_vars.savedValues[indices[i]] = values[i];
+	}
+	SaveFlashVars(&flash_vars, sizeof(flash_vars));
+}
+
 void HAL_FlashVars_ReadLED(byte* mode, short* brightness, short* temperature, byte* rgb, byte* bEnableAll)
 {
 	if(g_loaded == 0)
@@ -98,6 +98,17 @@ void HAL_FlashVars_SaveChannel(int index, int value) {
 	flash_vars.savedValues[index] = value;
 	write_flash_boot_content();
 }
+void HAL_FlashVars_SaveChannels(const int* indices, const int* values, int count) {
+	int i;
+	for (i = 0; i < count; i++) {
+		if (indices[i] < 0 || indices[i] >= MAX_RETAIN_CHANNELS) {
+			ADDLOG_INFO(LOG_FEATURE_CFG, "####### Flash Save Can't Save Channel %d as %d (not enough space in array) #######", indices[i], values[i]);
+			continue;
+		}
+		flash_vars.savedValues[indices[i]] = values[i];
+	}
+	write_flash_boot_content();
+}
 
 // call once started (>30s?)
 void HAL_FlashVars_SaveBootComplete() {
@@ -19,6 +19,13 @@ void HAL_FlashVars_IncreaseBootCount(){
 }
 void HAL_FlashVars_SaveChannel(int index, int value) {
 
+}
+void HAL_FlashVars_SaveChannels(const int* indices, const int* values, int count) {
+	int i;
+
+	for (i = 0; i < count; i++) {
+		HAL_FlashVars_SaveChannel(indices[i], values[i]);
+	}
 }
 int HAL_FlashVars_GetChannelValue(int ch) {
 	return 0;
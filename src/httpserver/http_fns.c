@@ -2919,8 +2919,8 @@ const char* g_obk_flagNames[] = {
 	"[HTTP] Hide ON/OFF for relays (only red/green buttons)",
 	"[MQTT] Never add get sufix",
 	"[WiFi] (RTL/BK) Enhanced fast connect by saving AP data to flash (preferable with Flag 37 & static ip). Quick reset 3 times to connect normally",
-	"error",
-	"error",
+	"[MQTT] Publish channel changes together as JSON in [client]/state, in addition to [client]/[ch]/get",
+	"[MQTT] With flag 52, don't publish [client]/[ch]/get on change (Home Assistant discovery entities use these topics, channel topics still reply to get)",
 	"error",
 }; 
 
@@ -9,6 +9,7 @@
 #include "../hal/hal_wifi.h"
 #include "../hal/hal_flashVars.h"
 #include "../littlefs/our_lfs.h"
+#include "../mqtt/new_mqtt.h"
 #include "lwip/sockets.h"
 
 #define DEFAULT_FLASH_LEN 0x200000
@@ -142,6 +143,7 @@ static int http_rest_get_seriallog(http_request_t* request);
 
 static int http_rest_post_logconfig(http_request_t* request);
 static int http_rest_get_logconfig(http_request_t* request);
+static int http_rest_get_logsites(http_request_t* request);
 
 #if ENABLE_LITTLEFS
 static int http_rest_get_lfs_delete(http_request_t* request);
@@ -210,6 +212,9 @@ static int http_rest_get(http_request_t* request) {
 	if (!strcmp(request->url, "api/logconfig")) {
 		return http_rest_get_logconfig(request);
 	}
+	if (!strcmp(request->url, "api/logsites")) {
+		return http_rest_get_logsites(request);
+	}
 
 	if (!strncmp(request->url, "api/seriallog", 13)) {
 		return http_rest_get_seriallog(request);
@@ -987,6 +992,34 @@ static int http_rest_get_logconfig(http_request_t* request) {
 	return 0;
 }
 
+// log call sites, the ones that were rate limited the most first
+static int http_rest_get_logsites(http_request_t* request) {
+	logSiteInfo_t* sites;
+	int i, count, limit, burst, untracked;
+
+	sites = os_malloc(sizeof(logSiteInfo_t) * LOG_MAX_SITES);
+	if (sites == 0) {
+		return http_rest_error(request, 500, "Out of memory");
+	}
+	LOG_GetRateLimitStats(&limit, &burst, &untracked);
+	count = LOG_GetNoisySites(sites, LOG_MAX_SITES);
+	http_setup(request, httpMimeTypeJson);
+	hprintf255(request, "{\"rate\":%d,\"burst\":%d,\"untracked\":%d,\"sites\":[", limit, burst, untracked);
+	for (i = 0; i < count; i++) {
+		if (i) {
+			poststr(request, ",");
+		}
+		poststr(request, "{\"text\":\"");
+		poststr_escapedForJSON(request, sites[i].text);
+		hprintf255(request, "\",\"feature\":%d,\"count\":%u,\"suppressed\":%u}",
+			sites[i].feature, sites[i].count, sites[i].suppressed);
+	}
+	poststr(request, "]}");
+	poststr(request, NULL);
+	os_free(sites);
+	return 0;
+}
+
 static int http_rest_post_logconfig(http_request_t* request) {
 	int i;
 	int r;
@@ -1065,6 +1098,9 @@ static int http_rest_post_logconfig(http_request_t* request) {
 static int http_rest_get_info(http_request_t* request) {
 	char macstr[3 * 6 + 1];
 	long int* pAllGenericFlags = (long int*)&g_cfg.genericFlags;
+#if ENABLE_MQTT
+	char mqttStats[MQTT_STATS_JSON_SIZE];
+#endif
 
 	http_setup(request, httpMimeTypeJson);
 	hprintf255(request, "{\"uptime_s\":%d,", g_secondsElapsed);
@@ -1086,6 +1122,12 @@ static int http_rest_get_info(http_request_t* request) {
 #else
 	hprintf255(request, "\"supportsSSDP\":0,");
 #endif
+#if ENABLE_MQTT
+	MQTT_GetPublishStatsJSON(mqttStats, sizeof(mqttStats));
+	poststr(request, "\"mqttStats\":");
+	poststr(request, mqttStats);
+	poststr(request, ",");
+#endif
 
 	hprintf255(request, "\"supportsClientDeviceDB\":true}");
 
@@ -1724,7 +1766,7 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 
 	if(nRetCode != 0)
 	{
-		ADDLOG_ERROR(LOG_FEATURE_OTA, error_message);
+		ADDLOG_ERROR(LOG_FEATURE_OTA, "%s", error_message);
 		socket_fwup_err(0, nRetCode);
 		return http_rest_error(request, nRetCode, error_message);
 	}
@@ -1863,7 +1905,7 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 
 	if(nRetCode != 0)
 	{
-		ADDLOG_ERROR(LOG_FEATURE_OTA, error_message);
+		ADDLOG_ERROR(LOG_FEATURE_OTA, "%s", error_message);
 		socket_fwup_err(0, nRetCode);
 		return http_rest_error(request, nRetCode, error_message);
 	}
@@ -3445,24 +3487,40 @@ static int http_rest_post_channels(http_request_t* request) {
 		return http_rest_error(request, 400, tmp);
 	}
 
-	/* Assume the top-level element is an object */
-	if (r < 1 || t[0].type != JSMN_ARRAY) {
-		ADDLOG_ERROR(LOG_FEATURE_API, "Array expected", r);
-		sprintf(tmp, "Object expected\n");
+	/* Top-level element is either array of values for channels 0..N, or an object {"channel":value} */
+	if (r < 1 || (t[0].type != JSMN_ARRAY && t[0].type != JSMN_OBJECT)) {
+		ADDLOG_ERROR(LOG_FEATURE_API, "Array or object expected", r);
+		sprintf(tmp, "Array or object expected\n");
 		os_free(p);
 		os_free(t);
 		return http_rest_error(request, 400, tmp);
 	}
 
-	/* Loop over all keys of the root object */
-	for (i = 1; i < r; i++) {
-		int chanval;
-		jsmntok_t* g = &t[i];
-		chanval = atoi(json_str + g->start);
-		CHANNEL_Set(i - 1, chanval, 0);
-		ADDLOG_DEBUG(LOG_FEATURE_API, "Set of chan %d to %d", i,
-			chanval);
+	// all channels are set in one batch, so changes are published and saved once
+	CHANNEL_BeginBatch();
+	if (t[0].type == JSMN_ARRAY) {
+		/* Loop over all values of the root array */
+		for (i = 1; i < r; i++) {
+			int chanval;
+			jsmntok_t* g = &t[i];
+			chanval = atoi(json_str + g->start);
+			CHANNEL_Set(i - 1, chanval, 0);
+			ADDLOG_DEBUG(LOG_FEATURE_API, "Set of chan %d to %d", i - 1,
+				chanval);
+		}
+	}
+	else {
+		/* Loop over all keys of the root object */
+		for (i = 1; i + 1 < r; i += 2) {
+			int ch, chanval;
+			ch = atoi(json_str + t[i].start);
+			chanval = atoi(json_str + t[i + 1].start);
+			CHANNEL_Set(ch, chanval, 0);
+			ADDLOG_DEBUG(LOG_FEATURE_API, "Set of chan %d to %d", ch,
+				chanval);
+		}
 	}
+	CHANNEL_CommitBatch();
 
 	os_free(p);
 	os_free(t);
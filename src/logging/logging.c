@@ -2,6 +2,7 @@
 // Trying to narrow down Boozeman crash.
 // Is the code with this define enabled crashing/freezing BK after few minutes for anybody?
 
+#include <stddef.h>
 #include "../new_common.h"
 #include "../httpserver/new_http.h"
 #include "../logging/logging.h"
@@ -100,11 +101,6 @@ static char g_loggingBuffer[LOGGING_BUFFER_SIZE];
 int tcp_log_ports[MAX_TCP_LOG_PORTS] = {-1};
 
 
-void LOG_SetRawSocketCallback(int newFD)
-{
-	g_extraSocketToSendLOG = newFD;
-}
-
 static int http_getlog(http_request_t* request);
 static int http_getlograw(http_request_t* request);
 
@@ -133,6 +129,616 @@ static struct tag_logMemory {
 static int initialised = 0;
 static int tcpLogStarted = 0;
 
+#if ENABLE_LOG_BINARY
+// Binary log records.
+// In binary mode addLogAdv does not format any text. It stores a record with
+// timestamp, level, feature, the fmt pointer and raw argument values into
+// logRecords ring (strings are copied, caller's buffer may be gone later).
+// Text is rendered only when a consumer - serial, TCP, HTTP or raw socket - drains it.
+// Producers never wait on a mutex: space is reserved by moving the head within
+// a few instructions with interrupts masked, record body is written outside of
+// that, and then published by setting its state. When the ring is full, oldest
+// records are overwritten and consumers that did not read them count them as lost.
+#define LOGREC_RING_SIZE	4096	// must be a power of two
+#define LOGREC_RING_MASK	(LOGREC_RING_SIZE - 1)
+#define LOGREC_MAX_SIZE		512
+
+#define LOGREC_STATE_WRITING	1
+#define LOGREC_STATE_READY		2
+
+typedef struct logRecordHeader_s {
+	// whole record size, with header and arguments, multiple of 4
+	unsigned short len;
+	byte state;
+	byte level;
+	byte feature;
+	unsigned int seq;
+	unsigned int timeMS;
+	// NULL when text without conversions was copied into record instead
+	const char *fmt;
+} logRecordHeader_t;
+
+// how argument of a conversion is stored in record
+enum {
+	LOGARG_NONE,
+	LOGARG_INT,
+	LOGARG_LONG,
+	LOGARG_LLONG,
+	LOGARG_SIZE,
+	LOGARG_PTR,
+	LOGARG_DOUBLE,
+	LOGARG_LDOUBLE,
+	LOGARG_STRING,
+	LOGARG_SKIP,
+};
+
+typedef struct logSpec_s {
+	const char *flags;
+	int flagsLen;
+	// -1 if not given, -2 if given as '*'
+	int width;
+	int precision;
+	byte argType;
+	char conv;
+} logSpec_t;
+
+typedef struct logConsumer_s {
+	unsigned int tail;
+	unsigned int nextSeq;
+	// part of the record at tail already rendered and taken
+	int offset;
+	unsigned int lost;
+} logConsumer_t;
+
+enum {
+	LOGCONSUMER_SERIAL,
+	LOGCONSUMER_TCP,
+	LOGCONSUMER_HTTP,
+	LOGCONSUMER_SOCKET,
+	LOGCONSUMER_COUNT
+};
+
+static byte logRecords[LOGREC_RING_SIZE];
+static volatile unsigned int logRecHead = 0;
+static volatile unsigned int logRecOldest = 0;
+static unsigned int logRecSeq = 0;
+static unsigned int logRecWritten = 0;
+static unsigned int logRecDropped = 0;
+static logConsumer_t logConsumers[LOGCONSUMER_COUNT];
+// consumer side scratch, used under logMemory.mutex
+static unsigned int logRecScratch[LOGREC_MAX_SIZE / sizeof(unsigned int)];
+static char logRecText[LOGGING_BUFFER_SIZE];
+int g_logBinary = 1;
+
+static void LOG_RingWrite(unsigned int pos, const void *src, int len) {
+	unsigned int ofs = pos & LOGREC_RING_MASK;
+	int first = LOGREC_RING_SIZE - ofs;
+
+	if (first >= len) {
+		memcpy(logRecords + ofs, src, len);
+		return;
+	}
+	memcpy(logRecords + ofs, src, first);
+	memcpy(logRecords, (const byte*)src + first, len - first);
+}
+static void LOG_RingRead(unsigned int pos, void *dst, int len) {
+	unsigned int ofs = pos & LOGREC_RING_MASK;
+	int first = LOGREC_RING_SIZE - ofs;
+
+	if (first >= len) {
+		memcpy(dst, logRecords + ofs, len);
+		return;
+	}
+	memcpy(dst, logRecords + ofs, first);
+	memcpy((byte*)dst + first, logRecords, len - first);
+}
+// p points just after '%', returns pointer after the conversion
+static const char *LOG_ParseSpec(const char *p, logSpec_t *s) {
+	int lenMod = 0;
+
+	s->flags = p;
+	while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+		p++;
+	}
+	s->flagsLen = p - s->flags;
+	s->width = -1;
+	if (*p == '*') {
+		s->width = -2;
+		p++;
+	}
+	else if (isdigit((unsigned char)*p)) {
+		s->width = 0;
+		while (isdigit((unsigned char)*p)) {
+			s->width = s->width * 10 + (*p - '0');
+			p++;
+		}
+	}
+	s->precision = -1;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			s->precision = -2;
+			p++;
+		}
+		else {
+			s->precision = 0;
+			while (isdigit((unsigned char)*p)) {
+				s->precision = s->precision * 10 + (*p - '0');
+				p++;
+			}
+		}
+	}
+	// 'l' = 1, 'll' = 2, 'z'/'t' = 3, 'L' = 4, 'h'/'hh' are promoted to int
+	while (*p == 'h' || *p == 'l' || *p == 'j' || *p == 'z' || *p == 't' || *p == 'L' || *p == 'q') {
+		if (*p == 'l')
+			lenMod++;
+		else if (*p == 'j' || *p == 'q')
+			lenMod = 2;
+		else if (*p == 'z' || *p == 't')
+			lenMod = 3;
+		else if (*p == 'L')
+			lenMod = 4;
+		p++;
+	}
+	s->conv = *p;
+	if (*p) {
+		p++;
+	}
+	switch (s->conv) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		if (lenMod == 1)
+			s->argType = LOGARG_LONG;
+		else if (lenMod == 2)
+			s->argType = LOGARG_LLONG;
+		else if (lenMod == 3)
+			s->argType = LOGARG_SIZE;
+		else
+			s->argType = LOGARG_INT;
+		break;
+	case 'c':
+		s->argType = LOGARG_INT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		s->argType = lenMod == 4 ? LOGARG_LDOUBLE : LOGARG_DOUBLE;
+		break;
+	case 's':
+		// wide strings are not supported, print just the pointer
+		s->argType = lenMod ? LOGARG_PTR : LOGARG_STRING;
+		break;
+	case 'p':
+		s->argType = LOGARG_PTR;
+		break;
+	case 'n':
+		s->argType = LOGARG_SKIP;
+		break;
+	default:
+		s->argType = LOGARG_NONE;
+		break;
+	}
+	return p;
+}
+
+typedef struct logPacker_s {
+	// ring position of record, or 0xFFFFFFFF when only measuring
+	unsigned int pos;
+	int size;
+	int max;
+} logPacker_t;
+
+static bool LOG_PackBytes(logPacker_t *w, const void *src, int len) {
+	if (w->size + len > w->max)
+		return false;
+	if (w->pos != 0xFFFFFFFF) {
+		LOG_RingWrite(w->pos + w->size, src, len);
+	}
+	w->size += len;
+	return true;
+}
+// copies as much of string as fits, always NUL terminated
+static void LOG_PackString(logPacker_t *w, const char *str) {
+	int len;
+
+	if (str == 0) {
+		str = "(null)";
+	}
+	len = strlen(str);
+	if (len > w->max - w->size - 1) {
+		len = w->max - w->size - 1;
+	}
+	if (len >= 0) {
+		LOG_PackBytes(w, str, len);
+		LOG_PackBytes(w, "", 1);
+	}
+}
+// walks fmt and stores argument values after the header; used once to measure
+// the record and once to write it
+static void LOG_PackArgs(logPacker_t *w, const char *fmt, va_list argList) {
+	logSpec_t s;
+	const char *p;
+	int i;
+	long l;
+	long long ll;
+	size_t sz;
+	void *ptr;
+	double d;
+
+	p = fmt;
+	while (*p) {
+		if (*p++ != '%')
+			continue;
+		p = LOG_ParseSpec(p, &s);
+		if (s.width == -2) {
+			i = va_arg(argList, int);
+			LOG_PackBytes(w, &i, sizeof(i));
+		}
+		if (s.precision == -2) {
+			i = va_arg(argList, int);
+			LOG_PackBytes(w, &i, sizeof(i));
+		}
+		switch (s.argType) {
+		case LOGARG_INT:
+			i = va_arg(argList, int);
+			LOG_PackBytes(w, &i, sizeof(i));
+			break;
+		case LOGARG_LONG:
+			l = va_arg(argList, long);
+			LOG_PackBytes(w, &l, sizeof(l));
+			break;
+		case LOGARG_LLONG:
+			ll = va_arg(argList, long long);
+			LOG_PackBytes(w, &ll, sizeof(ll));
+			break;
+		case LOGARG_SIZE:
+			sz = va_arg(argList, size_t);
+			LOG_PackBytes(w, &sz, sizeof(sz));
+			break;
+		case LOGARG_PTR:
+		case LOGARG_SKIP:
+			ptr = va_arg(argList, void*);
+			LOG_PackBytes(w, &ptr, sizeof(ptr));
+			break;
+		case LOGARG_DOUBLE:
+			d = va_arg(argList, double);
+			LOG_PackBytes(w, &d, sizeof(d));
+			break;
+		case LOGARG_LDOUBLE:
+			d = (double)va_arg(argList, long double);
+			LOG_PackBytes(w, &d, sizeof(d));
+			break;
+		case LOGARG_STRING:
+			LOG_PackString(w, va_arg(argList, const char*));
+			break;
+		}
+	}
+}
+static void LOG_AddRecord(int level, int feature, const char *fmt, va_list argList) {
+	logRecordHeader_t hdr;
+	logPacker_t w;
+	va_list copy;
+	bool bCopyText;
+	unsigned int pos;
+	unsigned short oldLen;
+	byte oldState;
+	GLOBAL_INT_DECLARATION();
+
+	// Plain text is copied, because some callers pass their own buffer as fmt.
+	// Strings with conversions are expected to be literals.
+	bCopyText = strchr(fmt, '%') == 0;
+
+	// measure
+	w.pos = 0xFFFFFFFF;
+	w.size = sizeof(hdr);
+	w.max = LOGREC_MAX_SIZE;
+	if (bCopyText) {
+		LOG_PackString(&w, fmt);
+	}
+	va_copy(copy, argList);
+	LOG_PackArgs(&w, fmt, copy);
+	va_end(copy);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.len = (w.size + 3) & ~3;
+	hdr.state = LOGREC_STATE_WRITING;
+	hdr.level = level;
+	hdr.feature = feature;
+	hdr.timeMS = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	hdr.fmt = bCopyText ? 0 : fmt;
+
+	// reserve
+	GLOBAL_INT_DISABLE();
+	pos = logRecHead;
+	while (pos + hdr.len - logRecOldest > LOGREC_RING_SIZE) {
+		LOG_RingRead(logRecOldest + offsetof(logRecordHeader_t, state), &oldState, 1);
+		if (oldState != LOGREC_STATE_READY) {
+			// oldest record is still being written by someone we interrupted
+			logRecDropped++;
+			GLOBAL_INT_RESTORE();
+			return;
+		}
+		LOG_RingRead(logRecOldest, &oldLen, sizeof(oldLen));
+		logRecOldest += oldLen;
+	}
+	hdr.seq = logRecSeq++;
+	LOG_RingWrite(pos, &hdr, sizeof(hdr));
+	logRecHead = pos + hdr.len;
+	GLOBAL_INT_RESTORE();
+
+	// fill and publish
+	w.pos = pos;
+	w.size = sizeof(hdr);
+	w.max = hdr.len;
+	if (bCopyText) {
+		LOG_PackString(&w, fmt);
+	}
+	LOG_PackArgs(&w, fmt, argList);
+	oldState = LOGREC_STATE_READY;
+	LOG_RingWrite(pos + offsetof(logRecordHeader_t, state), &oldState, 1);
+	logRecWritten++;
+}
+static const byte *LOG_TakeArg(const byte **p, const byte *end, int size) {
+	const byte *r = *p;
+	if (r + size > end)
+		return 0;
+	*p += size;
+	return r;
+}
+// renders record into text, exactly as text mode would have printed it
+static int LOG_RenderRecord(const logRecordHeader_t *hdr, char *out, int outLen) {
+	const byte *args, *end, *a;
+	const char *p, *specStart;
+	char spec[40];
+	char *t, *o;
+	logSpec_t s;
+	int i, n, width, precision;
+	long l;
+	long long ll;
+	size_t sz;
+	void *ptr;
+	double d;
+
+	args = (const byte*)hdr + sizeof(*hdr);
+	end = (const byte*)hdr + hdr->len;
+	t = out;
+	// save 3 bytes at end for /r/n/0
+	o = out + outLen - 3;
+	if (hdr->feature != LOG_FEATURE_RAW) {
+		t += snprintf(t, o - t, "%s", loglevelnames[hdr->level]);
+		if (hdr->feature < sizeof(logfeaturenames) / sizeof(*logfeaturenames)) {
+			t += snprintf(t, o - t, "%s", logfeaturenames[hdr->feature]);
+		}
+		if (t > o - 1)
+			t = o - 1;
+	}
+	p = hdr->fmt;
+	if (p == 0) {
+		p = (const char*)args;
+		args += strlen(p) + 1;
+	}
+	while (*p && t < o - 1) {
+		if (*p != '%') {
+			*t++ = *p++;
+			continue;
+		}
+		specStart = p;
+		p = LOG_ParseSpec(p + 1, &s);
+		if (s.argType == LOGARG_NONE) {
+			// %% and unknown conversions are printed as printf would
+			n = p - specStart;
+			if (n >= (int)sizeof(spec))
+				n = sizeof(spec) - 1;
+			memcpy(spec, specStart, n);
+			spec[n] = 0;
+			t += snprintf(t, o - t, spec, 0);
+			continue;
+		}
+		width = s.width;
+		precision = s.precision;
+		if (width == -2) {
+			if ((a = LOG_TakeArg(&args, end, sizeof(int))) == 0)
+				break;
+			memcpy(&width, a, sizeof(int));
+		}
+		if (precision == -2) {
+			if ((a = LOG_TakeArg(&args, end, sizeof(int))) == 0)
+				break;
+			memcpy(&precision, a, sizeof(int));
+		}
+		// rebuild spec with explicit numbers and canonical length modifier
+		n = snprintf(spec, sizeof(spec), "%%%.*s", s.flagsLen > 8 ? 8 : s.flagsLen, s.flags);
+		if (width >= 0)
+			n += snprintf(spec + n, sizeof(spec) - n, "%i", width);
+		else if (width != -1)
+			n += snprintf(spec + n, sizeof(spec) - n, "-%i", -width);
+		if (precision >= 0)
+			n += snprintf(spec + n, sizeof(spec) - n, ".%i", precision);
+		switch (s.argType) {
+		case LOGARG_LONG:
+			n += snprintf(spec + n, sizeof(spec) - n, "l");
+			break;
+		case LOGARG_LLONG:
+			n += snprintf(spec + n, sizeof(spec) - n, "ll");
+			break;
+		case LOGARG_SIZE:
+			n += snprintf(spec + n, sizeof(spec) - n, "z");
+			break;
+		}
+		snprintf(spec + n, sizeof(spec) - n, "%c", s.argType == LOGARG_PTR ? 'p' : s.conv);
+
+		switch (s.argType) {
+		case LOGARG_INT:
+			if ((a = LOG_TakeArg(&args, end, sizeof(i))) == 0)
+				goto truncated;
+			memcpy(&i, a, sizeof(i));
+			t += snprintf(t, o - t, spec, i);
+			break;
+		case LOGARG_LONG:
+			if ((a = LOG_TakeArg(&args, end, sizeof(l))) == 0)
+				goto truncated;
+			memcpy(&l, a, sizeof(l));
+			t += snprintf(t, o - t, spec, l);
+			break;
+		case LOGARG_LLONG:
+			if ((a = LOG_TakeArg(&args, end, sizeof(ll))) == 0)
+				goto truncated;
+			memcpy(&ll, a, sizeof(ll));
+			t += snprintf(t, o - t, spec, ll);
+			break;
+		case LOGARG_SIZE:
+			if ((a = LOG_TakeArg(&args, end, sizeof(sz))) == 0)
+				goto truncated;
+			memcpy(&sz, a, sizeof(sz));
+			t += snprintf(t, o - t, spec, sz);
+			break;
+		case LOGARG_PTR:
+			if ((a = LOG_TakeArg(&args, end, sizeof(ptr))) == 0)
+				goto truncated;
+			memcpy(&ptr, a, sizeof(ptr));
+			t += snprintf(t, o - t, spec, ptr);
+			break;
+		case LOGARG_SKIP:
+			if (LOG_TakeArg(&args, end, sizeof(ptr)) == 0)
+				goto truncated;
+			break;
+		case LOGARG_DOUBLE:
+		case LOGARG_LDOUBLE:
+			if ((a = LOG_TakeArg(&args, end, sizeof(d))) == 0)
+				goto truncated;
+			memcpy(&d, a, sizeof(d));
+			t += snprintf(t, o - t, spec, d);
+			break;
+		case LOGARG_STRING:
+			if (args >= end)
+				goto truncated;
+			t += snprintf(t, o - t, spec, (const char*)args);
+			args += strlen((const char*)args) + 1;
+			break;
+		}
+		// snprintf returns length it wanted to write
+		if (t > o - 1)
+			t = o - 1;
+	}
+truncated:
+	if (t > o - 1)
+		t = o - 1;
+	*t = 0;
+	if (t > out && t[-1] == '\n') *--t = 0;
+	if (t > out && t[-1] == '\r') *--t = 0;
+	*t++ = '\r';
+	*t++ = '\n';
+	*t = 0;
+	return t - out;
+}
+// copies record at consumer tail into logRecScratch, returns its size, 0 if none is ready
+static int LOG_FetchRecord(logConsumer_t *c) {
+	logRecordHeader_t *hdr = (logRecordHeader_t*)logRecScratch;
+	unsigned int oldest;
+
+	while (1) {
+		oldest = logRecOldest;
+		if ((int)(c->tail - oldest) < 0) {
+			// overwritten before we got to it
+			c->tail = oldest;
+			c->offset = 0;
+		}
+		if (c->tail == logRecHead)
+			return 0;
+		LOG_RingRead(c->tail, hdr, sizeof(*hdr));
+		if (hdr->state != LOGREC_STATE_READY)
+			return 0;
+		LOG_RingRead(c->tail + sizeof(*hdr), hdr + 1, hdr->len - sizeof(*hdr));
+		// if it was overwritten while we were copying, start over
+		if ((int)(c->tail - logRecOldest) >= 0)
+			break;
+	}
+	if (hdr->seq != c->nextSeq) {
+		c->lost += hdr->seq - c->nextSeq;
+		c->nextSeq = hdr->seq;
+	}
+	return hdr->len;
+}
+// renders records for given consumer into buff, caller holds logMemory.mutex
+static int LOG_GetRecordText(logConsumer_t *c, char *buff, int buffsize) {
+	int count, len, textLen, n;
+
+	count = 0;
+	while (buffsize - count > 1) {
+		len = LOG_FetchRecord(c);
+		if (len == 0)
+			break;
+		textLen = LOG_RenderRecord((logRecordHeader_t*)logRecScratch, logRecText, sizeof(logRecText));
+		n = textLen - c->offset;
+		if (n > buffsize - 1 - count)
+			n = buffsize - 1 - count;
+		memcpy(buff + count, logRecText + c->offset, n);
+		count += n;
+		c->offset += n;
+		if (c->offset < textLen)
+			break;
+		c->offset = 0;
+		c->tail += len;
+		c->nextSeq++;
+	}
+	buff[count] = 0;
+	return count;
+}
+static void LOG_SendRecordsToSocket() {
+	char buf[128];
+	int count;
+	BaseType_t taken;
+
+	if (!g_extraSocketToSendLOG || !initialised)
+		return;
+	// if someone else is draining right now, the rest will go out with next record
+	taken = xSemaphoreTake(logMemory.mutex, 0);
+	if (taken == 0)
+		return;
+	while ((count = LOG_GetRecordText(&logConsumers[LOGCONSUMER_SOCKET], buf, sizeof(buf)))) {
+		send(g_extraSocketToSendLOG, buf, count, 0);
+	}
+	xSemaphoreGive(logMemory.mutex);
+}
+#if WINDOWS
+// simulator has no serial thread, so print right away
+static void LOG_PrintRecords() {
+	char buf[128];
+	BaseType_t taken;
+
+	taken = xSemaphoreTake(logMemory.mutex, 100);
+	if (taken == 0)
+		return;
+	while (LOG_GetRecordText(&logConsumers[LOGCONSUMER_SERIAL], buf, sizeof(buf))) {
+		printf("%s", buf);
+	}
+	xSemaphoreGive(logMemory.mutex);
+}
+#endif
+// moves consumer to head, it will get only records added from now on
+static void LOG_SkipRecords(int consumer) {
+	logConsumer_t *c = &logConsumers[consumer];
+	GLOBAL_INT_DECLARATION();
+
+	GLOBAL_INT_DISABLE();
+	c->tail = logRecHead;
+	c->nextSeq = logRecSeq;
+	c->offset = 0;
+	GLOBAL_INT_RESTORE();
+}
+void LOG_GetRecordStats(int *written, int *dropped, int *lostByHttp) {
+	*written = logRecWritten;
+	*dropped = logRecDropped;
+	*lostByHttp = logConsumers[LOGCONSUMER_HTTP].lost;
+}
+#endif
+
+void LOG_SetRawSocketCallback(int newFD)
+{
+	g_extraSocketToSendLOG = newFD;
+#if ENABLE_LOG_BINARY
+	// new socket gets only what is logged from now on, same as in text mode
+	LOG_SkipRecords(LOGCONSUMER_SOCKET);
+#endif
+}
+
 commandResult_t log_command(const void* context, const char* cmd, const char* args, int cmdFlags);
 
 #if PLATFORM_BEKEN
@@ -211,6 +817,23 @@ static void initLog(void)
 	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("logdelay", log_command, NULL);
+	//cmddetail:{"name":"lograte","args":"[PerSecond][Burst]",
+	//cmddetail:"descr":"Limits how many messages per second a single log call site can print, 0 disables the limit. Burst defaults to twice the rate. Dropped messages are counted and summarized every 10 seconds, noisiest sites are listed by /api/logsites. Disabled by default. Messages logged as plain \"%s\" pass-through (echo, MQTT printf) are never limited",
+	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
+	//cmddetail:"examples":"lograte 5 10"}
+	CMD_RegisterCommand("lograte", log_command, NULL);
+#if ENABLE_LOG_BINARY
+	//cmddetail:{"name":"logmode","args":"[ModeStr]",
+	//cmddetail:"descr":"logmode binary|text - binary (default) stores raw arguments and formats them only when log is sent out, text formats every line at the time of logging",
+	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("logmode", log_command, NULL);
+	//cmddetail:{"name":"logstats","args":"",
+	//cmddetail:"descr":"Prints count of binary log records written, dropped because the ring was busy, and lost by each output because they were overwritten before being sent",
+	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("logstats", log_command, NULL);
+#endif
 #if PLATFORM_BEKEN
 	//cmddetail:{"name":"logport","args":"[Index]",
 	//cmddetail:"descr":"Allows you to change log output port. On Beken, the UART1 is used for flashing and for TuyaMCU/BL0942, while UART2 is for log. Sometimes it might be easier for you to have log on UART1, so now you can just use this command like backlog uartInit 115200; logport 1 to enable logging on UART1..",
@@ -276,39 +899,251 @@ void LOG_SetCommandHTTPRedirectReply(http_request_t* request) {
 	}
 #endif
 
-// adds a log to the log memory
-// if head collides with either tail, move the tails on.
-void addLogAdv(int level, int feature, const char* fmt, ...)
-{
-	char* tmp;
-	char* t;
-	int len;
-	va_list argList;
-	BaseType_t taken;
-	int i;
+// Rate limiting of log storms.
+// Every call site, identified by its fmt pointer (identical literals may be merged
+// by compiler, then they share the limit), has a token bucket refilled once per second.
+// Messages over the limit are dropped before any formatting or locking,
+// and a summary of how many were suppressed is printed every few seconds.
+// Command output printed to HTTP console is never limited.
+#define LOG_SITE_TEXT			24
+#define LOG_SUMMARY_SECONDS		10
+#define LOG_SITE_IDLE_SECONDS	10
+#define LOG_NOISY_SITE_IDLE_SECONDS	600
+
+typedef struct logSite_s {
+	const char *fmt;
+	// start of fmt for summaries, fmt may point to a buffer that is gone by then
+	char text[LOG_SITE_TEXT];
+	byte feature;
+	short tokens;
+	unsigned short idleSeconds;
+	unsigned int count;
+	// since last summary
+	unsigned int suppressed;
+	unsigned int suppressedTotal;
+} logSite_t;
+
+static logSite_t logSites[LOG_MAX_SITES];
+static unsigned int logSitesUntracked = 0;
+static int logSummaryCountdown = LOG_SUMMARY_SECONDS;
+static bool b_logSummaryRunning = false;
+// messages per second per call site, 0 disables the limit (default)
+int g_logRateLimit = 0;
+int g_logRateBurst = 40;
+
+static int LOG_SiteHome(const char *fmt) {
+	unsigned int h = (unsigned int)(size_t)fmt;
+	h ^= h >> 13;
+	h *= 2654435761u;
+	return (h >> 16) & (LOG_MAX_SITES - 1);
+}
+// removes entry at i, shifting back the following ones so lookups still find them
+static void LOG_RemoveSite(int i) {
+	int j, k;
 
-	if (fmt == 0)
-	{
-		return;
+	j = i;
+	while (1) {
+		logSites[i].fmt = 0;
+		do {
+			j = (j + 1) & (LOG_MAX_SITES - 1);
+			if (logSites[j].fmt == 0)
+				return;
+			k = LOG_SiteHome(logSites[j].fmt);
+		} while ((i <= j) ? (i < k && k <= j) : (i < k || k <= j));
+		logSites[i] = logSites[j];
+		i = j;
 	}
-	if (!((1 << feature) & logfeatures)) {
-		return;
+}
+// picks site to forget when table is full: one that was never limited,
+// otherwise the longest idle one; -1 if all are storming right now
+static int LOG_FindSiteToEvict() {
+	logSite_t *s;
+	int i, best, bestScore, score;
+
+	best = -1;
+	bestScore = 0;
+	for (i = 0; i < LOG_MAX_SITES; i++) {
+		s = &logSites[i];
+		if (s->fmt == 0 || s->suppressed)
+			continue;
+		score = s->idleSeconds;
+		if (s->suppressedTotal == 0)
+			score += 0x10001;
+		if (score > bestScore) {
+			bestScore = score;
+			best = i;
+		}
 	}
-	if (level > g_loglevel) {
-		return;
+	return best;
+}
+// returns site for fmt, adding it if needed; NULL if table is full
+static logSite_t *LOG_GetSite(int feature, const char *fmt, bool bCanEvict) {
+	logSite_t *s;
+	int i, n;
+
+	i = LOG_SiteHome(fmt);
+	for (n = 0; n < LOG_MAX_SITES; n++) {
+		s = &logSites[i];
+		if (s->fmt == fmt)
+			return s;
+		if (s->fmt == 0) {
+			// leave one slot free, so the lookup above always stops
+			if (n == LOG_MAX_SITES - 1)
+				break;
+			memset(s, 0, sizeof(*s));
+			s->fmt = fmt;
+			s->feature = feature;
+			s->tokens = g_logRateBurst;
+			strncpy(s->text, fmt, sizeof(s->text) - 1);
+			return s;
+		}
+		i = (i + 1) & (LOG_MAX_SITES - 1);
 	}
-
-	// if not initialised, direct output
-	if (!initialised) {
-		initLog();
+	if (bCanEvict) {
+		i = LOG_FindSiteToEvict();
+		if (i >= 0) {
+			LOG_RemoveSite(i);
+			return LOG_GetSite(feature, fmt, false);
+		}
 	}
-	if (g_StartupDelayOver && !tcpLogStarted){
-		inittcplog();
+	return 0;
+}
+// returns true if message should be dropped
+static bool LOG_IsRateLimited(int feature, const char *fmt) {
+	logSite_t *s;
+	bool bDrop;
+	GLOBAL_INT_DECLARATION();
+
+	if (g_logRateLimit <= 0 || g_log_alsoPrintToHTTP || b_logSummaryRunning)
+		return false;
+	// plain pass-through is shared by echo, MQTT printf and many others,
+	// so it's not a single call site and can't be limited as one
+	if (fmt[0] == '%' && fmt[1] == 's' && fmt[2] == 0)
+		return false;
+	bDrop = false;
+	GLOBAL_INT_DISABLE();
+	s = LOG_GetSite(feature, fmt, true);
+	if (s == 0) {
+		// table full, can't limit it
+		logSitesUntracked++;
+	}
+	else {
+		s->count++;
+		s->idleSeconds = 0;
+		if (s->tokens > 0) {
+			s->tokens--;
+		}
+		else {
+			s->suppressed++;
+			s->suppressedTotal++;
+			bDrop = true;
+		}
 	}
+	GLOBAL_INT_RESTORE();
+	return bDrop;
+}
+void LOG_RunEverySecond() {
+	logSite_t *s;
+	char text[LOG_SITE_TEXT];
+	unsigned int suppressed;
+	int i, feature;
+	bool bSummary;
+	GLOBAL_INT_DECLARATION();
+
+	bSummary = false;
+	if (--logSummaryCountdown <= 0) {
+		logSummaryCountdown = LOG_SUMMARY_SECONDS;
+		bSummary = true;
+	}
+	for (i = 0; i < LOG_MAX_SITES; i++) {
+		GLOBAL_INT_DISABLE();
+		s = &logSites[i];
+		if (s->fmt == 0) {
+			GLOBAL_INT_RESTORE();
+			continue;
+		}
+		s->tokens += g_logRateLimit;
+		if (s->tokens > g_logRateBurst)
+			s->tokens = g_logRateBurst;
+		if (s->idleSeconds < 0xFFFF)
+			s->idleSeconds++;
+		suppressed = 0;
+		if (bSummary && s->suppressed) {
+			suppressed = s->suppressed;
+			s->suppressed = 0;
+			feature = s->feature;
+			strcpy(text, s->text);
+		}
+		GLOBAL_INT_RESTORE();
+		if (suppressed) {
+			b_logSummaryRunning = true;
+			ADDLOG_LEVEL(LOG_WARN, feature, "Suppressed %u messages like \"%s\"", suppressed, text);
+			b_logSummaryRunning = false;
+		}
+	}
+	// forget sites that went quiet, noisy ones are kept longer for api/logsites
+	i = 0;
+	while (i < LOG_MAX_SITES) {
+		GLOBAL_INT_DISABLE();
+		s = &logSites[i];
+		if (s->fmt && s->suppressed == 0 && (s->idleSeconds >= LOG_NOISY_SITE_IDLE_SECONDS
+			|| (s->suppressedTotal == 0 && s->idleSeconds >= LOG_SITE_IDLE_SECONDS))) {
+			// another entry may be shifted into this slot, so check it again
+			LOG_RemoveSite(i);
+			GLOBAL_INT_RESTORE();
+			continue;
+		}
+		GLOBAL_INT_RESTORE();
+		i++;
+	}
+}
+// fills out with tracked call sites, most suppressed first, returns count
+int LOG_GetNoisySites(logSiteInfo_t *out, int maxCount) {
+	logSiteInfo_t tmp;
+	logSite_t *s;
+	int i, j, c;
+	GLOBAL_INT_DECLARATION();
+
+	c = 0;
+	for (i = 0; i < LOG_MAX_SITES; i++) {
+		GLOBAL_INT_DISABLE();
+		s = &logSites[i];
+		if (s->fmt == 0) {
+			GLOBAL_INT_RESTORE();
+			continue;
+		}
+		strcpy(tmp.text, s->text);
+		tmp.feature = s->feature;
+		tmp.count = s->count;
+		tmp.suppressed = s->suppressedTotal;
+		GLOBAL_INT_RESTORE();
+		// insertion into sorted output
+		for (j = c; j > 0; j--) {
+			if (out[j - 1].suppressed > tmp.suppressed
+				|| (out[j - 1].suppressed == tmp.suppressed && out[j - 1].count >= tmp.count))
+				break;
+			if (j < maxCount)
+				out[j] = out[j - 1];
+		}
+		if (j < maxCount)
+			out[j] = tmp;
+		if (c < maxCount)
+			c++;
+	}
+	return c;
+}
+void LOG_GetRateLimitStats(int *limit, int *burst, int *untracked) {
+	*limit = g_logRateLimit;
+	*burst = g_logRateBurst;
+	*untracked = logSitesUntracked;
+}
 
+// formats log line with prefix and \r\n into tmp, returns its length
+static int LOG_FormatText(char* tmp, int level, int feature, const char* fmt, va_list argList)
+{
+	char* t;
+	int len;
 
-	taken = xSemaphoreTake(logMemory.mutex, 100);
-	tmp = g_loggingBuffer;
 	memset(tmp, 0, LOGGING_BUFFER_SIZE);
 	t = tmp;
 
@@ -326,11 +1161,9 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 		}
 	}
 
-	va_start(argList, fmt);
 	//vsnprintf3(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
 	//vsnprintf2(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
 	vsnprintf(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
-	va_end(argList);
 	if (tmp[strlen(tmp) - 1] == '\n') tmp[strlen(tmp) - 1] = '\0';
 	if (tmp[strlen(tmp) - 1] == '\r') tmp[strlen(tmp) - 1] = '\0';
 
@@ -338,6 +1171,81 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 	tmp[len++] = '\r';
 	tmp[len++] = '\n';
 	tmp[len] = '\0';
+	return len;
+}
+
+// adds a log to the log memory
+// if head collides with either tail, move the tails on.
+void addLogAdv(int level, int feature, const char* fmt, ...)
+{
+	char* tmp;
+	int len;
+	va_list argList;
+	BaseType_t taken;
+	int i;
+
+	if (fmt == 0)
+	{
+		return;
+	}
+	if (!((1 << feature) & logfeatures)) {
+		return;
+	}
+	if (level > g_loglevel) {
+		return;
+	}
+	if (LOG_IsRateLimited(feature, fmt)) {
+		return;
+	}
+
+	// if not initialised, direct output
+	if (!initialised) {
+		initLog();
+	}
+	if (g_StartupDelayOver && !tcpLogStarted){
+		inittcplog();
+	}
+
+#if ENABLE_LOG_BINARY
+	// direct logging is for debugging crashes, so it stays synchronous
+	if (g_logBinary && direct_serial_log != LOGTYPE_DIRECT) {
+		va_start(argList, fmt);
+		LOG_AddRecord(level, feature, fmt, argList);
+		va_end(argList);
+		// HTTP console needs the text now, while request is still open
+		if (g_log_alsoPrintToHTTP && b_guard_recursivePrint == false) {
+			taken = xSemaphoreTake(logMemory.mutex, 100);
+			va_start(argList, fmt);
+			LOG_FormatText(g_loggingBuffer, level, feature, fmt, argList);
+			va_end(argList);
+			b_guard_recursivePrint = true;
+			poststr(g_log_alsoPrintToHTTP, g_loggingBuffer);
+			poststr(g_log_alsoPrintToHTTP, "<br>");
+			b_guard_recursivePrint = false;
+			if (taken == pdTRUE) {
+				xSemaphoreGive(logMemory.mutex);
+			}
+		}
+#if WINDOWS
+		LOG_PrintRecords();
+#endif
+		LOG_SendRecordsToSocket();
+#ifdef PLATFORM_BEKEN
+		trigger_log_send();
+#endif
+		// we don't know the text length here, so only fixed delay is supported
+		if (log_delay > 0) {
+			rtos_delay_milliseconds(log_delay);
+		}
+		return;
+	}
+#endif
+
+	taken = xSemaphoreTake(logMemory.mutex, 100);
+	tmp = g_loggingBuffer;
+	va_start(argList, fmt);
+	len = LOG_FormatText(tmp, level, feature, fmt, argList);
+	va_end(argList);
 #if WINDOWS
 	printf(tmp);
 #endif
@@ -415,7 +1323,7 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 }
 
 
-static int getData(char* buff, int buffsize, int* tail) {
+static int getData(char* buff, int buffsize, int* tail, int consumer) {
 	BaseType_t taken;
 	int count;
 	char* p;
@@ -440,6 +1348,10 @@ static int getData(char* buff, int buffsize, int* tail) {
 		count++;
 	}
 	*p = 0;
+#if ENABLE_LOG_BINARY
+	// text ring has only lines from before switching to binary mode, so they go first
+	count += LOG_GetRecordText(&logConsumers[consumer], p, buffsize);
+#endif
 
 	if (taken == pdTRUE) {
 		xSemaphoreGive(logMemory.mutex);
@@ -453,6 +1365,11 @@ static int getData(char* buff, int buffsize, int* tail) {
 // and not wait.
 // so in our thread, send until full, and never spin waiting to send...
 // H/W TX fifo seems to be 256 bytes!!!
+#if ENABLE_LOG_BINARY
+static char serialPending[64];
+static int serialPendingLen = 0;
+static int serialPendingPos = 0;
+#endif
 static int getSerial2() {
 	if (!initialised) return 0;
 	int* tail = &logMemory.tailserial;
@@ -480,6 +1397,26 @@ static int getSerial2() {
 	}
 
 	int remains = (*tail != logMemory.head);
+#if ENABLE_LOG_BINARY
+	// records are rendered in small pieces, only as fast as FIFO takes them
+	while (!remains) {
+		if (serialPendingPos == serialPendingLen) {
+			serialPendingPos = 0;
+			serialPendingLen = LOG_GetRecordText(&logConsumers[LOGCONSUMER_SERIAL], serialPending, sizeof(serialPending));
+			// nothing ready; whoever is writing a record will trigger us again
+			if (serialPendingLen == 0)
+				break;
+		}
+		if (uart_is_tx_fifo_full(UART_PORT)) {
+			remains = 1;
+			break;
+		}
+		c = serialPending[serialPendingPos++];
+		if (direct_serial_log == LOGTYPE_THREAD) {
+			UART_WRITE_BYTE(UART_PORT_INDEX, c);
+		}
+	}
+#endif
 
 	if (taken == pdTRUE) {
 		xSemaphoreGive(logMemory.mutex);
@@ -490,7 +1427,7 @@ static int getSerial2() {
 #else
 
 static int getSerial(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailserial);
+	int len = getData(buff, buffsize, &logMemory.tailserial, LOGCONSUMER_SERIAL);
 	//bk_printf("got serial: %d:%s\r\n", len, buff);
 	return len;
 }
@@ -499,13 +1436,13 @@ static int getSerial(char* buff, int buffsize) {
 
 
 static int getTcp(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailtcp);
+	int len = getData(buff, buffsize, &logMemory.tailtcp, LOGCONSUMER_TCP);
 	//bk_printf("got tcp: %d:%s\r\n", len,buff);
 	return len;
 }
 
 static int getHttp(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailhttp);
+	int len = getData(buff, buffsize, &logMemory.tailhttp, LOGCONSUMER_HTTP);
 	//printf("got tcp: %d:%s\r\n", len,buff);
 	return len;
 }
@@ -813,6 +1750,50 @@ commandResult_t log_command(const void* context, const char* cmd, const char* ar
 			result = CMD_RES_OK;
 			break;
 		}
+		if (!stricmp(cmd, "lograte")) {
+			int res, rate, burst;
+			res = sscanf(args, "%d %d", &rate, &burst);
+			if (res < 1 || rate < 0) {
+				ADDLOG_ERROR(LOG_FEATURE_CMD, "lograte '%s' invalid? current is %i per second, burst %i", args, g_logRateLimit, g_logRateBurst);
+				result = CMD_RES_BAD_ARGUMENT;
+				break;
+			}
+			if (res < 2) {
+				burst = rate * 2;
+			}
+			if (burst < rate)
+				burst = rate;
+			if (burst > 10000)
+				burst = 10000;
+			g_logRateLimit = rate;
+			g_logRateBurst = burst;
+			result = CMD_RES_OK;
+			break;
+		}
+#if ENABLE_LOG_BINARY
+		if (!stricmp(cmd, "logmode")) {
+			if (!stricmp(args, "text")) {
+				g_logBinary = 0;
+			}
+			else if (!stricmp(args, "binary")) {
+				g_logBinary = 1;
+			}
+			else {
+				ADDLOG_ERROR(LOG_FEATURE_CMD, "logmode '%s' invalid? current is %s", args, g_logBinary ? "binary" : "text");
+				result = CMD_RES_BAD_ARGUMENT;
+				break;
+			}
+			result = CMD_RES_OK;
+			break;
+		}
+		if (!stricmp(cmd, "logstats")) {
+			ADDLOG_INFO(LOG_FEATURE_CMD, "Log records: written %u, dropped %u, lost serial %u, tcp %u, http %u, socket %u",
+				logRecWritten, logRecDropped, logConsumers[LOGCONSUMER_SERIAL].lost, logConsumers[LOGCONSUMER_TCP].lost,
+				logConsumers[LOGCONSUMER_HTTP].lost, logConsumers[LOGCONSUMER_SOCKET].lost);
+			result = CMD_RES_OK;
+			break;
+		}
+#endif
 
 	} while (0);
 
@@ -14,20 +14,152 @@
 #ifndef _OBK_LOGGING_H
 #define _OBK_LOGGING_H
 
+#include "../obk_config.h"
+
 void addLogAdv(int level, int feature, const char *fmt, ...);
 void LOG_SetRawSocketCallback(int newFD);
+#if ENABLE_LOG_BINARY
+// counters of binary log records, see logmode command
+void LOG_GetRecordStats(int *written, int *dropped, int *lostByHttp);
+#endif
+
+// log call sites tracked by rate limiter, see lograte command
+#define LOG_MAX_SITES	32	// must be a power of two
+typedef struct logSiteInfo_s {
+	// start of format string
+	char text[24];
+	int feature;
+	unsigned int count;
+	unsigned int suppressed;
+} logSiteInfo_t;
+
+void LOG_RunEverySecond();
+int LOG_GetNoisySites(logSiteInfo_t *out, int maxCount);
+void LOG_GetRateLimitStats(int *limit, int *burst, int *untracked);
+
+// Compile-time log stripping, see LOG_COMPILED_LEVEL in obk_config.h.
+// Levels are numbers from log_levels below.
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL		6
+#endif
+#ifndef LOG_COMPILED_LEVEL_HTTP
+#define LOG_COMPILED_LEVEL_HTTP		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_MQTT
+#define LOG_COMPILED_LEVEL_MQTT		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_CFG
+#define LOG_COMPILED_LEVEL_CFG		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_HTTP_CLIENT
+#define LOG_COMPILED_LEVEL_HTTP_CLIENT		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_OTA
+#define LOG_COMPILED_LEVEL_OTA		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_PINS
+#define LOG_COMPILED_LEVEL_PINS		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_MAIN
+#define LOG_COMPILED_LEVEL_MAIN		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_GENERAL
+#define LOG_COMPILED_LEVEL_GENERAL		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_API
+#define LOG_COMPILED_LEVEL_API		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_LFS
+#define LOG_COMPILED_LEVEL_LFS		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_CMD
+#define LOG_COMPILED_LEVEL_CMD		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_NTP
+#define LOG_COMPILED_LEVEL_NTP		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_TUYAMCU
+#define LOG_COMPILED_LEVEL_TUYAMCU		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_I2C
+#define LOG_COMPILED_LEVEL_I2C		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_ENERGYMETER
+#define LOG_COMPILED_LEVEL_ENERGYMETER		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_EVENT
+#define LOG_COMPILED_LEVEL_EVENT		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_DGR
+#define LOG_COMPILED_LEVEL_DGR		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_DDP
+#define LOG_COMPILED_LEVEL_DDP		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_RAW
+#define LOG_COMPILED_LEVEL_RAW		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_HASS
+#define LOG_COMPILED_LEVEL_HASS		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_IR
+#define LOG_COMPILED_LEVEL_IR		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_SENSOR
+#define LOG_COMPILED_LEVEL_SENSOR		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_DRV
+#define LOG_COMPILED_LEVEL_DRV		LOG_COMPILED_LEVEL
+#endif
+#ifndef LOG_COMPILED_LEVEL_BERRY
+#define LOG_COMPILED_LEVEL_BERRY		LOG_COMPILED_LEVEL
+#endif
+
+// for a constant feature this folds into a single number
+#define LOG_COMPILED_LEVEL_FOR(x) ( \
+	(int)(x) == LOG_FEATURE_HTTP ? LOG_COMPILED_LEVEL_HTTP : \
+	(int)(x) == LOG_FEATURE_MQTT ? LOG_COMPILED_LEVEL_MQTT : \
+	(int)(x) == LOG_FEATURE_CFG ? LOG_COMPILED_LEVEL_CFG : \
+	(int)(x) == LOG_FEATURE_HTTP_CLIENT ? LOG_COMPILED_LEVEL_HTTP_CLIENT : \
+	(int)(x) == LOG_FEATURE_OTA ? LOG_COMPILED_LEVEL_OTA : \
+	(int)(x) == LOG_FEATURE_PINS ? LOG_COMPILED_LEVEL_PINS : \
+	(int)(x) == LOG_FEATURE_MAIN ? LOG_COMPILED_LEVEL_MAIN : \
+	(int)(x) == LOG_FEATURE_GENERAL ? LOG_COMPILED_LEVEL_GENERAL : \
+	(int)(x) == LOG_FEATURE_API ? LOG_COMPILED_LEVEL_API : \
+	(int)(x) == LOG_FEATURE_LFS ? LOG_COMPILED_LEVEL_LFS : \
+	(int)(x) == LOG_FEATURE_CMD ? LOG_COMPILED_LEVEL_CMD : \
+	(int)(x) == LOG_FEATURE_NTP ? LOG_COMPILED_LEVEL_NTP : \
+	(int)(x) == LOG_FEATURE_TUYAMCU ? LOG_COMPILED_LEVEL_TUYAMCU : \
+	(int)(x) == LOG_FEATURE_I2C ? LOG_COMPILED_LEVEL_I2C : \
+	(int)(x) == LOG_FEATURE_ENERGYMETER ? LOG_COMPILED_LEVEL_ENERGYMETER : \
+	(int)(x) == LOG_FEATURE_EVENT ? LOG_COMPILED_LEVEL_EVENT : \
+	(int)(x) == LOG_FEATURE_DGR ? LOG_COMPILED_LEVEL_DGR : \
+	(int)(x) == LOG_FEATURE_DDP ? LOG_COMPILED_LEVEL_DDP : \
+	(int)(x) == LOG_FEATURE_RAW ? LOG_COMPILED_LEVEL_RAW : \
+	(int)(x) == LOG_FEATURE_HASS ? LOG_COMPILED_LEVEL_HASS : \
+	(int)(x) == LOG_FEATURE_IR ? LOG_COMPILED_LEVEL_IR : \
+	(int)(x) == LOG_FEATURE_SENSOR ? LOG_COMPILED_LEVEL_SENSOR : \
+	(int)(x) == LOG_FEATURE_DRV ? LOG_COMPILED_LEVEL_DRV : \
+	(int)(x) == LOG_FEATURE_BERRY ? LOG_COMPILED_LEVEL_BERRY : \
+	LOG_COMPILED_LEVEL)
+
+// Level is checked before the call, so arguments of disabled logs are not
+// evaluated, and logs above compiled level are removed by the compiler.
+// Feature filter is left to addLogAdv, it would cost too much flash inline.
+#define LOG_IS_ENABLED(level, x) ((level) <= LOG_COMPILED_LEVEL_FOR(x) && (level) <= g_loglevel)
+#define ADDLOG_LEVEL(level, x, fmt, ...) (LOG_IS_ENABLED(level, x) ? addLogAdv(level, x, fmt, ##__VA_ARGS__) : (void)0)
+
+#define ADDLOG_ERROR(x, fmt, ...) ADDLOG_LEVEL(LOG_ERROR, x, fmt, ##__VA_ARGS__)
+#define ADDLOG_WARN(x, fmt, ...)  ADDLOG_LEVEL(LOG_WARN, x, fmt, ##__VA_ARGS__)
+#define ADDLOG_INFO(x, fmt, ...)  ADDLOG_LEVEL(LOG_INFO, x, fmt, ##__VA_ARGS__)
+#define ADDLOG_DEBUG(x, fmt, ...) ADDLOG_LEVEL(LOG_DEBUG, x, fmt, ##__VA_ARGS__)
+#define ADDLOG_EXTRADEBUG(x, fmt, ...) ADDLOG_LEVEL(LOG_EXTRADEBUG, x, fmt, ##__VA_ARGS__)
 
-#define ADDLOG_ERROR(x, fmt, ...) addLogAdv(LOG_ERROR, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_WARN(x, fmt, ...)  addLogAdv(LOG_WARN, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_INFO(x, fmt, ...)  addLogAdv(LOG_INFO, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_DEBUG(x, fmt, ...) addLogAdv(LOG_DEBUG, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_EXTRADEBUG(x, fmt, ...) addLogAdv(LOG_EXTRADEBUG, x, fmt, ##__VA_ARGS__)
-
-#define ADDLOGF_ERROR(fmt, ...) addLogAdv(LOG_ERROR, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_WARN(fmt, ...)  addLogAdv(LOG_WARN, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_INFO(fmt, ...)  addLogAdv(LOG_INFO, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_DEBUG(fmt, ...) addLogAdv(LOG_DEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_EXTRADEBUG(fmt, ...) addLogAdv(LOG_EXTRADEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#define ADDLOGF_ERROR(fmt, ...) ADDLOG_LEVEL(LOG_ERROR, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#define ADDLOGF_WARN(fmt, ...)  ADDLOG_LEVEL(LOG_WARN, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#define ADDLOGF_INFO(fmt, ...)  ADDLOG_LEVEL(LOG_INFO, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#define ADDLOGF_DEBUG(fmt, ...) ADDLOG_LEVEL(LOG_DEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#define ADDLOGF_EXTRADEBUG(fmt, ...) ADDLOG_LEVEL(LOG_EXTRADEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
 
 
 extern int g_loglevel;
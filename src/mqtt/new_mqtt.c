@@ -15,6 +15,7 @@
 #include "../driver/drv_ntp.h"
 #include "../driver/drv_tuyaMCU.h"
 #include "../ota/ota.h"
+#include "../quicktick.h"
 #ifndef WINDOWS
 #include <lwip/dns.h>
 #endif
@@ -75,6 +76,10 @@ extern void MQTT_TriggerRead();
 #define UNLOCK_TCPIP_CORE()
 #endif
 
+#ifndef portTICK_RATE_MS
+#define portTICK_RATE_MS ( ( portTickType ) 1000 / configTICK_RATE_HZ )
+#endif
+
 //
 // Variables for periodical self state broadcast
 //
@@ -91,76 +96,240 @@ static short g_teleState_interval = 120;
 static short g_teleSensor_interval = 3;
 
 /////////////////////////////////////////////////////////////
-// mqtt receive buffer, so we can action in our threads, not
-// in tcp_thread
+// mqtt receive slab, so we can action in our threads, not
+// in tcp_thread. Topic and payload are copied from LWIP once,
+// into a record, and callbacks get pointers into that record.
+// Records are reference counted - being queued is one reference,
+// MQTT_RetainRequest adds more - and space is reclaimed when the
+// oldest record drops to zero.
 //
-#define MQTT_RX_BUFFER_MAX 4096
-unsigned char mqtt_rx_buffer[MQTT_RX_BUFFER_MAX];
-int mqtt_rx_buffer_head;
-int mqtt_rx_buffer_tail;
-int mqtt_rx_buffer_count;
-unsigned char temp_topic[128];
-unsigned char temp_data[2048];
-
-int addLenData(int len, const unsigned char *data){
-	mqtt_rx_buffer[mqtt_rx_buffer_head] = (len >> 8) & 0xff;
-	mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count++;
-	mqtt_rx_buffer[mqtt_rx_buffer_head] = (len) & 0xff;
-	mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count++;
-	for (int i = 0; i < len; i++){
-		mqtt_rx_buffer[mqtt_rx_buffer_head] = data[i];
-		mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-		mqtt_rx_buffer_count++;
-	}
-	return len + 2;
-}
-
-int getLenData(int *len, unsigned char *data, int maxlen){
-	int l;
-	l = mqtt_rx_buffer[mqtt_rx_buffer_tail];
-	mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count--;
-	l = l<<8;
-	l |= mqtt_rx_buffer[mqtt_rx_buffer_tail];
-	mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count--;
-
-	for (int i = 0; i < l; i++){
-		if (i < maxlen){
-			data[i] = mqtt_rx_buffer[mqtt_rx_buffer_tail];
-		}
-		mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-		mqtt_rx_buffer_count--;
-	}
-	if (mqtt_rx_buffer_count < 0){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer underflow!!!");
-		mqtt_rx_buffer_count = 0;
-		mqtt_rx_buffer_tail = mqtt_rx_buffer_head = 0;
-	}
-
-	if (l > maxlen){
-		*len = maxlen;
-	} else {
-		*len = l;
+typedef struct mqttRxRecord_s {
+	unsigned short size;
+	unsigned char refs;
+	// set when whole payload has arrived
+	unsigned char ready;
+	unsigned int callbackMask;
+	unsigned short topicLen;
+	unsigned short dataLen;
+	unsigned short written;
+	unsigned short reserved;
+	unsigned int postedTime;
+	// topic and payload follow, both terminated
+} mqttRxRecord_t;
+
+#define MQTT_RX_RECORD(ofs) ((mqttRxRecord_t*)(g_mqttRx + (ofs)))
+#define MQTT_RX_TOPIC(rec) ((char*)((rec) + 1))
+#define MQTT_RX_DATA(rec) ((unsigned char*)((rec) + 1) + (rec)->topicLen + 1)
+
+static byte g_mqttRx[MQTT_RX_BUFFER_MAX];
+static int g_mqttRxHead = 0;
+static int g_mqttRxTail = 0;
+// oldest record not processed yet
+static int g_mqttRxRead = 0;
+static int g_mqttRxUnread = 0;
+// when records wrap around, this is the end of the older part
+static int g_mqttRxEnd = MQTT_RX_BUFFER_MAX;
+static int g_mqttRxUsed = 0;
+// record filled by mqtt_incoming_data_cb, -1 if none
+static int g_mqttRxWriting = -1;
+static int g_mqttRxHighWater = 0;
+static int g_mqttRxDropped = 0;
+static int g_mqttRxProcessed = 0;
+static int g_mqttRxMaxLatency = 0;
+static unsigned int g_mqttRxTotalLatency = 0;
+// advanced by quick tick, simulator time for MQTT_NowMS
+static unsigned int g_mqttTimeMS = 0;
+
+// time for latency stats, in ms
+static unsigned int MQTT_NowMS() {
+#ifdef WINDOWS
+	// tick count is not simulated
+	return g_mqttTimeMS;
+#else
+	return xTaskGetTickCount() * portTICK_RATE_MS;
+#endif
+}
+
+// reserves record, must be called with mutex taken
+static int MQTT_Rx_Alloc(unsigned int callbackMask, const char* topic, int topicLen, unsigned int dataLen) {
+	mqttRxRecord_t* rec;
+	int size;
+	int ofs;
+
+	if (dataLen > MQTT_RX_BUFFER_MAX) {
+		return -1;
+	}
+	size = (sizeof(mqttRxRecord_t) + topicLen + 1 + dataLen + 1 + 3) & ~3;
+	if (size > MQTT_RX_BUFFER_MAX) {
+		return -1;
+	}
+	if (g_mqttRxUsed == 0) {
+		g_mqttRxHead = g_mqttRxTail = 0;
+		g_mqttRxEnd = MQTT_RX_BUFFER_MAX;
+	}
+	if (g_mqttRxHead < g_mqttRxTail || (g_mqttRxHead == g_mqttRxTail && g_mqttRxUsed)) {
+		// wrapped, free space is only between head and tail
+		if (g_mqttRxHead + size > g_mqttRxTail) {
+			return -1;
+		}
+		ofs = g_mqttRxHead;
+	}
+	else if (g_mqttRxHead + size <= MQTT_RX_BUFFER_MAX) {
+		ofs = g_mqttRxHead;
+	}
+	else if (size <= g_mqttRxTail) {
+		// records must be contiguous, so wrap and leave the rest unused
+		g_mqttRxEnd = g_mqttRxHead;
+		ofs = 0;
+	}
+	else {
+		return -1;
+	}
+	g_mqttRxHead = ofs + size;
+	g_mqttRxUsed += size;
+	if (g_mqttRxUsed > g_mqttRxHighWater) {
+		g_mqttRxHighWater = g_mqttRxUsed;
+	}
+	if (g_mqttRxUnread == 0) {
+		g_mqttRxRead = ofs;
+	}
+	g_mqttRxUnread++;
+
+	rec = MQTT_RX_RECORD(ofs);
+	rec->size = size;
+	rec->refs = 1;
+	rec->ready = 0;
+	rec->callbackMask = callbackMask;
+	rec->topicLen = topicLen;
+	rec->dataLen = dataLen;
+	rec->written = 0;
+	memcpy(MQTT_RX_TOPIC(rec), topic, topicLen);
+	MQTT_RX_TOPIC(rec)[topicLen] = 0;
+	return ofs;
+}
+
+// marks record as complete, must be called with mutex taken
+static void MQTT_Rx_Commit(int ofs) {
+	mqttRxRecord_t* rec = MQTT_RX_RECORD(ofs);
+
+	rec->dataLen = rec->written;
+	MQTT_RX_DATA(rec)[rec->written] = 0;
+	rec->postedTime = MQTT_NowMS();
+	rec->ready = 1;
+}
+
+// must be called with mutex taken
+static void MQTT_Rx_Release(int ofs) {
+	mqttRxRecord_t* rec;
+
+	rec = MQTT_RX_RECORD(ofs);
+	if (rec->refs) {
+		rec->refs--;
+	}
+	while (g_mqttRxUsed > 0) {
+		rec = MQTT_RX_RECORD(g_mqttRxTail);
+		if (rec->refs) {
+			break;
+		}
+		g_mqttRxTail += rec->size;
+		g_mqttRxUsed -= rec->size;
+		if (g_mqttRxTail >= g_mqttRxEnd) {
+			g_mqttRxTail = 0;
+			g_mqttRxEnd = MQTT_RX_BUFFER_MAX;
+		}
+	}
+}
+
+// takes oldest complete record for processing, must be called with mutex taken
+static int MQTT_Rx_Next() {
+	mqttRxRecord_t* rec;
+	int ofs;
+
+	if (g_mqttRxUnread == 0) {
+		return -1;
+	}
+	ofs = g_mqttRxRead;
+	rec = MQTT_RX_RECORD(ofs);
+	// still receiving, later ones must wait to keep the order
+	if (rec->ready == 0) {
+		return -1;
+	}
+	g_mqttRxUnread--;
+	g_mqttRxRead += rec->size;
+	if (g_mqttRxUnread && g_mqttRxRead >= g_mqttRxEnd) {
+		g_mqttRxRead = 0;
+	}
+	return ofs;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Publish instrumentation. Latency is measured from the time publish
+// was requested (or queued) until LWIP accepted it, and from then until
+// broker acknowledged it (QoS 1 only). Both go into fixed histograms.
+//
+#define MQTT_LATENCY_BUCKETS 10
+// upper bounds of histogram buckets in ms, last bucket is for the rest
+static const unsigned short g_mqttLatencyBounds[MQTT_LATENCY_BUCKETS - 1] = { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000 };
+
+typedef struct mqttLatencyStats_s {
+	int hist[MQTT_LATENCY_BUCKETS];
+	int count;
+	unsigned int total;
+	unsigned int max;
+} mqttLatencyStats_t;
+
+static mqttLatencyStats_t g_mqttAcceptLatency;
+static mqttLatencyStats_t g_mqttAckLatency;
+static int g_mqttQueueHighWater = 0;
+static int g_mqttMutexTakes = 0;
+static int g_mqttMutexFails = 0;
+static unsigned int g_mqttMutexWaitTotal = 0;
+static unsigned int g_mqttMutexWaitMax = 0;
+static int g_mqttBytesThisSecond = 0;
+static int g_mqttBytesPerSecond = 0;
+static int g_mqttBytesPerSecondMax = 0;
+static int g_mqttPublishesThisSecond = 0;
+static int g_mqttPublishesPerSecond = 0;
+
+static void MQTT_Latency_Add(mqttLatencyStats_t* stats, unsigned int ms) {
+	int i;
+
+	for (i = 0; i < MQTT_LATENCY_BUCKETS - 1; i++) {
+		if (ms < g_mqttLatencyBounds[i]) {
+			break;
+		}
+	}
+	stats->hist[i]++;
+	stats->count++;
+	stats->total += ms;
+	if (ms > stats->max) {
+		stats->max = ms;
 	}
-	return l + 2;
 }
 
 static SemaphoreHandle_t g_mutex = 0;
 
 static bool MQTT_Mutex_Take(int del) {
+	unsigned int start;
+	unsigned int wait;
 	int taken;
 
 	if (g_mutex == 0)
 	{
 		g_mutex = xSemaphoreCreateMutex();
 	}
+	start = MQTT_NowMS();
 	taken = xSemaphoreTake(g_mutex, del);
+	wait = MQTT_NowMS() - start;
+	g_mqttMutexTakes++;
+	g_mqttMutexWaitTotal += wait;
+	if (wait > g_mqttMutexWaitMax) {
+		g_mqttMutexWaitMax = wait;
+	}
 	if (taken == pdTRUE) {
 		return true;
 	}
+	g_mqttMutexFails++;
 	return false;
 }
 
@@ -169,6 +338,93 @@ static void MQTT_Mutex_Free()
 	xSemaphoreGive(g_mutex);
 }
 
+// Guards publish queue and slab. Items are added from any thread, but taken
+// out only by PublishQueuedItems in mqtt worker thread. It's never held while
+// taking g_mutex, so publish can queue items while holding g_mutex.
+static SemaphoreHandle_t g_mqttQueueMutex = 0;
+
+static void MQTT_Queue_Lock() {
+	if (g_mqttQueueMutex == 0)
+	{
+		g_mqttQueueMutex = xSemaphoreCreateMutex();
+	}
+	// held only for short queue operations, so it's just waited for
+	while (xSemaphoreTake(g_mqttQueueMutex, 1000) != pdTRUE)
+	{
+	}
+}
+static void MQTT_Queue_Unlock() {
+	xSemaphoreGive(g_mqttQueueMutex);
+}
+
+// Quick tick is a timer callback with small stack on some platforms, so
+// publishing from queue and connect attempts are only requested there, and
+// done by mqtt worker thread. Simulator is single threaded and does it at once.
+static volatile bool g_mqttWantQueueDrain = false;
+static volatile bool g_mqttWantConnect = false;
+#ifndef WINDOWS
+static SemaphoreHandle_t g_mqttWorkerSem = 0;
+#endif
+
+static void MQTT_Reconnect_Try();
+
+static void MQTT_RunWork() {
+	if (g_mqttWantConnect) {
+		g_mqttWantConnect = false;
+		MQTT_Reconnect_Try();
+	}
+	if (g_mqttWantQueueDrain) {
+		g_mqttWantQueueDrain = false;
+		PublishQueuedItems();
+	}
+}
+#ifndef WINDOWS
+static void MQTT_Worker_Thread(beken_thread_arg_t arg) {
+	while (1) {
+		xSemaphoreTake(g_mqttWorkerSem, 1000);
+		MQTT_RunWork();
+	}
+}
+#endif
+static void MQTT_Worker_Start() {
+#ifndef WINDOWS
+	OSStatus err;
+
+	if (g_mqttWorkerSem) {
+		return;
+	}
+	g_mqttWorkerSem = xSemaphoreCreateBinary();
+	err = rtos_create_thread(NULL, BEKEN_APPLICATION_PRIORITY,
+		"mqtt_worker",
+		(beken_thread_function_t)MQTT_Worker_Thread,
+		MQTT_WORKER_STACK_SIZE,
+		(beken_thread_arg_t)0);
+	if (err != kNoErr)
+	{
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "create \"mqtt_worker\" thread failed with %i!", err);
+	}
+#endif
+}
+static void MQTT_RequestWork() {
+#ifdef WINDOWS
+	MQTT_RunWork();
+#else
+	if (g_mqttWorkerSem) {
+		xSemaphoreGive(g_mqttWorkerSem);
+	}
+#endif
+}
+static void MQTT_RequestQueueDrain() {
+	g_mqttWantQueueDrain = true;
+	MQTT_RequestWork();
+}
+static void MQTT_RequestConnect() {
+	g_mqttWantConnect = true;
+	MQTT_RequestWork();
+}
+
+static unsigned int MQTT_MatchCallbacks(const char* topic);
+
 // this is called from tcp_thread context to queue received mqtt,
 // and then we'll retrieve them from our own thread for processing.
 //
@@ -176,15 +432,32 @@ static void MQTT_Mutex_Free()
 // system can use it to spoof MQTT packets to check if MQTT commands
 // are working...
 int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *data, int datalen){
+	unsigned int callbackMask;
+	mqttRxRecord_t* rec;
+	int ofs;
+
 	MQTT_Mutex_Take(100);
-	if ((MQTT_RX_BUFFER_MAX - 1 - mqtt_rx_buffer_count) < topiclen + datalen + 2 + 2){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %s", topic);
-	} else {
-		addLenData(topiclen, (unsigned char *)topic);
-		addLenData(datalen, data);
+	callbackMask = MQTT_MatchCallbacks(topic);
+	if (callbackMask == 0) {
+		MQTT_Mutex_Free();
+		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "MQTT topic not handled: %s", topic);
+		return 0;
+	}
+	ofs = MQTT_Rx_Alloc(callbackMask, topic, topiclen, datalen);
+	if (ofs < 0) {
+		g_mqttRxDropped++;
+	}
+	else {
+		rec = MQTT_RX_RECORD(ofs);
+		memcpy(MQTT_RX_DATA(rec), data, datalen);
+		rec->written = datalen;
+		MQTT_Rx_Commit(ofs);
 	}
 	MQTT_Mutex_Free();
-
+	if (ofs < 0) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %s", topic);
+		return 1;
+	}
 
 #ifdef PLATFORM_BEKEN
 	MQTT_TriggerRead();
@@ -194,29 +467,75 @@ int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *dat
 int MQTT_Post_Received_Str(const char *topic, const char *data) {
 	return MQTT_Post_Received(topic, strlen(topic), (const unsigned char*)data, strlen(data));
 }
-int get_received(char **topic, int *topiclen, unsigned char **data, int *datalen){
-	int res = 0;
+void MQTT_RetainRequest(obk_mqtt_request_t* request) {
 	MQTT_Mutex_Take(100);
-	if (mqtt_rx_buffer_tail != mqtt_rx_buffer_head){
-		getLenData(topiclen, temp_topic, sizeof(temp_topic)-1);
-		temp_topic[*topiclen] = 0;
-		getLenData(datalen, temp_data, sizeof(temp_data)-1);
-		temp_data[*datalen] = 0;
-		*topic = (char *)temp_topic;
-		*data = temp_data;
-		res = 1;
-	}
+	MQTT_RX_RECORD(request->slabOffset)->refs++;
 	MQTT_Mutex_Free();
-	return res;
+}
+void MQTT_ReleaseRequest(obk_mqtt_request_t* request) {
+	MQTT_Mutex_Take(100);
+	MQTT_Rx_Release(request->slabOffset);
+	MQTT_Mutex_Free();
+}
+void MQTT_GetReceiveStats(int* outUsed, int* outHighWater, int* outDropped, int* outProcessed, int* outMaxLatencyMS) {
+	*outUsed = g_mqttRxUsed;
+	*outHighWater = g_mqttRxHighWater;
+	*outDropped = g_mqttRxDropped;
+	*outProcessed = g_mqttRxProcessed;
+	*outMaxLatencyMS = g_mqttRxMaxLatency;
 }
 //
 //////////////////////////////////////////////////////////////////////
 
-#define MQTT_QUEUE_ITEM_IS_REUSABLE(x)  (x->topic[0] == 0)
-#define MQTT_QUEUE_ITEM_SET_REUSABLE(x) (x->topic[0] = 0)
-
-MqttPublishItem_t* g_MqttPublishQueueHead = NULL;
-int g_MqttPublishItemsQueued = 0;   //Items in the queue waiting to be published. This is not the queue length.
+// Publish queue is a ring of small item descriptors, oldest first.
+// Strings are kept in slab - a byte ring of records, each record starts
+// with mqttSlabRecord_t. Records are freed in any order (coalesced item
+// may get a new record), so space is reclaimed when the oldest record dies.
+typedef struct mqttSlabRecord_s {
+	unsigned short size;
+	unsigned short alive;
+} mqttSlabRecord_t;
+
+static MqttPublishItem_t g_mqttQueue[MQTT_MAX_QUEUE_SIZE];
+static int g_mqttQueueFirst = 0;
+int g_MqttPublishItemsQueued = 0;   //Items in the queue waiting to be published.
+static byte* g_mqttSlab = 0;
+static int g_mqttSlabHead = 0;
+static int g_mqttSlabTail = 0;
+// when records wrap around, this is the end of the older part
+static int g_mqttSlabEnd = MQTT_QUEUE_SLAB_SIZE;
+static int g_mqttSlabUsed = 0;
+static int g_mqttQueueCoalesced = 0;
+static int g_mqttQueueDropped = 0;
+static bool g_mqttQueueCoalesce = false;
+
+// Token buckets of egress classes, last one is for all of them together.
+// Tokens are in thousandths of publish, refilled by quick tick.
+typedef struct mqttEgressBucket_s {
+	// publishes per second, 0 means no limit
+	int rate;
+	int burst;
+	int tokens;
+	int sent;
+	int deferred;
+	// publishes taken from queue and their wait there
+	int waited;
+	int maxWait;
+	unsigned int totalWait;
+} mqttEgressBucket_t;
+
+#define MQTT_EGRESS_TOTAL MQTT_EGRESS_MAX
+static mqttEgressBucket_t g_mqttEgress[MQTT_EGRESS_MAX + 1] = {
+	// control is never limited
+	{ 0 },
+	{ 0 },
+	{ MQTT_EGRESS_DEFAULT_TELE_RATE, MQTT_EGRESS_DEFAULT_TELE_RATE * 2, MQTT_EGRESS_DEFAULT_TELE_RATE * 2000, 0, 0, 0, 0, 0 },
+	{ MQTT_EGRESS_DEFAULT_DISCOVERY_RATE, MQTT_EGRESS_DEFAULT_DISCOVERY_RATE, MQTT_EGRESS_DEFAULT_DISCOVERY_RATE * 1000, 0, 0, 0, 0, 0 },
+	{ MQTT_EGRESS_DEFAULT_TOTAL_RATE, MQTT_EGRESS_DEFAULT_TOTAL_RATE, MQTT_EGRESS_DEFAULT_TOTAL_RATE * 1000, 0, 0, 0, 0, 0 },
+};
+static const char* g_mqttEgressNames[MQTT_EGRESS_MAX + 1] = { "control", "state", "tele", "discovery", "total" };
+// items of each class waiting in publish queue
+static int g_mqttEgressQueued[MQTT_EGRESS_MAX];
 
 // from mqtt.c
 extern void mqtt_disconnect(mqtt_client_t* client);
@@ -243,16 +562,86 @@ typedef struct mqtt_callback_tag {
 	mqtt_callback_fn callback;
 } mqtt_callback_t;
 
+// one bit per callback in masks below
 #define MAX_MQTT_CALLBACKS 32
 static mqtt_callback_t* callbacks[MAX_MQTT_CALLBACKS];
 static int numCallbacks = 0;
-// note: only one incomming can be processed at a time.
-static obk_mqtt_request_t g_mqtt_request;
-static obk_mqtt_request_t g_mqtt_request_cb;
+
+// Subscription topics of callbacks are compiled into a trie, one node per
+// topic level, so incoming topic is matched once, level by level, no matter
+// how many callbacks are registered. Node text points into subscriptionTopic
+// (or topic) of callback, so trie is rebuilt whenever callbacks change.
+typedef struct mqttTopicNode_s {
+	const char* text;
+	unsigned short len;
+	// indexes in g_topicNodes, 0 means none (root is never a child)
+	unsigned char firstChild;
+	unsigned char nextSibling;
+	// callbacks which subscription ends at this level
+	unsigned int callbackMask;
+} mqttTopicNode_t;
+
+#define MQTT_MAX_TOPIC_NODES 128
+static mqttTopicNode_t g_topicNodes[MQTT_MAX_TOPIC_NODES];
+static int g_numTopicNodes = 1;
+
+#define MQTT_TOPIC_NODE_IS(n, c) ((n)->len == 1 && (n)->text[0] == (c))
 
 #define LOOPS_WITH_DISCONNECTED 15
 int mqtt_loopsWithDisconnected = 0;
 int mqtt_reconnect = 0;
+
+// Fast reconnect, see mqtt_fastReconnect. Instead of waiting LOOPS_WITH_DISCONNECTED
+// seconds, connect is attempted from quick tick with exponential backoff. After a
+// reconnect, only channels changed since their last acknowledged publish are sent
+// again, instead of whole device state. LWIP always connects with clean session,
+// so subscriptions are still renewed on every connect.
+static bool g_mqttFastReconnect = false;
+static int g_mqttBackoffMinMS = MQTT_BACKOFF_DEFAULT_MIN_MS;
+static int g_mqttBackoffMaxMS = MQTT_BACKOFF_DEFAULT_MAX_MS;
+// delay before next failed attempt is retried, 0 means at once
+static int g_mqttBackoffMS = 0;
+static bool g_mqttConnectPending = false;
+static unsigned int g_mqttNextConnectMS = 0;
+static unsigned int g_mqttConnectStartMS = 0;
+// broker has accepted us before, so it already has our state
+static bool g_mqttHadSession = false;
+// connection was accepted and not lost since
+static bool g_mqttSessionUp = false;
+static bool g_mqttWaitingForWiFi = false;
+static int g_mqttConnectAttempts = 0;
+static int g_mqttLastConnectMS = 0;
+static int g_mqttMaxConnectMS = 0;
+static int g_mqttReconciled = 0;
+// last resolved address of broker, used again until connect to it fails
+static bool g_mqttDnsCacheValid = false;
+static int g_mqttDnsCacheHits = 0;
+
+// Per channel sequence numbers - the one of latest requested publish, and the
+// one of latest publish acknowledged by broker (or accepted by LWIP for QoS 0)
+static unsigned int g_mqttSeq = 0;
+static unsigned int g_mqttChannelSeq[CHANNEL_MAX];
+static unsigned int g_mqttChannelAckedSeq[CHANNEL_MAX];
+
+// QoS 1 publishes waiting for broker ack. Publish request callback gets slot
+// and its tag, so a late ack can't be taken for the publish that reused the slot.
+typedef struct mqttInflight_s {
+	unsigned int sendTime;
+	unsigned int seq;
+	// -1 if it's not a channel topic
+	short channel;
+	unsigned short tag;
+} mqttInflight_t;
+
+// bits of slot index in mqtt_pub_request_cb argument, tag is above them
+#define MQTT_INFLIGHT_SLOT_BITS		5
+#define MQTT_INFLIGHT_SLOT_MASK		((1 << MQTT_INFLIGHT_SLOT_BITS) - 1)
+#if MQTT_INFLIGHT_SLOTS > (1 << MQTT_INFLIGHT_SLOT_BITS)
+#error "MQTT_INFLIGHT_SLOTS does not fit in MQTT_INFLIGHT_SLOT_BITS"
+#endif
+
+static mqttInflight_t g_mqttInflight[MQTT_INFLIGHT_SLOTS];
+static int g_mqttInflightNext = 0;
 // set for the device to broadcast self state on start
 int g_bPublishAllStatesNow = 0;
 int g_publishItemIndex = PUBLISHITEM_ALL_INDEX_FIRST;
@@ -397,6 +786,130 @@ char* MQTT_GetStatusMessage(void)
 	return mqtt_status_message;
 }
 
+static int MQTT_Trie_AddLevel(int parent, const char* text, int len) {
+	mqttTopicNode_t* node;
+	int i;
+
+	for (i = g_topicNodes[parent].firstChild; i; i = g_topicNodes[i].nextSibling) {
+		if (g_topicNodes[i].len == len && !memcmp(g_topicNodes[i].text, text, len)) {
+			return i;
+		}
+	}
+	if (g_numTopicNodes >= MQTT_MAX_TOPIC_NODES) {
+		return -1;
+	}
+	i = g_numTopicNodes++;
+	node = &g_topicNodes[i];
+	node->text = text;
+	node->len = len;
+	node->firstChild = 0;
+	node->callbackMask = 0;
+	node->nextSibling = g_topicNodes[parent].firstChild;
+	g_topicNodes[parent].firstChild = i;
+	return i;
+}
+// adds levels of filter below given node, returns node of last level or -1 if full.
+// Filter may have MQTT wildcards, + for single level, # for all remaining levels
+static int MQTT_Trie_Add(int node, const char* filter, int filterLen) {
+	const char* end = filter + filterLen;
+	const char* p = filter;
+	const char* q;
+
+	while (1) {
+		q = p;
+		while (q < end && *q != '/') {
+			q++;
+		}
+		node = MQTT_Trie_AddLevel(node, p, q - p);
+		if (node < 0 || q >= end) {
+			return node;
+		}
+		p = q + 1;
+	}
+}
+static void MQTT_Trie_Rebuild() {
+	mqtt_callback_t* cb;
+	int i, len, node;
+
+	MQTT_Mutex_Take(100);
+	g_numTopicNodes = 1;
+	memset(&g_topicNodes[0], 0, sizeof(g_topicNodes[0]));
+	for (i = 0; i < numCallbacks; i++) {
+		cb = callbacks[i];
+		if (cb == 0) {
+			continue;
+		}
+		if (cb->subscriptionTopic && cb->subscriptionTopic[0]) {
+			node = MQTT_Trie_Add(0, cb->subscriptionTopic, strlen(cb->subscriptionTopic));
+		}
+		else {
+			// no subscription, take everything under base topic
+			len = strlen(cb->topic);
+			if (len && cb->topic[len - 1] == '/') {
+				len--;
+			}
+			node = MQTT_Trie_Add(0, cb->topic, len);
+			if (node >= 0) {
+				node = MQTT_Trie_AddLevel(node, "#", 1);
+			}
+		}
+		if (node < 0) {
+			ADDLOG_ERROR(LOG_FEATURE_MQTT, "MQTT topic tree is full, callback %i will not be called", cb->ID);
+			continue;
+		}
+		g_topicNodes[node].callbackMask |= 1u << i;
+	}
+	MQTT_Mutex_Free();
+}
+// returns mask of callbacks which subscriptions match topic at given node
+static unsigned int MQTT_Trie_Match(int parent, const char* p, bool bFirstLevel) {
+	mqttTopicNode_t* node;
+	const char* q;
+	unsigned int mask = 0;
+	int i, j;
+	// wildcards at first level do not match $SYS etc
+	bool bWildcardsAllowed = !(bFirstLevel && *p == '$');
+
+	q = p;
+	while (*q && *q != '/') {
+		q++;
+	}
+	for (i = g_topicNodes[parent].firstChild; i; i = node->nextSibling) {
+		node = &g_topicNodes[i];
+		if (MQTT_TOPIC_NODE_IS(node, '#')) {
+			if (bWildcardsAllowed) {
+				mask |= node->callbackMask;
+			}
+			continue;
+		}
+		if (MQTT_TOPIC_NODE_IS(node, '+')) {
+			if (!bWildcardsAllowed) {
+				continue;
+			}
+		}
+		else if (node->len != q - p || memcmp(node->text, p, node->len)) {
+			continue;
+		}
+		if (*q == 0) {
+			mask |= node->callbackMask;
+			// "a/#" matches also "a"
+			for (j = node->firstChild; j; j = g_topicNodes[j].nextSibling) {
+				if (MQTT_TOPIC_NODE_IS(&g_topicNodes[j], '#')) {
+					mask |= g_topicNodes[j].callbackMask;
+				}
+			}
+		}
+		else {
+			mask |= MQTT_Trie_Match(i, q + 1, false);
+		}
+	}
+	return mask;
+}
+// must be called with mutex taken
+static unsigned int MQTT_MatchCallbacks(const char* topic) {
+	return MQTT_Trie_Match(0, topic, true);
+}
+
 void MQTT_ClearCallbacks() {
 	int i;
 	for (i = 0; i < MAX_MQTT_CALLBACKS; i++) {
@@ -407,6 +920,7 @@ void MQTT_ClearCallbacks() {
 			callbacks[i] = 0;
 		}
 	}
+	MQTT_Trie_Rebuild();
 }
 // this can REPLACE callbacks, since we MAY wish to change the root topic....
 // in which case we would re-resigster all callbacks?
@@ -417,7 +931,7 @@ int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic,
 	if (!basetopic || !subscriptiontopic || !callback) {
 		return -1;
 	}
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT_RegisterCallback called for bT %s subT %s", basetopic, subscriptiontopic);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT_RegisterCallback called for bT %s subT %s", basetopic, subscriptiontopic);
 
 	// find existing to replace
 	for (index = 0; index < numCallbacks; index++) {
@@ -489,10 +1003,12 @@ int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic,
 		}
 	}
 
+	callbacks[index]->ID = ID;
 	callbacks[index]->callback = callback;
 	if (index == numCallbacks) {
 		numCallbacks++;
 	}
+	MQTT_Trie_Rebuild();
 
 	if (subscribechange) {
 		if (mqtt_client) {
@@ -519,6 +1035,7 @@ int MQTT_RemoveCallback(int ID) {
 				}
 				os_free(callbacks[index]);
 				callbacks[index] = NULL;
+				MQTT_Trie_Rebuild();
 				if (mqtt_client) {
 					mqtt_reconnect = 8;
 				}
@@ -585,7 +1102,7 @@ int channelGet(obk_mqtt_request_t* request) {
 		return 1;
 	}
 
-	addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "channelGet topic %i with arg %s", request->topic, request->received);
+	ADDLOG_DEBUG(LOG_FEATURE_MQTT, "channelGet topic %i with arg %s", request->topic, request->received);
 
 	p = MQTT_RemoveClientFromTopic(request->topic,0);
 
@@ -593,7 +1110,7 @@ int channelGet(obk_mqtt_request_t* request) {
 		return 0;
 	}
 
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "channelGet part topic %s", p);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "channelGet part topic %s", p);
 #if ENABLE_LED_BASIC
 	if (stribegins(p, "led_enableAll")) {
 		LED_SendEnableAllState();
@@ -627,7 +1144,8 @@ int channelGet(obk_mqtt_request_t* request) {
 		return 0;
 	}
 
-	MQTT_ChannelPublish(channel, 0);
+	// reply to get, so it's sent even if value was just published
+	MQTT_ChannelPublish(channel, OBK_PUBLISH_FLAG_NO_DEDUP);
 
 	// return 1 to stop processing callbacks here.
 	// return 0 to allow later callbacks to process this topic.
@@ -641,7 +1159,7 @@ int channelSet(obk_mqtt_request_t* request) {
 	const char* p;
 	const char *argument;
 
-	addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "channelSet topic %i with arg %s", request->topic, request->received);
+	ADDLOG_DEBUG(LOG_FEATURE_MQTT, "channelSet topic %i with arg %s", request->topic, request->received);
 
 	p = MQTT_RemoveClientFromTopic(request->topic,0);
 
@@ -670,7 +1188,7 @@ int channelSet(obk_mqtt_request_t* request) {
 		return 0;
 	}
 
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT client in mqtt_incoming_data_cb data is %.*s for ch %i\n", MQTT_MAX_DATA_LOG_LENGTH, request->received, channel);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT client in mqtt_incoming_data_cb data is %.*s for ch %i\n", MQTT_MAX_DATA_LOG_LENGTH, request->received, channel);
 
 	argument = ((const char*)request->received);
 
@@ -775,8 +1293,7 @@ int tasCmnd(obk_mqtt_request_t* request) {
 
 #if 1
 	args = (const char *)request->received;
-	// I think that our function get_received always ensured that
-	// there is a NULL terminating character after payload of MQTT
+	// receive slab always keeps a NULL terminating character after payload of MQTT
 	// So we can feed it directly as command
 	CMD_ExecuteCommandArgs(p, args, COMMAND_FLAG_SOURCE_MQTT);
 #if ENABLE_TASMOTA_JSON
@@ -830,15 +1347,177 @@ static void MQTT_disconnect(mqtt_client_t* client)
 
 }
 
+static void MQTT_ConfirmChannel(int channel, unsigned int seq) {
+	if (channel >= 0 && (int)(seq - g_mqttChannelAckedSeq[channel]) > 0) {
+		g_mqttChannelAckedSeq[channel] = seq;
+	}
+}
+// Takes in-flight slot for QoS 1 publish, returns argument for mqtt_pub_request_cb
+static void* MQTT_Inflight_Add(int channel) {
+	mqttInflight_t* inflight;
+	int slot;
+
+	slot = g_mqttInflightNext;
+	g_mqttInflightNext = (g_mqttInflightNext + 1) % MQTT_INFLIGHT_SLOTS;
+	inflight = &g_mqttInflight[slot];
+	inflight->tag++;
+	inflight->sendTime = MQTT_NowMS();
+	inflight->channel = channel;
+	inflight->seq = channel >= 0 ? g_mqttChannelSeq[channel] : 0;
+	return (void*)(size_t)((((unsigned int)inflight->tag << MQTT_INFLIGHT_SLOT_BITS | slot) << 1) | 1);
+}
+
 /* Called when publish is complete either with sucess or failure */
+// arg is in-flight slot and tag (shifted left, lowest bit set) for QoS 1, 0 otherwise
 static void mqtt_pub_request_cb(void* arg, err_t result)
 {
+	mqttInflight_t* inflight;
+	unsigned int v;
+
 	if (result != ERR_OK)
 	{
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish result: %d(%s)\n", result, get_error_name(result));
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Publish result: %d(%s)\n", result, get_error_name(result));
 		mqtt_publish_errors++;
 	}
+	else if (arg)
+	{
+		v = (unsigned int)(size_t)arg >> 1;
+		inflight = &g_mqttInflight[v & MQTT_INFLIGHT_SLOT_MASK];
+		if (inflight->tag == (unsigned short)(v >> MQTT_INFLIGHT_SLOT_BITS)) {
+			MQTT_Latency_Add(&g_mqttAckLatency, (MQTT_NowMS() - inflight->sendTime) & 0x7FFFFFFF);
+			MQTT_ConfirmChannel(inflight->channel, inflight->seq);
+		}
+	}
+}
+
+// Class of topic for generic deduper, see MQTT_Dedup_Class_t
+static int MQTT_GetDedupClass(const char* topic) {
+	const char* clientId;
+	const char* p;
+	int len;
+
+	if (!strncmp(topic, "tele/", 5)) {
+		return DEDUP_CLASS_TELE;
+	}
+	clientId = CFG_GetMQTTClientId();
+	len = strlen(clientId);
+	if (strncmp(topic, clientId, len) || topic[len] != '/') {
+		return DEDUP_CLASS_OTHER;
+	}
+	p = topic + len + 1;
+	if (!isdigit((unsigned char)*p)) {
+		return DEDUP_CLASS_SENSOR;
+	}
+	while (isdigit((unsigned char)*p)) {
+		p++;
+	}
+	if (*p == 0 || *p == '/') {
+		return DEDUP_CLASS_CHANNEL;
+	}
+	return DEDUP_CLASS_SENSOR;
+}
+
+// "obk0696FB33/12/get" gives 12, other topics -1
+static int MQTT_GetTopicChannel(const char* topic) {
+	int channel;
+
+	if (MQTT_GetDedupClass(topic) != DEDUP_CLASS_CHANNEL) {
+		return -1;
+	}
+	channel = atoi(topic + strlen(CFG_GetMQTTClientId()) + 1);
+	return (channel >= 0 && channel < CHANNEL_MAX) ? channel : -1;
+}
+static int MQTT_GetEgressClass(const char* topic, const char* channel, int flags) {
+	const char* fullTopic;
+	int len;
+
+	fullTopic = (flags & OBK_PUBLISH_FLAG_RAW_TOPIC_NAME) ? channel : topic;
+	if (!strncmp(fullTopic, "stat/", 5)) {
+		return MQTT_EGRESS_CONTROL;
+	}
+	if (!strncmp(fullTopic, "tele/", 5)) {
+		return MQTT_EGRESS_TELE;
+	}
+	len = strlen(channel);
+	if (len > 7 && !strcmp(channel + len - 7, "/config")) {
+		return MQTT_EGRESS_DISCOVERY;
+	}
+	return MQTT_EGRESS_STATE;
+}
+
+static bool MQTT_Egress_HasToken(mqttEgressBucket_t* bucket) {
+	return bucket->rate == 0 || bucket->tokens >= 1000;
+}
+
+// command replies always go, others need a token of their class and a total one
+static bool MQTT_Egress_CanSend(int egressClass) {
+	if (egressClass == MQTT_EGRESS_CONTROL) {
+		return true;
+	}
+	return MQTT_Egress_HasToken(&g_mqttEgress[egressClass]) && MQTT_Egress_HasToken(&g_mqttEgress[MQTT_EGRESS_TOTAL]);
+}
+
+static void MQTT_Egress_Take(int egressClass) {
+	mqttEgressBucket_t* bucket = &g_mqttEgress[egressClass];
+	mqttEgressBucket_t* total = &g_mqttEgress[MQTT_EGRESS_TOTAL];
+
+	bucket->sent++;
+	total->sent++;
+	if (bucket->rate) {
+		bucket->tokens -= 1000;
+	}
+	if (total->rate) {
+		// command replies may overdraw it, so the rest waits for them
+		total->tokens -= 1000;
+		if (total->tokens < -total->burst * 1000) {
+			total->tokens = -total->burst * 1000;
+		}
+	}
+}
+
+static void MQTT_Egress_Refill(int deltaMS) {
+	mqttEgressBucket_t* bucket;
+	int i;
+
+	for (i = 0; i <= MQTT_EGRESS_MAX; i++) {
+		bucket = &g_mqttEgress[i];
+		if (bucket->rate == 0) {
+			continue;
+		}
+		bucket->tokens += bucket->rate * deltaMS;
+		if (bucket->tokens > bucket->burst * 1000) {
+			bucket->tokens = bucket->burst * 1000;
+		}
+	}
+}
+
+#if ENABLE_LITTLEFS
+// Stores publish that failed because broker is not connected, replayed by MQTT_Spool_Replay
+static void MQTT_SpoolPublish(const char* sTopic, const char* sChannel, const char* sVal, int flags, bool appendGet)
+{
+	char* pub_topic;
+	int egressClass;
+
+	pub_topic = (char*)os_malloc(strlen(sTopic) + 1 + strlen(sChannel) + 5 + 1); //5 for /get
+	if (pub_topic == NULL)
+	{
+		return;
+	}
+	if (flags & OBK_PUBLISH_FLAG_RAW_TOPIC_NAME)
+	{
+		strcpy(pub_topic, sChannel);
+	}
+	else
+	{
+		sprintf(pub_topic, "%s/%s%s", sTopic, sChannel, (appendGet == true ? "/get" : ""));
+	}
+	egressClass = MQTT_GetEgressClass(sTopic, sChannel, flags);
+	// only the latest state matters, but telemetry is history
+	MQTT_Spool_Write(pub_topic, sVal, flags | OBK_PUBLISH_FLAG_RAW_TOPIC_NAME,
+		egressClass == MQTT_EGRESS_STATE || egressClass == MQTT_EGRESS_DISCOVERY);
+	os_free(pub_topic);
 }
+#endif
 
 // This publishes value to the specified topic/channel.
 static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const char* sTopic, const char* sChannel, const char* sVal, int flags, bool appendGet)
@@ -852,10 +1531,16 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 	u8_t retain = 0; /* No don't retain such crappy payload... */
 	size_t sVal_len;
 	char* pub_topic;
+	int egressClass;
+	unsigned int requestTime;
+	void* ackArg;
+	int topicChannel;
 
 	if (client == 0)
 		return OBK_PUBLISH_WAS_DISCONNECTED;
 
+	requestTime = MQTT_NowMS();
+
 	if (flags & OBK_PUBLISH_FLAG_MUTEX_SILENT)
 	{
 		if (MQTT_Mutex_Take(100) == 0)
@@ -866,7 +1551,7 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 	else {
 		if (MQTT_Mutex_Take(500) == 0)
 		{
-			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_PublishTopicToClient: mutex failed for %s=%s\r\n", sChannel, sVal);
+			ADDLOG_ERROR(LOG_FEATURE_MQTT, "MQTT_PublishTopicToClient: mutex failed for %s=%s\r\n", sChannel, sVal);
 			return OBK_PUBLISH_MUTEX_FAIL;
 		}
 	}
@@ -897,6 +1582,13 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 	{
 		g_my_reconnect_mqtt_after_time = 5;
 		MQTT_Mutex_Free();
+#if ENABLE_LITTLEFS
+		// queued ones stay in queue, the rest is kept in spool, if enabled
+		if (!(flags & OBK_PUBLISH_FLAG_QUEUED) && sVal && MQTT_Spool_IsEnabled())
+		{
+			MQTT_SpoolPublish(sTopic, sChannel, sVal, flags, appendGet);
+		}
+#endif
 		return OBK_PUBLISH_WAS_DISCONNECTED;
 	}
 
@@ -914,38 +1606,95 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 		{
 			sprintf(pub_topic, "%s/%s%s", sTopic, sChannel, (appendGet == true ? "/get" : ""));
 		}
+		if (MQTT_Dedup_Filter(MQTT_GetDedupClass(pub_topic), pub_topic, sVal, sVal_len, flags))
+		{
+			os_free(pub_topic);
+			MQTT_Mutex_Free();
+			return OBK_PUBLISH_OK;
+		}
+		egressClass = MQTT_GetEgressClass(sTopic, sChannel, flags);
+		// over the limit of its class, or older ones of the same class are still
+		// waiting (must not be overtaken), so queue it, with topic already made.
+		// Topic or value too long for queue item is sent at once, it can't wait.
+		if (!(flags & OBK_PUBLISH_FLAG_QUEUED)
+			&& (g_mqttEgressQueued[egressClass] || !MQTT_Egress_CanSend(egressClass))
+			&& strlen(pub_topic) <= MQTT_PUBLISH_ITEM_CHANNEL_LENGTH && sVal_len <= MQTT_PUBLISH_ITEM_VALUE_LENGTH)
+		{
+			g_mqttEgress[egressClass].deferred++;
+			if (MQTT_QueuePublish("", pub_topic, sVal, flags | OBK_PUBLISH_FLAG_RAW_TOPIC_NAME | OBK_PUBLISH_FLAG_NO_DEDUP) == false)
+			{
+				// dropped (and counted) by full queue, so next publish of the same value must not be skipped
+				MQTT_Dedup_Forget(pub_topic);
+				os_free(pub_topic);
+				MQTT_Mutex_Free();
+				return OBK_PUBLISH_MEM_FAIL;
+			}
+			os_free(pub_topic);
+			MQTT_Mutex_Free();
+			return OBK_PUBLISH_OK;
+		}
 		if (sVal_len < 128)
 		{
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publishing val %s to %s retain=%i\n", sVal, pub_topic, retain);
+			ADDLOG_INFO(LOG_FEATURE_MQTT, "Publishing val %s to %s retain=%i\n", sVal, pub_topic, retain);
 		}
 		else {
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publishing val (%d bytes) to %s retain=%i\n", sVal_len, pub_topic, retain);
+			ADDLOG_INFO(LOG_FEATURE_MQTT, "Publishing val (%d bytes) to %s retain=%i\n", sVal_len, pub_topic, retain);
 		}
 
 
+		topicChannel = g_mqttFastReconnect ? MQTT_GetTopicChannel(pub_topic) : -1;
+		ackArg = qos ? MQTT_Inflight_Add(topicChannel) : 0;
 		LOCK_TCPIP_CORE();
-		err = mqtt_publish(client, pub_topic, sVal, strlen(sVal), qos, retain, mqtt_pub_request_cb, 0);
+		err = mqtt_publish(client, pub_topic, sVal, strlen(sVal), qos, retain, mqtt_pub_request_cb, ackArg);
 		UNLOCK_TCPIP_CORE();
+		if (err != ERR_OK)
+		{
+			// not sent, so next publish of the same value must not be skipped
+			MQTT_Dedup_Forget(pub_topic);
+		}
+		else
+		{
+			g_mqttBytesThisSecond += strlen(pub_topic) + sVal_len;
+			if (qos == 0 && topicChannel >= 0) {
+				MQTT_ConfirmChannel(topicChannel, g_mqttChannelSeq[topicChannel]);
+			}
+#if ENABLE_LITTLEFS
+			MQTT_Spool_OnPublished(pub_topic);
+#endif
+		}
 		os_free(pub_topic);
 
+		if (err == ERR_MEM && (flags & OBK_PUBLISH_FLAG_QUEUED))
+		{
+			// output buffer or request list is full, queue will retry
+			ADDLOG_DEBUG(LOG_FEATURE_MQTT, "Publish deferred, no space for %d bytes\n", sVal_len);
+			MQTT_Mutex_Free();
+			return OBK_PUBLISH_MEM_FAIL;
+		}
 		if (err != ERR_OK)
 		{
 			if (err == ERR_CONN)
 			{
-				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: ERR_CONN aka %d\n", err);
+				ADDLOG_ERROR(LOG_FEATURE_MQTT, "Publish err: ERR_CONN aka %d\n", err);
 			}
 			else if (err == ERR_MEM) {
-				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: ERR_MEM aka %d\n", err);
+				ADDLOG_ERROR(LOG_FEATURE_MQTT, "Publish err: ERR_MEM aka %d\n", err);
 				g_memoryErrorsThisSession++;
 			}
 			else {
-				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: %d\n", err);
+				ADDLOG_ERROR(LOG_FEATURE_MQTT, "Publish err: %d\n", err);
 			}
 			mqtt_publish_errors++;
 			MQTT_Mutex_Free();
 			return OBK_PUBLISH_MEM_FAIL;
 		}
 		mqtt_published_events++;
+		MQTT_Egress_Take(egressClass);
+		// queued ones are measured from the time they were queued, by PublishQueuedItems
+		if (!(flags & OBK_PUBLISH_FLAG_QUEUED)) {
+			MQTT_Latency_Add(&g_mqttAcceptLatency, MQTT_NowMS() - requestTime);
+		}
+		g_mqttPublishesThisSecond++;
 		MQTT_Mutex_Free();
 		return OBK_PUBLISH_OK;
 	}
@@ -955,6 +1704,38 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 	}
 }
 
+#if ENABLE_LITTLEFS
+// Replays spooled publishes, called every second while connected.
+// Stops when egress class of the next one has no tokens, so they are not coalesced in queue.
+static void MQTT_Spool_Replay()
+{
+	const char* topic;
+	const char* value;
+	mqttSpoolRecord_t* record;
+	OBK_Publish_Result res;
+	int egressClass;
+	int flags;
+	int i;
+
+	for (i = 0; i < MQTT_Spool_GetReplayRate(); i++) {
+		if (!MQTT_Spool_Peek(&topic, &value, &flags, &record)) {
+			break;
+		}
+		egressClass = MQTT_GetEgressClass("", topic, flags);
+		if (g_mqttEgressQueued[egressClass] || !MQTT_Egress_CanSend(egressClass)) {
+			break;
+		}
+		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "Replaying %s spooled %i seconds ago", topic, g_secondsElapsed - record->uptime);
+		res = MQTT_PublishTopicToClient(mqtt_client, "", topic, value, flags | OBK_PUBLISH_FLAG_QUEUED, false);
+		if (res != OBK_PUBLISH_OK) {
+			// retry the same one later
+			break;
+		}
+		MQTT_Spool_Advance();
+	}
+}
+#endif
+
 // This is used to publish channel values in "obk0696FB33/1/get" format with numerical value,
 // This is also used to publish custom information with string name,
 // for example, "obk0696FB33/voltage/get" is used to publish voltage from the sensor
@@ -986,7 +1767,7 @@ OBK_Publish_Result MQTT_Publish(const char* sTopic, const char* sChannel, const
 }
 
 void MQTT_OBK_Printf(char* s) {
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, s);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "%s", s);
 }
 
 ////////////////////////////////////////
@@ -994,74 +1775,84 @@ void MQTT_OBK_Printf(char* s) {
 // we should do callbacks from one of our threads?
 static void mqtt_incoming_data_cb(void* arg, const u8_t* data, u16_t len, u8_t flags)
 {
-	int i;
+	mqttRxRecord_t* rec;
+
 	// unused - left here as example
 	//const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 
-	// if we stored a topic in g_mqtt_request, then we found a matching callback, so use it.
-	if (g_mqtt_request.topic[0])
-	{
-		// note: data is NOT terminated (it may be binary...).
-		g_mqtt_request.received = data;
-		g_mqtt_request.receivedLen = len;
-
-		//addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT in topic %s", g_mqtt_request.topic);
+	// if mqtt_incoming_publish_cb reserved a record, payload goes
+	// straight into it, it may come in more than one part
+	if (g_mqttRxWriting < 0)
+		return;
+	rec = MQTT_RX_RECORD(g_mqttRxWriting);
+	// note: data is NOT terminated (it may be binary...).
+	if (len > rec->dataLen - rec->written) {
+		len = rec->dataLen - rec->written;
+	}
+	memcpy(MQTT_RX_DATA(rec) + rec->written, data, len);
+	rec->written += len;
+	if (flags & MQTT_DATA_FLAG_LAST) {
 		mqtt_received_events++;
-
-		for (i = 0; i < numCallbacks; i++)
-		{
-			if (callbacks[i] == 0)
-				continue;
-			char* cbtopic = callbacks[i]->topic;
-			if (!strncmp(g_mqtt_request.topic, cbtopic, strlen(cbtopic)))
-			{
-				MQTT_Post_Received(g_mqtt_request.topic, strlen(g_mqtt_request.topic), data, len);
-				// if ANYONE is interested, store it.
-				break;
-				// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
-				// i.e. multiple people can get each topic if required.
-				//if (callbacks[i]->callback(&g_mqtt_request))
-				//{
-				//	return;
-				//}
-			}
-		}
-		//addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT topic not handled: %s", g_mqtt_request.topic);
+		MQTT_Mutex_Take(100);
+		MQTT_Rx_Commit(g_mqttRxWriting);
+		g_mqttRxWriting = -1;
+		MQTT_Mutex_Free();
+#ifdef PLATFORM_BEKEN
+		MQTT_TriggerRead();
+#endif
 	}
 }
 
 
 // run from userland (quicktick or wakeable thread)
 int MQTT_process_received(){
-	char *topic;
-	int topiclen;
-	unsigned char *data;
-	int datalen;
-	int found = 0;
+	obk_mqtt_request_t request;
+	mqttRxRecord_t* rec;
+	unsigned int callbackMask;
+	unsigned int latency;
+	int ofs;
 	int count = 0;
-	do{
-		found = get_received(&topic, &topiclen, &data, &datalen);
-		if (found){
-			count++;
-			strncpy(g_mqtt_request_cb.topic, topic, sizeof(g_mqtt_request_cb.topic));
-			g_mqtt_request_cb.received = data;
-			g_mqtt_request_cb.receivedLen = datalen;
-			for (int i = 0; i < numCallbacks; i++)
+
+	while (1) {
+		MQTT_Mutex_Take(100);
+		ofs = MQTT_Rx_Next();
+		MQTT_Mutex_Free();
+		if (ofs < 0)
+			break;
+		count++;
+		rec = MQTT_RX_RECORD(ofs);
+		latency = MQTT_NowMS() - rec->postedTime;
+		g_mqttRxTotalLatency += latency;
+		if ((int)latency > g_mqttRxMaxLatency) {
+			g_mqttRxMaxLatency = latency;
+		}
+		g_mqttRxProcessed++;
+		// callbacks get views into the record, it stays in place until released
+		request.topic = MQTT_RX_TOPIC(rec);
+		request.topicLen = rec->topicLen;
+		request.received = MQTT_RX_DATA(rec);
+		request.receivedLen = rec->dataLen;
+		request.slabOffset = ofs;
+		callbackMask = rec->callbackMask;
+		// callbacks are called in order of registration
+		for (int i = 0; callbackMask && i < numCallbacks; i++)
+		{
+			if (!(callbackMask & (1u << i)))
+				continue;
+			callbackMask &= ~(1u << i);
+			// could be removed since it was queued
+			if (callbacks[i] == 0)
+				continue;
+			// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
+			// i.e. multiple people can get each topic if required.
+			if (callbacks[i]->callback(&request))
 			{
-				char* cbtopic = callbacks[i]->topic;
-				if (!strncmp(topic, cbtopic, strlen(cbtopic)))
-				{
-					// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
-					// i.e. multiple people can get each topic if required.
-					if (callbacks[i]->callback(&g_mqtt_request_cb))
-					{
-						// if no further processing, then break this loop.
-						break;
-					}
-				}
+				// if no further processing, then break this loop.
+				break;
 			}
 		}
-	} while (found);
+		MQTT_ReleaseRequest(&request);
+	}
 
 	return count;
 }
@@ -1071,33 +1862,314 @@ int MQTT_process_received(){
 // called from tcp_thread context
 static void mqtt_incoming_publish_cb(void* arg, const char* topic, u32_t tot_len)
 {
-	//const char *p;
-	int i;
+	unsigned int callbackMask;
+	int topicLen;
+
 	// unused - left here as example
 	//const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 
-	// look for a callback with this URL and method, or HTTP_ANY
-	g_mqtt_request.topic[0] = '\0';
-	for (i = 0; i < numCallbacks; i++)
-	{
-		char* cbtopic = callbacks[i]->topic;
-		if (strncmp(topic, cbtopic, strlen(cbtopic)))
-		{
-			strncpy(g_mqtt_request.topic, topic, sizeof(g_mqtt_request.topic) - 1);
-			g_mqtt_request.topic[sizeof(g_mqtt_request.topic) - 1] = 0;
-			break;
+	// find callbacks for this topic once and reserve room for whole
+	// payload, mqtt_incoming_data_cb will fill it
+	topicLen = strlen(topic);
+	MQTT_Mutex_Take(100);
+	if (g_mqttRxWriting >= 0) {
+		// previous one did not get all of its data, pass what we have
+		MQTT_Rx_Commit(g_mqttRxWriting);
+		g_mqttRxWriting = -1;
+	}
+	callbackMask = MQTT_MatchCallbacks(topic);
+	if (callbackMask) {
+		g_mqttRxWriting = MQTT_Rx_Alloc(callbackMask, topic, topicLen, tot_len);
+		if (g_mqttRxWriting < 0) {
+			g_mqttRxDropped++;
 		}
 	}
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT client in mqtt_incoming_publish_cb topic %s\n", topic);
+	MQTT_Mutex_Free();
+	if (callbackMask && g_mqttRxWriting < 0) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %s", topic);
+	}
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT client in mqtt_incoming_publish_cb topic %s\n", topic);
 }
 
 static void mqtt_request_cb(void* arg, err_t err)
 {
 	const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 	if (err != 0) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT client \"%s\" request cb: err %d\n", client_info->client_id, (int)err);
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "MQTT client \"%s\" request cb: err %d\n", client_info->client_id, (int)err);
+	}
+}
+
+// Next connect attempt of fast reconnect. First one after lost connection is
+// made at once, next ones after growing delay with jitter, so devices that lost
+// broker at the same time do not come back all at once.
+static void MQTT_Reconnect_Schedule()
+{
+	int delay;
+
+	delay = g_mqttBackoffMS;
+	if (delay > 0) {
+		delay += (delay / 4) - (rand() % (delay / 2 + 1));
+		g_mqttBackoffMS *= 2;
+		if (g_mqttBackoffMS > g_mqttBackoffMaxMS) {
+			g_mqttBackoffMS = g_mqttBackoffMaxMS;
+		}
+	}
+	else {
+		g_mqttBackoffMS = g_mqttBackoffMinMS;
+	}
+	g_mqttNextConnectMS = MQTT_NowMS() + delay;
+	g_mqttConnectPending = true;
+}
+
+#if MQTT_TLS_OPTIONS
+// TLS handshake cost reduction, set by mqtt_tls and mqtt_tlsPsk.
+// This part doesn't use mbedtls, TLS glue below reports handshakes to it.
+static bool g_mqttTlsResume = true;
+// 0 - not negotiated, otherwise 512, 1024, 2048 or 4096
+static int g_mqttTlsMaxFragLen = 0;
+// Some brokers fail the handshake when client asks for max fragment length.
+// After failed handshake, next one is made without it. If that one succeeds,
+// it's not asked for anymore, otherwise it was not the reason and is asked again.
+typedef enum {
+	MQTT_TLS_MFL_OFFER,
+	MQTT_TLS_MFL_RETRY_WITHOUT,
+	MQTT_TLS_MFL_REFUSED,
+} mqttTlsMflState_t;
+static byte g_mqttTlsMflState = MQTT_TLS_MFL_OFFER;
+static char g_mqttTlsPskIdentity[64];
+static unsigned char g_mqttTlsPsk[32];
+static int g_mqttTlsPskLen = 0;
+// config is kept between connects, this forces it to be created again
+static bool g_mqttTlsConfigDirty = false;
+// session of last successful handshake is kept, it's offered to broker on next connect
+static bool g_mqttTlsSessionValid = false;
+// handshake stats, heap is sampled by quick tick while handshake is running
+static bool g_mqttTlsMeasuring = false;
+static unsigned int g_mqttTlsStartMS;
+static int g_mqttTlsStartHeap;
+static int g_mqttTlsMinHeap;
+static int g_mqttTlsHandshakes = 0;
+static int g_mqttTlsResumed = 0;
+static int g_mqttTlsLastMS = 0;
+static int g_mqttTlsMaxMS = 0;
+static int g_mqttTlsPeakHeap = 0;
+
+// max fragment length to ask for in next config, 0 if none
+int MQTT_TLS_GetMaxFragLen() {
+	int mfl = g_mqttTlsMaxFragLen;
+
+	if (mfl == 0 || g_mqttTlsMflState != MQTT_TLS_MFL_OFFER) {
+		return 0;
+	}
+	// altcp_tls expects whole write to go in one record
+	if (mfl < MQTT_OUTPUT_RINGBUF_SIZE) {
+		ADDLOG_WARN(LOG_FEATURE_MQTT, "TLS max fragment %i is below MQTT output buffer, using %i", mfl, MQTT_OUTPUT_RINGBUF_SIZE);
+		mfl = MQTT_OUTPUT_RINGBUF_SIZE;
+	}
+	if (mfl <= 512) {
+		return 512;
+	}
+	if (mfl <= 1024) {
+		return 1024;
+	}
+	if (mfl <= 2048) {
+		return 2048;
+	}
+	return 4096;
+}
+bool MQTT_TLS_IsPskSet() {
+	return g_mqttTlsPskLen > 0;
+}
+bool MQTT_TLS_ShouldResume() {
+	return g_mqttTlsResume && g_mqttTlsSessionValid;
+}
+bool MQTT_TLS_NeedsNewConfig() {
+	return g_mqttTlsConfigDirty;
+}
+// new config was created, session of old one is not resumed
+void MQTT_TLS_OnConfigCreated() {
+	g_mqttTlsConfigDirty = false;
+	g_mqttTlsSessionValid = false;
+}
+// before mqtt_client_connect, that allocates TLS context
+static void MQTT_TLS_BeforeConnect() {
+	g_mqttTlsStartMS = MQTT_NowMS();
+	g_mqttTlsStartHeap = xPortGetFreeHeapSize();
+	g_mqttTlsMinHeap = g_mqttTlsStartHeap;
+}
+// connect was started, handshake runs when TCP is connected
+void MQTT_TLS_OnHandshakeStarted() {
+	g_mqttTlsMeasuring = true;
+}
+static void MQTT_TLS_SampleHeap() {
+	int freeHeap;
+
+	if (g_mqttTlsMeasuring) {
+		freeHeap = xPortGetFreeHeapSize();
+		if (freeHeap < g_mqttTlsMinHeap) {
+			g_mqttTlsMinHeap = freeHeap;
+		}
+	}
+}
+// broker accepted connection, bSessionSaved is set if its session is kept for resume
+void MQTT_TLS_OnHandshakeDone(bool bResumed, bool bSessionSaved) {
+	if (g_mqttTlsMeasuring == false) {
+		return;
+	}
+	g_mqttTlsMeasuring = false;
+	MQTT_TLS_SampleHeap();
+	g_mqttTlsHandshakes++;
+	if (bResumed) {
+		g_mqttTlsResumed++;
+	}
+	// includes TCP connect and CONNACK
+	g_mqttTlsLastMS = MQTT_NowMS() - g_mqttTlsStartMS;
+	if (g_mqttTlsLastMS > g_mqttTlsMaxMS) {
+		g_mqttTlsMaxMS = g_mqttTlsLastMS;
+	}
+	if (g_mqttTlsStartHeap - g_mqttTlsMinHeap > g_mqttTlsPeakHeap) {
+		g_mqttTlsPeakHeap = g_mqttTlsStartHeap - g_mqttTlsMinHeap;
+	}
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT TLS %s handshake, connected in %i ms, heap used %i\n",
+		bResumed ? "resumed" : "full", g_mqttTlsLastMS, g_mqttTlsStartHeap - g_mqttTlsMinHeap);
+	if (g_mqttTlsMflState == MQTT_TLS_MFL_RETRY_WITHOUT) {
+		ADDLOG_WARN(LOG_FEATURE_MQTT, "Broker refused TLS max fragment length, it's not asked for anymore");
+		g_mqttTlsMflState = MQTT_TLS_MFL_REFUSED;
+	}
+	g_mqttTlsSessionValid = bSessionSaved;
+}
+// connect failed before it was accepted, session may be what broker did not like
+void MQTT_TLS_OnHandshakeFailed() {
+	if (g_mqttTlsMeasuring == false) {
+		return;
+	}
+	g_mqttTlsMeasuring = false;
+	g_mqttTlsSessionValid = false;
+	if (g_mqttTlsMaxFragLen && g_mqttTlsMflState == MQTT_TLS_MFL_OFFER) {
+		ADDLOG_WARN(LOG_FEATURE_MQTT, "TLS connect failed, trying without max fragment length");
+		g_mqttTlsMflState = MQTT_TLS_MFL_RETRY_WITHOUT;
+		g_mqttTlsConfigDirty = true;
+	}
+	else if (g_mqttTlsMflState == MQTT_TLS_MFL_RETRY_WITHOUT) {
+		g_mqttTlsMflState = MQTT_TLS_MFL_OFFER;
+		g_mqttTlsConfigDirty = true;
+	}
+}
+void MQTT_TLS_GetStats(int* outHandshakes, int* outResumed) {
+	*outHandshakes = g_mqttTlsHandshakes;
+	*outResumed = g_mqttTlsResumed;
+}
+#endif
+
+#if MQTT_USE_TLS
+static unsigned int g_mqttTlsConfigKey = 0;
+static mbedtls_ssl_session g_mqttTlsSession;
+
+static const int g_mqttTlsPskCiphersuites[] = {
+	MBEDTLS_TLS_PSK_WITH_AES_128_GCM_SHA256,
+	MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+	0
+};
+
+// Settings that need new TLS config, so cached session is not resumed with other verify settings
+static unsigned int MQTT_TLS_GetConfigKey(bool bVerify) {
+	const char* s = CFG_GetMQTTCertFile();
+	unsigned int hash = bVerify ? 1 : 2;
+
+	while (*s) {
+		hash = hash * 31 + (unsigned char)*s;
+		s++;
+	}
+	return hash;
+}
+static bool MQTT_TLS_ConfigChanged(bool bVerify) {
+	return MQTT_TLS_NeedsNewConfig() || g_mqttTlsConfigKey != MQTT_TLS_GetConfigKey(bVerify);
+}
+// called for newly created config
+static void MQTT_TLS_ApplyOptions(mbedtls_ssl_config* conf, bool bVerify) {
+	g_mqttTlsConfigKey = MQTT_TLS_GetConfigKey(bVerify);
+	mbedtls_ssl_session_free(&g_mqttTlsSession);
+	MQTT_TLS_OnConfigCreated();
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+	mbedtls_ssl_conf_session_tickets(conf, g_mqttTlsResume ? MBEDTLS_SSL_SESSION_TICKETS_ENABLED : MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+	switch (MQTT_TLS_GetMaxFragLen()) {
+	case 512:
+		mbedtls_ssl_conf_max_frag_len(conf, MBEDTLS_SSL_MAX_FRAG_LEN_512);
+		break;
+	case 1024:
+		mbedtls_ssl_conf_max_frag_len(conf, MBEDTLS_SSL_MAX_FRAG_LEN_1024);
+		break;
+	case 2048:
+		mbedtls_ssl_conf_max_frag_len(conf, MBEDTLS_SSL_MAX_FRAG_LEN_2048);
+		break;
+	case 4096:
+		mbedtls_ssl_conf_max_frag_len(conf, MBEDTLS_SSL_MAX_FRAG_LEN_4096);
+		break;
+	}
+#endif
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+	if (MQTT_TLS_IsPskSet()) {
+		if (mbedtls_ssl_conf_psk(conf, g_mqttTlsPsk, g_mqttTlsPskLen,
+			(const unsigned char*)g_mqttTlsPskIdentity, strlen(g_mqttTlsPskIdentity)) == 0) {
+			// PSK first, certificate based as fallback
+			mbedtls_ssl_conf_ciphersuites(conf, g_mqttTlsPskCiphersuites);
+			ADDLOG_INFO(LOG_FEATURE_MQTT, "TLS PSK identity %s", g_mqttTlsPskIdentity);
+		}
+		else {
+			ADDLOG_ERROR(LOG_FEATURE_MQTT, "TLS PSK setup failed");
+		}
 	}
+#endif
 }
+// after mqtt_client_connect, handshake starts when TCP is connected
+static void MQTT_TLS_AfterConnect(mqtt_client_t* client) {
+	altcp_mbedtls_state_t* state;
+
+	if (mqtt_client_info.tls_config == NULL || client->conn == NULL || client->conn->state == NULL) {
+		return;
+	}
+	state = client->conn->state;
+	if (MQTT_TLS_ShouldResume()) {
+		if (mbedtls_ssl_set_session(&state->ssl_context, &g_mqttTlsSession) != 0) {
+			mbedtls_ssl_session_free(&g_mqttTlsSession);
+			g_mqttTlsSessionValid = false;
+		}
+	}
+	MQTT_TLS_OnHandshakeStarted();
+}
+// from mqtt_connection_cb, in tcpip thread
+static void MQTT_TLS_OnConnected(mqtt_client_t* client) {
+	altcp_mbedtls_state_t* state;
+	mbedtls_ssl_context* ssl;
+	bool bResumed;
+	bool bSaved = false;
+
+	if (g_mqttTlsMeasuring == false || client->conn == NULL || client->conn->state == NULL) {
+		return;
+	}
+	state = client->conn->state;
+	ssl = &state->ssl_context;
+	// broker echoes offered session id when it resumes
+	bResumed = g_mqttTlsSessionValid && ssl->session
+		&& ssl->session->id_len == g_mqttTlsSession.id_len
+		&& memcmp(ssl->session->id, g_mqttTlsSession.id, g_mqttTlsSession.id_len) == 0;
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT TLS VERSION: %s\n", mbedtls_ssl_get_version(ssl));
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT TLS CIPHER : %s\n", mbedtls_ssl_get_ciphersuite(ssl));
+	mbedtls_ssl_session_free(&g_mqttTlsSession);
+	if (g_mqttTlsResume) {
+		bSaved = mbedtls_ssl_get_session(ssl, &g_mqttTlsSession) == 0;
+	}
+	MQTT_TLS_OnHandshakeDone(bResumed, bSaved);
+}
+static void MQTT_TLS_OnConnectFailed() {
+	if (g_mqttTlsMeasuring) {
+		mbedtls_ssl_session_free(&g_mqttTlsSession);
+	}
+	MQTT_TLS_OnHandshakeFailed();
+}
+#endif
 
 /////////////////////////////////////////////
 // should be called in tcp_thread context.
@@ -1113,16 +2185,31 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 	//   addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"MQTT client < removed name > connection cb: status %d\n",  (int)status);
 	 //  addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"MQTT client \"%s\" connection cb: status %d\n", client_info->client_id, (int)status);
 
+	// publish cut by connection change will never be completed, drop it
+	MQTT_Mutex_Take(100);
+	if (g_mqttRxWriting >= 0) {
+		MQTT_RX_RECORD(g_mqttRxWriting)->callbackMask = 0;
+		MQTT_Rx_Commit(g_mqttRxWriting);
+		g_mqttRxWriting = -1;
+	}
+	MQTT_Mutex_Free();
+
 	if (status == MQTT_CONNECT_ACCEPTED)
 	{
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_connection_cb: Successfully connected\n");
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_connection_cb: Successfully connected\n");
+		g_mqttSessionUp = true;
+		if (g_mqttFastReconnect) {
+			g_mqttConnectPending = false;
+			g_mqttBackoffMS = 0;
+			g_mqttLastConnectMS = MQTT_NowMS() - g_mqttConnectStartMS;
+			if (g_mqttLastConnectMS > g_mqttMaxConnectMS) {
+				g_mqttMaxConnectMS = g_mqttLastConnectMS;
+			}
+		}
 
-#if LWIP_ALTCP_TLS_MBEDTLS
-		if (CFG_GetMQTTUseTls() && client && client->conn && client->conn->state) {
-			altcp_mbedtls_state_t* state = client->conn->state;
-			mbedtls_ssl_context* ssl = &state->ssl_context;
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT TLS VERSION: %s\n", mbedtls_ssl_get_version(ssl));
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT TLS CIPHER : %s\n", mbedtls_ssl_get_ciphersuite(ssl));
+#if MQTT_USE_TLS
+		if (CFG_GetMQTTUseTls() && client) {
+			MQTT_TLS_OnConnected(client);
 		}
 #endif
 
@@ -1144,10 +2231,10 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 						mqtt_request_cb, LWIP_CONST_CAST(void*, client_info),
 						1);
 					if (err != ERR_OK) {
-						addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribe to %s return: %d\n", callbacks[i]->subscriptionTopic, err);
+						ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_subscribe to %s return: %d\n", callbacks[i]->subscriptionTopic, err);
 					}
 					else {
-						addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribed to %s\n", callbacks[i]->subscriptionTopic);
+						ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_subscribed to %s\n", callbacks[i]->subscriptionTopic);
 					}
 				}
 			}
@@ -1160,7 +2247,7 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 		err = mqtt_publish(client, tmp, "online", strlen("online"), 2, true, mqtt_pub_request_cb, 0);
 		//UNLOCK_TCPIP_CORE();
 		if (err != ERR_OK) {
-			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: %d\n", err);
+			ADDLOG_ERROR(LOG_FEATURE_MQTT, "Publish err: %d\n", err);
 			if (err == ERR_CONN) {
 				// g_my_reconnect_mqtt_after_time = 5;
 			}
@@ -1178,13 +2265,56 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 		//        1);
 	}
 	else {
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_connection_cb: Disconnected, reason: %d(%s)\n", status, get_callback_error(status));
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_connection_cb: Disconnected, reason: %d(%s)\n", status, get_callback_error(status));
+		if (g_mqttSessionUp) {
+			// lost connection that was working, try again at once
+			g_mqttBackoffMS = 0;
+			g_mqttConnectStartMS = MQTT_NowMS();
+		}
+		else {
+			// connect failed, broker may have moved, resolve it again
+			g_mqttDnsCacheValid = false;
+		}
+		g_mqttSessionUp = false;
+#if MQTT_USE_TLS
+		MQTT_TLS_OnConnectFailed();
+#endif
+		if (g_mqttFastReconnect) {
+			MQTT_Reconnect_Schedule();
+		}
 	}
 }
 
 static ip_addr_t mqtt_ip_resolved;
 static volatile int dns_in_progress_time;
 static volatile bool dns_resolved;
+static ip_addr_t g_mqttDnsCacheAddr;
+static unsigned int g_mqttDnsCacheHostHash;
+
+static unsigned int MQTT_DnsCache_HostHash(const char* host) {
+	unsigned int hash = 2166136261u;
+
+	while (*host) {
+		hash = (hash ^ (unsigned char)*host) * 16777619;
+		host++;
+	}
+	return hash;
+}
+static void MQTT_DnsCache_Store(const char* host, const ip_addr_t* addr) {
+	memcpy(&g_mqttDnsCacheAddr, addr, sizeof(g_mqttDnsCacheAddr));
+	g_mqttDnsCacheHostHash = MQTT_DnsCache_HostHash(host);
+	g_mqttDnsCacheValid = true;
+}
+// fast reconnect uses address of previous connect, without asking DNS again
+static bool MQTT_DnsCache_Lookup(const char* host, ip_addr_t* addr) {
+	if (!g_mqttFastReconnect || !g_mqttDnsCacheValid
+		|| g_mqttDnsCacheHostHash != MQTT_DnsCache_HostHash(host)) {
+		return false;
+	}
+	memcpy(addr, &g_mqttDnsCacheAddr, sizeof(g_mqttDnsCacheAddr));
+	g_mqttDnsCacheHits++;
+	return true;
+}
 void dnsFound(const char *name, ip_addr_t *ipaddr, void *arg) 
 {       
 
@@ -1192,14 +2322,19 @@ void dnsFound(const char *name, ip_addr_t *ipaddr, void *arg)
 	{
 		memcpy(&mqtt_ip_resolved, ipaddr, sizeof(mqtt_ip_resolved));
 		dns_resolved = true;
+		MQTT_DnsCache_Store(name, ipaddr);
 		/* Try to reconnect immediately after resolving the host */
 		mqtt_loopsWithDisconnected = LOOPS_WITH_DISCONNECTED + 1;
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_host %s resolution SUCCESS\r\n", name);
+		if (g_mqttFastReconnect) {
+			g_mqttNextConnectMS = MQTT_NowMS();
+			g_mqttConnectPending = true;
+		}
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_host %s resolution SUCCESS\r\n", name);
 	}
 	else
 	{
 		dns_resolved = false;
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_host %s resolution FAILED\r\n", name);
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_host %s resolution FAILED\r\n", name);
 	}
 	dns_in_progress_time = 0;
 }
@@ -1216,7 +2351,7 @@ static int MQTT_do_connect(mqtt_client_t* client)
 	mqtt_host = CFG_GetMQTTHost();
 
 	if (!mqtt_host[0]) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_host empty, not starting mqtt\r\n");
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_host empty, not starting mqtt\r\n");
 		snprintf(mqtt_status_message, sizeof(mqtt_status_message), "mqtt_host empty, not starting mqtt");
 		return 0;
 	}
@@ -1231,7 +2366,7 @@ static int MQTT_do_connect(mqtt_client_t* client)
 #endif
 
 	if (dns_in_progress_time <= 0 && !dns_resolved) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_userName %s\r\nmqtt_pass %s\r\nmqtt_clientID %s\r\nmqtt_host %s:%d\r\n",
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_userName %s\r\nmqtt_pass %s\r\nmqtt_clientID %s\r\nmqtt_host %s:%d\r\n",
 			mqtt_userName,
 			/* do not log sensitive data */
 			//mqtt_pass,
@@ -1264,27 +2399,49 @@ static int MQTT_do_connect(mqtt_client_t* client)
 	mqtt_client_info.will_qos = 1;
 
 #ifdef WINDOWS
-	hostEntry = gethostbyname(mqtt_host);
-	// host name/ip
-	if (NULL != hostEntry)
+	// simulator resolves at once, but goes through the same cache as devices
+	dns_resolved = MQTT_DnsCache_Lookup(mqtt_host, &mqtt_ip_resolved);
+	if (!dns_resolved)
 	{
-#ifndef LINUX
-		if (hostEntry->h_addr_list && hostEntry->h_addr_list[0]) {
+		hostEntry = gethostbyname(mqtt_host);
+		if (NULL != hostEntry && hostEntry->h_addr_list && hostEntry->h_addr_list[0]) {
 			int len = hostEntry->h_length;
 			if (len > 4) {
-				addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_host resolves to addr len > 4\r\n");
+				ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_host resolves to addr len > 4\r\n");
 				len = 4;
 			}
-			memcpy(&mqtt_ip, hostEntry->h_addr_list[0], len);
+			memset(&mqtt_ip_resolved, 0, sizeof(mqtt_ip_resolved));
+			memcpy(&mqtt_ip_resolved, hostEntry->h_addr_list[0], len);
+			MQTT_DnsCache_Store(mqtt_host, &mqtt_ip_resolved);
+			dns_resolved = true;
 		}
-		else 
-#endif
+		else if (NULL != hostEntry)
 		{
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_host resolves no addresses?\r\n");
+			ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_host resolves no addresses?\r\n");
 			snprintf(mqtt_status_message, sizeof(mqtt_status_message), "mqtt_host resolves no addresses?");
 			return 0;
 		}
+	}
+#ifdef LINUX
+	// Linux simulator only resolves, it does not connect
+	if (dns_resolved)
+	{
+		dns_resolved = false;
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_host resolves no addresses?\r\n");
+		snprintf(mqtt_status_message, sizeof(mqtt_status_message), "mqtt_host resolves no addresses?");
+		return 0;
+	}
+#endif
+	if (dns_resolved)
+	{
+		dns_resolved = false;
+		memcpy(&mqtt_ip, &mqtt_ip_resolved, sizeof(mqtt_ip_resolved));
 #else
+	if (dns_in_progress_time <= 0 && !dns_resolved
+		&& MQTT_DnsCache_Lookup(mqtt_host, &mqtt_ip_resolved))
+	{
+		dns_resolved = true;
+	}
 	if (dns_in_progress_time <= 0 && !dns_resolved)
 	{
 #ifdef PLATFORM_XR809
@@ -1296,6 +2453,7 @@ static int MQTT_do_connect(mqtt_client_t* client)
 		{
 			dns_in_progress_time = 0;
 			dns_resolved = true;
+			MQTT_DnsCache_Store(mqtt_host, &mqtt_ip_resolved);
 		}
 		else if (ERR_INPROGRESS == res)
 		{
@@ -1318,19 +2476,20 @@ static int MQTT_do_connect(mqtt_client_t* client)
 
 		/* Includes for MQTT over TLS */
 #if MQTT_USE_TLS
-		/* Free old configuration */
-		if (mqtt_client_info.tls_config) {
+		/* Free old configuration, if it can't be used again */
+		if (mqtt_client_info.tls_config && (mqtt_use_tls == false || MQTT_TLS_ConfigChanged(mqtt_verify_tls_cert))) {
 			altcp_tls_free_config(mqtt_client_info.tls_config);
 			altcp_tls_free_entropy();
 			mqtt_client_info.tls_config = NULL;
 		}
-		if (mqtt_use_tls) {
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Secure TLS connection enabled");
+		// reusing config saves parsing certificate and seeding RNG on each reconnect
+		if (mqtt_use_tls && mqtt_client_info.tls_config == NULL) {
+			ADDLOG_INFO(LOG_FEATURE_MQTT, "Secure TLS connection enabled");
 			size_t ca_len = 0;
 			u8_t* ca = NULL;
 			if (mqtt_verify_tls_cert) {
 				if (strlen(CFG_GetMQTTCertFile()) > 0) {
-					addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Load certificate %s", CFG_GetMQTTCertFile());
+					ADDLOG_INFO(LOG_FEATURE_MQTT, "Load certificate %s", CFG_GetMQTTCertFile());
 					ca = LFS_ReadFile(CFG_GetMQTTCertFile());
 					if (ca) {
 						ca_len = strlen((char*)ca)+1;
@@ -1338,7 +2497,7 @@ static int MQTT_do_connect(mqtt_client_t* client)
 				}
 			}
 			else {
-				addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Verify certificate disabled");
+				ADDLOG_INFO(LOG_FEATURE_MQTT, "Verify certificate disabled");
 			}
 			mqtt_client_info.tls_config = altcp_tls_create_config_client(ca, ca_len);
 			if (ca) {
@@ -1363,9 +2522,10 @@ static int MQTT_do_connect(mqtt_client_t* client)
 				else {
 					mbedtls_ssl_conf_authmode(&mqtt_client_info.tls_config->conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
 				}
+				MQTT_TLS_ApplyOptions(&mqtt_client_info.tls_config->conf, mqtt_verify_tls_cert);
 			}
 			else {
-				addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Secure TLS config fail. Try connect anyway.");
+				ADDLOG_INFO(LOG_FEATURE_MQTT, "Secure TLS config fail. Try connect anyway.");
 			}
 		}
 #endif /* MQTT_USE_TLS */
@@ -1378,16 +2538,24 @@ static int MQTT_do_connect(mqtt_client_t* client)
 		  to establish a connection with the server.
 		  For now MQTT version 3.1.1 is always used */
 
+#if MQTT_TLS_OPTIONS
+		MQTT_TLS_BeforeConnect();
+#endif
 		LOCK_TCPIP_CORE();
 		res = mqtt_client_connect(mqtt_client,
 			&mqtt_ip, mqtt_port,
 			mqtt_connection_cb, LWIP_CONST_CAST(void*, &mqtt_client_info),
 			&mqtt_client_info);
+#if MQTT_USE_TLS
+		if (res == ERR_OK) {
+			MQTT_TLS_AfterConnect(mqtt_client);
+		}
+#endif
 		UNLOCK_TCPIP_CORE();
 		mqtt_connect_result = res;
 		if (res != ERR_OK)
 		{
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Connect error in mqtt_client_connect - code: %d (%s)\n", res, get_error_name(res));
+			ADDLOG_INFO(LOG_FEATURE_MQTT, "Connect error in mqtt_client_connect - code: %d (%s)\n", res, get_error_name(res));
 			snprintf(mqtt_status_message, sizeof(mqtt_status_message), "mqtt_client_connect connect failed");
 			if (res == ERR_ISCONN)
 			{
@@ -1402,7 +2570,7 @@ static int MQTT_do_connect(mqtt_client_t* client)
 	else {
 		if (dns_in_progress_time > 0)
 		{
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_host %s is being resolved by gethostbyname\r\n", mqtt_host);
+			ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_host %s is being resolved by gethostbyname\r\n", mqtt_host);
 			dns_in_progress_time--;
 			/* Discount connection event if host is being resolved */
 			mqtt_connect_events--;
@@ -1411,7 +2579,7 @@ static int MQTT_do_connect(mqtt_client_t* client)
 		{
 			if (!dns_resolved)
 			{
-				addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_host %s not found by gethostbyname\r\n", mqtt_host);
+				ADDLOG_INFO(LOG_FEATURE_MQTT, "mqtt_host %s not found by gethostbyname\r\n", mqtt_host);
 				snprintf(mqtt_status_message, sizeof(mqtt_status_message), "mqtt_host %s not found by gethostbyname", mqtt_host);
 			}
 		}
@@ -1448,6 +2616,66 @@ OBK_Publish_Result MQTT_PublishMain_StringString(const char* sChannel, const cha
 
 }
 
+// Channels changed since last state JSON publish, see OBK_FLAG_MQTT_CHANNELS_AS_JSON
+static unsigned int g_stateJsonDirty[(CHANNEL_MAX + 31) / 32];
+static bool g_stateJsonAnyDirty = false;
+// time since first change in current window
+static int g_stateJsonWindowTime = 0;
+
+static void MQTT_FormatChannelValue(int channel, char* valueStr) {
+	if (CFG_HasFlag(OBK_FLAG_PUBLISH_MULTIPLIED_VALUES)) {
+		sprintf(valueStr, "%f", CHANNEL_GetFinalValue(channel));
+	}
+	else {
+		sprintf(valueStr, "%i", CHANNEL_Get(channel));
+	}
+}
+// Publishes all changed channels as {"1":0,"2":100}, split into
+// more messages only if it doesn't fit into buffer
+static void MQTT_PublishStateJSON() {
+	char json[384];
+	char valueStr[16];
+	int len = 0;
+	int i;
+
+	g_stateJsonAnyDirty = false;
+	g_stateJsonWindowTime = 0;
+	for (i = 0; i < CHANNEL_MAX; i++) {
+		if (!(g_stateJsonDirty[i / 32] & (1u << (i % 32)))) {
+			continue;
+		}
+		g_stateJsonDirty[i / 32] &= ~(1u << (i % 32));
+		MQTT_FormatChannelValue(i, valueStr);
+		// "64":value, and closing brace
+		if (len + 6 + strlen(valueStr) + 2 >= sizeof(json)) {
+			json[len++] = '}';
+			json[len] = 0;
+			MQTT_PublishMain(mqtt_client, "state", json, 0, false);
+			len = 0;
+		}
+		len += sprintf(json + len, "%c\"%i\":%s", len ? ',' : '{', i, valueStr);
+	}
+	if (len) {
+		json[len++] = '}';
+		json[len] = 0;
+		MQTT_PublishMain(mqtt_client, "state", json, 0, false);
+	}
+}
+static void MQTT_MarkChannelForStateJSON(int channel) {
+	g_stateJsonDirty[channel / 32] |= 1u << (channel % 32);
+	g_stateJsonAnyDirty = true;
+}
+// called from quick tick, changes are collected for MQTT_STATE_JSON_WINDOW_MS
+static void MQTT_RunStateJSON(int deltaMS) {
+	if (!g_stateJsonAnyDirty) {
+		return;
+	}
+	g_stateJsonWindowTime += deltaMS;
+	if (g_stateJsonWindowTime >= MQTT_STATE_JSON_WINDOW_MS) {
+		MQTT_PublishStateJSON();
+	}
+}
+
 OBK_Publish_Result MQTT_ChannelPublish(int channel, int flags)
 {
 	char channelNameStr[8];
@@ -1457,20 +2685,26 @@ OBK_Publish_Result MQTT_ChannelPublish(int channel, int flags)
 	if (CHANNEL_HasNeverPublishFlag(channel)) {
 		return OBK_PUBLISH_OK;
 	}
-
-	if (CFG_HasFlag(OBK_FLAG_PUBLISH_MULTIPLIED_VALUES)) {
-		float dVal = CHANNEL_GetFinalValue(channel);
-		// Float value
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Channel has changed! Publishing %f to channel %i \n", dVal, channel);
-		sprintf(valueStr, "%f", dVal);
+	if (channel >= 0 && channel < CHANNEL_MAX) {
+		g_mqttChannelSeq[channel] = ++g_mqttSeq;
 	}
-	else {
-		int iVal = CHANNEL_Get(channel);
-		// Integer value
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Channel has changed! Publishing %i to channel %i \n", iVal, channel);
-		sprintf(valueStr, "%i", iVal);
+
+	// in JSON mode, change is also sent later together with others.
+	// Channel topic is kept, unless disabled, because discovery entities use it,
+	// and reply to get always goes there
+	if (CFG_HasFlag(OBK_FLAG_MQTT_CHANNELS_AS_JSON) && !(flags & OBK_PUBLISH_FLAG_NO_DEDUP)
+		&& channel >= 0 && channel < CHANNEL_MAX) {
+		MQTT_MarkChannelForStateJSON(channel);
+		if (CFG_HasFlag(OBK_FLAG_MQTT_CHANNELS_JSON_ONLY)) {
+			MQTT_BroadcastTasmotaTeleSTATE();
+			MQTT_BroadcastTasmotaTeleSENSOR();
+			return OBK_PUBLISH_OK;
+		}
 	}
 
+	MQTT_FormatChannelValue(channel, valueStr);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Channel has changed! Publishing %s to channel %i \n", valueStr, channel);
+
 	MQTT_BroadcastTasmotaTeleSTATE();
 	MQTT_BroadcastTasmotaTeleSENSOR();
 
@@ -1513,19 +2747,20 @@ commandResult_t MQTT_PublishChannel(const void* context, const char* cmd, const
 commandResult_t MQTT_PublishCommand(const void* context, const char* cmd, const char* args, int cmdFlags) {
 	const char* topic, * value;
 	OBK_Publish_Result ret;
-	int flags = 0;
+	// explicit publish is always sent, also if value is the same
+	int flags = OBK_PUBLISH_FLAG_NO_DEDUP;
 
 	Tokenizer_TokenizeString(args, TOKENIZER_ALLOW_QUOTES | TOKENIZER_ALLOW_ESCAPING_QUOTATIONS | TOKENIZER_EXPAND_EARLY);
 
 	if (Tokenizer_GetArgsCount() < 2) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish command requires two arguments (topic and value)");
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Publish command requires two arguments (topic and value)");
 		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
 	}
 	topic = Tokenizer_GetArg(0);
 	value = Tokenizer_GetArg(1);
 	// optional third argument to remove get, etc
 	if (Tokenizer_GetArgIntegerDefault(2, 0) != 0) {
-		flags = OBK_PUBLISH_FLAG_RAW_TOPIC_NAME;
+		flags |= OBK_PUBLISH_FLAG_RAW_TOPIC_NAME;
 	}
 	ret = MQTT_PublishMain_StringString(topic, value, flags);
 
@@ -1541,20 +2776,21 @@ commandResult_t MQTT_PublishCommand(const void* context, const char* cmd, const
 commandResult_t MQTT_PublishFile(const void* context, const char* cmd, const char* args, int cmdFlags) {
 	const char* topic, *fname;
 	OBK_Publish_Result ret;
-	int flags = 0;
+	// explicit publish is always sent, also if value is the same
+	int flags = OBK_PUBLISH_FLAG_NO_DEDUP;
 	byte*data;
 
 	Tokenizer_TokenizeString(args, TOKENIZER_ALLOW_QUOTES | TOKENIZER_ALLOW_ESCAPING_QUOTATIONS);
 
 	if (Tokenizer_GetArgsCount() < 2) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish command requires two arguments (topic and value)");
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Publish command requires two arguments (topic and value)");
 		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
 	}
 	topic = Tokenizer_GetArg(0);
 	fname = Tokenizer_GetArg(1);
 	// optional third argument to remove get, etc
 	if (Tokenizer_GetArgIntegerDefault(2, 0) != 0) {
-		flags = OBK_PUBLISH_FLAG_RAW_TOPIC_NAME;
+		flags |= OBK_PUBLISH_FLAG_RAW_TOPIC_NAME;
 	}
 	data = LFS_ReadFile(fname);
 	if (data) {
@@ -1571,19 +2807,20 @@ commandResult_t MQTT_PublishCommandInteger(const void* context, const char* cmd,
 	const char* topic;
 	int value;
 	OBK_Publish_Result ret;
-	int flags = 0;
+	// explicit publish is always sent, also if value is the same
+	int flags = OBK_PUBLISH_FLAG_NO_DEDUP;
 
 	Tokenizer_TokenizeString(args, 0);
 
 	if (Tokenizer_GetArgsCount() < 2) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish command requires two arguments (topic and value)");
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Publish command requires two arguments (topic and value)");
 		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
 	}
 	topic = Tokenizer_GetArg(0);
 	value = Tokenizer_GetArgInteger(1);
 	// optional third argument to remove get, etc
 	if (Tokenizer_GetArgIntegerDefault(2, 0) != 0) {
-		flags = OBK_PUBLISH_FLAG_RAW_TOPIC_NAME;
+		flags |= OBK_PUBLISH_FLAG_RAW_TOPIC_NAME;
 	}
 	ret = MQTT_PublishMain_StringInt(topic, value, flags);
 
@@ -1596,13 +2833,14 @@ commandResult_t MQTT_PublishCommandFloat(const void* context, const char* cmd, c
 	const char* topic;
 	float value;
 	OBK_Publish_Result ret;
-	int flags = 0;
+	// explicit publish is always sent, also if value is the same
+	int flags = OBK_PUBLISH_FLAG_NO_DEDUP;
 	int decimalPlaces;
 
 	Tokenizer_TokenizeString(args, 0);
 
 	if (Tokenizer_GetArgsCount() < 2) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish command requires two arguments (topic and value)");
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Publish command requires two arguments (topic and value)");
 		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
 	}
 	topic = Tokenizer_GetArg(0);
@@ -1610,7 +2848,7 @@ commandResult_t MQTT_PublishCommandFloat(const void* context, const char* cmd, c
 
 	// optional third argument to remove get, etc
 	if (Tokenizer_GetArgIntegerDefault(2, 0) != 0) {
-		flags = OBK_PUBLISH_FLAG_RAW_TOPIC_NAME;
+		flags |= OBK_PUBLISH_FLAG_RAW_TOPIC_NAME;
 	}
 	// optional fourth argument to set rounding
 	decimalPlaces = Tokenizer_GetArgIntegerDefault(3, -1);
@@ -1636,10 +2874,6 @@ typedef struct BENCHMARK_TEST_INFO
 	bool report_published;
 } BENCHMARK_TEST_INFO;
 
-#ifndef portTICK_RATE_MS
-#define portTICK_RATE_MS ( ( portTickType ) 1000 / configTICK_RATE_HZ )
-#endif
-
 void MQTT_Test_Tick(void* param)
 {
 	BENCHMARK_TEST_INFO* info = (BENCHMARK_TEST_INFO*)param;
@@ -1699,7 +2933,7 @@ void MQTT_Test_Tick(void* param)
 					if (err == ERR_OK)
 					{
 						/* Report published */
-						addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, info->value);
+						ADDLOG_INFO(LOG_FEATURE_MQTT, "%s", info->value);
 						info->report_published = true;
 						/* Stop timer */
 					}
@@ -1751,6 +2985,247 @@ commandResult_t MQTT_SetBroadcastInterval(const void* context, const char* cmd,
 
 	return CMD_RES_OK;
 }
+commandResult_t MQTT_SetQueueCoalesce(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	int queued, slabUsed, coalesced, dropped;
+
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() >= 1) {
+		g_mqttQueueCoalesce = Tokenizer_GetArgInteger(0) != 0;
+	}
+	MQTT_GetQueueStats(&queued, &slabUsed, &coalesced, &dropped);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Queue coalesce %i, %i items queued, %i bytes used, %i coalesced, %i dropped",
+		g_mqttQueueCoalesce, queued, slabUsed, coalesced, dropped);
+
+	return CMD_RES_OK;
+}
+commandResult_t MQTT_PrintReceiveStats(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Rx %i/%i bytes used, high-water %i, %i dropped, %i processed, latency avg %i max %i ms",
+		g_mqttRxUsed, MQTT_RX_BUFFER_MAX, g_mqttRxHighWater, g_mqttRxDropped, g_mqttRxProcessed,
+		g_mqttRxProcessed ? (int)(g_mqttRxTotalLatency / g_mqttRxProcessed) : 0, g_mqttRxMaxLatency);
+
+	return CMD_RES_OK;
+}
+// mqtt_egress [Class] [Rate] [Burst]
+commandResult_t MQTT_SetEgressLimit(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	mqttEgressBucket_t* bucket;
+	const char* className;
+	int i;
+
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() >= 2) {
+		className = Tokenizer_GetArg(0);
+		// control is never limited
+		for (i = MQTT_EGRESS_STATE; i <= MQTT_EGRESS_MAX; i++) {
+			if (!stricmp(className, g_mqttEgressNames[i])) {
+				break;
+			}
+		}
+		if (i > MQTT_EGRESS_MAX) {
+			ADDLOG_ERROR(LOG_FEATURE_MQTT, "Unknown egress class %s", className);
+			return CMD_RES_BAD_ARGUMENT;
+		}
+		bucket = &g_mqttEgress[i];
+		bucket->rate = Tokenizer_GetArgInteger(1);
+		bucket->burst = Tokenizer_GetArgIntegerDefault(2, bucket->rate);
+		if (bucket->burst < 1) {
+			bucket->burst = 1;
+		}
+		bucket->tokens = bucket->burst * 1000;
+	}
+	else if (Tokenizer_GetArgsCount() != 0) {
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+	for (i = 0; i <= MQTT_EGRESS_MAX; i++) {
+		bucket = &g_mqttEgress[i];
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Egress %s: rate %i burst %i, sent %i, deferred %i, waiting %i, wait avg %i max %i ms",
+			g_mqttEgressNames[i], bucket->rate, bucket->burst, bucket->sent, bucket->deferred,
+			i < MQTT_EGRESS_MAX ? g_mqttEgressQueued[i] : g_MqttPublishItemsQueued,
+			bucket->waited ? (int)(bucket->totalWait / bucket->waited) : 0, bucket->maxWait);
+	}
+
+	return CMD_RES_OK;
+}
+#if MQTT_TLS_OPTIONS
+// mqtt_tls [Resume 0/1] [MaxFragmentLength]
+commandResult_t MQTT_SetTlsOptions(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() >= 1) {
+		g_mqttTlsResume = Tokenizer_GetArgInteger(0) != 0;
+		if (Tokenizer_GetArgsCount() >= 2) {
+			g_mqttTlsMaxFragLen = Tokenizer_GetArgInteger(1);
+			if (g_mqttTlsMaxFragLen < 0) {
+				g_mqttTlsMaxFragLen = 0;
+			}
+			// new value is asked for, also if broker refused previous one
+			g_mqttTlsMflState = MQTT_TLS_MFL_OFFER;
+		}
+		// applied on next connect
+		g_mqttTlsConfigDirty = true;
+	}
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "TLS resume %i (session %s), max fragment %i%s, PSK %s",
+		g_mqttTlsResume, g_mqttTlsSessionValid ? "cached" : "none", g_mqttTlsMaxFragLen,
+		g_mqttTlsMflState == MQTT_TLS_MFL_OFFER ? "" : " (refused by broker)",
+		g_mqttTlsPskLen ? g_mqttTlsPskIdentity : "none");
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "TLS handshakes %i, resumed %i, last %i ms, max %i ms, peak heap %i",
+		g_mqttTlsHandshakes, g_mqttTlsResumed, g_mqttTlsLastMS, g_mqttTlsMaxMS, g_mqttTlsPeakHeap);
+	return CMD_RES_OK;
+}
+// mqtt_tlsPsk [Identity] [KeyHex]
+commandResult_t MQTT_SetTlsPsk(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	const char* key;
+	int len;
+
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() < 2) {
+		// without arguments, PSK is not used
+		g_mqttTlsPskLen = 0;
+		g_mqttTlsConfigDirty = true;
+		return CMD_RES_OK;
+	}
+	key = Tokenizer_GetArg(1);
+	len = strlen(key);
+	if (len % 2 || len / 2 > (int)sizeof(g_mqttTlsPsk)) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "PSK must be hex string of at most %i bytes", (int)sizeof(g_mqttTlsPsk));
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	strcpy_safe(g_mqttTlsPskIdentity, Tokenizer_GetArg(0), sizeof(g_mqttTlsPskIdentity));
+	for (g_mqttTlsPskLen = 0; g_mqttTlsPskLen < len / 2; g_mqttTlsPskLen++) {
+		g_mqttTlsPsk[g_mqttTlsPskLen] = hexbyte(key + g_mqttTlsPskLen * 2);
+	}
+	g_mqttTlsConfigDirty = true;
+	return CMD_RES_OK;
+}
+#endif
+// mqtt_fastReconnect [0/1] [MinBackoffMS] [MaxBackoffMS]
+commandResult_t MQTT_SetFastReconnect(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() >= 1) {
+		if (g_mqttFastReconnect == false) {
+			// acks were not tracked so far, take what was published as confirmed
+			memcpy(g_mqttChannelAckedSeq, g_mqttChannelSeq, sizeof(g_mqttChannelAckedSeq));
+		}
+		g_mqttFastReconnect = Tokenizer_GetArgInteger(0) != 0;
+		if (Tokenizer_GetArgsCount() >= 2) {
+			g_mqttBackoffMinMS = Tokenizer_GetArgInteger(1);
+		}
+		if (Tokenizer_GetArgsCount() >= 3) {
+			g_mqttBackoffMaxMS = Tokenizer_GetArgInteger(2);
+		}
+		if (g_mqttBackoffMinMS < 1) {
+			g_mqttBackoffMinMS = 1;
+		}
+		if (g_mqttBackoffMaxMS < g_mqttBackoffMinMS) {
+			g_mqttBackoffMaxMS = g_mqttBackoffMinMS;
+		}
+		g_mqttConnectPending = false;
+		g_mqttBackoffMS = 0;
+	}
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Fast reconnect %i, backoff %i..%i ms, attempts %i, last connect %i ms, max %i ms, reconciled %i, DNS cache hits %i",
+		g_mqttFastReconnect, g_mqttBackoffMinMS, g_mqttBackoffMaxMS, g_mqttConnectAttempts,
+		g_mqttLastConnectMS, g_mqttMaxConnectMS, g_mqttReconciled, g_mqttDnsCacheHits);
+	return CMD_RES_OK;
+}
+void MQTT_GetReconnectStats(int* outAttempts, int* outLastConnectMS, int* outMaxConnectMS, int* outReconciled, int* outDnsCacheHits) {
+	*outAttempts = g_mqttConnectAttempts;
+	*outLastConnectMS = g_mqttLastConnectMS;
+	*outMaxConnectMS = g_mqttMaxConnectMS;
+	*outReconciled = g_mqttReconciled;
+	*outDnsCacheHits = g_mqttDnsCacheHits;
+}
+#ifdef WINDOWS
+void MQTT_SimulateConnectionStatus(int status) {
+	mqtt_connection_cb(mqtt_client, &mqtt_client_info, (mqtt_connection_status_t)status);
+}
+#endif
+static int MQTT_Latency_PrintJSON(char* out, int outSize, const char* name, mqttLatencyStats_t* stats) {
+	int len;
+	int i;
+
+	len = snprintf(out, outSize, "\"%s\":{\"count\":%i,\"avg\":%i,\"max\":%u,\"hist\":[",
+		name, stats->count, stats->count ? (int)(stats->total / stats->count) : 0, stats->max);
+	for (i = 0; i < MQTT_LATENCY_BUCKETS && len < outSize; i++) {
+		len += snprintf(out + len, outSize - len, "%s%i", i ? "," : "", stats->hist[i]);
+	}
+	if (len < outSize) {
+		len += snprintf(out + len, outSize - len, "]}");
+	}
+	return len < outSize ? len : outSize - 1;
+}
+
+// Writes publish stats as JSON object, used by mqtt_pubStats, /api/info and tele
+int MQTT_GetPublishStatsJSON(char* out, int outSize) {
+	int len;
+	int i;
+
+	len = snprintf(out, outSize, "{\"published\":%i,\"errors\":%i,\"perSec\":%i,\"bytesPerSec\":%i,\"bytesPerSecMax\":%i,"
+		"\"queue\":%i,\"queueMax\":%i,\"mutexWaitAvg\":%i,\"mutexWaitMax\":%u,\"mutexFails\":%i,\"bounds\":[",
+		mqtt_published_events, mqtt_publish_errors, g_mqttPublishesPerSecond, g_mqttBytesPerSecond, g_mqttBytesPerSecondMax,
+		g_MqttPublishItemsQueued, g_mqttQueueHighWater,
+		g_mqttMutexTakes ? (int)(g_mqttMutexWaitTotal / g_mqttMutexTakes) : 0, g_mqttMutexWaitMax, g_mqttMutexFails);
+	for (i = 0; i < MQTT_LATENCY_BUCKETS - 1 && len < outSize; i++) {
+		len += snprintf(out + len, outSize - len, "%s%i", i ? "," : "", g_mqttLatencyBounds[i]);
+	}
+	if (len < outSize) {
+		len += snprintf(out + len, outSize - len, "],");
+	}
+	if (len < outSize) {
+		len += MQTT_Latency_PrintJSON(out + len, outSize - len, "accept", &g_mqttAcceptLatency);
+	}
+	if (len < outSize) {
+		len += snprintf(out + len, outSize - len, ",");
+	}
+	if (len < outSize) {
+		len += MQTT_Latency_PrintJSON(out + len, outSize - len, "ack", &g_mqttAckLatency);
+	}
+#if ENABLE_LITTLEFS
+	if (len < outSize && MQTT_Spool_IsEnabled()) {
+		int spoolBytes, spoolRecords, spoolReplayed, spoolSuperseded, spoolDropped;
+
+		MQTT_Spool_GetStats(&spoolBytes, &spoolRecords, &spoolReplayed, &spoolSuperseded, &spoolDropped);
+		len += snprintf(out + len, outSize - len, ",\"spool\":{\"bytes\":%i,\"records\":%i,\"replayed\":%i,"
+			"\"superseded\":%i,\"dropped\":%i,\"rate\":%i}",
+			spoolBytes, spoolRecords, spoolReplayed, spoolSuperseded, spoolDropped, MQTT_Spool_GetReplayRate());
+	}
+#endif
+	if (len < outSize) {
+		len += snprintf(out + len, outSize - len, "}");
+	}
+	return len < outSize ? len : outSize - 1;
+}
+void MQTT_PublishStatsTele() {
+	char buffer[MQTT_STATS_JSON_SIZE];
+
+	MQTT_GetPublishStatsJSON(buffer, sizeof(buffer));
+	MQTT_PublishTele("MQTT", buffer);
+}
+// mqtt_pubStats [reset]
+commandResult_t MQTT_PrintPublishStats(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	char buffer[MQTT_STATS_JSON_SIZE];
+
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() >= 1 && !stricmp(Tokenizer_GetArg(0), "reset")) {
+		memset(&g_mqttAcceptLatency, 0, sizeof(g_mqttAcceptLatency));
+		memset(&g_mqttAckLatency, 0, sizeof(g_mqttAckLatency));
+		g_mqttQueueHighWater = g_MqttPublishItemsQueued;
+		g_mqttMutexTakes = 0;
+		g_mqttMutexFails = 0;
+		g_mqttMutexWaitTotal = 0;
+		g_mqttMutexWaitMax = 0;
+		g_mqttBytesPerSecondMax = 0;
+		return CMD_RES_OK;
+	}
+	MQTT_GetPublishStatsJSON(buffer, sizeof(buffer));
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Publish stats %s", buffer);
+
+	return CMD_RES_OK;
+}
 static BENCHMARK_TEST_INFO* info = NULL;
 
 #if WINDOWS
@@ -1895,9 +3370,14 @@ void MQTT_init()
 	// WINDOWS must support reinit
 #ifdef WINDOWS
 	mqtt_client = 0;
+	g_mqttHadSession = false;
+	g_mqttSessionUp = false;
+	g_mqttConnectPending = false;
+	g_mqttBackoffMS = 0;
 #endif
 
 	MQTT_InitCallbacks();
+	MQTT_Worker_Start();
 
 	mqtt_initialised = 1;
 
@@ -1946,6 +3426,47 @@ void MQTT_init()
 	//cmddetail:"fn":"MQTT_SetMaxBroadcastItemsPublishedPerSecond","file":"mqtt/new_mqtt.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("mqtt_broadcastItemsPerSec", MQTT_SetMaxBroadcastItemsPublishedPerSecond, NULL);
+	MQTT_Dedup_Init();
+#if ENABLE_LITTLEFS
+	MQTT_Spool_Init();
+#endif
+	//cmddetail:{"name":"mqtt_queueCoalesce","args":"[0/1]",
+	//cmddetail:"descr":"Enables or disables coalescing in publish queue. Disabled by default. When enabled, queuing a state topic which is still waiting for publish only replaces its value, so only the latest value is sent. Command replies (stat/), telemetry and discovery are never coalesced. Without argument, prints queue statistics.",
+	//cmddetail:"fn":"MQTT_SetQueueCoalesce","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("mqtt_queueCoalesce", MQTT_SetQueueCoalesce, NULL);
+	//cmddetail:{"name":"mqtt_fastReconnect","args":"[0/1][MinBackoffMS][MaxBackoffMS]",
+	//cmddetail:"descr":"Enables fast reconnect. Lost connection is retried at once, and then with exponential backoff with jitter between MinBackoffMS and MaxBackoffMS, instead of fixed 15 seconds wait. Broker address is resolved again only if connect to it fails. After reconnect, only channels changed since their last acknowledged publish are published, instead of whole device state. Without arguments, prints statistics.",
+	//cmddetail:"fn":"MQTT_SetFastReconnect","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_fastReconnect 1 500 60000"}
+	CMD_RegisterCommand("mqtt_fastReconnect", MQTT_SetFastReconnect, NULL);
+#if MQTT_TLS_OPTIONS
+	//cmddetail:{"name":"mqtt_tls","args":"[Resume][MaxFragmentLength]",
+	//cmddetail:"descr":"Sets TLS handshake options of MQTT connection. Resume 1 (default) caches session ID or ticket of last handshake and offers it on reconnect, so broker can skip the full handshake. MaxFragmentLength (512, 1024, 2048 or 4096, 0 is off) asks broker for smaller records, it's not set lower than MQTT output buffer. If handshake fails with it, next connect is made without it, and if that one works, it's not asked for until set again. Without arguments, prints handshake count, how many were resumed, connect time and peak heap used during handshake.",
+	//cmddetail:"fn":"MQTT_SetTlsOptions","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_tls 1 4096"}
+	CMD_RegisterCommand("mqtt_tls", MQTT_SetTlsOptions, NULL);
+	//cmddetail:{"name":"mqtt_tlsPsk","args":"[Identity][KeyHex]",
+	//cmddetail:"descr":"Sets pre-shared key for MQTT TLS connection. PSK cipher suite is offered first, which skips certificate and public key operations. Without arguments, PSK is not used. Put it in autoexec.bat, it's not saved in config.",
+	//cmddetail:"fn":"MQTT_SetTlsPsk","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_tlsPsk myDevice 0123456789abcdef0123456789abcdef"}
+	CMD_RegisterCommand("mqtt_tlsPsk", MQTT_SetTlsPsk, NULL);
+#endif
+	//cmddetail:{"name":"mqtt_rxStats","args":"",
+	//cmddetail:"descr":"Prints statistics of receive buffer, where incoming publishes wait for processing: bytes used, high-water mark, dropped and processed count and processing latency.",
+	//cmddetail:"fn":"MQTT_PrintReceiveStats","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("mqtt_rxStats", MQTT_PrintReceiveStats, NULL);
+	//cmddetail:{"name":"mqtt_egress","args":"[Class][Rate][Burst]",
+	//cmddetail:"descr":"Sets token bucket limit of MQTT publishes for a class: state, tele, discovery or total (all classes together). Rate is publishes per second (0 is no limit), Burst is how many can go at once (default is Rate). Publishes over the limit wait in queue and are sent by priority: control (command replies, never limited), state, tele, discovery. Without arguments, prints limits and per-class statistics.",
+	//cmddetail:"fn":"MQTT_SetEgressLimit","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_egress tele 2 5"}
+	CMD_RegisterCommand("mqtt_egress", MQTT_SetEgressLimit, NULL);
+	//cmddetail:{"name":"mqtt_pubStats","args":"[reset]",
+	//cmddetail:"descr":"Prints MQTT publish statistics as JSON: counts, publishes and bytes per second, queue depth, mutex wait and latency histograms (ms, bucket upper bounds are given in bounds) from request to LWIP acceptance (accept) and from there to broker PUBACK for QoS 1 (ack). Same JSON is in /api/info and is published to tele/[client]/MQTT with Tasmota STATE tele. With reset, clears latency, mutex and peak statistics.",
+	//cmddetail:"fn":"MQTT_PrintPublishStats","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_pubStats reset"}
+	CMD_RegisterCommand("mqtt_pubStats", MQTT_PrintPublishStats, NULL);
 	//cmddetail:{"name":"TasTeleInterval","args":"[SensorInterval][StateInterval]",
 	//cmddetail:"descr":"This allows you to configure Tasmota TELE publish intervals, only if you have TELE flag enabled. First argument is interval for sensor publish (energy metering, etc), second is interval for State tele publish.",
 	//cmddetail:"fn":"MQTT_SetTasTeleIntervals","file":"mqtt/new_mqtt.c","requires":"",
@@ -1981,7 +3502,8 @@ OBK_Publish_Result MQTT_DoItemPublish(int idx)
 		return OBK_PUBLISH_WAS_NOT_REQUIRED;
 
 	case PUBLISHITEM_QUEUED_VALUES:
-		return PublishQueuedItems();
+		MQTT_RequestQueueDrain();
+		return OBK_PUBLISH_WAS_NOT_REQUIRED;
 
 	case PUBLISHITEM_SELF_DYNAMIC_LIGHTSTATE:
 	{
@@ -2080,6 +3602,12 @@ OBK_Publish_Result MQTT_DoItemPublish(int idx)
 	// TODO
 	//type = CHANNEL_GetType(idx);
 	if (bWantsToPublish) {
+		// in JSON only mode nothing is sent here, so whole state goes in one message
+		if (CFG_HasFlag(OBK_FLAG_MQTT_CHANNELS_AS_JSON) && CFG_HasFlag(OBK_FLAG_MQTT_CHANNELS_JSON_ONLY)
+			&& !CHANNEL_HasNeverPublishFlag(idx)) {
+			MQTT_MarkChannelForStateJSON(idx);
+			return OBK_PUBLISH_WAS_NOT_REQUIRED;
+		}
 		return MQTT_ChannelPublish(g_publishItemIndex, OBK_PUBLISH_FLAG_MUTEX_SILENT);
 	}
 
@@ -2092,6 +3620,23 @@ int MQTT_RunQuickTick(){
 	// on Beken, we use a one-shot timer for this.
 	MQTT_process_received();
 #endif
+	g_mqttTimeMS += g_deltaTimeMS;
+	MQTT_Egress_Refill(g_deltaTimeMS);
+#if MQTT_TLS_OPTIONS
+	MQTT_TLS_SampleHeap();
+#endif
+	// connect (DNS, TLS setup) is too heavy for quick tick, so it's only
+	// decided here that it's due
+	if (g_mqttFastReconnect && g_mqttConnectPending && g_mqttWantConnect == false
+		&& (int)(MQTT_NowMS() - g_mqttNextConnectMS) >= 0) {
+		MQTT_RequestConnect();
+	}
+	// publishes held back by egress limits go out as soon as there are tokens,
+	// but not from here, quick tick is a timer callback on some platforms
+	if (g_MqttPublishItemsQueued > 0 && MQTT_IsReady()) {
+		MQTT_RequestQueueDrain();
+	}
+	MQTT_RunStateJSON(g_deltaTimeMS);
 	return 0;
 }
 
@@ -2120,15 +3665,108 @@ void MQTT_BroadcastTasmotaTeleSTATE() {
 	MQTT_ProcessCommandReplyJSON("STATE", "", COMMAND_FLAG_SOURCE_TELESENDER);
 #endif
 }
+// (re)creates client and starts connecting, called with mutex taken
+static int MQTT_StartConnect()
+{
+	int res;
+
+	if (mqtt_client == 0)
+	{
+		LOCK_TCPIP_CORE();
+		mqtt_client = mqtt_client_new();
+		UNLOCK_TCPIP_CORE();
+	}
+	else
+	{
+		LOCK_TCPIP_CORE();
+		mqtt_disconnect(mqtt_client);
+#if defined(MQTT_CLIENT_CLEANUP)
+		mqtt_client_cleanup(mqtt_client);
+#endif
+		UNLOCK_TCPIP_CORE();
+	}
+	res = MQTT_do_connect(mqtt_client);
+	mqtt_connect_events++;
+	return res;
+}
+// connect attempt of fast reconnect, requested by quick tick, done in mqtt worker thread
+static void MQTT_Reconnect_Try()
+{
+	if (Main_HasWiFiConnected() == 0)
+	{
+		// tried at once when WiFi is back
+		return;
+	}
+	g_mqttWaitingForWiFi = false;
+#if PLATFORM_BK7231N || PLATFORM_BK7231T
+	if (ota_progress() != -1)
+	{
+		return;
+	}
+#endif
+	if (MQTT_IsReady())
+	{
+		// connection has survived
+		g_mqttConnectPending = false;
+		g_mqttBackoffMS = 0;
+		return;
+	}
+	if (MQTT_Mutex_Take(10) == 0)
+	{
+		return;
+	}
+	g_mqttConnectAttempts++;
+	// result comes to mqtt_connection_cb, which schedules next attempt,
+	// but if nothing comes from LWIP, try again later anyway
+	g_mqttNextConnectMS = MQTT_NowMS() + MQTT_CONNECT_ATTEMPT_TIMEOUT_MS;
+	if (MQTT_StartConnect() == ERR_RTE)
+	{
+		MQTT_Reconnect_Schedule();
+	}
+	MQTT_Mutex_Free();
+}
+// After reconnect, sends channels which latest value was not acknowledged by broker.
+// Called without mutex, publishes take it.
+static void MQTT_Reconcile()
+{
+	int i;
+	int count = 0;
+
+	for (i = 0; i < CHANNEL_MAX; i++) {
+		if ((int)(g_mqttChannelSeq[i] - g_mqttChannelAckedSeq[i]) > 0) {
+			MQTT_ChannelPublish(i, 0);
+			count++;
+		}
+	}
+	g_mqttReconciled += count;
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT reconnected in %i ms, republished %i changed channels", g_mqttLastConnectMS, count);
+}
 // called from user timer.
 int MQTT_RunEverySecondUpdate()
 {
+	bool bReconcile = false;
+
 	if (!mqtt_initialised)
 		return 0;
 
+	g_mqttBytesPerSecond = g_mqttBytesThisSecond;
+	if (g_mqttBytesPerSecond > g_mqttBytesPerSecondMax) {
+		g_mqttBytesPerSecondMax = g_mqttBytesPerSecond;
+	}
+	g_mqttPublishesPerSecond = g_mqttPublishesThisSecond;
+	g_mqttBytesThisSecond = 0;
+	g_mqttPublishesThisSecond = 0;
+
 	if (Main_HasWiFiConnected() == 0)
 	{
 		mqtt_reconnect = 0;
+		if (g_mqttFastReconnect && g_mqttWaitingForWiFi == false) {
+			// connect as soon as WiFi is back
+			g_mqttWaitingForWiFi = true;
+			g_mqttConnectStartMS = MQTT_NowMS();
+			g_mqttBackoffMS = 0;
+			MQTT_Reconnect_Schedule();
+		}
 		if (Main_HasFastConnect()) {
 			mqtt_loopsWithDisconnected = LOOPS_WITH_DISCONNECTED + 1;
 		}
@@ -2144,15 +3782,17 @@ int MQTT_RunEverySecondUpdate()
 		return 0;
 	}
 	if (g_mqtt_bBaseTopicDirty) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT base topic is dirty, will reinit callbacks and reconnect\n");
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT base topic is dirty, will reinit callbacks and reconnect\n");
 		MQTT_InitCallbacks();
 		mqtt_reconnect = 5;
+		// new topics, so everything has to be published again
+		g_mqttHadSession = false;
 	}
 
 	// reconnect if went into MQTT library ERR_MEM forever loop
 	if (g_memoryErrorsThisSession >= 5)
 	{
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT will reconnect soon to fix ERR_MEM errors\n");
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT will reconnect soon to fix ERR_MEM errors\n");
 		g_memoryErrorsThisSession = 0;
 		mqtt_reconnect = 5;
 	}
@@ -2167,13 +3807,13 @@ int MQTT_RunEverySecondUpdate()
 	if (mqtt_reconnect > 0)
 	{
 		mqtt_reconnect--;
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT has pending reconnect in %i\n", mqtt_reconnect);
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT has pending reconnect in %i\n", mqtt_reconnect);
 		if (mqtt_reconnect == 0)
 		{
 			// then if connected, disconnect, and then it will reconnect automatically in 2s
 			if (mqtt_client && res)
 			{
-				addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT will now do a forced reconnect\n");
+				ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT will now do a forced reconnect\n");
 				MQTT_disconnect(mqtt_client);
 				mqtt_loopsWithDisconnected = LOOPS_WITH_DISCONNECTED - 2;
 			}
@@ -2187,31 +3827,27 @@ int MQTT_RunEverySecondUpdate()
 		if (ota_progress() == -1)
 #endif
 		{
-			mqtt_loopsWithDisconnected++;
-			if (mqtt_loopsWithDisconnected > LOOPS_WITH_DISCONNECTED)
+			if (g_mqttFastReconnect)
 			{
-				if (mqtt_client == 0)
+				// attempts are made by quick tick
+				if (g_mqttConnectPending == false)
 				{
-					LOCK_TCPIP_CORE();
-					mqtt_client = mqtt_client_new();
-					UNLOCK_TCPIP_CORE();
+					g_mqttConnectStartMS = MQTT_NowMS();
+					MQTT_Reconnect_Schedule();
 				}
-				else
+			}
+			else
+			{
+				mqtt_loopsWithDisconnected++;
+				if (mqtt_loopsWithDisconnected > LOOPS_WITH_DISCONNECTED)
 				{
-					LOCK_TCPIP_CORE();
-					mqtt_disconnect(mqtt_client);
-#if defined(MQTT_CLIENT_CLEANUP)
-					mqtt_client_cleanup(mqtt_client);
-#endif
-					UNLOCK_TCPIP_CORE();
-				}
-				if (MQTT_do_connect(mqtt_client) == ERR_RTE) {
-					// silently allow retry next frame
-				}
-				else {
-					mqtt_loopsWithDisconnected = 0;
+					if (MQTT_StartConnect() == ERR_RTE) {
+						// silently allow retry next frame
+					}
+					else {
+						mqtt_loopsWithDisconnected = 0;
+					}
 				}
-				mqtt_connect_events++;
 			}
 		}
 		MQTT_Mutex_Free();
@@ -2221,18 +3857,27 @@ int MQTT_RunEverySecondUpdate()
 		// things to do in our threads on connection accepted.
 		if (g_just_connected){
 			g_just_connected = 0;
+			if (g_mqttFastReconnect && g_mqttHadSession) {
+				// broker has seen us before, only changes are missing,
+				// they are published after mutex is freed
+				bReconcile = true;
+			}
 			// publish all values on state
-			if (CFG_HasFlag(OBK_FLAG_MQTT_BROADCASTSELFSTATEONCONNECT)) {
+			else if (CFG_HasFlag(OBK_FLAG_MQTT_BROADCASTSELFSTATEONCONNECT)) {
 				g_wantTasmotaTeleSend = 1;
 				MQTT_PublishWholeDeviceState();
 			}
 			else {
 				//MQTT_PublishOnlyDeviceChannelsIfPossible();
 			}
+			g_mqttHadSession = true;
 		}
 
 		MQTT_Mutex_Free();
 		// below mutex is not required any more
+		if (bReconcile) {
+			MQTT_Reconcile();
+		}
 
 		// it is connected publish TELE
 		if (g_wantTasmotaTeleSend) {
@@ -2240,11 +3885,14 @@ int MQTT_RunEverySecondUpdate()
 			MQTT_BroadcastTasmotaTeleSENSOR();
 			g_wantTasmotaTeleSend = 0;
 		}
+#if ENABLE_LITTLEFS
+		MQTT_Spool_Replay();
+#endif
 		g_timeSinceLastMQTTPublish++;
 #if PLATFORM_BK7231N || PLATFORM_BK7231T
 		if (ota_progress() != -1)
 		{
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "OTA started MQTT will be closed\n");
+			ADDLOG_INFO(LOG_FEATURE_MQTT, "OTA started MQTT will be closed\n");
 			LOCK_TCPIP_CORE();
 			mqtt_disconnect(mqtt_client);
 			UNLOCK_TCPIP_CORE();
@@ -2264,6 +3912,7 @@ int MQTT_RunEverySecondUpdate()
 			if (g_mqtt_tasmotaTeleCounter_state >= g_teleState_interval) {
 				g_mqtt_tasmotaTeleCounter_state = 0;
 				MQTT_BroadcastTasmotaTeleSTATE();
+				MQTT_PublishStatsTele();
 			}
 		}
 
@@ -2274,7 +3923,7 @@ int MQTT_RunEverySecondUpdate()
 		//Handle only queued items. Don't need to do this separately if entire state is being published.
 		if ((g_MqttPublishItemsQueued > 0) && !g_bPublishAllStatesNow)
 		{
-			PublishQueuedItems();
+			MQTT_RequestQueueDrain();
 			return 1;
 		}
 		else if (g_bPublishAllStatesNow)
@@ -2291,7 +3940,7 @@ int MQTT_RunEverySecondUpdate()
 					if (publishRes != OBK_PUBLISH_WAS_NOT_REQUIRED)
 					{
 						if (false) {
-							addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "[g_bPublishAllStatesNow] item %i result %i\n", g_publishItemIndex, publishRes);
+							ADDLOG_INFO(LOG_FEATURE_MQTT, "[g_bPublishAllStatesNow] item %i result %i\n", g_publishItemIndex, publishRes);
 						}
 					}
 					// There are several things that can happen now
@@ -2341,84 +3990,226 @@ int MQTT_RunEverySecondUpdate()
 	return 1;
 }
 
-MqttPublishItem_t* get_queue_tail(MqttPublishItem_t* head) {
-	if (head == NULL) { return NULL; }
+#define MQTT_QUEUE_ITEM(i) (&g_mqttQueue[(g_mqttQueueFirst + (i)) % MQTT_MAX_QUEUE_SIZE])
+#define MQTT_SLAB_RECORD(ofs) ((mqttSlabRecord_t*)(g_mqttSlab + (ofs)))
+
+static const char* MQTT_Queue_GetTopic(MqttPublishItem_t* item) {
+	return (const char*)(g_mqttSlab + item->slabOffset + sizeof(mqttSlabRecord_t));
+}
+static const char* MQTT_Queue_GetChannel(MqttPublishItem_t* item) {
+	return MQTT_Queue_GetTopic(item) + item->topicLength + 1;
+}
+static const char* MQTT_Queue_GetValue(MqttPublishItem_t* item) {
+	return MQTT_Queue_GetChannel(item) + item->channelLength + 1;
+}
+
+// returns string length and updates FNV-1a hash, in single pass
+static int MQTT_Queue_HashString(const char* s, unsigned int* hash) {
+	const char* p = s;
+	unsigned int h = *hash;
 
-	while (head->next != NULL) {
-		head = head->next;
+	while (*p) {
+		h ^= (byte)*p;
+		h *= 16777619;
+		p++;
 	}
-	return head;
+	*hash = h;
+	return p - s;
 }
 
-MqttPublishItem_t* find_queue_reusable_item(MqttPublishItem_t* head) {
-	while (head != NULL) {
-		if (MQTT_QUEUE_ITEM_IS_REUSABLE(head)) {
-			return head;
+// returns offset of reserved record or -1 if slab is full
+static int MQTT_Queue_SlabAlloc(int size) {
+	int ofs;
+
+	if (g_mqttSlab == 0) {
+		g_mqttSlab = (byte*)os_malloc(MQTT_QUEUE_SLAB_SIZE);
+		if (g_mqttSlab == 0) {
+			return -1;
+		}
+	}
+	if (g_mqttSlabUsed == 0) {
+		g_mqttSlabHead = g_mqttSlabTail = 0;
+		g_mqttSlabEnd = MQTT_QUEUE_SLAB_SIZE;
+	}
+	if (g_mqttSlabHead < g_mqttSlabTail || (g_mqttSlabHead == g_mqttSlabTail && g_mqttSlabUsed)) {
+		// wrapped, free space is only between head and tail
+		if (g_mqttSlabHead + size > g_mqttSlabTail) {
+			return -1;
 		}
-		head = head->next;
+		ofs = g_mqttSlabHead;
 	}
-	return head;
+	else if (g_mqttSlabHead + size <= MQTT_QUEUE_SLAB_SIZE) {
+		ofs = g_mqttSlabHead;
+	}
+	else if (size <= g_mqttSlabTail) {
+		// records must be contiguous, so wrap and leave the rest unused
+		g_mqttSlabEnd = g_mqttSlabHead;
+		ofs = 0;
+	}
+	else {
+		return -1;
+	}
+	g_mqttSlabHead = ofs + size;
+	g_mqttSlabUsed += size;
+	MQTT_SLAB_RECORD(ofs)->size = size;
+	MQTT_SLAB_RECORD(ofs)->alive = 1;
+	return ofs;
 }
 
-/// @brief Queue an entry for publish and execute a command after the publish.
-/// @param topic 
-/// @param channel 
-/// @param value 
-/// @param flags
-/// @param command Command to execute after the publish
-void MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command) {
-	MqttPublishItem_t* newItem;
-	if (g_MqttPublishItemsQueued >= MQTT_MAX_QUEUE_SIZE) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! %i items already present\r\n", g_MqttPublishItemsQueued);
-		return;
-	}
+static void MQTT_Queue_SlabFree(int ofs) {
+	mqttSlabRecord_t* rec;
 
-	if ((strlen(topic) > MQTT_PUBLISH_ITEM_TOPIC_LENGTH) ||
-		(strlen(channel) > MQTT_PUBLISH_ITEM_CHANNEL_LENGTH) ||
-		(strlen(value) > MQTT_PUBLISH_ITEM_VALUE_LENGTH)) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! Topic (%i), channel (%i) or value (%i) exceeds size limit\r\n",
-			strlen(topic), strlen(channel), strlen(value));
-		return;
+	MQTT_SLAB_RECORD(ofs)->alive = 0;
+	while (g_mqttSlabUsed > 0) {
+		rec = MQTT_SLAB_RECORD(g_mqttSlabTail);
+		if (rec->alive) {
+			break;
+		}
+		g_mqttSlabTail += rec->size;
+		g_mqttSlabUsed -= rec->size;
+		if (g_mqttSlabTail >= g_mqttSlabEnd) {
+			g_mqttSlabTail = 0;
+			g_mqttSlabEnd = MQTT_QUEUE_SLAB_SIZE;
+		}
 	}
+}
 
-	//Queue data for publish. This might be a new item in the queue or an existing item. This is done to prevent
-	//memory fragmentation. The total queue length is limited to MQTT_MAX_QUEUE_SIZE.
+// copies strings into the given record
+static void MQTT_Queue_SetStrings(MqttPublishItem_t* item, int ofs, const char* topic, int topicLen,
+	const char* channel, int channelLen, const char* value, int valueLen) {
+	char* p = (char*)(g_mqttSlab + ofs + sizeof(mqttSlabRecord_t));
+
+	memcpy(p, topic, topicLen + 1);
+	p += topicLen + 1;
+	memcpy(p, channel, channelLen + 1);
+	p += channelLen + 1;
+	memcpy(p, value, valueLen + 1);
+	item->slabOffset = ofs;
+	item->topicLength = topicLen;
+	item->channelLength = channelLen;
+	item->valueLength = valueLen;
+}
 
-	if (g_MqttPublishQueueHead == NULL) {
-		g_MqttPublishQueueHead = newItem = os_malloc(sizeof(MqttPublishItem_t));
-		newItem->next = NULL;
-	}
-	else {
-		newItem = find_queue_reusable_item(g_MqttPublishQueueHead);
+// finds pending item publishing to the same place
+static MqttPublishItem_t* MQTT_Queue_FindSame(unsigned int hash, const char* topic, int topicLen,
+	const char* channel, int channelLen, int flags) {
+	MqttPublishItem_t* item;
+	int i;
 
-		if (newItem == NULL) {
-			newItem = os_malloc(sizeof(MqttPublishItem_t));
-			newItem->next = NULL;
-			get_queue_tail(g_MqttPublishQueueHead)->next = newItem; //Append new item
+	for (i = 0; i < g_MqttPublishItemsQueued; i++) {
+		item = MQTT_QUEUE_ITEM(i);
+		if (item->busy || item->hash != hash || item->flags != flags
+			|| item->topicLength != topicLen || item->channelLength != channelLen) {
+			continue;
+		}
+		if (memcmp(MQTT_Queue_GetTopic(item), topic, topicLen) == 0
+			&& memcmp(MQTT_Queue_GetChannel(item), channel, channelLen) == 0) {
+			return item;
 		}
 	}
+	return 0;
+}
 
-	//os_strcpy does copy ending null character.
-	os_strcpy(newItem->topic, topic);
-	os_strcpy(newItem->channel, channel);
-	os_strcpy(newItem->value, value);
-	newItem->command = command;
-	newItem->flags = flags;
+/// @brief Queue an entry for publish and execute a command after the publish.
+/// If coalescing is enabled by mqtt_queueCoalesce and the same state topic is already waiting, only its value is replaced.
+/// @param topic 
+/// @param channel 
+/// @param value 
+/// @param flags
+/// @param command Command to execute after the publish
+/// @return false if it was dropped
+static bool MQTT_Queue_Add(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command) {
+	MqttPublishItem_t* item;
+	unsigned int hash = 2166136261u;
+	int topicLen, channelLen, valueLen;
+	int size, ofs;
+
+	topicLen = MQTT_Queue_HashString(topic, &hash);
+	hash = (hash ^ '/') * 16777619;
+	channelLen = MQTT_Queue_HashString(channel, &hash);
+	valueLen = strlen(value);
+	if ((topicLen > MQTT_PUBLISH_ITEM_TOPIC_LENGTH) ||
+		(channelLen > MQTT_PUBLISH_ITEM_CHANNEL_LENGTH) ||
+		(valueLen > MQTT_PUBLISH_ITEM_VALUE_LENGTH)) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "Unable to queue! Topic (%i), channel (%i) or value (%i) exceeds size limit\r\n",
+			topicLen, channelLen, valueLen);
+		g_mqttQueueDropped++;
+		return false;
+	}
+	size = sizeof(mqttSlabRecord_t) + topicLen + channelLen + valueLen + 3;
+	size = (size + 3) & ~3;
+
+	// item with command must keep its place at the end, and only state values
+	// are coalesced - events and command replies must all be delivered
+	if (g_mqttQueueCoalesce && command == None && MQTT_GetEgressClass(topic, channel, flags) == MQTT_EGRESS_STATE) {
+		item = MQTT_Queue_FindSame(hash, topic, topicLen, channel, channelLen, flags);
+		if (item) {
+			ofs = item->slabOffset;
+			if (MQTT_SLAB_RECORD(ofs)->size < size) {
+				ofs = MQTT_Queue_SlabAlloc(size);
+				if (ofs < 0) {
+					ADDLOG_ERROR(LOG_FEATURE_MQTT, "Unable to queue! No space for %i bytes\r\n", size);
+					g_mqttQueueDropped++;
+					return false;
+				}
+				MQTT_Queue_SlabFree(item->slabOffset);
+			}
+			MQTT_Queue_SetStrings(item, ofs, topic, topicLen, channel, channelLen, value, valueLen);
+			item->retries = 0;
+			g_mqttQueueCoalesced++;
+			ADDLOG_DEBUG(LOG_FEATURE_MQTT, "Coalesced topic=%s/%s, %i items in queue", topic, channel, g_MqttPublishItemsQueued);
+			return true;
+		}
+	}
+	if (g_MqttPublishItemsQueued >= MQTT_MAX_QUEUE_SIZE) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "Unable to queue! %i items already present\r\n", g_MqttPublishItemsQueued);
+		g_mqttQueueDropped++;
+		return false;
+	}
+	ofs = MQTT_Queue_SlabAlloc(size);
+	if (ofs < 0) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "Unable to queue! No space for %i bytes\r\n", size);
+		g_mqttQueueDropped++;
+		return false;
+	}
+	item = MQTT_QUEUE_ITEM(g_MqttPublishItemsQueued);
+	MQTT_Queue_SetStrings(item, ofs, topic, topicLen, channel, channelLen, value, valueLen);
+	item->hash = hash;
+	item->flags = flags;
+	item->retries = 0;
+	item->command = command;
+	item->busy = 0;
+	item->egressClass = MQTT_GetEgressClass(topic, channel, flags);
+	item->queuedTime = MQTT_NowMS();
+	g_mqttEgressQueued[item->egressClass]++;
 
 	g_MqttPublishItemsQueued++;
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Queued topic=%s/%s, %i items in queue", newItem->topic, newItem->channel, g_MqttPublishItemsQueued);
+	if (g_MqttPublishItemsQueued > g_mqttQueueHighWater) {
+		g_mqttQueueHighWater = g_MqttPublishItemsQueued;
+	}
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Queued topic=%s/%s, %i items in queue", topic, channel, g_MqttPublishItemsQueued);
+	return true;
+}
+bool MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command) {
+	bool bQueued;
+
+	MQTT_Queue_Lock();
+	bQueued = MQTT_Queue_Add(topic, channel, value, flags, command);
+	MQTT_Queue_Unlock();
+	return bQueued;
 }
 
 /// @brief Add the specified command to the last entry in the queue.
 /// @param command 
 void MQTT_InvokeCommandAtEnd(PostPublishCommands command) {
-	MqttPublishItem_t* tail = get_queue_tail(g_MqttPublishQueueHead);
-	if (tail == NULL){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "InvokeCommandAtEnd invoked but queue is empty");
+	MQTT_Queue_Lock();
+	if (g_MqttPublishItemsQueued == 0){
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "InvokeCommandAtEnd invoked but queue is empty");
 	}
 	else {
-		tail->command = command;
+		MQTT_QUEUE_ITEM(g_MqttPublishItemsQueued - 1)->command = command;
 	}
+	MQTT_Queue_Unlock();
 }
 
 /// @brief Queue an entry for publish.
@@ -2426,53 +4217,138 @@ void MQTT_InvokeCommandAtEnd(PostPublishCommands command) {
 /// @param channel 
 /// @param value 
 /// @param flags
-void MQTT_QueuePublish(const char* topic, const char* channel, const char* value, int flags) {
-	MQTT_QueuePublishWithCommand(topic, channel, value, flags, None);
+/// @return false if it was dropped
+bool MQTT_QueuePublish(const char* topic, const char* channel, const char* value, int flags) {
+	return MQTT_QueuePublishWithCommand(topic, channel, value, flags, None);
 }
 
+void MQTT_GetQueueStats(int* outQueued, int* outSlabUsed, int* outCoalesced, int* outDropped) {
+	*outQueued = g_MqttPublishItemsQueued;
+	*outSlabUsed = g_mqttSlabUsed;
+	*outCoalesced = g_mqttQueueCoalesced;
+	*outDropped = g_mqttQueueDropped;
+}
+
+static void MQTT_Queue_Remove(int index) {
+	int i;
+
+	MQTT_Queue_SlabFree(MQTT_QUEUE_ITEM(index)->slabOffset);
+	g_mqttEgressQueued[MQTT_QUEUE_ITEM(index)->egressClass]--;
+	// older items move one place up, so the first one can be dropped
+	for (i = index; i > 0; i--) {
+		*MQTT_QUEUE_ITEM(i) = *MQTT_QUEUE_ITEM(i - 1);
+	}
+	g_mqttQueueFirst = (g_mqttQueueFirst + 1) % MQTT_MAX_QUEUE_SIZE;
+	g_MqttPublishItemsQueued--;
+}
+
+// Returns index of oldest item of the highest priority class that
+// can be sent now, or -1 if egress limits don't allow any.
+static int MQTT_Queue_PickNext() {
+	int best = -1;
+	int egressClass;
+	int i;
 
-/// @brief Publish MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE queued items.
+	for (i = 0; i < g_MqttPublishItemsQueued; i++) {
+		egressClass = MQTT_QUEUE_ITEM(i)->egressClass;
+		if (best != -1 && egressClass >= MQTT_QUEUE_ITEM(best)->egressClass) {
+			continue;
+		}
+		if (MQTT_Egress_CanSend(egressClass)) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+/// @brief Publish queued items, up to MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE, highest
+/// egress class first. Stops earlier when LWIP has no space left for next item
+/// (the item stays in queue for next call) or when egress limits are reached.
+/// Only mqtt worker thread may call it (see MQTT_RequestQueueDrain), because it's
+/// the only one taking items out. Queue lock is not held while publishing, the
+/// item is only marked busy, so it's not coalesced meanwhile.
 /// @return 
 OBK_Publish_Result PublishQueuedItems() {
 	OBK_Publish_Result result = OBK_PUBLISH_WAS_NOT_REQUIRED;
-
+	MqttPublishItem_t* item;
+	mqttEgressBucket_t* bucket;
+	const char* topic;
+	const char* channel;
+	const char* value;
 	int count = 0;
-	MqttPublishItem_t* head = g_MqttPublishQueueHead;
-
-	//The next actionable item might not be at the front. The queue size is limited to MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE
-	//so this traversal is fast.
-	//addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"PublishQueuedItems g_MqttPublishItemsQueued=%i",g_MqttPublishItemsQueued );
-	while ((head != NULL) && (count < MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE) && (g_MqttPublishItemsQueued > 0)) {
-		if (!MQTT_QUEUE_ITEM_IS_REUSABLE(head)) {  //Skip reusable entries
-			count++;
-			result = MQTT_PublishTopicToClient(mqtt_client, head->topic, head->channel, head->value, head->flags, false);
-			MQTT_QUEUE_ITEM_SET_REUSABLE(head); //Flag item as reusable
-			g_MqttPublishItemsQueued--;   //decrement queued count
-
-			//Stop if last publish failed
-			if (result != OBK_PUBLISH_OK) break;
+	int command;
+	int flags;
+	int index;
+	int wait;
 
-			switch (head->command) {
-			case None:
-				break;
-			case PublishAll:
-				MQTT_PublishWholeDeviceState_Internal(true);
-				break;
-			case PublishChannels:
-				MQTT_PublishOnlyDeviceChannelsIfPossible();
-				break;
+	while ((count < MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE) && (g_MqttPublishItemsQueued > 0)) {
+		MQTT_Queue_Lock();
+		index = MQTT_Queue_PickNext();
+		if (index < 0) {
+			MQTT_Queue_Unlock();
+			break;
+		}
+		item = MQTT_QUEUE_ITEM(index);
+		item->busy = 1;
+		topic = MQTT_Queue_GetTopic(item);
+		channel = MQTT_Queue_GetChannel(item);
+		value = MQTT_Queue_GetValue(item);
+		flags = item->flags;
+		MQTT_Queue_Unlock();
+
+		count++;
+		result = MQTT_PublishTopicToClient(mqtt_client, topic, channel, value, flags | OBK_PUBLISH_FLAG_QUEUED, false);
+
+		// others only append, so item is still at the same index
+		MQTT_Queue_Lock();
+		item = MQTT_QUEUE_ITEM(index);
+		item->busy = 0;
+		if (result != OBK_PUBLISH_OK) {
+			// output buffer is full, try again later, but don't get stuck forever on one item
+			if (result == OBK_PUBLISH_MEM_FAIL && ++item->retries >= MQTT_QUEUE_MAX_RETRIES) {
+				ADDLOG_ERROR(LOG_FEATURE_MQTT, "Dropping queued topic=%s/%s after %i retries",
+					MQTT_Queue_GetTopic(item), MQTT_Queue_GetChannel(item), item->retries);
+				MQTT_Queue_Remove(index);
+				g_mqttQueueDropped++;
 			}
+			MQTT_Queue_Unlock();
+			break;
 		}
-		else {
-			//addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"PublishQueuedItems item skipped reusable");
+		bucket = &g_mqttEgress[item->egressClass];
+		wait = MQTT_NowMS() - item->queuedTime;
+		MQTT_Latency_Add(&g_mqttAcceptLatency, wait);
+		bucket->waited++;
+		bucket->totalWait += wait;
+		if (wait > bucket->maxWait) {
+			bucket->maxWait = wait;
 		}
+		command = item->command;
+		MQTT_Queue_Remove(index);
+		MQTT_Queue_Unlock();
 
-		head = head->next;
+		// these queue more items, so lock must be released
+		switch (command) {
+		case None:
+			break;
+		case PublishAll:
+			MQTT_PublishWholeDeviceState_Internal(true);
+			break;
+		case PublishChannels:
+			MQTT_PublishOnlyDeviceChannelsIfPossible();
+			break;
+		}
 	}
 
 	return result;
 }
 
+void MQTT_GetEgressStats(int egressClass, int* outSent, int* outDeferred, int* outQueued, int* outMaxWaitMS) {
+	*outSent = g_mqttEgress[egressClass].sent;
+	*outDeferred = g_mqttEgress[egressClass].deferred;
+	*outQueued = egressClass < MQTT_EGRESS_MAX ? g_mqttEgressQueued[egressClass] : g_MqttPublishItemsQueued;
+	*outMaxWaitMS = g_mqttEgress[egressClass].maxWait;
+}
+
 
 /// @brief Is MQTT sub system ready and connected?
 /// @return 
@@ -2536,7 +4412,7 @@ struct tm* mbedtls_platform_gmtime_r(const mbedtls_time_t* tt, struct tm* tm_buf
 	if (!NTP_IsTimeSynced()) {	
 		ltm = cvt_date(__DATE__, __TIME__, tm_buf);
 		if (log_gmtime_alt) {
-			addLogAdv(LOG_INFO, LOG_FEATURE_NTP, "MBEDTLS: NTP not synchronized. Using compile time: %04d/%02d/%02d %02d:%02d:%02d",
+			ADDLOG_INFO(LOG_FEATURE_NTP, "MBEDTLS: NTP not synchronized. Using compile time: %04d/%02d/%02d %02d:%02d:%02d",
 				ltm->tm_year + 1900, ltm->tm_mon + 1, ltm->tm_mday, ltm->tm_hour, ltm->tm_min, ltm->tm_sec);
 			log_gmtime_alt = false; 
 		}			
@@ -2553,16 +4429,16 @@ static int mbedtls_verify_cb(void* data, mbedtls_x509_crt* crt, int depth, uint3
 	((void)data);
 	char buf[1024];
 
-	addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "Verify requested for (Depth% d) : \n", depth);
+	ADDLOG_DEBUG(LOG_FEATURE_MQTT, "Verify requested for (Depth% d) : \n", depth);
 	mbedtls_x509_crt_info(buf, sizeof(buf) - 1, "", crt);
-	addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "\n%s", buf);
+	ADDLOG_DEBUG(LOG_FEATURE_MQTT, "\n%s", buf);
 
 	if ((*flags) == 0) {
-		addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "  This certificate has no flags\n");
+		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "  This certificate has no flags\n");
 	}
 	else {
 		mbedtls_x509_crt_verify_info(buf, sizeof(buf), "  ! ", *flags);
-		addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "%s\n", buf);
+		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "%s\n", buf);
 	}
 	return 0;
 }
@@ -2582,107 +4458,107 @@ static void mbedtls_debug_cb(void* ctx, int level, const char* file, int line, c
 		}
 	}
 
-	addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "%s:%04d: |%d| %s", basename, line, level, str);
+	ADDLOG_ERROR(LOG_FEATURE_MQTT, "%s:%04d: |%d| %s", basename, line, level, str);
 }
 
 void mbedtls_dump_conf(mbedtls_ssl_config* conf, mbedtls_ssl_context* ssl) {
 	if (ssl && ssl->handshake) {
-		addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE CIPHER SUITE: %s", ssl->handshake->ciphersuite_info->name);
+		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE CIPHER SUITE: %s", ssl->handshake->ciphersuite_info->name);
 		switch (ssl->handshake->ciphersuite_info->key_exchange)
 		{
 			case MBEDTLS_KEY_EXCHANGE_NONE: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_NONE");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_NONE");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_RSA: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_RSA");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_RSA");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_DHE_RSA: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_DHE_RSA");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_DHE_RSA");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_ECDHE_RSA: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECDHE_RSA");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECDHE_RSA");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_PSK: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_PSK");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_PSK");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_DHE_PSK: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_DHE_PSK");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_DHE_PSK");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_RSA_PSK: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_RSA_PSK");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_RSA_PSK");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_ECDHE_PSK: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECDHE_PSK");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECDHE_PSK");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_ECDH_RSA: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECDH_RSA");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECDH_RSA");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_ECDH_ECDSA: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECDH_ECDSA");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECDH_ECDSA");
 				break;
 			case MBEDTLS_KEY_EXCHANGE_ECJPAKE: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECJPAKE");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "HANDSHAKE KEY EXCHANGE: MBEDTLS_KEY_EXCHANGE_ECJPAKE");
 				break;
 		}
 	}
 	
 	if (conf) {
-		addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "AVAILABLE CIPHERS:");
+		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "AVAILABLE CIPHERS:");
 		int len = sizeof(conf->ciphersuite_list) / (sizeof(conf->ciphersuite_list[0]));
 		for (int s = 0; s < len; s++) {
-			addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     %s",
+			ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     %s",
 				mbedtls_ssl_get_ciphersuite_name(*conf->ciphersuite_list[s]));
 		}
-		addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "AVAILABLE CURVES:");
+		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "AVAILABLE CURVES:");
 		len = sizeof(conf->curve_list) / (sizeof(mbedtls_ecp_group_id));
 		const mbedtls_ecp_group_id* c = conf->curve_list;
 		for (; *c; c++) {
 			switch (*c)
 			{
 			case MBEDTLS_ECP_DP_NONE: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_NONE");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_NONE");
 				break;
 			case MBEDTLS_ECP_DP_SECP192R1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP192R1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP192R1");
 				break;
 			case MBEDTLS_ECP_DP_SECP224R1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP224R1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP224R1");
 				break;
 			case MBEDTLS_ECP_DP_SECP256R1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP256R1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP256R1");
 				break;
 			case MBEDTLS_ECP_DP_SECP384R1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP384R1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP384R1");
 				break;
 			case MBEDTLS_ECP_DP_SECP521R1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP521R1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP521R1");
 				break;
 			case MBEDTLS_ECP_DP_BP256R1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_BP256R1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_BP256R1");
 				break;
 			case MBEDTLS_ECP_DP_BP384R1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_BP384R1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_BP384R1");
 				break;
 			case MBEDTLS_ECP_DP_BP512R1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_BP512R1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_BP512R1");
 				break;
 			case MBEDTLS_ECP_DP_CURVE25519: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_CURVE25519");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_CURVE25519");
 				break;
 			case MBEDTLS_ECP_DP_SECP192K1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP192K1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP192K1");
 				break;
 			case MBEDTLS_ECP_DP_SECP224K1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP224K1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP224K1");
 				break;
 			case MBEDTLS_ECP_DP_SECP256K1: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP256K1");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_SECP256K1");
 				break;
 			case MBEDTLS_ECP_DP_CURVE448: 
-				addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_CURVE448");
+				ADDLOG_DEBUG(LOG_FEATURE_MQTT, "     MBEDTLS_ECP_DP_CURVE448");
 				break;
 			}
 		}
@@ -72,18 +72,34 @@ enum OBK_Publish_Result_e {
 // do not add anything to given topic
 #define OBK_PUBLISH_FLAG_RAW_TOPIC_NAME			8
 #define OBK_PUBLISH_FLAG_QOS_ZERO				16
+// used by publish queue - full output buffer is not an error, item is retried later
+#define OBK_PUBLISH_FLAG_QUEUED					32
+// always send, even if generic deduper would skip it (for example, reply to get)
+#define OBK_PUBLISH_FLAG_NO_DEDUP				64
 
 
 #include "new_mqtt_deduper.h"
+#include "new_mqtt_spool.h"
 
 
 // ability to register callbacks for MQTT data
+// Topic and payload point into receive slab and are valid until callback
+// returns, unless callback keeps them with MQTT_RetainRequest.
 typedef struct obk_mqtt_request_tag {
-	const unsigned char* received; // note: NOT terminated, may be binary
+	const unsigned char* received; // terminated, but may be binary, so use receivedLen
 	int receivedLen;
-	char topic[128];
+	const char* topic;
+	int topicLen;
+	// receive slab record, for MQTT_RetainRequest
+	int slabOffset;
 } obk_mqtt_request_t;
 
+// Bytes for received publishes waiting for processing in our thread.
+// Must stay below 64KB, record sizes are 16 bit.
+#ifndef MQTT_RX_BUFFER_MAX
+#define MQTT_RX_BUFFER_MAX 6144
+#endif
+
 #define MQTT_PUBLISH_ITEM_TOPIC_LENGTH    64
 #define MQTT_PUBLISH_ITEM_CHANNEL_LENGTH  128
 #define MQTT_PUBLISH_ITEM_VALUE_LENGTH    1512
@@ -95,27 +111,108 @@ typedef enum PostPublishCommands_e {
 } PostPublishCommands;
 
 
-/// @brief Publish queue item
+/// @brief Publish queue item. Strings are kept in queue slab,
+/// one after another, each with terminating zero.
 typedef struct MqttPublishItem
 {
-	char topic[MQTT_PUBLISH_ITEM_TOPIC_LENGTH];
-	char channel[MQTT_PUBLISH_ITEM_CHANNEL_LENGTH];
-	char value[MQTT_PUBLISH_ITEM_VALUE_LENGTH];
+	unsigned short slabOffset;
+	unsigned short topicLength;
+	unsigned short channelLength;
+	unsigned short valueLength;
+	// hash of topic and channel, used to find item to coalesce with
+	unsigned int hash;
 	int flags;
-	struct MqttPublishItem* next;
-	PostPublishCommands command;
+	unsigned char retries;
+	unsigned char command;
+	unsigned char egressClass;
+	// being published by PublishQueuedItems, so it's not coalesced meanwhile
+	unsigned char busy;
+	// time when it was queued, in ms
+	unsigned int queuedTime;
 } MqttPublishItem_t;
 
+// Egress classes of publishes, highest priority first. Command replies
+// are never held back. Others are limited by token bucket of their class
+// and by the total one, and what is over the limit waits in publish queue.
+typedef enum MQTT_Egress_Class_e {
+	// stat/obk0696FB33/..., replies to commands
+	MQTT_EGRESS_CONTROL,
+	// obk0696FB33/1/get and everything else
+	MQTT_EGRESS_STATE,
+	// tele/obk0696FB33/...
+	MQTT_EGRESS_TELE,
+	// Home Assistant discovery, .../config
+	MQTT_EGRESS_DISCOVERY,
+	MQTT_EGRESS_MAX,
+} MQTT_Egress_Class_t;
+
+// Default limits, in publishes per second, 0 means no limit.
+// Simulator self tests expect every publish at once.
+#ifndef MQTT_EGRESS_DEFAULT_TOTAL_RATE
+#ifdef WINDOWS
+#define MQTT_EGRESS_DEFAULT_TOTAL_RATE		0
+#define MQTT_EGRESS_DEFAULT_TELE_RATE		0
+#define MQTT_EGRESS_DEFAULT_DISCOVERY_RATE	0
+#else
+#define MQTT_EGRESS_DEFAULT_TOTAL_RATE		20
+#define MQTT_EGRESS_DEFAULT_TELE_RATE		5
+#define MQTT_EGRESS_DEFAULT_DISCOVERY_RATE	8
+#endif
+#endif
+
+// Fast reconnect (mqtt_fastReconnect) - delay before next connect attempt starts
+// at min and doubles after each failure, with +-25% jitter. First attempt after
+// lost connection is made at once.
+#ifndef MQTT_BACKOFF_DEFAULT_MIN_MS
+#define MQTT_BACKOFF_DEFAULT_MIN_MS		500
+#endif
+#ifndef MQTT_BACKOFF_DEFAULT_MAX_MS
+#define MQTT_BACKOFF_DEFAULT_MAX_MS		60000
+#endif
+// connect attempt without any result from LWIP is given up after that
+#define MQTT_CONNECT_ATTEMPT_TIMEOUT_MS	10000
+// QoS 1 publishes that are tracked until broker acknowledges them, at most 32
+// (see MQTT_INFLIGHT_SLOT_BITS)
+#define MQTT_INFLIGHT_SLOTS				16
 
 // Maximum length to log data parameters
 #define MQTT_MAX_DATA_LOG_LENGTH					12
 
-// Count of queued items published at once.
-#define MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE	3
+// Count of queued items published at once. Drain stops earlier
+// if LWIP MQTT client has no more space in output buffer, or when
+// egress limits are reached.
+#define MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE	16
 // When using Hass discovery, when we have, for example,
 // 16 relays, every relay will be a separate publish,
-// so I bumped MAX to 32
-#define MQTT_MAX_QUEUE_SIZE	                32
+// so I bumped MAX to 64. Items are small, the real limit
+// is the slab size.
+#define MQTT_MAX_QUEUE_SIZE	                64
+// Bytes for topics and values of queued items, allocated on first use.
+// Must stay below 64KB, offsets are 16 bit.
+#ifndef MQTT_QUEUE_SLAB_SIZE
+#define MQTT_QUEUE_SLAB_SIZE				16384
+#endif
+// Times item is retried after output buffer was full, before it's dropped
+#define MQTT_QUEUE_MAX_RETRIES				8
+// Stack of thread which publishes queued items and makes fast reconnect
+// attempts, both requested by quick tick. TLS handshake setup needs more.
+#ifndef MQTT_WORKER_STACK_SIZE
+#if MQTT_USE_TLS
+#define MQTT_WORKER_STACK_SIZE				0x2000
+#else
+#define MQTT_WORKER_STACK_SIZE				0x1000
+#endif
+#endif
+// TLS handshake options don't need mbedtls, so simulator has them too
+// and self tests report handshakes the way TLS glue does
+#if MQTT_USE_TLS || WINDOWS
+#define MQTT_TLS_OPTIONS					1
+#endif
+// With OBK_FLAG_MQTT_CHANNELS_AS_JSON, channel changes within that time
+// are published together in one [client]/state message
+#ifndef MQTT_STATE_JSON_WINDOW_MS
+#define MQTT_STATE_JSON_WINDOW_MS			100
+#endif
 
 // callback function for mqtt.
 // return 0 to allow the incoming topic/data to be processed by others/channel set.
@@ -147,6 +244,11 @@ int MQTT_RemoveCallback(int ID);
 // are working...
 int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *data, int datalen);
 int MQTT_Post_Received_Str(const char *topic, const char *data);
+// keeps topic and payload of request after callback returns, each call
+// must be paired with MQTT_ReleaseRequest
+void MQTT_RetainRequest(obk_mqtt_request_t* request);
+void MQTT_ReleaseRequest(obk_mqtt_request_t* request);
+void MQTT_GetReceiveStats(int* outUsed, int* outHighWater, int* outDropped, int* outProcessed, int* outMaxLatencyMS);
 
 void MQTT_GetStats(int* outUsed, int* outMax, int* outFreeMem);
 
@@ -156,13 +258,36 @@ OBK_Publish_Result MQTT_PublishMain_StringFloat(const char* sChannel, float f,
 OBK_Publish_Result MQTT_PublishMain_StringInt(const char* sChannel, int val, int flags);
 OBK_Publish_Result MQTT_PublishMain_StringString(const char* sChannel, const char* valueStr, int flags);
 void MQTT_PublishOnlyDeviceChannelsIfPossible();
-void MQTT_QueuePublish(const char* topic, const char* channel, const char* value, int flags);
-void MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command);
+// returns false if item was dropped, because queue or slab is full
+bool MQTT_QueuePublish(const char* topic, const char* channel, const char* value, int flags);
+bool MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command);
 OBK_Publish_Result MQTT_Publish(const char* sTopic, const char* sChannel, const char* value, int flags);
 OBK_Publish_Result MQTT_PublishStat(const char* statName, const char* statValue);
 OBK_Publish_Result MQTT_PublishTele(const char* teleName, const char* teleValue);
 void MQTT_InvokeCommandAtEnd(PostPublishCommands command);
+void MQTT_GetQueueStats(int* outQueued, int* outSlabUsed, int* outCoalesced, int* outDropped);
+void MQTT_GetEgressStats(int egressClass, int* outSent, int* outDeferred, int* outQueued, int* outMaxWaitMS);
+// buffer size for MQTT_GetPublishStatsJSON
+#define MQTT_STATS_JSON_SIZE 640
+int MQTT_GetPublishStatsJSON(char* out, int outSize);
+void MQTT_PublishStatsTele();
 bool MQTT_IsReady();
+void MQTT_GetReconnectStats(int* outAttempts, int* outLastConnectMS, int* outMaxConnectMS, int* outReconciled, int* outDnsCacheHits);
+#if MQTT_TLS_OPTIONS
+int MQTT_TLS_GetMaxFragLen();
+bool MQTT_TLS_IsPskSet();
+bool MQTT_TLS_ShouldResume();
+bool MQTT_TLS_NeedsNewConfig();
+void MQTT_TLS_OnConfigCreated();
+void MQTT_TLS_OnHandshakeStarted();
+void MQTT_TLS_OnHandshakeDone(bool bResumed, bool bSessionSaved);
+void MQTT_TLS_OnHandshakeFailed();
+void MQTT_TLS_GetStats(int* outHandshakes, int* outResumed);
+#endif
+#ifdef WINDOWS
+// self tests have no broker, this reports connection change like LWIP would
+void MQTT_SimulateConnectionStatus(int status);
+#endif
 extern int g_mqtt_bBaseTopicDirty;
 extern int mqtt_reconnect;
 extern int mqtt_loopsWithDisconnected;
@@ -39,6 +39,45 @@ static int stat_deduper_send = 0;
 static int stat_deduper_culled_duplicates = 0;
 static int stat_deduper_culled_tooFast = 0;
 
+// generic deduper
+typedef struct mqtt_dedup_entry_s {
+	// 0 means empty
+	unsigned int topicHash;
+	unsigned int valueHash;
+	int lastSend;
+	int dedupClass;
+	int pendingFlags;
+	// latest value that was too fast to send, "topic\0value\0"
+	char* pending;
+} mqtt_dedup_entry_t;
+
+typedef struct mqtt_dedup_class_s {
+	// changed value is not sent more often than that, latest is sent later
+	int minInterval;
+	// same value is not sent again for that long
+	int maxSilence;
+} mqtt_dedup_class_t;
+
+static const char* g_dedupClassNames[DEDUP_CLASS_MAX] = { "channel", "sensor", "tele", "other" };
+static mqtt_dedup_class_t g_dedupClasses[DEDUP_CLASS_MAX] = {
+	{ 0, MQTT_DEDUP_DEFAULT_MAX_SILENCE },
+	{ 0, MQTT_DEDUP_DEFAULT_MAX_SILENCE },
+	{ 0, MQTT_DEDUP_DEFAULT_MAX_SILENCE },
+	{ 0, 0 },
+};
+static mqtt_dedup_entry_t g_dedupTable[MQTT_DEDUP_TABLE_SIZE];
+// entries checked from the home slot of topic
+#define MQTT_DEDUP_PROBE 8
+// seconds, increased by MQTT_Dedup_Tick
+static int g_dedupNow = 0;
+
+static int stat_dedup_send = 0;
+static int stat_dedup_culled_duplicates = 0;
+static int stat_dedup_culled_tooFast = 0;
+static int stat_dedup_evicted = 0;
+
+extern int g_bPublishAllStatesNow;
+
 static SemaphoreHandle_t g_mutex = 0;
 
 
@@ -61,6 +100,156 @@ static void DD_Mutex_Free()
     xSemaphoreGive(g_mutex);
 }
 
+static unsigned int DD_Hash(const char* s, int len) {
+	unsigned int h = 2166136261u;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (byte)s[i];
+		h *= 16777619;
+	}
+	return h;
+}
+static void DD_FreePending(mqtt_dedup_entry_t* e) {
+	if (e->pending) {
+		free(e->pending);
+		e->pending = 0;
+	}
+}
+static mqtt_dedup_entry_t* DD_Find(unsigned int topicHash, bool bCreate) {
+	mqtt_dedup_entry_t* e;
+	mqtt_dedup_entry_t* oldest = 0;
+	int i;
+
+	for (i = 0; i < MQTT_DEDUP_PROBE; i++) {
+		e = &g_dedupTable[(topicHash + i) % MQTT_DEDUP_TABLE_SIZE];
+		// entries are never removed, only replaced, so empty ends the search
+		if (e->topicHash == 0) {
+			if (!bCreate) {
+				return 0;
+			}
+			break;
+		}
+		if (e->topicHash == topicHash) {
+			return e;
+		}
+		// prefer to evict the one without value waiting for send
+		if (oldest == 0 || (oldest->pending && !e->pending)
+			|| (!oldest->pending == !e->pending && e->lastSend < oldest->lastSend)) {
+			oldest = e;
+		}
+	}
+	if (!bCreate) {
+		return 0;
+	}
+	if (i == MQTT_DEDUP_PROBE) {
+		e = oldest;
+		DD_FreePending(e);
+		stat_dedup_evicted++;
+	}
+	e->topicHash = topicHash;
+	e->valueHash = 0;
+	e->lastSend = g_dedupNow;
+	return e;
+}
+bool MQTT_Dedup_Filter(int dedupClass, const char* topic, const char* value, int valueLen, int flags) {
+	mqtt_dedup_class_t* cl = &g_dedupClasses[dedupClass];
+	mqtt_dedup_entry_t* e;
+	unsigned int topicHash, valueHash;
+	int topicLen, age;
+
+	if (cl->minInterval <= 0 && cl->maxSilence <= 0) {
+		return false;
+	}
+	topicLen = strlen(topic);
+	topicHash = DD_Hash(topic, topicLen);
+	if (topicHash == 0) {
+		topicHash = 1;
+	}
+	valueHash = DD_Hash(value, valueLen);
+	e = DD_Find(topicHash, true);
+	age = g_dedupNow - e->lastSend;
+
+	// full state publish is requested on purpose, so it's never skipped
+	if (e->valueHash != 0 && !(flags & OBK_PUBLISH_FLAG_NO_DEDUP) && !g_bPublishAllStatesNow) {
+		if (valueHash == e->valueHash) {
+			if (age < cl->maxSilence) {
+				// value went back to what was sent, so forget the newer one
+				DD_FreePending(e);
+				stat_dedup_culled_duplicates++;
+				return true;
+			}
+		}
+		else if (age < cl->minInterval && valueLen <= MQTT_DEDUP_MAX_PENDING_LEN) {
+			DD_FreePending(e);
+			e->pending = malloc(topicLen + 1 + valueLen + 1);
+			if (e->pending) {
+				memcpy(e->pending, topic, topicLen + 1);
+				memcpy(e->pending + topicLen + 1, value, valueLen);
+				e->pending[topicLen + 1 + valueLen] = 0;
+				e->pendingFlags = flags;
+				e->dedupClass = dedupClass;
+				stat_dedup_culled_tooFast++;
+				return true;
+			}
+		}
+	}
+	DD_FreePending(e);
+	e->valueHash = valueHash;
+	e->lastSend = g_dedupNow;
+	stat_dedup_send++;
+	return false;
+}
+void MQTT_Dedup_Forget(const char* topic) {
+	mqtt_dedup_entry_t* e;
+	unsigned int topicHash;
+
+	topicHash = DD_Hash(topic, strlen(topic));
+	if (topicHash == 0) {
+		topicHash = 1;
+	}
+	e = DD_Find(topicHash, false);
+	if (e) {
+		e->valueHash = 0;
+	}
+}
+// sends latest values which were skipped because they came too fast
+static void DD_FlushPending() {
+	mqtt_dedup_entry_t* e;
+	char* pending;
+	const char* value;
+	int i;
+
+	for (i = 0; i < MQTT_DEDUP_TABLE_SIZE; i++) {
+		e = &g_dedupTable[i];
+		if (e->pending == 0) {
+			continue;
+		}
+		if (g_dedupNow - e->lastSend < g_dedupClasses[e->dedupClass].minInterval) {
+			continue;
+		}
+		// publish goes through MQTT_Dedup_Filter again, which frees pending
+		// value of this entry, so take it out of the entry first
+		pending = e->pending;
+		e->pending = 0;
+		value = pending + strlen(pending) + 1;
+		if (MQTT_Publish("", pending, value, e->pendingFlags | OBK_PUBLISH_FLAG_RAW_TOPIC_NAME | OBK_PUBLISH_FLAG_NO_DEDUP) == OBK_PUBLISH_OK) {
+			e->valueHash = DD_Hash(value, strlen(value));
+			e->lastSend = g_dedupNow;
+			free(pending);
+			stat_dedup_send++;
+		}
+		else if (e->pending == 0) {
+			// try again later
+			e->pending = pending;
+		}
+		else {
+			// newer value was stored meanwhile
+			free(pending);
+		}
+	}
+}
+
 void MQTT_Dedup_Tick() {
 	int i;
 
@@ -82,12 +271,54 @@ void MQTT_Dedup_Tick() {
 		}
 	}
 //	DD_Mutex_Free();
+	g_dedupNow++;
+	DD_FlushPending();
 	if (CFG_HasLoggerFlag(LOGGER_FLAG_MQTT_DEDUPER)) {
 		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "MQTT deduper sent %i, culled duplicates %i, culled too fast %i",
 			stat_deduper_send, stat_deduper_culled_duplicates, stat_deduper_culled_tooFast);
+		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "MQTT generic deduper sent %i, culled duplicates %i, culled too fast %i, evicted %i",
+			stat_dedup_send, stat_dedup_culled_duplicates, stat_dedup_culled_tooFast, stat_dedup_evicted);
 	}
 
 }
+// mqtt_dedup [Class] [MinInterval] [MaxSilence]
+static commandResult_t MQTT_Dedup_Command(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	const char* className;
+	int i;
+
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() >= 3) {
+		className = Tokenizer_GetArg(0);
+		for (i = 0; i < DEDUP_CLASS_MAX; i++) {
+			if (!stricmp(className, g_dedupClassNames[i])) {
+				break;
+			}
+		}
+		if (i == DEDUP_CLASS_MAX) {
+			ADDLOG_ERROR(LOG_FEATURE_MQTT, "Unknown dedup class %s", className);
+			return CMD_RES_BAD_ARGUMENT;
+		}
+		g_dedupClasses[i].minInterval = Tokenizer_GetArgInteger(1);
+		g_dedupClasses[i].maxSilence = Tokenizer_GetArgInteger(2);
+	}
+	else if (Tokenizer_GetArgsCount() != 0) {
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+	for (i = 0; i < DEDUP_CLASS_MAX; i++) {
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Dedup %s: min interval %i, max silence %i", g_dedupClassNames[i],
+			g_dedupClasses[i].minInterval, g_dedupClasses[i].maxSilence);
+	}
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "Dedup sent %i, culled duplicates %i, culled too fast %i, evicted %i",
+		stat_dedup_send, stat_dedup_culled_duplicates, stat_dedup_culled_tooFast, stat_dedup_evicted);
+	return CMD_RES_OK;
+}
+void MQTT_Dedup_Init() {
+	//cmddetail:{"name":"mqtt_dedup","args":"[Class][MinInterval][MaxSilence]",
+	//cmddetail:"descr":"Configures generic deduper of MQTT publishes. Class is channel, sensor, tele or other. Same value on the same topic is not published again for MaxSilence seconds, and changed value is not published more often than every MinInterval seconds (the latest one is sent later). Zeros disable the class, and all classes are disabled by default. Publish commands (publish, publishInt, publishFloat, publishFile) are never deduplicated. Without arguments, prints settings and statistics.",
+	//cmddetail:"fn":"MQTT_Dedup_Command","file":"mqtt/new_mqtt_deduper.c","requires":"",
+	//cmddetail:"examples":"mqtt_dedup sensor 2 60"}
+	CMD_RegisterCommand("mqtt_dedup", MQTT_Dedup_Command, NULL);
+}
 OBK_Publish_Result MQTT_PublishMain_StringInt_DeDuped(int slotCode, int expireTime, const char* sChannel, int val, int flags) {
 	char buffer[16];
 	sprintf(buffer,"%i",val);
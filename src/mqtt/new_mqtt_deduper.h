@@ -26,5 +26,37 @@ OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int slotCode, int expir
 OBK_Publish_Result MQTT_PublishMain_StringInt_DeDuped(int slotCode, int expireTime, const char* sChannel, int val, int flags);
 void MQTT_Dedup_Tick();
 
+// Generic deduper, used for every publish in MQTT_PublishTopicToClient.
+// It keeps only hashes of topic and value, so it works for any topic.
+typedef enum MQTT_Dedup_Class_e {
+	// obk0696FB33/1/get
+	DEDUP_CLASS_CHANNEL,
+	// obk0696FB33/voltage/get and others under client topic
+	DEDUP_CLASS_SENSOR,
+	// tele/obk0696FB33/...
+	DEDUP_CLASS_TELE,
+	// everything else, stat replies, Home Assistant discovery, raw topics
+	DEDUP_CLASS_OTHER,
+	DEDUP_CLASS_MAX,
+} MQTT_Dedup_Class_t;
+
+#define MQTT_DEDUP_TABLE_SIZE 64
+// changed values longer than that are not delayed, only duplicates are skipped
+#define MQTT_DEDUP_MAX_PENDING_LEN 256
+
+// Default for sensor, channel and tele classes - same value is not sent again
+// for that many seconds. 0, so dedup is off until enabled with mqtt_dedup.
+#ifndef MQTT_DEDUP_DEFAULT_MAX_SILENCE
+#define MQTT_DEDUP_DEFAULT_MAX_SILENCE 0
+#endif
+
+// Returns true if publish should be skipped. If it's skipped because value changed too fast,
+// latest value is kept and sent by MQTT_Dedup_Tick.
+bool MQTT_Dedup_Filter(int dedupClass, const char* topic, const char* value, int valueLen, int flags);
+// Called when publish that passed filter has failed, so it's not taken as sent
+void MQTT_Dedup_Forget(const char* topic);
+// registers mqtt_dedup command
+void MQTT_Dedup_Init();
+
 #endif
 
@@ -0,0 +1,466 @@
+
+#include "new_mqtt.h"
+
+#if ENABLE_MQTT && ENABLE_LITTLEFS
+
+#include "../new_common.h"
+#include "../new_cfg.h"
+#include "../logging/logging.h"
+// Commands register, execution API and cmd tokenizer
+#include "../cmnds/cmd_public.h"
+#include "../driver/drv_ntp.h"
+#include "../littlefs/our_lfs.h"
+
+// Spool file is append only. Records between read and write offset are still to be
+// replayed, and when all are replayed, file is removed.
+// Latest offset of each state topic is kept in RAM, so replay can skip older values
+// of the same topic, and also values that were already published live after reconnect.
+// When file is full, but much of it is taken by replayed and superseded records,
+// it's compacted - rewritten with only the records that are still to be replayed.
+typedef struct mqtt_spool_latest_s {
+	// 0 means empty
+	unsigned int topicHash;
+	int topicLen;
+	// offset of newest record of that topic, -1 if newer value was published live
+	int ofs;
+	// size of that record
+	int size;
+} mqtt_spool_latest_t;
+
+static bool g_spoolEnabled = false;
+static int g_spoolMaxBytes = MQTT_SPOOL_DEFAULT_MAX_BYTES;
+static int g_spoolReplayPerSec = MQTT_SPOOL_DEFAULT_REPLAY_PER_SEC;
+static int g_spoolReadOfs = 0;
+static int g_spoolWriteOfs = 0;
+static int g_spoolRecords = 0;
+// bytes of superseded records after read offset, freed by compaction
+static int g_spoolDeadBytes = 0;
+
+static mqtt_spool_latest_t g_spoolLatest[MQTT_SPOOL_LATEST_SIZE];
+
+// record loaded by MQTT_Spool_Peek, topic\0value\0
+static int g_spoolPeekOfs = -1;
+static mqttSpoolRecord_t g_spoolPeekRecord;
+static char g_spoolPeekData[MQTT_SPOOL_MAX_RECORD + 2];
+
+static int stat_spool_written = 0;
+static int stat_spool_replayed = 0;
+static int stat_spool_superseded = 0;
+static int stat_spool_dropped = 0;
+static int stat_spool_compacted = 0;
+
+static unsigned int MQTT_Spool_Hash(const char* s, int len) {
+	unsigned int hash = 2166136261u;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ (unsigned char)s[i]) * 16777619;
+	}
+	// 0 is used for empty slot
+	return hash ? hash : 1;
+}
+static mqtt_spool_latest_t* MQTT_Spool_FindLatest(unsigned int hash, int topicLen, bool bCreate) {
+	int i;
+
+	for (i = 0; i < MQTT_SPOOL_LATEST_SIZE; i++) {
+		if (g_spoolLatest[i].topicHash == hash && g_spoolLatest[i].topicLen == topicLen) {
+			return &g_spoolLatest[i];
+		}
+	}
+	if (bCreate == false) {
+		return 0;
+	}
+	// if table is full, all records of that topic are replayed
+	for (i = 0; i < MQTT_SPOOL_LATEST_SIZE; i++) {
+		if (g_spoolLatest[i].topicHash == 0) {
+			g_spoolLatest[i].topicHash = hash;
+			g_spoolLatest[i].topicLen = topicLen;
+			return &g_spoolLatest[i];
+		}
+	}
+	return 0;
+}
+static void MQTT_Spool_Reset() {
+	lfs_remove(&lfs, MQTT_SPOOL_FILE);
+	g_spoolReadOfs = 0;
+	g_spoolWriteOfs = 0;
+	g_spoolRecords = 0;
+	g_spoolDeadBytes = 0;
+	g_spoolPeekOfs = -1;
+	memset(g_spoolLatest, 0, sizeof(g_spoolLatest));
+}
+// loads record at given offset of open file into peek buffer
+static bool MQTT_Spool_ReadRecordFrom(lfs_file_t* file, int ofs) {
+	int dataLen;
+	int lfsres;
+
+	g_spoolPeekOfs = -1;
+	lfs_file_seek(&lfs, file, ofs, LFS_SEEK_SET);
+	lfsres = lfs_file_read(&lfs, file, &g_spoolPeekRecord, sizeof(g_spoolPeekRecord));
+	dataLen = g_spoolPeekRecord.topicLen + g_spoolPeekRecord.valueLen;
+	if (lfsres != sizeof(g_spoolPeekRecord) || dataLen > MQTT_SPOOL_MAX_RECORD
+		|| g_spoolPeekRecord.topicLen == 0) {
+		return false;
+	}
+	lfsres = lfs_file_read(&lfs, file, g_spoolPeekData, g_spoolPeekRecord.topicLen);
+	g_spoolPeekData[g_spoolPeekRecord.topicLen] = 0;
+	if (lfsres == g_spoolPeekRecord.topicLen) {
+		lfsres = lfs_file_read(&lfs, file, g_spoolPeekData + g_spoolPeekRecord.topicLen + 1, g_spoolPeekRecord.valueLen);
+		g_spoolPeekData[dataLen + 1] = 0;
+		if (lfsres == g_spoolPeekRecord.valueLen) {
+			g_spoolPeekOfs = ofs;
+		}
+	}
+	return g_spoolPeekOfs == ofs;
+}
+// loads record at given offset into peek buffer
+static bool MQTT_Spool_ReadRecord(int ofs) {
+	lfs_file_t file;
+	bool bOk;
+
+	g_spoolPeekOfs = -1;
+	memset(&file, 0, sizeof(lfs_file_t));
+	if (lfs_file_open(&lfs, &file, MQTT_SPOOL_FILE, LFS_O_RDONLY) < 0) {
+		return false;
+	}
+	bOk = MQTT_Spool_ReadRecordFrom(&file, ofs);
+	lfs_file_close(&lfs, &file);
+	return bOk;
+}
+static int MQTT_Spool_RecordSize(const mqttSpoolRecord_t* record) {
+	return sizeof(mqttSpoolRecord_t) + record->topicLen + record->valueLen;
+}
+// record at ofs is the newest of its topic, older one (if still in file) is dead
+static void MQTT_Spool_SetLatest(mqtt_spool_latest_t* latest, int ofs, int size) {
+	if (latest->ofs >= g_spoolReadOfs) {
+		g_spoolDeadBytes += latest->size;
+	}
+	latest->ofs = ofs;
+	latest->size = size;
+}
+static void MQTT_Spool_TrackLatest(int ofs) {
+	mqtt_spool_latest_t* latest;
+
+	if (g_spoolPeekRecord.recordFlags & MQTT_SPOOL_RECORD_LATEST_ONLY) {
+		latest = MQTT_Spool_FindLatest(MQTT_Spool_Hash(g_spoolPeekData, g_spoolPeekRecord.topicLen),
+			g_spoolPeekRecord.topicLen, true);
+		if (latest) {
+			MQTT_Spool_SetLatest(latest, ofs, MQTT_Spool_RecordSize(&g_spoolPeekRecord));
+		}
+	}
+}
+// true if record in peek buffer at given offset is still to be replayed
+static bool MQTT_Spool_IsLive(int ofs) {
+	mqtt_spool_latest_t* latest;
+
+	if ((g_spoolPeekRecord.recordFlags & MQTT_SPOOL_RECORD_LATEST_ONLY) == 0) {
+		return true;
+	}
+	latest = MQTT_Spool_FindLatest(MQTT_Spool_Hash(g_spoolPeekData, g_spoolPeekRecord.topicLen),
+		g_spoolPeekRecord.topicLen, false);
+	// not tracked, because table was full
+	if (latest == 0) {
+		return true;
+	}
+	return latest->ofs == ofs;
+}
+// Rewrites spool without replayed and superseded records. If it fails,
+// spooled records are dropped, like on read error.
+static void MQTT_Spool_Compact() {
+	lfs_file_t src, dst;
+	mqtt_spool_latest_t* latest;
+	int ofs, newOfs;
+	int size;
+	int records = 0;
+	int i;
+	bool bOk = true;
+
+	for (i = 0; i < MQTT_SPOOL_LATEST_SIZE; i++) {
+		// record of it was already replayed
+		if (g_spoolLatest[i].ofs < g_spoolReadOfs) {
+			g_spoolLatest[i].ofs = -1;
+		}
+	}
+	memset(&src, 0, sizeof(lfs_file_t));
+	memset(&dst, 0, sizeof(lfs_file_t));
+	if (lfs_file_open(&lfs, &src, MQTT_SPOOL_FILE, LFS_O_RDONLY) < 0) {
+		bOk = false;
+	}
+	else if (lfs_file_open(&lfs, &dst, MQTT_SPOOL_TEMP_FILE, LFS_O_CREAT | LFS_O_TRUNC | LFS_O_WRONLY) < 0) {
+		lfs_file_close(&lfs, &src);
+		bOk = false;
+	}
+	if (bOk == false) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "MQTT spool compaction failed, dropping %i records", g_spoolRecords);
+		stat_spool_dropped += g_spoolRecords;
+		MQTT_Spool_Reset();
+		return;
+	}
+	ofs = g_spoolReadOfs;
+	newOfs = 0;
+	while (ofs < g_spoolWriteOfs) {
+		if (!MQTT_Spool_ReadRecordFrom(&src, ofs)) {
+			bOk = false;
+			break;
+		}
+		size = MQTT_Spool_RecordSize(&g_spoolPeekRecord);
+		if (MQTT_Spool_IsLive(ofs)) {
+			if (lfs_file_write(&lfs, &dst, &g_spoolPeekRecord, sizeof(g_spoolPeekRecord)) != sizeof(g_spoolPeekRecord)
+				|| lfs_file_write(&lfs, &dst, g_spoolPeekData, g_spoolPeekRecord.topicLen) != g_spoolPeekRecord.topicLen
+				|| lfs_file_write(&lfs, &dst, g_spoolPeekData + g_spoolPeekRecord.topicLen + 1,
+					g_spoolPeekRecord.valueLen) != g_spoolPeekRecord.valueLen) {
+				bOk = false;
+				break;
+			}
+			if (g_spoolPeekRecord.recordFlags & MQTT_SPOOL_RECORD_LATEST_ONLY) {
+				latest = MQTT_Spool_FindLatest(MQTT_Spool_Hash(g_spoolPeekData, g_spoolPeekRecord.topicLen),
+					g_spoolPeekRecord.topicLen, false);
+				if (latest) {
+					latest->ofs = newOfs;
+				}
+			}
+			newOfs += size;
+			records++;
+		}
+		else {
+			stat_spool_superseded++;
+		}
+		ofs += size;
+	}
+	lfs_file_close(&lfs, &src);
+	lfs_file_close(&lfs, &dst);
+	g_spoolPeekOfs = -1;
+	if (bOk == false || lfs_rename(&lfs, MQTT_SPOOL_TEMP_FILE, MQTT_SPOOL_FILE) < 0) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "MQTT spool compaction failed, dropping %i records", g_spoolRecords);
+		lfs_remove(&lfs, MQTT_SPOOL_TEMP_FILE);
+		stat_spool_dropped += g_spoolRecords;
+		MQTT_Spool_Reset();
+		return;
+	}
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT spool compacted from %i to %i bytes", g_spoolWriteOfs - g_spoolReadOfs, newOfs);
+	g_spoolReadOfs = 0;
+	g_spoolWriteOfs = newOfs;
+	g_spoolRecords = records;
+	g_spoolDeadBytes = 0;
+	stat_spool_compacted++;
+	if (records == 0) {
+		MQTT_Spool_Reset();
+	}
+}
+// picks up records left from before reboot
+static void MQTT_Spool_Open() {
+	lfs_file_t file;
+	int size;
+	int ofs;
+
+	init_lfs(1);
+	if (!lfs_present()) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "MQTT spool needs LittleFS");
+		return;
+	}
+	memset(g_spoolLatest, 0, sizeof(g_spoolLatest));
+	g_spoolReadOfs = 0;
+	g_spoolWriteOfs = 0;
+	g_spoolRecords = 0;
+	g_spoolDeadBytes = 0;
+	g_spoolPeekOfs = -1;
+	memset(&file, 0, sizeof(lfs_file_t));
+	if (lfs_file_open(&lfs, &file, MQTT_SPOOL_FILE, LFS_O_RDONLY) < 0) {
+		return;
+	}
+	size = lfs_file_size(&lfs, &file);
+	lfs_file_close(&lfs, &file);
+
+	ofs = 0;
+	while (ofs < size && MQTT_Spool_ReadRecord(ofs)) {
+		MQTT_Spool_TrackLatest(ofs);
+		ofs += MQTT_Spool_RecordSize(&g_spoolPeekRecord);
+		g_spoolRecords++;
+	}
+	g_spoolWriteOfs = ofs;
+	if (ofs != size) {
+		// last write was interrupted
+		memset(&file, 0, sizeof(lfs_file_t));
+		if (lfs_file_open(&lfs, &file, MQTT_SPOOL_FILE, LFS_O_WRONLY) >= 0) {
+			lfs_file_truncate(&lfs, &file, ofs);
+			lfs_file_close(&lfs, &file);
+		}
+	}
+	if (g_spoolRecords == 0) {
+		MQTT_Spool_Reset();
+	}
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT spool has %i records to replay", g_spoolRecords);
+}
+bool MQTT_Spool_IsEnabled() {
+	return g_spoolEnabled;
+}
+bool MQTT_Spool_Write(const char* topic, const char* value, int flags, bool bLatestOnly) {
+	mqttSpoolRecord_t record;
+	mqtt_spool_latest_t* latest;
+	lfs_file_t file;
+	int topicLen, valueLen;
+	int size;
+	int lfsres;
+
+	if (g_spoolEnabled == false || !lfs_present()) {
+		return false;
+	}
+	topicLen = strlen(topic);
+	valueLen = strlen(value);
+	size = sizeof(record) + topicLen + valueLen;
+	if (topicLen == 0 || topicLen + valueLen > MQTT_SPOOL_MAX_RECORD) {
+		stat_spool_dropped++;
+		return false;
+	}
+	// full, compact if enough can be freed, so that is not done on each write
+	if (g_spoolWriteOfs + size > g_spoolMaxBytes
+		&& g_spoolWriteOfs - g_spoolReadOfs - g_spoolDeadBytes + size <= g_spoolMaxBytes
+		&& g_spoolReadOfs + g_spoolDeadBytes >= g_spoolMaxBytes / MQTT_SPOOL_COMPACT_DIVISOR) {
+		MQTT_Spool_Compact();
+	}
+	if (g_spoolWriteOfs + size > g_spoolMaxBytes) {
+		stat_spool_dropped++;
+		return false;
+	}
+	memset(&record, 0, sizeof(record));
+	record.topicLen = topicLen;
+	record.valueLen = valueLen;
+	record.publishFlags = flags;
+	record.uptime = g_secondsElapsed;
+	if (bLatestOnly) {
+		record.recordFlags |= MQTT_SPOOL_RECORD_LATEST_ONLY;
+	}
+	if (NTP_IsTimeSynced()) {
+		record.recordFlags |= MQTT_SPOOL_RECORD_HAS_UTC;
+		record.utc = NTP_GetCurrentTimeWithoutOffset();
+	}
+
+	memset(&file, 0, sizeof(lfs_file_t));
+	lfsres = lfs_file_open(&lfs, &file, MQTT_SPOOL_FILE, LFS_O_CREAT | LFS_O_APPEND | LFS_O_WRONLY);
+	if (lfsres < 0) {
+		stat_spool_dropped++;
+		return false;
+	}
+	lfsres = lfs_file_write(&lfs, &file, &record, sizeof(record));
+	if (lfsres == sizeof(record)) {
+		lfsres = lfs_file_write(&lfs, &file, topic, topicLen);
+	}
+	if (lfsres == topicLen) {
+		lfsres = lfs_file_write(&lfs, &file, value, valueLen);
+	}
+	if (lfsres != valueLen) {
+		// do not leave half of record
+		lfs_file_truncate(&lfs, &file, g_spoolWriteOfs);
+		lfs_file_close(&lfs, &file);
+		stat_spool_dropped++;
+		return false;
+	}
+	lfs_file_close(&lfs, &file);
+
+	if (bLatestOnly) {
+		latest = MQTT_Spool_FindLatest(MQTT_Spool_Hash(topic, topicLen), topicLen, true);
+		if (latest) {
+			MQTT_Spool_SetLatest(latest, g_spoolWriteOfs, size);
+		}
+	}
+	g_spoolWriteOfs += size;
+	g_spoolRecords++;
+	stat_spool_written++;
+	return true;
+}
+void MQTT_Spool_OnPublished(const char* topic) {
+	mqtt_spool_latest_t* latest;
+	int topicLen;
+
+	if (g_spoolRecords == 0) {
+		return;
+	}
+	topicLen = strlen(topic);
+	latest = MQTT_Spool_FindLatest(MQTT_Spool_Hash(topic, topicLen), topicLen, false);
+	if (latest) {
+		MQTT_Spool_SetLatest(latest, -1, 0);
+	}
+}
+static void MQTT_Spool_Skip() {
+	g_spoolReadOfs += MQTT_Spool_RecordSize(&g_spoolPeekRecord);
+	g_spoolRecords--;
+	if (g_spoolReadOfs >= g_spoolWriteOfs) {
+		MQTT_Spool_Reset();
+	}
+}
+bool MQTT_Spool_Peek(const char** outTopic, const char** outValue, int* outFlags, mqttSpoolRecord_t** outRecord) {
+	while (g_spoolReadOfs < g_spoolWriteOfs) {
+		if (g_spoolPeekOfs != g_spoolReadOfs && !MQTT_Spool_ReadRecord(g_spoolReadOfs)) {
+			ADDLOG_ERROR(LOG_FEATURE_MQTT, "MQTT spool read failed, dropping %i records", g_spoolRecords);
+			stat_spool_dropped += g_spoolRecords;
+			MQTT_Spool_Reset();
+			return false;
+		}
+		if (!MQTT_Spool_IsLive(g_spoolReadOfs)) {
+			stat_spool_superseded++;
+			// it's behind read offset now
+			g_spoolDeadBytes -= MQTT_Spool_RecordSize(&g_spoolPeekRecord);
+			MQTT_Spool_Skip();
+			continue;
+		}
+		*outTopic = g_spoolPeekData;
+		*outValue = g_spoolPeekData + g_spoolPeekRecord.topicLen + 1;
+		*outFlags = g_spoolPeekRecord.publishFlags;
+		*outRecord = &g_spoolPeekRecord;
+		return true;
+	}
+	return false;
+}
+void MQTT_Spool_Advance() {
+	if (g_spoolPeekOfs != g_spoolReadOfs) {
+		return;
+	}
+	stat_spool_replayed++;
+	MQTT_Spool_Skip();
+}
+int MQTT_Spool_GetReplayRate() {
+	return g_spoolReplayPerSec;
+}
+void MQTT_Spool_GetStats(int* outBytes, int* outRecords, int* outReplayed, int* outSuperseded, int* outDropped) {
+	*outBytes = g_spoolWriteOfs - g_spoolReadOfs;
+	*outRecords = g_spoolRecords;
+	*outReplayed = stat_spool_replayed;
+	*outSuperseded = stat_spool_superseded;
+	*outDropped = stat_spool_dropped;
+}
+// mqtt_spool [MaxBytes] [ReplayPerSec]
+static commandResult_t MQTT_Spool_Command(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	Tokenizer_TokenizeString(args, 0);
+	if (Tokenizer_GetArgsCount() >= 1) {
+		g_spoolMaxBytes = Tokenizer_GetArgInteger(0);
+		if (Tokenizer_GetArgsCount() >= 2) {
+			g_spoolReplayPerSec = Tokenizer_GetArgInteger(1);
+		}
+		if (g_spoolMaxBytes <= 0) {
+			if (g_spoolEnabled && lfs_present()) {
+				MQTT_Spool_Reset();
+			}
+			g_spoolEnabled = false;
+		}
+		else if (g_spoolEnabled == false) {
+			g_spoolEnabled = true;
+			MQTT_Spool_Open();
+		}
+	}
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT spool %s, %i of %i bytes used by %i records, replay %i per second",
+		g_spoolEnabled ? "enabled" : "disabled", g_spoolWriteOfs - g_spoolReadOfs, g_spoolMaxBytes,
+		g_spoolRecords, g_spoolReplayPerSec);
+	ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT spool written %i, replayed %i, superseded %i, dropped %i, compacted %i times",
+		stat_spool_written, stat_spool_replayed, stat_spool_superseded, stat_spool_dropped, stat_spool_compacted);
+	return CMD_RES_OK;
+}
+void MQTT_Spool_Init() {
+	//cmddetail:{"name":"mqtt_spool","args":"[MaxBytes][ReplayPerSec]",
+	//cmddetail:"descr":"Enables offline spool. Publishes made while MQTT is disconnected are stored in LittleFS file mqtt_spool.dat, up to MaxBytes, and replayed after reconnect, ReplayPerSec per second. For state topics only the latest value is replayed, and not at all if it was already published again. When spool is full, it's compacted if replayed and superseded records take at least a quarter of it. MaxBytes 0 disables spool and removes the file. Without arguments, prints statistics.",
+	//cmddetail:"fn":"MQTT_Spool_Command","file":"mqtt/new_mqtt_spool.c","requires":"",
+	//cmddetail:"examples":"mqtt_spool 16384 5"}
+	CMD_RegisterCommand("mqtt_spool", MQTT_Spool_Command, NULL);
+}
+
+#endif
+
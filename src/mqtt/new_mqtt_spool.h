@@ -0,0 +1,60 @@
+#include "../obk_config.h"
+
+
+
+#if ENABLE_MQTT && ENABLE_LITTLEFS
+
+// Offline spool - publishes made while broker is not connected are appended
+// to a file in LittleFS and replayed after reconnect. Disabled by default,
+// enabled with mqtt_spool command.
+#define MQTT_SPOOL_FILE "mqtt_spool.dat"
+// spool is rewritten to it by compaction, then renamed
+#define MQTT_SPOOL_TEMP_FILE "mqtt_spool.tmp"
+
+#ifndef MQTT_SPOOL_DEFAULT_MAX_BYTES
+#define MQTT_SPOOL_DEFAULT_MAX_BYTES 16384
+#endif
+#ifndef MQTT_SPOOL_DEFAULT_REPLAY_PER_SEC
+#define MQTT_SPOOL_DEFAULT_REPLAY_PER_SEC 5
+#endif
+// topic and value of single record, larger publishes are not spooled
+#define MQTT_SPOOL_MAX_RECORD 512
+// topics of state records that are tracked, so only the latest value of each is replayed
+#define MQTT_SPOOL_LATEST_SIZE 32
+// full spool is compacted if at least MaxBytes / this can be freed
+#define MQTT_SPOOL_COMPACT_DIVISOR 4
+
+// record is state, replayed only if it's the latest one for its topic
+#define MQTT_SPOOL_RECORD_LATEST_ONLY	1
+// utc field is valid
+#define MQTT_SPOOL_RECORD_HAS_UTC		2
+
+// on disk header, followed by topic and value (not terminated)
+typedef struct mqttSpoolRecord_s {
+	unsigned short topicLen;
+	unsigned short valueLen;
+	unsigned short publishFlags;
+	unsigned short recordFlags;
+	// NTP time, if it was synced at the time of publish
+	unsigned int utc;
+	// g_secondsElapsed at the time of publish
+	unsigned int uptime;
+} mqttSpoolRecord_t;
+
+bool MQTT_Spool_IsEnabled();
+// Appends publish to spool. Returns false if spool is disabled, full or write failed.
+bool MQTT_Spool_Write(const char* topic, const char* value, int flags, bool bLatestOnly);
+// Called for each publish that was sent, so older spooled value of the same topic is not replayed
+void MQTT_Spool_OnPublished(const char* topic);
+// Gets next record to replay, without removing it. Records that are superseded by
+// newer ones are skipped. Returned strings are valid until next call.
+bool MQTT_Spool_Peek(const char** outTopic, const char** outValue, int* outFlags, mqttSpoolRecord_t** outRecord);
+// Removes record returned by MQTT_Spool_Peek, after it was published
+void MQTT_Spool_Advance();
+int MQTT_Spool_GetReplayRate();
+void MQTT_Spool_GetStats(int* outBytes, int* outRecords, int* outReplayed, int* outSuperseded, int* outDropped);
+// registers mqtt_spool command
+void MQTT_Spool_Init();
+
+#endif
+
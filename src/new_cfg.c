@@ -96,6 +96,7 @@ void CFG_MarkAsDirty() {
 }
 void CFG_ClearIO() {
 	memset(&g_cfg.pins, 0, sizeof(g_cfg.pins));
+	PIN_MarkIndexDirty();
 	g_cfg_pendingChanges++;
 }
 void CFG_SetDefaultConfig() {
@@ -112,6 +113,7 @@ void CFG_SetDefaultConfig() {
 	g_configInitialized = 1;
 
 	memset(&g_cfg,0,sizeof(mainConfig_t));
+	PIN_MarkIndexDirty();
 	g_cfg.version = MAIN_CFG_VERSION;
 	g_cfg.mqtt_port = 1883;
 	g_cfg.ident0 = CFG_IDENT_0;
@@ -481,6 +483,7 @@ void CFG_SetMQTTPass(const char *s) {
 }
 void CFG_ClearPins() {
 	memset(&g_cfg.pins,0,sizeof(g_cfg.pins));
+	PIN_MarkIndexDirty();
 	g_cfg_pendingChanges++;
 }
 void CFG_IncrementOTACount() {
@@ -633,6 +636,7 @@ void PIN_SetPinChannelForPinIndex(int index, int ch) {
 	if(g_cfg.pins.channels[index] != ch) {
 		g_cfg_pendingChanges++;
 		g_cfg.pins.channels[index] = ch;
+		PIN_MarkIndexDirty();
 	}
 }
 void PIN_SetPinChannel2ForPinIndex(int index, int ch) {
@@ -643,6 +647,7 @@ void PIN_SetPinChannel2ForPinIndex(int index, int ch) {
 	if(g_cfg.pins.channels2[index] != ch) {
 		g_cfg_pendingChanges++;
 		g_cfg.pins.channels2[index] = ch;
+		PIN_MarkIndexDirty();
 	}
 }
 //void CFG_ApplyStartChannelValues() {
@@ -791,6 +796,7 @@ void CFG_InitAndLoad() {
 	byte chkSum;
 
 	HAL_Configuration_ReadConfigMemory(&g_cfg,sizeof(g_cfg));
+	PIN_MarkIndexDirty();
 	chkSum = CFG_CalcChecksum(&g_cfg);
 	if(g_cfg.ident0 != CFG_IDENT_0 || g_cfg.ident1 != CFG_IDENT_1 || g_cfg.ident2 != CFG_IDENT_2
 		|| chkSum != g_cfg.crc) {
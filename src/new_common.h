@@ -333,6 +333,12 @@ typedef int OSStatus;
 
 int rtos_delay_milliseconds(int sec);
 int delay_ms(int sec);
+int xTaskGetTickCount();
+int xSemaphoreCreateMutex();
+int xSemaphoreCreateBinary();
+int xSemaphoreTake(int semaphore, int blockTime);
+int xSemaphoreGive(int semaphore);
+int xPortGetFreeHeapSize();
 
 enum {
 	kNoErr = 0,
@@ -69,7 +69,7 @@ void FV_UpdateStartupSSIDIfChanged_StoredValue(int assidindex) {
 	if ((assidindex < 0) && (assidindex > 1)) return;	//only SSID1 (0) and SSID2 (1) allowed
 	int fval = HAL_FlashVars_GetChannelValue(g_StartupSSIDRetainChannel);
 	if (fval == assidindex) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "WiFi unchanged (SSID%i), HAL_FlashVars_SaveChannel skipped", assidindex+1);
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "WiFi unchanged (SSID%i), HAL_FlashVars_SaveChannel skipped", assidindex+1);
 		return;	//same value, no update
 	}
 	HAL_FlashVars_SaveChannel(g_StartupSSIDRetainChannel,assidindex);
@@ -255,7 +255,7 @@ void PINS_BeginDeepSleepWithPinWakeUp(unsigned int wakeUpTime) {
 #endif
 		}
 	}
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Index map: %i, edge: %i", g_gpio_index_map[0], g_gpio_edge_map[0]);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "Index map: %i, edge: %i", g_gpio_index_map[0], g_gpio_edge_map[0]);
 #ifdef PLATFORM_BEKEN_NEW
 	PS_DEEP_CTRL_PARAM params;
 	params.gpio_index_map = g_gpio_index_map[0];
@@ -379,57 +379,213 @@ void PIN_SetupPins() {
 	// TODO: better place to call?
 	DHT_OnPinsConfigChanged();
 #endif
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "PIN_SetupPins pins have been set up.\r\n");
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "PIN_SetupPins pins have been set up.\r\n");
 }
 
 int PIN_GetPinRoleForPinIndex(int index) {
 	if (index < 0 || index >= PLATFORM_GPIO_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_CFG, "PIN_GetPinRoleForPinIndex: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_CFG, "PIN_GetPinRoleForPinIndex: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
 		return 0;
 	}
 	return g_cfg.pins.roles[index];
 }
 int PIN_GetPinChannelForPinIndex(int index) {
 	if (index < 0 || index >= PLATFORM_GPIO_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_CFG, "PIN_GetPinChannelForPinIndex: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_CFG, "PIN_GetPinChannelForPinIndex: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
 		return 0;
 	}
 	return g_cfg.pins.channels[index];
 }
-int PIN_CountPinsWithRoleOrRole(int role, int role2) {
-	int i;
-	int r = 0;
+// Reverse index of pin config - pins of each channel and of each role as bitmasks,
+// and output pins of each channel with pre-decoded action. Rebuilt on first use
+// after pin roles or channels have changed, see PIN_MarkIndexDirty.
+#if PLATFORM_GPIO_MAX > 32
+typedef unsigned long long pinMask_t;
+#else
+typedef unsigned int pinMask_t;
+#endif
+#define PIN_MASK(i) (((pinMask_t)1) << (i))
 
+// what channel change does to output pin
+typedef enum {
+	PIN_ACTION_NONE,
+	PIN_ACTION_SET,
+	PIN_ACTION_SET_INV,
+	PIN_ACTION_PWM,
+	PIN_ACTION_PWM_INV,
+} pinAction_t;
+
+#define PIN_INDEX_END 0xFF
+
+static bool g_pinIndexDirty = true;
+static pinMask_t g_channelPins[CHANNEL_MAX];
+static pinMask_t g_channel2Pins[CHANNEL_MAX];
+static pinMask_t g_rolePins[IOR_Total_Options];
+// pins which roles make channel published on primary / secondary channel
+static pinMask_t g_publishPins;
+static pinMask_t g_publish2Pins;
+// list of output pins for each channel, linked by pin index
+static byte g_channelFirstOutput[CHANNEL_MAX];
+static byte g_pinNextOutput[PLATFORM_GPIO_MAX];
+static byte g_pinAction[PLATFORM_GPIO_MAX];
+
+void PIN_MarkIndexDirty() {
+	g_pinIndexDirty = true;
+}
+static pinAction_t PIN_GetActionForRole(int role) {
+	switch (role) {
+	case IOR_Relay:
+	case IOR_BAT_Relay:
+	case IOR_LED:
+		return PIN_ACTION_SET;
+	case IOR_Relay_n:
+	case IOR_BAT_Relay_n:
+	case IOR_LED_n:
+		return PIN_ACTION_SET_INV;
+	case IOR_PWM:
+	case IOR_PWM_ScriptOnly:
+		return PIN_ACTION_PWM;
+	case IOR_PWM_n:
+	case IOR_PWM_ScriptOnly_n:
+		return PIN_ACTION_PWM_INV;
+	}
+	return PIN_ACTION_NONE;
+}
+static bool PIN_IsPublishedRole(int role) {
+	return role == IOR_Relay || role == IOR_Relay_n
+		|| role == IOR_LED || role == IOR_LED_n
+		|| role == IOR_ADC || role == IOR_BAT_ADC
+		|| role == IOR_CHT83XX_DAT || role == IOR_SHT3X_DAT || role == IOR_SGP_DAT
+		|| role == IOR_DigitalInput || role == IOR_DigitalInput_n
+		|| role == IOR_DoorSensorWithDeepSleep || role == IOR_DoorSensorWithDeepSleep_NoPup
+		|| role == IOR_DoorSensorWithDeepSleep_pd
+		|| IS_PIN_DHT_ROLE(role)
+		|| role == IOR_DigitalInput_NoPup || role == IOR_DigitalInput_NoPup_n;
+}
+static bool PIN_IsPublishedRoleOnChannel2(int role) {
+	// SGP, CHT8305 and SHT3X uses secondary channel for humidity
+	return IS_PIN_DHT_ROLE(role)
+		|| role == IOR_CHT83XX_DAT || role == IOR_SHT3X_DAT || role == IOR_SGP_DAT;
+}
+static void PIN_RebuildIndex() {
+	int i;
+	int role;
+	int ch;
+	byte* last[CHANNEL_MAX];
+
+	g_pinIndexDirty = false;
+	memset(g_channelPins, 0, sizeof(g_channelPins));
+	memset(g_channel2Pins, 0, sizeof(g_channel2Pins));
+	memset(g_rolePins, 0, sizeof(g_rolePins));
+	memset(g_channelFirstOutput, PIN_INDEX_END, sizeof(g_channelFirstOutput));
+	g_publishPins = 0;
+	g_publish2Pins = 0;
+	for (i = 0; i < CHANNEL_MAX; i++) {
+		last[i] = &g_channelFirstOutput[i];
+	}
 	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.roles[i] == role)
-			r++;
-		else if (g_cfg.pins.roles[i] == role2)
-			r++;
+		role = g_cfg.pins.roles[i];
+		if (role < IOR_Total_Options) {
+			g_rolePins[role] |= PIN_MASK(i);
+		}
+		if (PIN_IsPublishedRole(role)) {
+			g_publishPins |= PIN_MASK(i);
+		}
+		if (PIN_IsPublishedRoleOnChannel2(role)) {
+			g_publish2Pins |= PIN_MASK(i);
+		}
+		g_pinNextOutput[i] = PIN_INDEX_END;
+		g_pinAction[i] = PIN_GetActionForRole(role);
+		ch = g_cfg.pins.channels[i];
+		if (ch < CHANNEL_MAX) {
+			g_channelPins[ch] |= PIN_MASK(i);
+			// keep pin order, so outputs change in the same order as before
+			if (g_pinAction[i] != PIN_ACTION_NONE) {
+				*last[ch] = i;
+				last[ch] = &g_pinNextOutput[i];
+			}
+		}
+		ch = g_cfg.pins.channels2[i];
+		if (ch < CHANNEL_MAX) {
+			g_channel2Pins[ch] |= PIN_MASK(i);
+		}
 	}
-	return r;
 }
-int PIN_CountPinsWithRole(int role) {
-	int i;
+static pinMask_t PIN_GetChannelPins(int ch) {
+	if (ch < 0 || ch >= CHANNEL_MAX) {
+		return 0;
+	}
+	if (g_pinIndexDirty) {
+		PIN_RebuildIndex();
+	}
+	return g_channelPins[ch];
+}
+static pinMask_t PIN_GetChannel2Pins(int ch) {
+	if (ch < 0 || ch >= CHANNEL_MAX) {
+		return 0;
+	}
+	if (g_pinIndexDirty) {
+		PIN_RebuildIndex();
+	}
+	return g_channel2Pins[ch];
+}
+static pinMask_t PIN_GetRolePins(int role) {
+	if (role < 0 || role >= IOR_Total_Options) {
+		return 0;
+	}
+	if (g_pinIndexDirty) {
+		PIN_RebuildIndex();
+	}
+	return g_rolePins[role];
+}
+static int PIN_CountBits(pinMask_t mask) {
 	int r = 0;
 
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.roles[i] == role)
-			r++;
+	while (mask) {
+		mask &= mask - 1;
+		r++;
 	}
 	return r;
 }
+static int PIN_FirstBit(pinMask_t mask) {
+	int i = 0;
+
+	if (mask == 0) {
+		return -1;
+	}
+	while ((mask & 1) == 0) {
+		mask >>= 1;
+		i++;
+	}
+	return i;
+}
+// first output pin of channel, next is g_pinNextOutput[pin], PIN_INDEX_END ends list
+static int PIN_GetFirstOutputPin(int ch) {
+	if (ch < 0 || ch >= CHANNEL_MAX) {
+		return PIN_INDEX_END;
+	}
+	if (g_pinIndexDirty) {
+		PIN_RebuildIndex();
+	}
+	return g_channelFirstOutput[ch];
+}
+int PIN_CountPinsWithRoleOrRole(int role, int role2) {
+	return PIN_CountBits(PIN_GetRolePins(role) | PIN_GetRolePins(role2));
+}
+int PIN_CountPinsWithRole(int role) {
+	return PIN_CountBits(PIN_GetRolePins(role));
+}
 int PIN_FindPinIndexForRole(int role, int defaultIndexToReturnIfNotFound) {
 	int i;
 
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.roles[i] == role)
-			return i;
-	}
-	return defaultIndexToReturnIfNotFound;
+	i = PIN_FirstBit(PIN_GetRolePins(role));
+	if (i < 0)
+		return defaultIndexToReturnIfNotFound;
+	return i;
 }
 int PIN_GetPinChannel2ForPinIndex(int index) {
 	if (index < 0 || index >= PLATFORM_GPIO_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_CFG, "PIN_GetPinChannel2ForPinIndex: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_CFG, "PIN_GetPinChannel2ForPinIndex: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
 		return 0;
 	}
 	return g_cfg.pins.channels2[index];
@@ -455,7 +611,7 @@ int PIN_IOR_NofChan(int test){
 
 void RAW_SetPinValue(int index, int iVal) {
 	if (index < 0 || index >= PLATFORM_GPIO_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_CFG, "RAW_SetPinValue: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_CFG, "RAW_SetPinValue: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
 		return;
 	}
 	if (g_enable_pins) {
@@ -464,7 +620,7 @@ void RAW_SetPinValue(int index, int iVal) {
 }
 void Button_OnPressRelease(int index) {
 	if (CFG_HasFlag(OBK_FLAG_BUTTON_DISABLE_ALL)) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 		return;
 	}
 	// fire event - button on pin <index> was released
@@ -472,10 +628,10 @@ void Button_OnPressRelease(int index) {
 }
 void Button_OnInitialPressDown(int index)
 {
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "%i Button_OnInitialPressDown\r\n", index);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "%i Button_OnInitialPressDown\r\n", index);
 
 	if (CFG_HasFlag(OBK_FLAG_BUTTON_DISABLE_ALL)) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 		return;
 	}
 
@@ -525,9 +681,9 @@ void Button_OnInitialPressDown(int index)
 }
 void Button_OnShortClick(int index)
 {
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "%i key_short_press\r\n", index);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "%i key_short_press\r\n", index);
 	if (CFG_HasFlag(OBK_FLAG_BUTTON_DISABLE_ALL)) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 		return;
 	}
 	// fire event - button on pin <index> was clicked
@@ -574,9 +730,9 @@ void Button_OnShortClick(int index)
 }
 void Button_OnDoubleClick(int index)
 {
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "%i key_double_press\r\n", index);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "%i key_double_press\r\n", index);
 	if (CFG_HasFlag(OBK_FLAG_BUTTON_DISABLE_ALL)) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 		return;
 	}
 	if (g_cfg.pins.roles[index] == IOR_Button_ToggleAll || g_cfg.pins.roles[index] == IOR_Button_ToggleAll_n)
@@ -605,9 +761,9 @@ void Button_OnDoubleClick(int index)
 }
 void Button_OnTripleClick(int index)
 {
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "%i key_triple_press\r\n", index);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "%i key_triple_press\r\n", index);
 	if (CFG_HasFlag(OBK_FLAG_BUTTON_DISABLE_ALL)) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 		return;
 	}
 	// fire event - button on pin <index> was 3clicked
@@ -622,9 +778,9 @@ void Button_OnTripleClick(int index)
 }
 void Button_OnQuadrupleClick(int index)
 {
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "%i key_quadruple_press\r\n", index);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "%i key_quadruple_press\r\n", index);
 	if (CFG_HasFlag(OBK_FLAG_BUTTON_DISABLE_ALL)) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 		return;
 	}
 	// fire event - button on pin <index> was 4clicked
@@ -632,18 +788,18 @@ void Button_OnQuadrupleClick(int index)
 }
 void Button_On5xClick(int index)
 {
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "%i key_5x_press\r\n", index);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "%i key_5x_press\r\n", index);
 	if (CFG_HasFlag(OBK_FLAG_BUTTON_DISABLE_ALL)) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 		return;
 	}
 	// fire event - button on pin <index> was 4clicked
 	EventHandlers_FireEvent(CMD_EVENT_PIN_ON5CLICK, index);
 }
 void Button_OnLongPressHold(int index) {
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "%i Button_OnLongPressHold\r\n", index);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "%i Button_OnLongPressHold\r\n", index);
 	if (CFG_HasFlag(OBK_FLAG_BUTTON_DISABLE_ALL)) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 		return;
 	}
 	// fire event - button on pin <index> was held
@@ -664,9 +820,9 @@ void Button_OnLongPressHold(int index) {
 #endif
 }
 void Button_OnLongPressHoldStart(int index) {
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "%i Button_OnLongPressHoldStart\r\n", index);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "%i Button_OnLongPressHoldStart\r\n", index);
 	if (CFG_HasFlag(OBK_FLAG_BUTTON_DISABLE_ALL)) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 		return;
 	}
 	// fire event - button on pin <index> was held
@@ -676,7 +832,7 @@ void Button_OnLongPressHoldStart(int index) {
 bool BTN_ShouldInvert(int index) {
 	int role;
 	if (index < 0 || index >= PLATFORM_GPIO_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_CFG, "BTN_ShouldInvert: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_CFG, "BTN_ShouldInvert: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
 		return false;
 	}
 	role = g_cfg.pins.roles[index];
@@ -738,22 +894,20 @@ void CHANNEL_SetFirstChannelByTypeEx(int requiredType, int newVal, int ausemovin
 
 int CHANNEL_FindIndexForPinType(int requiredType) {
 	int i;
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.roles[i] == requiredType) {
-			return g_cfg.pins.channels[i];
-		}
-	}
-	return -1;
+
+	i = PIN_FirstBit(PIN_GetRolePins(requiredType));
+	if (i < 0)
+		return -1;
+	return g_cfg.pins.channels[i];
 }
 
 int CHANNEL_FindIndexForPinType2(int requiredType, int requiredType2) {
 	int i;
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.roles[i] == requiredType || g_cfg.pins.roles[i] == requiredType2) {
-			return g_cfg.pins.channels[i];
-		}
-	}
-	return -1;
+
+	i = PIN_FirstBit(PIN_GetRolePins(requiredType) | PIN_GetRolePins(requiredType2));
+	if (i < 0)
+		return -1;
+	return g_cfg.pins.channels[i];
 }
 int CHANNEL_FindIndexForType(int requiredType) {
 	int i;
@@ -771,7 +925,7 @@ void CHANNEL_SetFirstChannelByType(int requiredType, int newVal) {
 void CHANNEL_SetAll(int iVal, int iFlags) {
 	int i;
 
-
+	CHANNEL_BeginBatch();
 	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
 		switch (g_cfg.pins.roles[i])
 		{
@@ -816,6 +970,7 @@ void CHANNEL_SetAll(int iVal, int iFlags) {
 			break;
 		}
 	}
+	CHANNEL_CommitBatch();
 }
 void CHANNEL_SetStateOnly(int iVal) {
 	int i;
@@ -862,7 +1017,7 @@ void PIN_SetPinRoleForPinIndex(int index, int role) {
 	bool bSampleInitialState = false;
 
 	if (index < 0 || index >= PLATFORM_GPIO_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_CFG, "PIN_SetPinRoleForPinIndex: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_CFG, "PIN_SetPinRoleForPinIndex: Pin index %i out of range <0,%i).", index, PLATFORM_GPIO_MAX);
 		return;
 	}
 #if 0
@@ -952,6 +1107,7 @@ void PIN_SetPinRoleForPinIndex(int index, int role) {
 			}
 		}
 		g_cfg.pins.roles[index] = role;
+		PIN_MarkIndexDirty();
 		g_cfg_pendingChanges++;
 	}
 
@@ -1188,6 +1344,179 @@ void Channel_SaveInFlashIfNeeded(int ch) {
 		//addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Channel_SaveInFlashIfNeeded: Channel %i is not saved to flash, state %i", ch, g_channelValues[ch]);
 	}
 }
+// Batched channel updates. Between CHANNEL_BeginBatch and CHANNEL_CommitBatch
+// new values are still applied to pins and drivers at once, but MQTT publish,
+// change events and flash save are deferred and done once per channel on commit.
+// Channels that end up with the same value as before the batch are skipped.
+// Only one batch is open at a time, and only changes made by the thread that
+// opened it are deferred, changes from other threads go out as usual.
+#define CHANNEL_BATCH_WORDS ((CHANNEL_MAX + 31) / 32)
+static SemaphoreHandle_t g_channelBatchSem = 0;
+static void* g_channelBatchOwner = 0;
+static int g_channelBatchDepth = 0;
+// set while outermost commit flushes, batches opened by change handlers are
+// flushed by it in next pass
+static bool g_channelBatchFlushing = false;
+static int g_channelBatchStartTime = 0;
+static unsigned int g_channelBatchChanged[CHANNEL_BATCH_WORDS];
+static unsigned int g_channelBatchPublish[CHANNEL_BATCH_WORDS];
+static int g_channelBatchPrevValues[CHANNEL_MAX];
+// copy of the above taken by commit, so handlers can start next batch
+static unsigned int g_channelBatchFlushChanged[CHANNEL_BATCH_WORDS];
+static unsigned int g_channelBatchFlushPublish[CHANNEL_BATCH_WORDS];
+static int g_channelBatchFlushPrevValues[CHANNEL_MAX];
+static int g_channelBatchSaveIndices[CHANNEL_MAX];
+static int g_channelBatchSaveValues[CHANNEL_MAX];
+
+#define CHANNEL_BATCH_CHECK(arr, ch) ((arr)[(ch) >> 5] & (1U << ((ch) & 31)))
+#define CHANNEL_BATCH_SET(arr, ch) (arr)[(ch) >> 5] |= (1U << ((ch) & 31))
+
+#if WINDOWS
+// simulator is single threaded
+#define CHANNEL_GetBatchCaller() ((void*)1)
+#else
+#define CHANNEL_GetBatchCaller() ((void*)xTaskGetCurrentTaskHandle())
+#endif
+
+// publish, events and flash save part of the channel change
+static void Channel_FinishChange(int ch, int prevValue, int iVal, bool bPublish) {
+#if ENABLE_MQTT
+	if (bPublish) {
+		if (CHANNEL_ShouldBePublished(ch)) {
+			MQTT_ChannelPublish(ch, 0);
+		}
+	}
+#endif
+	// Simple event - it just says that there was a change
+	EventHandlers_FireEvent(CMD_EVENT_CHANNEL_ONCHANGE, ch);
+	// more advanced events - change FROM value TO value
+	EventHandlers_ProcessVariableChange_Integer(CMD_EVENT_CHANGE_CHANNEL0 + ch, prevValue, iVal);
+}
+// true if batch of calling thread is open
+static bool Channel_IsBatchOwner() {
+	return (g_channelBatchDepth > 0 || g_channelBatchFlushing)
+		&& g_channelBatchOwner == CHANNEL_GetBatchCaller();
+}
+bool CHANNEL_IsBatchActive() {
+	return g_channelBatchDepth > 0 && Channel_IsBatchOwner();
+}
+void CHANNEL_InitBatch() {
+	// simulator calls Main_Init again for each test
+	if (g_channelBatchSem) {
+		return;
+	}
+	g_channelBatchSem = xSemaphoreCreateBinary();
+	xSemaphoreGive(g_channelBatchSem);
+}
+void CHANNEL_BeginBatch() {
+	if (Channel_IsBatchOwner()) {
+		// nested batch, or batch opened by change handler during flush
+		g_channelBatchDepth++;
+		return;
+	}
+	if (g_channelBatchSem == 0) {
+		// before init, changes are not batched
+		return;
+	}
+	// batches are short, except for scripts, so don't wait for long
+	if (xSemaphoreTake(g_channelBatchSem, CHANNEL_BATCH_WAIT_MS / portTICK_PERIOD_MS) != pdTRUE) {
+		ADDLOG_WARN(LOG_FEATURE_GENERAL, "Channel batch of other thread is open, changes are not batched");
+		return;
+	}
+	g_channelBatchOwner = CHANNEL_GetBatchCaller();
+	g_channelBatchStartTime = g_secondsElapsed;
+	g_channelBatchDepth = 1;
+}
+// publishes, fires events and saves channels of g_channelBatchFlush* arrays
+static void Channel_FlushBatch(int* changed, int* saveCount) {
+	int ch;
+	int iVal;
+	int prevValue;
+
+	for (ch = 0; ch < CHANNEL_MAX; ch++) {
+		if (CHANNEL_BATCH_CHECK(g_channelBatchFlushChanged, ch) == 0) {
+			continue;
+		}
+		prevValue = g_channelBatchFlushPrevValues[ch];
+		iVal = g_channelValues[ch];
+		if (prevValue == iVal) {
+			continue;
+		}
+		(*changed)++;
+		Channel_FinishChange(ch, prevValue, iVal, CHANNEL_BATCH_CHECK(g_channelBatchFlushPublish, ch) != 0);
+		// save, if marked as save value in flash (-1)
+		if (g_cfg.startChannelValues[ch] == -1) {
+			g_channelBatchSaveIndices[*saveCount] = ch;
+			g_channelBatchSaveValues[*saveCount] = g_channelValues[ch];
+			(*saveCount)++;
+		}
+	}
+}
+void CHANNEL_CommitBatch() {
+	int i;
+	int changed = 0;
+	int saveCount = 0;
+	unsigned int any;
+
+	if (g_channelBatchDepth <= 0 || Channel_IsBatchOwner() == false) {
+		return;
+	}
+	g_channelBatchDepth--;
+	// nested batch, outermost commit does the work
+	if (g_channelBatchDepth > 0 || g_channelBatchFlushing) {
+		return;
+	}
+	g_channelBatchFlushing = true;
+	while (1) {
+		// take the changes and clear them before handlers run,
+		// changes deferred by handlers are flushed in next pass
+		any = 0;
+		for (i = 0; i < CHANNEL_BATCH_WORDS; i++) {
+			any |= g_channelBatchChanged[i];
+		}
+		if (any == 0) {
+			break;
+		}
+		memcpy(g_channelBatchFlushChanged, g_channelBatchChanged, sizeof(g_channelBatchFlushChanged));
+		memcpy(g_channelBatchFlushPublish, g_channelBatchPublish, sizeof(g_channelBatchFlushPublish));
+		memcpy(g_channelBatchFlushPrevValues, g_channelBatchPrevValues, sizeof(g_channelBatchFlushPrevValues));
+		memset(g_channelBatchChanged, 0, sizeof(g_channelBatchChanged));
+		memset(g_channelBatchPublish, 0, sizeof(g_channelBatchPublish));
+		saveCount = 0;
+		Channel_FlushBatch(&changed, &saveCount);
+		if (saveCount > 0) {
+			HAL_FlashVars_SaveChannels(g_channelBatchSaveIndices, g_channelBatchSaveValues, saveCount);
+		}
+	}
+	g_channelBatchFlushing = false;
+	g_channelBatchOwner = 0;
+	xSemaphoreGive(g_channelBatchSem);
+	ADDLOG_DEBUG(LOG_FEATURE_GENERAL, "Channel batch committed, %i changed", changed);
+}
+// called every second, so a batch that was never committed
+// (for example, script error) does not hold back publishes forever
+void CHANNEL_CheckBatchTimeout() {
+	if (g_channelBatchDepth <= 0 || g_channelBatchFlushing) {
+		return;
+	}
+	if (g_secondsElapsed - g_channelBatchStartTime < CHANNEL_BATCH_TIMEOUT_SECONDS) {
+		return;
+	}
+	ADDLOG_ERROR(LOG_FEATURE_GENERAL, "Channel batch was open for %i seconds, committing", g_secondsElapsed - g_channelBatchStartTime);
+	// taken over by this thread, late commit of the old owner does nothing
+	g_channelBatchOwner = CHANNEL_GetBatchCaller();
+	g_channelBatchDepth = 1;
+	CHANNEL_CommitBatch();
+}
+static void Channel_AddToBatch(int ch, int prevValue, int iFlags) {
+	if (CHANNEL_BATCH_CHECK(g_channelBatchChanged, ch) == 0) {
+		CHANNEL_BATCH_SET(g_channelBatchChanged, ch);
+		g_channelBatchPrevValues[ch] = prevValue;
+	}
+	if ((iFlags & CHANNEL_SET_FLAG_SKIP_MQTT) == 0) {
+		CHANNEL_BATCH_SET(g_channelBatchPublish, ch);
+	}
+}
 static void Channel_OnChanged(int ch, int prevValue, int iFlags) {
 	int i;
 	int iVal;
@@ -1210,33 +1539,27 @@ static void Channel_OnChanged(int ch, int prevValue, int iFlags) {
 	TuyaMCU_OnChannelChanged(ch, iVal);
 #endif
 
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.channels[i] == ch) {
-			if (g_cfg.pins.roles[i] == IOR_Relay || g_cfg.pins.roles[i] == IOR_BAT_Relay || g_cfg.pins.roles[i] == IOR_LED) {
-				RAW_SetPinValue(i, bOn);
-			}
-			else if (g_cfg.pins.roles[i] == IOR_Relay_n || g_cfg.pins.roles[i] == IOR_LED_n || g_cfg.pins.roles[i] == IOR_BAT_Relay_n) {
-				RAW_SetPinValue(i, !bOn);
-			}
-			else if (g_cfg.pins.roles[i] == IOR_PWM || g_cfg.pins.roles[i] == IOR_PWM_ScriptOnly) {
-				HAL_PIN_PWM_Update(i, iVal);
-			}
-			else if (g_cfg.pins.roles[i] == IOR_PWM_n || g_cfg.pins.roles[i] == IOR_PWM_ScriptOnly_n) {
-				HAL_PIN_PWM_Update(i, 100 - iVal);
-			}
+	for (i = PIN_GetFirstOutputPin(ch); i != PIN_INDEX_END; i = g_pinNextOutput[i]) {
+		switch (g_pinAction[i]) {
+		case PIN_ACTION_SET:
+			RAW_SetPinValue(i, bOn);
+			break;
+		case PIN_ACTION_SET_INV:
+			RAW_SetPinValue(i, !bOn);
+			break;
+		case PIN_ACTION_PWM:
+			HAL_PIN_PWM_Update(i, iVal);
+			break;
+		case PIN_ACTION_PWM_INV:
+			HAL_PIN_PWM_Update(i, 100 - iVal);
+			break;
 		}
 	}
-#if ENABLE_MQTT
-	if ((iFlags & CHANNEL_SET_FLAG_SKIP_MQTT) == 0) {
-		if (CHANNEL_ShouldBePublished(ch)) {
-			MQTT_ChannelPublish(ch, 0);
-		}
+	if (g_channelBatchDepth > 0 && Channel_IsBatchOwner()) {
+		Channel_AddToBatch(ch, prevValue, iFlags);
+		return;
 	}
-#endif
-	// Simple event - it just says that there was a change
-	EventHandlers_FireEvent(CMD_EVENT_CHANNEL_ONCHANGE, ch);
-	// more advanced events - change FROM value TO value
-	EventHandlers_ProcessVariableChange_Integer(CMD_EVENT_CHANGE_CHANNEL0 + ch, prevValue, iVal);
+	Channel_FinishChange(ch, prevValue, iVal, (iFlags & CHANNEL_SET_FLAG_SKIP_MQTT) == 0);
 	//addLogAdv(LOG_ERROR, LOG_FEATURE_GENERAL,"CHANNEL_OnChanged: Channel index %i startChannelValues %i\n\r",ch,g_cfg.startChannelValues[ch]);
 
 	Channel_SaveInFlashIfNeeded(ch);
@@ -1423,7 +1746,7 @@ float CHANNEL_GetFinalValue(int channel) {
 }
 float CHANNEL_GetFloat(int ch) {
 	if (ch < 0 || ch >= CHANNEL_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_GENERAL, "CHANNEL_Get: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_GENERAL, "CHANNEL_Get: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
 		return 0;
 	}
 	return g_channelValuesFloats[ch];
@@ -1448,7 +1771,7 @@ int CHANNEL_Get(int ch) {
 		return HAL_FlashVars_GetChannelValue(ch - SPECIAL_CHANNEL_FLASHVARS_FIRST);
 	}
 	if (ch < 0 || ch >= CHANNEL_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_GENERAL, "CHANNEL_Get: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_GENERAL, "CHANNEL_Get: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
 		return 0;
 	}
 	return g_channelValues[ch];
@@ -1468,14 +1791,12 @@ void CHANNEL_Set_FloatPWM(int ch, float fVal, int iFlags) {
 	g_channelValues[ch] = (int)fVal;
 	g_channelValuesFloats[ch] = fVal;
 
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.channels[i] == ch) {
-			if (g_cfg.pins.roles[i] == IOR_PWM || g_cfg.pins.roles[i] == IOR_PWM_ScriptOnly) {
-				HAL_PIN_PWM_Update(i, fVal);
-			}
-			else if (g_cfg.pins.roles[i] == IOR_PWM_n || g_cfg.pins.roles[i] == IOR_PWM_ScriptOnly_n) {
-				HAL_PIN_PWM_Update(i, 100.0f - fVal);
-			}
+	for (i = PIN_GetFirstOutputPin(ch); i != PIN_INDEX_END; i = g_pinNextOutput[i]) {
+		if (g_pinAction[i] == PIN_ACTION_PWM) {
+			HAL_PIN_PWM_Update(i, fVal);
+		}
+		else if (g_pinAction[i] == PIN_ACTION_PWM_INV) {
+			HAL_PIN_PWM_Update(i, 100.0f - fVal);
 		}
 	}
 	// TODO: support float
@@ -1522,7 +1843,7 @@ void CHANNEL_Set_Ex(int ch, int iVal, int iFlags, int ausemovingaverage) {
 	}
 	if (ch < 0 || ch >= CHANNEL_MAX) {
 		//if(bMustBeSilent==0) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_GENERAL, "CHANNEL_Set: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_GENERAL, "CHANNEL_Set: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
 		//}
 		return;
 	}
@@ -1530,13 +1851,13 @@ void CHANNEL_Set_Ex(int ch, int iVal, int iFlags, int ausemovingaverage) {
 	if (bForce == 0) {
 		if (prevValue == iVal) {
 			if (bSilent == 0) {
-				addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "No change in channel %i (still set to %i) - ignoring\n\r", ch, prevValue);
+				ADDLOG_INFO(LOG_FEATURE_GENERAL, "No change in channel %i (still set to %i) - ignoring\n\r", ch, prevValue);
 			}
 			return;
 		}
 	}
 	if (bSilent == 0) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "CHANNEL_Set channel %i has changed to %i (flags %i)\n\r", ch, iVal, iFlags);
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "CHANNEL_Set channel %i has changed to %i (flags %i)\n\r", ch, iVal, iFlags);
 	}
 	#ifdef ENABLE_BL_MOVINGAVG
 	//addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "CHANNEL_Set debug channel %i has changed to %i (flags %i)\n\r", ch, iVal, iFlags);
@@ -1556,7 +1877,7 @@ void CHANNEL_AddClamped(int ch, int iVal, int min, int max, int bWrapInsteadOfCl
 #if 0
 	int prevValue;
 	if (ch < 0 || ch >= CHANNEL_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_GENERAL, "CHANNEL_AddClamped: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_GENERAL, "CHANNEL_AddClamped: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
 		return;
 	}
 	prevValue = g_channelValues[ch];
@@ -1575,7 +1896,7 @@ void CHANNEL_AddClamped(int ch, int iVal, int min, int max, int bWrapInsteadOfCl
 			g_channelValues[ch] = min;
 	}
 
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "CHANNEL_AddClamped channel %i has changed to %i\n\r", ch, g_channelValues[ch]);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "CHANNEL_AddClamped channel %i has changed to %i\n\r", ch, g_channelValues[ch]);
 
 	Channel_OnChanged(ch, prevValue, 0);
 #else
@@ -1596,7 +1917,7 @@ void CHANNEL_AddClamped(int ch, int iVal, int min, int max, int bWrapInsteadOfCl
 			iVal = min;
 	}
 
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "CHANNEL_AddClamped channel %i has changed to %i\n\r", ch, iVal);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "CHANNEL_AddClamped channel %i has changed to %i\n\r", ch, iVal);
 
 	CHANNEL_Set(ch, iVal, 0);
 #endif
@@ -1605,37 +1926,29 @@ void CHANNEL_Add(int ch, int iVal) {
 #if 0
 	int prevValue;
 	if (ch < 0 || ch >= CHANNEL_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_GENERAL, "CHANNEL_Add: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_GENERAL, "CHANNEL_Add: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
 		return;
 	}
 	prevValue = g_channelValues[ch];
 	g_channelValues[ch] = g_channelValues[ch] + iVal;
 
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "CHANNEL_Add channel %i has changed to %i\n\r", ch, g_channelValues[ch]);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "CHANNEL_Add channel %i has changed to %i\n\r", ch, g_channelValues[ch]);
 
 	Channel_OnChanged(ch, prevValue, 0);
 #else
 	// we want to support special channel indexes, so it's better to use GET/SET interface
 	// Special channel indexes are used to access things like dimmer, led colors, etc
 	iVal = iVal + CHANNEL_Get(ch);
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "CHANNEL_Add channel %i has changed to %i\n\r", ch, iVal);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "CHANNEL_Add channel %i has changed to %i\n\r", ch, iVal);
 	CHANNEL_Set(ch, iVal, 0);
 #endif
 }
 
 int CHANNEL_FindMaxValueForChannel(int ch) {
-	int i;
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		// is pin tied to this channel?
-		if (g_cfg.pins.channels[i] == ch) {
-			// is it PWM?
-			if (g_cfg.pins.roles[i] == IOR_PWM || g_cfg.pins.roles[i] == IOR_PWM_ScriptOnly) {
-				return 100;
-			}
-			if (g_cfg.pins.roles[i] == IOR_PWM_n || g_cfg.pins.roles[i] == IOR_PWM_ScriptOnly_n) {
-				return 100;
-			}
-		}
+	// is there PWM pin tied to this channel?
+	if (PIN_GetChannelPins(ch) & (PIN_GetRolePins(IOR_PWM) | PIN_GetRolePins(IOR_PWM_ScriptOnly)
+		| PIN_GetRolePins(IOR_PWM_n) | PIN_GetRolePins(IOR_PWM_ScriptOnly_n))) {
+		return 100;
 	}
 	if (g_cfg.pins.channelTypes[ch] == ChType_Dimmer)
 		return 100;
@@ -1658,7 +1971,7 @@ void CHANNEL_Toggle(int ch) {
 	}
 #endif
 	if (ch < 0 || ch >= CHANNEL_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_GENERAL, "CHANNEL_Toggle: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_GENERAL, "CHANNEL_Toggle: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
 		return;
 	}
 	prev = g_channelValues[ch];
@@ -1670,35 +1983,21 @@ void CHANNEL_Toggle(int ch) {
 	Channel_OnChanged(ch, prev, 0);
 }
 int CHANNEL_HasChannelPinWithRoleOrRole(int ch, int iorType, int iorType2) {
-	int i;
-
 	if (ch < 0 || ch >= CHANNEL_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_GENERAL, "CHANNEL_HasChannelPinWithRole: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_GENERAL, "CHANNEL_HasChannelPinWithRole: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
 		return 0;
 	}
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.channels[i] == ch) {
-			if (g_cfg.pins.roles[i] == iorType)
-				return 1;
-			else if (g_cfg.pins.roles[i] == iorType2)
-				return 1;
-		}
-	}
+	if (PIN_GetChannelPins(ch) & (PIN_GetRolePins(iorType) | PIN_GetRolePins(iorType2)))
+		return 1;
 	return 0;
 }
 int CHANNEL_HasChannelPinWithRole(int ch, int iorType) {
-	int i;
-
 	if (ch < 0 || ch >= CHANNEL_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_GENERAL, "CHANNEL_HasChannelPinWithRole: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_GENERAL, "CHANNEL_HasChannelPinWithRole: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
 		return 0;
 	}
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.channels[i] == ch) {
-			if (g_cfg.pins.roles[i] == iorType)
-				return 1;
-		}
-	}
+	if (PIN_GetChannelPins(ch) & PIN_GetRolePins(iorType))
+		return 1;
 	return 0;
 }
 bool CHANNEL_Check(int ch) {
@@ -1708,7 +2007,7 @@ bool CHANNEL_Check(int ch) {
 	}
 #endif
 	if (ch < 0 || ch >= CHANNEL_MAX) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_GENERAL, "CHANNEL_Check: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
+		ADDLOG_ERROR(LOG_FEATURE_GENERAL, "CHANNEL_Check: Channel index %i is out of range <0,%i)\n\r", ch, CHANNEL_MAX);
 		return 0;
 	}
 	if (g_channelValues[ch] > 0)
@@ -1717,71 +2016,37 @@ bool CHANNEL_Check(int ch) {
 }
 
 bool CHANNEL_IsInUse(int ch) {
-	int i;
-
 	if (g_cfg.pins.channelTypes[ch] != ChType_Default) {
 		return true;
 	}
-
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.roles[i] != IOR_None) {
-			if (g_cfg.pins.channels[i] == ch) {
-				return true;
-			}
-			if (g_cfg.pins.channels2[i] == ch) {
-				return true;
-			}
-		}
+	// any pin with role, using it as first or second channel
+	if ((PIN_GetChannelPins(ch) | PIN_GetChannel2Pins(ch)) & ~PIN_GetRolePins(IOR_None)) {
+		return true;
 	}
 	return false;
 }
 
 
 bool CHANNEL_IsPowerRelayChannel(int ch) {
-	int i;
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.channels[i] == ch) {
-			int role = g_cfg.pins.roles[i];
-			// NOTE: do not include Battery relay
-			if (role == IOR_Relay || role == IOR_Relay_n) {
-				return true;
-			}
-			// Also allow toggling Bridge channel
-			// https://www.elektroda.com/rtvforum/viewtopic.php?p=20906463#20906463
-			if (role == IOR_BridgeForward || role == IOR_BridgeReverse) {
-				return true;
-			}
-		}
+	// NOTE: do not include Battery relay
+	// Also allow toggling Bridge channel
+	// https://www.elektroda.com/rtvforum/viewtopic.php?p=20906463#20906463
+	if (PIN_GetChannelPins(ch) & (PIN_GetRolePins(IOR_Relay) | PIN_GetRolePins(IOR_Relay_n)
+		| PIN_GetRolePins(IOR_BridgeForward) | PIN_GetRolePins(IOR_BridgeReverse))) {
+		return true;
 	}
 	return false;
 }
 bool CHANNEL_ShouldBePublished(int ch) {
-	int i;
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		int role = g_cfg.pins.roles[i];
-
-		if (g_cfg.pins.channels[i] == ch) {
-			if (role == IOR_Relay || role == IOR_Relay_n
-				|| role == IOR_LED || role == IOR_LED_n
-				|| role == IOR_ADC || role == IOR_BAT_ADC
-				|| role == IOR_CHT83XX_DAT || role == IOR_SHT3X_DAT || role == IOR_SGP_DAT
-				|| role == IOR_DigitalInput || role == IOR_DigitalInput_n
-				|| role == IOR_DoorSensorWithDeepSleep || role == IOR_DoorSensorWithDeepSleep_NoPup
-				|| role == IOR_DoorSensorWithDeepSleep_pd
-				|| IS_PIN_DHT_ROLE(role)
-				|| role == IOR_DigitalInput_NoPup || role == IOR_DigitalInput_NoPup_n) {
-				return true;
-			}
-		}
-		else if (g_cfg.pins.channels2[i] == ch) {
-			if (IS_PIN_DHT_ROLE(role)) {
-				return true;
-			}
-			// SGP, CHT8305 and SHT3X uses secondary channel for humidity
-			if (role == IOR_CHT83XX_DAT || role == IOR_SHT3X_DAT || role == IOR_SGP_DAT) {
-				return true;
-			}
-		}
+	pinMask_t pins;
+
+	pins = PIN_GetChannelPins(ch);
+	if (pins & g_publishPins) {
+		return true;
+	}
+	// second channel counts only for pins which have other first channel
+	if (PIN_GetChannel2Pins(ch) & ~pins & g_publish2Pins) {
+		return true;
 	}
 	if (g_cfg.pins.channelTypes[ch] != ChType_Default) {
 		return true;
@@ -1800,8 +2065,11 @@ bool CHANNEL_ShouldBePublished(int ch) {
 }
 int CHANNEL_GetRoleForOutputChannel(int ch) {
 	int i;
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (g_cfg.pins.channels[i] == ch) {
+	pinMask_t pins;
+
+	pins = PIN_GetChannelPins(ch);
+	for (i = 0; pins; i++, pins >>= 1) {
+		if (pins & 1) {
 			switch (g_cfg.pins.roles[i]) {
 			case IOR_BAT_Relay:
 			case IOR_BAT_Relay_n:
@@ -2147,7 +2415,7 @@ void PIN_ticks(void* param)
 								CHANNEL_Toggle(g_cfg.pins.channels[i]);
 								EventHandlers_FireEvent(CMD_EVENT_PIN_ONTOGGLE, i);
 							} else {
-								addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+								ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 							}
 						}
 					} else {
@@ -2163,7 +2431,7 @@ void PIN_ticks(void* param)
 								CHANNEL_Toggle(g_cfg.pins.channels[i]);
 								EventHandlers_FireEvent(CMD_EVENT_PIN_ONTOGGLE, i);
 							} else {
-								addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Child lock!");
+								ADDLOG_INFO(LOG_FEATURE_GENERAL, "Child lock!");
 							}
 						}
 					} else {
@@ -2179,7 +2447,7 @@ void PIN_ticks(void* param)
 	// TODO: not implemented yet - this bit continues polling
 	// for a while after a GPI is fired, so that we can see long press, etc.
 	if (param) {
-		addLogAdv(LOG_DEBUG, LOG_FEATURE_GENERAL, "Pin intr at %d (+%d) (%08lX)", g_time, t_diff, pinvalues[0]);
+		ADDLOG_DEBUG(LOG_FEATURE_GENERAL, "Pin intr at %d (+%d) (%08lX)", g_time, t_diff, pinvalues[0]);
 	}
 #endif
 #endif
@@ -2196,10 +2464,10 @@ void PIN_ticks(void* param)
 #ifdef BEKEN_PIN_GPI_INTERRUPTS
 		PIN_TriggerPoll();
 		if (activepins) {
-			addLogAdv(LOG_DEBUG, LOG_FEATURE_GENERAL, "Pins active at %d (%x)", g_time, pinvalues[0]);
+			ADDLOG_DEBUG(LOG_FEATURE_GENERAL, "Pins active at %d (%x)", g_time, pinvalues[0]);
 		}
 		else {
-			addLogAdv(LOG_DEBUG, LOG_FEATURE_GENERAL, "Pins ->inactive at %d (%x)", g_time, pinvalues[0]);
+			ADDLOG_DEBUG(LOG_FEATURE_GENERAL, "Pins ->inactive at %d (%x)", g_time, pinvalues[0]);
 		}
 #endif
 #endif
@@ -2208,7 +2476,7 @@ void PIN_ticks(void* param)
 	else {
 #ifdef PLATFORM_BEKEN
 #ifdef BEKEN_PIN_GPI_INTERRUPTS
-		addLogAdv(LOG_DEBUG, LOG_FEATURE_GENERAL, "Pins inactive at %d", g_time);
+		ADDLOG_DEBUG(LOG_FEATURE_GENERAL, "Pins inactive at %d", g_time);
 #endif      
 #endif      
 	}
@@ -2307,7 +2575,7 @@ static commandResult_t CMD_setButtonHoldRepeat(const void* context, const char*
 	Tokenizer_TokenizeString(args, 0);
 
 	if (Tokenizer_GetArgsCount() < 1) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "This command requires 1 argument - timeRepeat - current %i",
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "This command requires 1 argument - timeRepeat - current %i",
 			g_cfg.buttonHoldRepeat);
 		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
 	}
@@ -2317,10 +2585,10 @@ static commandResult_t CMD_setButtonHoldRepeat(const void* context, const char*
 
 	CFG_Save_IfThereArePendingChanges();
 
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Times set, %i. Config autosaved to flash.",
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "Times set, %i. Config autosaved to flash.",
 		g_cfg.buttonHoldRepeat
 	);
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "If something is wrong, you can restore default %i",
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "If something is wrong, you can restore default %i",
 		CFG_DEFAULT_BTN_REPEAT);
 	return CMD_RES_OK;
 }
@@ -2332,7 +2600,7 @@ static commandResult_t CMD_SetButtonTimes(const void* context, const char* cmd,
 	Tokenizer_TokenizeString(args, 0);
 
 	if (Tokenizer_GetArgsCount() < 3) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "This command requires 3 arguments - timeLong, timeShort, timeRepeat - current %i %i %i",
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "This command requires 3 arguments - timeLong, timeShort, timeRepeat - current %i %i %i",
 			g_cfg.buttonLongPress, g_cfg.buttonShortPress, g_cfg.buttonHoldRepeat);
 		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
 	}
@@ -2345,10 +2613,10 @@ static commandResult_t CMD_SetButtonTimes(const void* context, const char* cmd,
 
 	CFG_Save_IfThereArePendingChanges();
 
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Times set, %i %i %i. Config autosaved to flash.",
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "Times set, %i %i %i. Config autosaved to flash.",
 		g_cfg.buttonLongPress, g_cfg.buttonShortPress, g_cfg.buttonHoldRepeat
 	);
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "If something is wrong, you can restore defaults - %i %i %i",
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "If something is wrong, you can restore defaults - %i %i %i",
 		CFG_DEFAULT_BTN_LONG, CFG_DEFAULT_BTN_SHORT, CFG_DEFAULT_BTN_REPEAT);
 	return 0;
 }
@@ -2357,7 +2625,7 @@ static commandResult_t CMD_ShowChannelValues(const void* context, const char* cm
 
 	for (i = 0; i < CHANNEL_MAX; i++) {
 		if (g_channelValues[i] > 0) {
-			addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Channel %i value is %i", i, g_channelValues[i]);
+			ADDLOG_INFO(LOG_FEATURE_GENERAL, "Channel %i value is %i", i, g_channelValues[i]);
 		}
 	}
 
@@ -2371,7 +2639,7 @@ static commandResult_t CMD_SetChannelType(const void* context, const char* cmd,
 	Tokenizer_TokenizeString(args, 0);
 
 	if (Tokenizer_GetArgsCount() < 2) {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "This command requires 2 arguments");
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "This command requires 2 arguments");
 		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
 	}
 	channel = Tokenizer_GetArgInteger(0);
@@ -2380,13 +2648,13 @@ static commandResult_t CMD_SetChannelType(const void* context, const char* cmd,
 	typeCode = CHANNEL_ParseChannelType(type);
 	if (typeCode == ChType_Error) {
 
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Channel %i type not set because %s is not a known type", channel, type);
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Channel %i type not set because %s is not a known type", channel, type);
 		return CMD_RES_BAD_ARGUMENT;
 	}
 
 	CHANNEL_SetType(channel, typeCode);
 
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Channel %i type changed to %s", channel, type);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "Channel %i type changed to %s", channel, type);
 	return CMD_RES_OK;
 }
 #if ALLOW_SSID2
@@ -2398,14 +2666,14 @@ static commandResult_t CMD_setStartupSSIDChannel(const void* context, const char
 	if (Tokenizer_GetArgsCount() >= 1) {
 		int fval = Tokenizer_GetArgInteger(0);
 		if ((fval < -1) || (fval >= MAX_RETAIN_CHANNELS - 1)) {
-			addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "StartupSSIDChannel value error: %i Allowed values (-1, 0..%i)", fval, MAX_RETAIN_CHANNELS - 1);
+			ADDLOG_INFO(LOG_FEATURE_GENERAL, "StartupSSIDChannel value error: %i Allowed values (-1, 0..%i)", fval, MAX_RETAIN_CHANNELS - 1);
 			return CMD_RES_BAD_ARGUMENT;
 		}
 		g_StartupSSIDRetainChannel = fval;
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "StartupSSIDChannel changed to %i", g_StartupSSIDRetainChannel);
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "StartupSSIDChannel changed to %i", g_StartupSSIDRetainChannel);
 	}
 	else {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "StartupSSIDChannel is %i", g_StartupSSIDRetainChannel);
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "StartupSSIDChannel is %i", g_StartupSSIDRetainChannel);
 	}
 	return CMD_RES_OK;
 }
@@ -2420,21 +2688,21 @@ static commandResult_t CMD_setStartupSSID(const void* context, const char* cmd,
 	if (Tokenizer_GetArgsCount() >= 1) {
 		int fval = Tokenizer_GetArgInteger(0);
 		if ((fval < 0) || (fval >1)) {
-			addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "StartupSSID value error: %i Allowed values (0, 1)", fval);
+			ADDLOG_INFO(LOG_FEATURE_GENERAL, "StartupSSID value error: %i Allowed values (0, 1)", fval);
 			return CMD_RES_BAD_ARGUMENT;
 		}
 		if (g_StartupSSIDRetainChannel<0) {
-			addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "Cannot set StartupSSID, StartupSSIDChannel is not set.");
+			ADDLOG_INFO(LOG_FEATURE_GENERAL, "Cannot set StartupSSID, StartupSSIDChannel is not set.");
 			return CMD_RES_BAD_ARGUMENT;
 		}
 		if (!(fval==fold)) {
 			FV_UpdateStartupSSIDIfChanged_StoredValue(fval);//update flash only when changed
-			addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "StartupSSID changed to %i", fval);
+			ADDLOG_INFO(LOG_FEATURE_GENERAL, "StartupSSID changed to %i", fval);
 		} else {
-			addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "StartupSSID unchanged %i", fval);
+			ADDLOG_INFO(LOG_FEATURE_GENERAL, "StartupSSID unchanged %i", fval);
 		}
 	} else {
-		addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "StartupSSID is %i", fold);
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "StartupSSID is %i", fold);
 	}
 	return CMD_RES_OK;
 }
@@ -2508,61 +2776,28 @@ void PIN_get_Relay_PWM_Count(int* relayCount, int* pwmCount, int* dInputCount) {
 
 
 int h_isChannelPWM(int tg_ch) {
-	int i;
-	int role;
-	int ch;
-
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		ch = PIN_GetPinChannelForPinIndex(i);
-		if (tg_ch != ch)
-			continue;
-		role = PIN_GetPinRoleForPinIndex(i);
-		if (role == IOR_PWM || role == IOR_PWM_n) {
-			return true;
-		}
-		// DO NOT COUNT SCRIPTONLY PWM HERE!
-		// As in title - it's only for scripts. 
-		// It should not generate lights!
-		//if (role == IOR_PWM_ScriptOnly) {
-		//	return true;
-		//}
+	// DO NOT COUNT SCRIPTONLY PWM HERE!
+	// As in title - it's only for scripts. 
+	// It should not generate lights!
+	if (PIN_GetChannelPins(tg_ch) & (PIN_GetRolePins(IOR_PWM) | PIN_GetRolePins(IOR_PWM_n))) {
+		return true;
 	}
 	return false;
 }
 int h_isChannelRelay(int tg_ch) {
-	int i;
-	int role;
-
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		int ch = PIN_GetPinChannelForPinIndex(i);
-		if (tg_ch != ch)
-			continue;
-		role = PIN_GetPinRoleForPinIndex(i);
-		if (role == IOR_Relay || role == IOR_Relay_n || role == IOR_LED || role == IOR_LED_n) {
-			return true;
-		}
-		if ((role == IOR_BridgeForward) || (role == IOR_BridgeReverse))
-		{
-			return true;
-		}
+	if (PIN_GetChannelPins(tg_ch) & (PIN_GetRolePins(IOR_Relay) | PIN_GetRolePins(IOR_Relay_n)
+		| PIN_GetRolePins(IOR_LED) | PIN_GetRolePins(IOR_LED_n)
+		| PIN_GetRolePins(IOR_BridgeForward) | PIN_GetRolePins(IOR_BridgeReverse))) {
+		return true;
 	}
 	return false;
 }
 int h_isChannelDigitalInput(int tg_ch) {
-	int i;
-	int role;
-
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		int ch = PIN_GetPinChannelForPinIndex(i);
-		if (tg_ch != ch)
-			continue;
-		role = PIN_GetPinRoleForPinIndex(i);
-		if (role == IOR_DigitalInput || role == IOR_DigitalInput_n || role == IOR_DigitalInput_NoPup || role == IOR_DigitalInput_NoPup_n) {
-			return true;
-		}
-		if (role == IOR_DoorSensorWithDeepSleep || role == IOR_DoorSensorWithDeepSleep_NoPup || role == IOR_DoorSensorWithDeepSleep_pd) {
-			return true;
-		}
+	if (PIN_GetChannelPins(tg_ch) & (PIN_GetRolePins(IOR_DigitalInput) | PIN_GetRolePins(IOR_DigitalInput_n)
+		| PIN_GetRolePins(IOR_DigitalInput_NoPup) | PIN_GetRolePins(IOR_DigitalInput_NoPup_n)
+		| PIN_GetRolePins(IOR_DoorSensorWithDeepSleep) | PIN_GetRolePins(IOR_DoorSensorWithDeepSleep_NoPup)
+		| PIN_GetRolePins(IOR_DoorSensorWithDeepSleep_pd))) {
+		return true;
 	}
 	return false;
 }
@@ -2581,7 +2816,7 @@ static commandResult_t showgpi(const void* context, const char* cmd, const char*
 		else
 			value[0] |= ((val & 1) << i);
 	}
-	addLogAdv(LOG_INFO, LOG_FEATURE_GENERAL, "GPIs are 0x%08lX%08lX", value[1], value[0]);
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "GPIs are 0x%08lX%08lX", value[1], value[0]);
 	return CMD_RES_OK;
 }
 
@@ -2600,7 +2835,7 @@ static commandResult_t CMD_setMovingAvg(const void* context, const char* cmd,
 			CMD_GetResultString(CMD_RES_BAD_ARGUMENT));
 		return CMD_RES_BAD_ARGUMENT;
 	}
-	addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "MovingAvg=%i", fval);	
+	ADDLOG_INFO(LOG_FEATURE_ENERGYMETER, "MovingAvg=%i", fval);	
 	movingavg_cnt = fval;
 	return CMD_RES_OK;
 }
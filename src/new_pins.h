@@ -1221,8 +1221,10 @@ typedef struct pinsState_s {
 #define OBK_FLAG_HTTP_NO_ONOFF_WORDS				49
 #define OBK_FLAG_MQTT_NEVERAPPENDGET				50
 #define OBK_FLAG_WIFI_ENHANCED_FAST_CONNECT			51
+#define OBK_FLAG_MQTT_CHANNELS_AS_JSON				52
+#define OBK_FLAG_MQTT_CHANNELS_JSON_ONLY			53
 
-#define OBK_TOTAL_FLAGS 52
+#define OBK_TOTAL_FLAGS 54
 
 #define LOGGER_FLAG_MQTT_DEDUPER					1
 #define LOGGER_FLAG_POWER_SAVE						2
@@ -1466,6 +1468,8 @@ int PIN_GetPinChannel2ForPinIndex(int index);
 int PIN_FindPinIndexForRole(int role, int defaultIndexToReturnIfNotFound);
 const char* PIN_GetPinNameAlias(int index);
 void PIN_SetPinRoleForPinIndex(int index, int role);
+// pin roles or channels were changed, reverse index is rebuilt on next use
+void PIN_MarkIndexDirty();
 void PIN_SetPinChannelForPinIndex(int index, int ch);
 void PIN_SetPinChannel2ForPinIndex(int index, int ch);
 void CHANNEL_Toggle(int ch);
@@ -1493,6 +1497,18 @@ void CHANNEL_SetFirstChannelByTypeEx(int requiredType, int newVal, int ausemovin
 void CHANNEL_SetFirstChannelByType(int requiredType, int newVal);
 // CHANNEL_SET_FLAG_*
 void CHANNEL_SetAll(int iVal, int iFlags);
+// Batched channel updates - values are applied to hardware at once, but publish,
+// change events and flash save are done once per changed channel on commit.
+// Batches can be nested, only the outermost commit flushes. One thread has
+// a batch open at a time, others wait for it up to CHANNEL_BATCH_WAIT_MS.
+#define CHANNEL_BATCH_TIMEOUT_SECONDS 5
+#define CHANNEL_BATCH_WAIT_MS 100
+// creates batch semaphore, called once on start
+void CHANNEL_InitBatch();
+void CHANNEL_BeginBatch();
+void CHANNEL_CommitBatch();
+bool CHANNEL_IsBatchActive();
+void CHANNEL_CheckBatchTimeout();
 void CHANNEL_SetStateOnly(int iVal);
 int CHANNEL_HasChannelPinWithRole(int ch, int iorType);
 int CHANNEL_HasChannelPinWithRoleOrRole(int ch, int iorType, int iorType2);
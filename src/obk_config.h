@@ -173,6 +173,8 @@
 #define ENABLE_DRIVER_SHIFTREGISTER		1
 #define ENABLE_OBK_SCRIPTING			1
 #define ENABLE_OBK_BERRY				1
+// log records with deferred formatting
+#define ENABLE_LOG_BINARY				1
 
 #elif PLATFORM_BL602
 
@@ -263,6 +265,8 @@
 #define ENABLE_DRIVER_KP18058			1
 #define ENABLE_DRIVER_ADCSMOOTHER		1
 #define ENABLE_OBK_SCRIPTING			1
+// log records with deferred formatting
+#define ENABLE_LOG_BINARY				1
 //#define ENABLE_DRIVER_OPENWEATHERMAP	1
 #if PLATFORM_BEKEN_NEW
 #define NEW_TCP_SERVER				1
@@ -485,6 +489,15 @@
 //#define ENABLE_BL_MOVINGAVG	1
 #endif
 
+// Compile-time log stripping.
+// ADDLOG_* calls more verbose than this level are removed from the build,
+// together with their arguments. 1 = error, 2 = warn, 3 = info, 4 = debug,
+// 5 = extradebug, 6 = all (default). It can be also set for a single feature,
+// for example LOG_COMPILED_LEVEL_MQTT 2 keeps only MQTT errors and warnings.
+// Runtime loglevel still applies to whatever is compiled in.
+//#define LOG_COMPILED_LEVEL			3
+//#define LOG_COMPILED_LEVEL_MQTT		2
+
 // closing OBK_CONFIG_H
 #endif
 
@@ -15,6 +15,71 @@ static void ResetEventsAndChannels(int eventsCleared) {
 	SELFTEST_ASSERT_CHANNEL(3, 0);
 }
 
+static void RunEventSeconds(unsigned int from, int count) {
+	for (int i = 0; i < count; i++) {
+		NTP_RunEvents(from + i, true);
+	}
+}
+void Test_ClockEvents_Schedule() {
+	// Thu, 20 Apr 2023 13:54:30
+	unsigned int simTime = 1681998870;
+
+	NTP_ClearEvents();
+	CMD_ExecuteCommand("setChannel 1 0", 0);
+	CMD_ExecuteCommand("setChannel 2 0", 0);
+	CMD_ExecuteCommand("setChannel 3 0", 0);
+	CMD_ExecuteCommand("setChannel 4 0", 0);
+	NTP_RunEvents(simTime, false);
+	NTP_RunEvents(simTime, true);
+
+	// thursday only, friday only, and every day
+	CMD_ExecuteCommand("addClockEvent 13:55 0x10 1 addChannel 1 1", 0);
+	CMD_ExecuteCommand("addClockEvent 13:55 0x20 2 addChannel 2 1", 0);
+	CMD_ExecuteCommand("addClockEvent 13:56 0x7f 3 addChannel 3 1", 0);
+	// never fires
+	CMD_ExecuteCommand("addClockEvent 13:57 0x00 4 addChannel 4 1", 0);
+	SELFTEST_ASSERT(NTP_GetNextEventTime() == simTime + 30);
+
+	RunEventSeconds(simTime, 200);
+	SELFTEST_ASSERT_CHANNEL(1, 1);
+	SELFTEST_ASSERT_CHANNEL(2, 0);
+	SELFTEST_ASSERT_CHANNEL(3, 1);
+	SELFTEST_ASSERT_CHANNEL(4, 0);
+	// next is 13:55 on friday
+	SELFTEST_ASSERT(NTP_GetNextEventTime() == simTime + 30 + 24 * 3600);
+
+	// time going back replays events
+	RunEventSeconds(simTime, 200);
+	SELFTEST_ASSERT_CHANNEL(1, 2);
+	SELFTEST_ASSERT_CHANNEL(3, 2);
+
+	// catch-up after a small jump runs events that were skipped over
+	NTP_RunEvents(simTime, true);
+	NTP_RunEvents(simTime + 91, true);
+	SELFTEST_ASSERT_CHANNEL(1, 3);
+	SELFTEST_ASSERT_CHANNEL(3, 3);
+
+	// large jump only replays first 100 seconds, friday 13:55 and 13:56 are skipped
+	NTP_RunEvents(simTime + 24 * 3600 + 100, true);
+	RunEventSeconds(simTime + 24 * 3600 + 100, 100);
+	SELFTEST_ASSERT_CHANNEL(1, 3);
+	SELFTEST_ASSERT_CHANNEL(2, 0);
+	SELFTEST_ASSERT_CHANNEL(3, 3);
+	// saturday 13:56
+	SELFTEST_ASSERT(NTP_GetNextEventTime() == simTime + 90 + 2 * 24 * 3600);
+
+	// event can remove itself
+	SELFTEST_ASSERT(NTP_PrintEventList() == 4);
+	CMD_ExecuteCommand("addClockEvent 14:00 0x7f 5 backlog addChannel 4 1; removeClockEvent 5", 0);
+	SELFTEST_ASSERT(NTP_PrintEventList() == 5);
+	RunEventSeconds(simTime + 24 * 3600 + 200, 400);
+	SELFTEST_ASSERT_CHANNEL(4, 1);
+	SELFTEST_ASSERT(NTP_PrintEventList() == 4);
+
+	NTP_ClearEvents();
+	SELFTEST_ASSERT(NTP_GetNextEventTime() == 0);
+}
+
 void Test_ClockEvents() {
 	// reset whole device
 	SIM_ClearOBK(0);
@@ -141,6 +206,8 @@ void Test_ClockEvents() {
 	SELFTEST_ASSERT_CHANNEL(2, 20);
 	SELFTEST_ASSERT_CHANNEL(3, 30);
 	SELFTEST_ASSERT_CHANNEL(4, 53);
+
+	Test_ClockEvents_Schedule();
 }
 
 #endif
@@ -1,6 +1,7 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h"
+#include <time.h>
 
 void Test_Events() {
 	// reset whole device
@@ -148,9 +149,127 @@ void Test_UART() {
 	}
 }
 
+void Test_CommandCache() {
+	cmdCache_t cache;
+	const char *line = "  addChannel 5 10";
+	const char *aliasLine = "myCachedAlias";
+
+	// reset whole device
+	SIM_ClearOBK(0);
+
+	memset(&cache, 0, sizeof(cache));
+	CMD_ExecuteCommandCached(&cache, line, 0);
+	SELFTEST_ASSERT_CHANNEL(5, 10);
+	SELFTEST_ASSERT(cache.line == line);
+	SELFTEST_ASSERT(cache.cmd != 0);
+	CMD_ExecuteCommandCached(&cache, line, 0);
+	CMD_ExecuteCommandCached(&cache, line, 0);
+	SELFTEST_ASSERT_CHANNEL(5, 30);
+
+	// unknown command is not cached...
+	memset(&cache, 0, sizeof(cache));
+	CMD_ExecuteCommandCached(&cache, aliasLine, 0);
+	SELFTEST_ASSERT(cache.line == 0);
+	// ...but it will be resolved once it gets registered
+	CMD_ExecuteCommand("alias myCachedAlias addChannel 6 7", 0);
+	CMD_ExecuteCommandCached(&cache, aliasLine, 0);
+	SELFTEST_ASSERT(cache.line == aliasLine);
+	SELFTEST_ASSERT_CHANNEL(6, 7);
+	CMD_ExecuteCommandCached(&cache, aliasLine, 0);
+	SELFTEST_ASSERT_CHANNEL(6, 14);
+
+	// registering new command invalidates cache, it must still work
+	CMD_ExecuteCommand("alias myOtherCachedAlias addChannel 6 100", 0);
+	CMD_ExecuteCommandCached(&cache, aliasLine, 0);
+	SELFTEST_ASSERT_CHANNEL(6, 21);
+
+	// event handlers are running commands through the cache as well
+	CMD_ExecuteCommand("addEventHandler 124 1 addChannel 7 3", 0);
+	EventHandlers_FireEvent(124, 1);
+	EventHandlers_FireEvent(124, 1);
+	SELFTEST_ASSERT_CHANNEL(7, 6);
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+}
+
+static clock_t Test_EventsDispatch_Measure(int loops) {
+	clock_t t0;
+	int i;
+
+	t0 = clock();
+	for (i = 0; i < loops; i++) {
+		// no handler for that argument, so this measures just the lookup
+		EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 5000);
+	}
+	return clock() - t0;
+}
+void Test_EventsDispatch() {
+	char buffer[64];
+	clock_t tFew, tMany;
+	int i;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+
+	// string handlers are matched case insensitive, but only by their text
+	CMD_ExecuteCommand("addEventHandler OnUART Hello addChannel 20 1", 0);
+	CMD_ExecuteCommand("addEventHandler OnUART Other addChannel 20 10", 0);
+	EventHandlers_FireEvent_String(CMD_EVENT_ON_UART, "HELLO");
+	SELFTEST_ASSERT_CHANNEL(20, 1);
+	EventHandlers_FireEvent_String(CMD_EVENT_ON_UART, "other");
+	SELFTEST_ASSERT_CHANNEL(20, 11);
+	EventHandlers_FireEvent(CMD_EVENT_ON_UART, 0);
+	SELFTEST_ASSERT_CHANNEL(20, 11);
+
+	// same argument, different events
+	CMD_ExecuteCommand("addEventHandler OnClick 7 addChannel 21 1", 0);
+	CMD_ExecuteCommand("addEventHandler OnHold 7 addChannel 21 100", 0);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 7);
+	SELFTEST_ASSERT_CHANNEL(21, 1);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONHOLD, 7);
+	SELFTEST_ASSERT_CHANNEL(21, 101);
+	// two handlers for the same event run newest first
+	CMD_ExecuteCommand("addEventHandler OnClick 7 setChannel 21 0", 0);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 7);
+	SELFTEST_ASSERT_CHANNEL(21, 1);
+
+	tFew = Test_EventsDispatch_Measure(100000);
+	// many rules for other pins and channels must not slow the dispatch down
+	for (i = 0; i < 300; i++) {
+		snprintf(buffer, sizeof(buffer), "addEventHandler OnClick %i addChannel 22 1", 100 + i);
+		CMD_ExecuteCommand(buffer, 0);
+		snprintf(buffer, sizeof(buffer), "addChangeHandler Channel%i == %i addChannel 23 1", i % 60, i);
+		CMD_ExecuteCommand(buffer, 0);
+	}
+	SELFTEST_ASSERT(EventHandlers_GetActiveCount() == 605);
+	tMany = Test_EventsDispatch_Measure(100000);
+	printf("Event dispatch benchmark: 5 handlers %i ms, 605 handlers %i ms\n",
+		(int)(tFew * 1000 / CLOCKS_PER_SEC), (int)(tMany * 1000 / CLOCKS_PER_SEC));
+
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 250);
+	SELFTEST_ASSERT_CHANNEL(22, 1);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 7);
+	SELFTEST_ASSERT_CHANNEL(21, 1);
+	SELFTEST_ASSERT_CHANNEL(22, 1);
+	// channel 3 has change handlers for 3, 63, 123, 183 and 243
+	CMD_ExecuteCommand("setChannel 3 63", 0);
+	SELFTEST_ASSERT_CHANNEL(23, 1);
+	CMD_ExecuteCommand("setChannel 3 64", 0);
+	SELFTEST_ASSERT_CHANNEL(23, 1);
+	CMD_ExecuteCommand("setChannel 4 64", 0);
+	SELFTEST_ASSERT_CHANNEL(23, 2);
+
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+	SELFTEST_ASSERT(EventHandlers_GetActiveCount() == 0);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 250);
+	SELFTEST_ASSERT_CHANNEL(22, 1);
+}
+
 void Test_Commands_Generic() {
 	Test_UART();
 	Test_Events();
+	Test_EventsDispatch();
+	Test_CommandCache();
 
 	// reset whole device
 	SIM_ClearOBK(0);
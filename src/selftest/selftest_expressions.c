@@ -1,6 +1,7 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h"
+#include <time.h>
 
 void Test_Expressions_RunTests_Basic() {
 	// reset whole device
@@ -312,4 +313,119 @@ void Test_Expressions_RunTests_Braces() {
 
 }
 
+
+void Test_Expressions_RunTests_Constants() {
+	float f;
+	const char *s;
+	const char *after;
+
+	SIM_ClearOBK(0);
+	CMD_ExecuteCommand("setChannel 5 7", 0);
+	CMD_ExecuteCommand("setChannel 55 8", 0);
+
+	// names are case insensitive and digits suffixes pick the right entry
+	SELFTEST_ASSERT_EXPRESSION("$CH5", 7);
+	SELFTEST_ASSERT_EXPRESSION("$ch55", 8);
+	SELFTEST_ASSERT_EXPRESSION("$Ch005", 7);
+	SELFTEST_ASSERT_EXPRESSION("$CH5+$CH55+$CH005", 22);
+	// without stop, the longest numeric suffix is used and the rest is left
+	s = "$CH055abc";
+	f = 0;
+	after = CMD_ExpandConstant(s, 0, &f);
+	SELFTEST_ASSERT(after == s + 6);
+	SELFTEST_ASSERT(Float_Equals(f, 8));
+	// with stop, the name must end exactly there
+	f = 0;
+	after = CMD_ExpandConstant(s, s + 5, &f);
+	SELFTEST_ASSERT(after == s + 5);
+	SELFTEST_ASSERT(CMD_ExpandConstant("$CHx", 0, &f) == 0);
+	SELFTEST_ASSERT(CMD_ExpandConstant("$nonExistingConstant", 0, &f) == 0);
+	SELFTEST_ASSERT(CMD_ExpandConstant("$", 0, &f) == 0);
+	SELFTEST_ASSERT(CMD_ExpandConstant("", 0, &f) == 0);
+	// legacy name without $
+	SELFTEST_ASSERT(CMD_ExpandConstant("MQTTOn", 0, &f) != 0);
+	// $rand01 is listed before $rand and must not be shadowed
+	for (int i = 0; i < 10; i++) {
+		f = CMD_EvaluateExpression("$rand01", 0);
+		SELFTEST_ASSERT(f >= 0 && f <= 1);
+	}
+}
+// compiled (cached) and interpreted evaluation must always agree
+static void Test_Expressions_Compare(const char *exp) {
+	float a = CMD_EvaluateExpression(exp, 0);
+	float b = CMD_EvaluateExpression_Interpreted(exp, 0);
+	SELFTEST_ASSERT(Float_Equals(a, b));
+}
+void Test_Expressions_RunTests_Compiled() {
+	const char *benchExp = "(($CH2+$CH1)*(5+6))+((2.0*$CH2)+$CH1)";
+	int hits, misses, hits2, misses2;
+	int i, loops;
+	float sum;
+	clock_t t0, tCompiled, tInterpreted;
+
+	SIM_ClearOBK(0);
+	CMD_ExecuteCommand("setChannel 1 4", 0);
+	CMD_ExecuteCommand("setChannel 2 3", 0);
+	CMD_ExecuteCommand("setChannel 12 10", 0);
+
+	Test_Expressions_Compare(benchExp);
+	Test_Expressions_Compare("-1-1");
+	Test_Expressions_Compare("!$CH1");
+	Test_Expressions_Compare("!0 + 1");
+	Test_Expressions_Compare("$CH12 >= 10 && $CH1 < 5");
+	Test_Expressions_Compare("(3 - 6) % (4 + 2)");
+	Test_Expressions_Compare("$CH12*-1");
+	Test_Expressions_Compare("$MQTTOn || $CH2 != 3");
+	Test_Expressions_Compare(" ( $CH12 ) ");
+
+	// second evaluation of the same text must hit the cache
+	CMD_GetExpressionCacheStats(&hits, &misses);
+	SELFTEST_ASSERT_EXPRESSION("$CH12*10.0+$CH1", 104.0f);
+	SELFTEST_ASSERT_EXPRESSION("$CH12*10.0+$CH1", 104.0f);
+	CMD_GetExpressionCacheStats(&hits2, &misses2);
+	SELFTEST_ASSERT(misses2 == misses + 1);
+	SELFTEST_ASSERT(hits2 == hits + 1);
+	// cached program must still see current channel values
+	CMD_ExecuteCommand("setChannel 12 20", 0);
+	CMD_GetExpressionCacheStats(&hits, &misses);
+	SELFTEST_ASSERT_EXPRESSION("$CH12*10.0+$CH1", 204.0f);
+	CMD_GetExpressionCacheStats(&hits2, &misses2);
+	SELFTEST_ASSERT(misses2 == misses);
+	SELFTEST_ASSERT(hits2 == hits + 1);
+
+	// plain numbers do not go through the cache
+	CMD_GetExpressionCacheStats(&hits, &misses);
+	SELFTEST_ASSERT_EXPRESSION("123", 123);
+	SELFTEST_ASSERT_EXPRESSION("-0.5", -0.5f);
+	SELFTEST_ASSERT_EXPRESSION("7.25", 7.25f);
+	CMD_GetExpressionCacheStats(&hits2, &misses2);
+	SELFTEST_ASSERT(misses2 == misses);
+	SELFTEST_ASSERT(hits2 == hits);
+
+	// too long to be compiled, goes through the interpreter
+	SELFTEST_ASSERT_EXPRESSION("1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1", 50);
+	// too many operations for a single program, goes through the interpreter
+	SELFTEST_ASSERT_EXPRESSION("$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1+$CH1", 68);
+
+	// microbenchmark, just for the log
+	loops = 20000;
+	CMD_ExecuteCommand("setChannel 12 10", 0);
+	sum = 0;
+	t0 = clock();
+	for (i = 0; i < loops; i++) {
+		sum += CMD_EvaluateExpression(benchExp, 0);
+	}
+	tCompiled = clock() - t0;
+	SELFTEST_ASSERT(Float_Equals(sum, 87.0f * loops));
+	sum = 0;
+	t0 = clock();
+	for (i = 0; i < loops; i++) {
+		sum += CMD_EvaluateExpression_Interpreted(benchExp, 0);
+	}
+	tInterpreted = clock() - t0;
+	SELFTEST_ASSERT(Float_Equals(sum, 87.0f * loops));
+	printf("Expression benchmark: %i evaluations, compiled %i ms, interpreted %i ms\n", loops,
+		(int)(tCompiled * 1000 / CLOCKS_PER_SEC), (int)(tInterpreted * 1000 / CLOCKS_PER_SEC));
+}
+
 #endif
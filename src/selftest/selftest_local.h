@@ -86,6 +86,7 @@ void Test_Command_If();
 void Test_Command_If_Else();
 void Test_LFS();
 void Test_Tokenizer();
+void Test_Logging();
 void Test_Commands_Alias();
 void Test_ExpandConstant();
 void Test_Scripting();
@@ -133,6 +134,8 @@ void Test_DoorSensor();
 void Test_Enums();
 void Test_Expressions_RunTests_Basic();
 void Test_Expressions_RunTests_Braces();
+void Test_Expressions_RunTests_Compiled();
+void Test_Expressions_RunTests_Constants();
 void Test_ButtonEvents();
 void Test_Http();
 void Test_Demo_ConditionalRelay();
@@ -181,6 +184,9 @@ bool SIM_HasMQTTHistoryStringWithJSONPayload(const char *topic, bool bPrefixMode
 bool SIM_CheckMQTTHistoryForFloat(const char *topic, float value, bool bRetain);
 const char *SIM_GetMQTTHistoryString(const char *topic, bool bPrefixMode);
 bool SIM_BeginParsingMQTTJSON(const char *topic, bool bPrefixMode);
+void SIM_SetMQTTOffline(bool bOffline);
+// number of times a semaphore was taken while it was already taken
+int SIM_GetSemaphoreDoubleTakes();
 
 void SIM_SimulateUserClickOnPin(int pin);
 
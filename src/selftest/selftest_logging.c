@@ -0,0 +1,162 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../logging/logging.h"
+
+#if ENABLE_LOG_BINARY
+
+// reads everything queued for HTTP log viewer, so next read has only new lines
+static void Test_Logging_Drain() {
+	Test_FakeHTTPClientPacket_GET("lograw");
+}
+static void Test_Logging_Expect(const char *text) {
+	Test_FakeHTTPClientPacket_GET("lograw");
+	SELFTEST_ASSERT_HTML_REPLY_CONTAINS(text);
+}
+static void Test_Logging_Formats() {
+	char expected[256];
+	char prefix[64];
+	char tmp[32];
+	long long big = 1234567890123LL;
+
+	snprintf(prefix, sizeof(prefix), "%s%s", loglevelnames[LOG_INFO], logfeaturenames[LOG_FEATURE_GENERAL]);
+
+	Test_Logging_Drain();
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "Mix %i %s %.2f %x %c [%-5s] [%.*s] %lld %05u %%",
+		-42, "str", 3.14159f, 0xBEEF, 'Q', "ab", 3, "abcdef", big, 77);
+	snprintf(expected, sizeof(expected), "%sMix %i %s %.2f %x %c [%-5s] [%.*s] %lld %05u %%\r\n",
+		prefix, -42, "str", 3.14159f, 0xBEEF, 'Q', "ab", 3, "abcdef", big, 77);
+	Test_Logging_Expect(expected);
+
+	// width given as argument, long and size_t
+	Test_Logging_Drain();
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "[%*i] [%-*s] %ld %zu", 6, 12, 4, "x", 100000L, sizeof(expected));
+	snprintf(expected, sizeof(expected), "%s[%*i] [%-*s] %ld %zu\r\n", prefix, 6, 12, 4, "x", 100000L, sizeof(expected));
+	Test_Logging_Expect(expected);
+
+	// string arguments are copied, so later changes to caller buffer are not visible
+	strcpy(tmp, "before");
+	Test_Logging_Drain();
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "Value is %s", tmp);
+	strcpy(tmp, "after");
+	Test_Logging_Expect("Value is before\r\n");
+
+	// the same for plain text passed as fmt
+	strcpy(tmp, "plain text");
+	Test_Logging_Drain();
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, tmp);
+	strcpy(tmp, "changed");
+	Test_Logging_Expect("plain text\r\n");
+
+	// raw has no prefix, trailing newline is replaced
+	Test_Logging_Drain();
+	ADDLOG_INFO(LOG_FEATURE_RAW, "raw line %i\n", 5);
+	Test_Logging_Expect("raw line 5\r\n");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), loglevelnames[LOG_INFO]) == 0);
+
+	// NULL string does not crash
+	Test_Logging_Drain();
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "null is %s!", (const char*)0);
+	Test_Logging_Expect("null is (null)!");
+
+	// very long string is cut, but record is still there
+	memset(expected, 'z', sizeof(expected) - 1);
+	expected[sizeof(expected) - 1] = 0;
+	Test_Logging_Drain();
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "long %s %s %s end", expected, expected, expected);
+	Test_Logging_Expect("long zzzz");
+}
+static void Test_Logging_Overflow() {
+	int written, dropped, lost;
+	int written2, dropped2, lost2;
+	int i;
+
+	Test_Logging_Drain();
+	LOG_GetRecordStats(&written, &dropped, &lost);
+	// much more than the ring can hold, while nobody reads
+	for (i = 0; i < 500; i++) {
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Spam record %i with some text", i);
+	}
+	LOG_GetRecordStats(&written2, &dropped2, &lost2);
+	SELFTEST_ASSERT(written2 - written == 500);
+	// single threaded, so nothing was being written while we reserved
+	SELFTEST_ASSERT(dropped2 == dropped);
+	// viewer gets the newest ones and counts the rest as lost
+	Test_Logging_Expect("Spam record 499 with some text\r\n");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "Spam record 0 ") == 0);
+	LOG_GetRecordStats(&written2, &dropped2, &lost2);
+	SELFTEST_ASSERT(lost2 > lost);
+	SELFTEST_ASSERT(lost2 < lost + 500);
+	// nothing more after that
+	Test_FakeHTTPClientPacket_GET("lograw");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "Spam record") == 0);
+}
+static void Test_Logging_RateLimit() {
+	int i;
+
+	CMD_ExecuteCommand("lograte 5 10", 0);
+	Test_Logging_Drain();
+	for (i = 0; i < 100; i++) {
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Storm message %i end", i);
+	}
+	// only the burst gets through
+	Test_Logging_Expect("Storm message 9 end");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "Storm message 10 end") == 0);
+	// other call sites are not affected
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "Calm message");
+	Test_Logging_Expect("Calm message");
+	// "%s" pass-through is shared by many sites and never limited
+	Test_Logging_Drain();
+	for (i = 0; i < 100; i++) {
+		char tmp[32];
+		snprintf(tmp, sizeof(tmp), "Echo line %i end", i);
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "%s", tmp);
+	}
+	Test_Logging_Expect("Echo line 99 end");
+
+	// bucket is refilled every second
+	Sim_RunSeconds(1, false);
+	Test_Logging_Drain();
+	for (i = 100; i < 200; i++) {
+		ADDLOG_INFO(LOG_FEATURE_GENERAL, "Storm message %i end", i);
+	}
+	Test_Logging_Expect("Storm message 104 end");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "Storm message 199 end") == 0);
+
+	// 90 dropped in first batch and 95 in second
+	Test_FakeHTTPClientPacket_GET("api/logsites");
+	SELFTEST_ASSERT_HTML_REPLY_CONTAINS("\"rate\":5,\"burst\":10");
+	SELFTEST_ASSERT_HTML_REPLY_CONTAINS("{\"text\":\"Storm message %i end\",\"feature\":7,\"count\":200,\"suppressed\":185}");
+
+	// and what was dropped is summarized
+	Test_Logging_Drain();
+	Sim_RunSeconds(11, false);
+	Test_Logging_Expect("messages like \"Storm message %i end\"");
+	SELFTEST_ASSERT_HTML_REPLY_CONTAINS("Suppressed ");
+	CMD_ExecuteCommand("lograte 0", 0);
+}
+void Test_Logging() {
+	SIM_ClearOBK(0);
+
+	CMD_ExecuteCommand("logmode binary", 0);
+	Test_Logging_Formats();
+	Test_Logging_Overflow();
+	Test_Logging_RateLimit();
+
+	// text mode still works and hands over to same outputs
+	CMD_ExecuteCommand("logmode text", 0);
+	Test_Logging_Drain();
+	ADDLOG_INFO(LOG_FEATURE_GENERAL, "Text mode %i", 123);
+	Test_Logging_Expect("Text mode 123\r\n");
+	CMD_ExecuteCommand("logmode binary", 0);
+}
+
+#else
+
+void Test_Logging() {
+
+}
+
+#endif
+
+#endif
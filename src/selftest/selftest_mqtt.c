@@ -2,6 +2,7 @@
 
 #include "selftest_local.h"
 #include "../hal/hal_wifi.h"
+#include "../mqtt/new_mqtt.h"
 
 void SIM_ClearAndPrepareForMQTTTesting(const char *clientName, const char *groupName) {
 	SIM_ClearOBK(0);
@@ -731,6 +732,994 @@ void Test_MQTT_Average() {
 	SIM_ClearMQTTHistory();
 }
 
+#if ENABLE_MQTT
+void Test_MQTT_StateJSON() {
+	SIM_ClearAndPrepareForMQTTTesting("jsDev", "bekens");
+	CFG_SetFlag(OBK_FLAG_MQTT_CHANNELS_AS_JSON, true);
+
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	PIN_SetPinRoleForPinIndex(10, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(10, 2);
+	CMD_ExecuteCommand("setChannelType 3 Dimmer", 0);
+	Sim_RunMiliseconds(500, false);
+
+	// by default channel topics are still published, for discovery entities
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("jsDev/1/get", "1", false);
+	Sim_RunMiliseconds(200, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("jsDev/state", "{\"1\":1}", false);
+	CMD_ExecuteCommand("setChannel 1 0", 0);
+	Sim_RunMiliseconds(200, false);
+
+	// changes in one window are sent together, not in channel topics
+	CFG_SetFlag(OBK_FLAG_MQTT_CHANNELS_JSON_ONLY, true);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	CMD_ExecuteCommand("setChannel 2 1", 0);
+	CMD_ExecuteCommand("setChannel 3 50", 0);
+	CMD_ExecuteCommand("setChannel 3 60", 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("jsDev/state", false) == 0);
+	Sim_RunMiliseconds(200, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("jsDev/state", "{\"1\":1,\"2\":1,\"3\":60}", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("jsDev/1/get", false) == 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("jsDev/3/get", false) == 0);
+
+	// only changed ones next time
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("setChannel 2 0", 0);
+	Sim_RunMiliseconds(200, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("jsDev/state", "{\"2\":0}", false);
+
+	// channel topic still replies to get
+	SIM_ClearMQTTHistory();
+	SIM_SendFakeMQTT("jsDev/3/get", "");
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("jsDev/3/get", "60", false);
+
+	// whole state is sent at once
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("publishChannels", 0);
+	Sim_RunSeconds(5, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("jsDev/state", "{\"1\":1,\"2\":0,\"3\":60}", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("jsDev/1/get", false) == 0);
+
+	CFG_SetFlag(OBK_FLAG_MQTT_CHANNELS_AS_JSON, false);
+	CFG_SetFlag(OBK_FLAG_MQTT_CHANNELS_JSON_ONLY, false);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("setChannel 2 1", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("jsDev/2/get", "1", false);
+	SIM_ClearMQTTHistory();
+}
+#else
+void Test_MQTT_StateJSON() {
+
+}
+#endif
+
+#if ENABLE_MQTT
+void Test_MQTT_Dedup() {
+	SIM_ClearAndPrepareForMQTTTesting("ddDev", "bekens");
+	CMD_ExecuteCommand("mqtt_dedup sensor 2 5", 0);
+	CMD_ExecuteCommand("mqtt_dedup channel 0 5", 0);
+
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringString("voltage", "230", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("ddDev/voltage/get", "230", false);
+	// same value again is skipped
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringString("voltage", "230", 0);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("ddDev/voltage/get", "230", false));
+	// other topic is separate
+	MQTT_PublishMain_StringString("current", "1", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("ddDev/current/get", "1", false);
+
+	// changes faster than min interval, only the last one is sent later
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringString("voltage", "231", 0);
+	MQTT_PublishMain_StringString("voltage", "232", 0);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("ddDev/voltage/get", "231", false));
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("ddDev/voltage/get", "232", false));
+	Sim_RunSeconds(3, false);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("ddDev/voltage/get", "231", false));
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("ddDev/voltage/get", "232", false);
+	// going back to the sent value drops the waiting one
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringString("voltage", "233", 0);
+	MQTT_PublishMain_StringString("voltage", "232", 0);
+	Sim_RunSeconds(3, false);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("ddDev/voltage/get", "233", false));
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("ddDev/voltage/get", "232", false));
+	// after max silence, same value is sent again
+	Sim_RunSeconds(3, false);
+	MQTT_PublishMain_StringString("voltage", "232", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("ddDev/voltage/get", "232", false);
+
+	// publish command is never deduped, user asked for it
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("publish current 1", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("ddDev/current/get", "1", false);
+
+	// channels, reply to get is always sent
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("setChannel 3 7", 0);
+	CMD_ExecuteCommand("publishChannel 3", 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("ddDev/3/get", "7", false);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("publishChannel 3", 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("ddDev/3/get", "7", false));
+	SIM_SendFakeMQTT("ddDev/3/get", "");
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("ddDev/3/get", "7", false);
+
+	// other class is not deduped by default
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("publish raw/topic 5 1", 0);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("publish raw/topic 5 1", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("raw/topic", "5", false);
+
+	CMD_ExecuteCommand("mqtt_dedup sensor 0 0", 0);
+	CMD_ExecuteCommand("mqtt_dedup channel 0 0", 0);
+	SIM_ClearMQTTHistory();
+}
+#else
+void Test_MQTT_Dedup() {
+
+}
+#endif
+
+#if ENABLE_MQTT
+static int g_testCallbackHits[4];
+static char g_testCallbackTopic[128];
+
+static int Test_MQTT_Callback_Temp(obk_mqtt_request_t* request) {
+	g_testCallbackHits[0]++;
+	strcpy(g_testCallbackTopic, request->topic);
+	// eats the message, so later callbacks don't get it
+	return 1;
+}
+static int Test_MQTT_Callback_Sensors(obk_mqtt_request_t* request) {
+	g_testCallbackHits[1]++;
+	strcpy(g_testCallbackTopic, request->topic);
+	return 0;
+}
+static int Test_MQTT_Callback_Status(obk_mqtt_request_t* request) {
+	g_testCallbackHits[2]++;
+	return 0;
+}
+static int Test_MQTT_Callback_All(obk_mqtt_request_t* request) {
+	g_testCallbackHits[3]++;
+	return 0;
+}
+static void Test_MQTT_Callbacks_Expect(const char *topic, int temp, int sensors, int status, int all) {
+	memset(g_testCallbackHits, 0, sizeof(g_testCallbackHits));
+	SIM_SendFakeMQTT(topic, "1");
+	SELFTEST_ASSERT(g_testCallbackHits[0] == temp);
+	SELFTEST_ASSERT(g_testCallbackHits[1] == sensors);
+	SELFTEST_ASSERT(g_testCallbackHits[2] == status);
+	SELFTEST_ASSERT(g_testCallbackHits[3] == all);
+}
+void Test_MQTT_Callbacks() {
+	SIM_ClearAndPrepareForMQTTTesting("cbDev", "bekens");
+
+	MQTT_RegisterCallback("cbDev/sensors/", "cbDev/sensors/+/temp", 20, Test_MQTT_Callback_Temp);
+	MQTT_RegisterCallback("cbDev/sensors/", "cbDev/sensors/#", 21, Test_MQTT_Callback_Sensors);
+	MQTT_RegisterCallback("", "+/status", 22, Test_MQTT_Callback_Status);
+	MQTT_RegisterCallback("", "#", 23, Test_MQTT_Callback_All);
+
+	// first one eats it
+	Test_MQTT_Callbacks_Expect("cbDev/sensors/kitchen/temp", 1, 0, 0, 0);
+	SELFTEST_ASSERT_STRING(g_testCallbackTopic, "cbDev/sensors/kitchen/temp");
+	// + is only single level
+	Test_MQTT_Callbacks_Expect("cbDev/sensors/kitchen/2/temp", 0, 1, 0, 1);
+	SELFTEST_ASSERT_STRING(g_testCallbackTopic, "cbDev/sensors/kitchen/2/temp");
+	// # matches also parent level
+	Test_MQTT_Callbacks_Expect("cbDev/sensors", 0, 1, 0, 1);
+	Test_MQTT_Callbacks_Expect("cbDev/sensors/", 0, 1, 0, 1);
+	Test_MQTT_Callbacks_Expect("cbDev/sensorsX/a", 0, 0, 0, 1);
+	Test_MQTT_Callbacks_Expect("lamp/status", 0, 0, 1, 1);
+	Test_MQTT_Callbacks_Expect("/status", 0, 0, 1, 1);
+	Test_MQTT_Callbacks_Expect("lamp/status/x", 0, 0, 0, 1);
+	// wildcards at first level don't match $ topics
+	Test_MQTT_Callbacks_Expect("$SYS/status", 0, 0, 0, 0);
+
+	// replaced by ID, now with different subscription
+	MQTT_RegisterCallback("", "other/status", 22, Test_MQTT_Callback_Status);
+	Test_MQTT_Callbacks_Expect("lamp/status", 0, 0, 0, 1);
+	Test_MQTT_Callbacks_Expect("other/status", 0, 0, 1, 1);
+	MQTT_RemoveCallback(23);
+	Test_MQTT_Callbacks_Expect("lamp/status", 0, 0, 0, 0);
+
+	// device callbacks still work
+	SIM_SendFakeMQTTRawChannelSet(5, "123");
+	SELFTEST_ASSERT_CHANNEL(5, 123);
+
+	MQTT_RemoveCallback(20);
+	MQTT_RemoveCallback(21);
+	MQTT_RemoveCallback(22);
+	Test_MQTT_Callbacks_Expect("cbDev/sensors/kitchen/temp", 0, 0, 0, 0);
+}
+#else
+void Test_MQTT_Callbacks() {
+
+}
+#endif
+
+#if ENABLE_MQTT
+static int g_testRxHits;
+static int g_testRxLastLen;
+static obk_mqtt_request_t g_testRxRetained;
+
+static int Test_MQTT_Callback_Rx(obk_mqtt_request_t* request) {
+	g_testRxHits++;
+	g_testRxLastLen = request->receivedLen;
+	SELFTEST_ASSERT(request->topicLen == (int)strlen(request->topic));
+	SELFTEST_ASSERT(request->received[request->receivedLen] == 0);
+	if (!strcmp(request->topic, "rxDev/scene/keep")) {
+		MQTT_RetainRequest(request);
+		g_testRxRetained = *request;
+	}
+	return 1;
+}
+void Test_MQTT_ReceiveBurst() {
+	int used, highWater, dropped, dropped0, processed, processed0, maxLatency;
+	char payload[201];
+	int i;
+
+	SIM_ClearAndPrepareForMQTTTesting("rxDev", "bekens");
+	MQTT_RegisterCallback("rxDev/scene/", "rxDev/scene/#", 30, Test_MQTT_Callback_Rx);
+
+	// scene sends many commands at once, none is lost
+	MQTT_GetReceiveStats(&used, &highWater, &dropped0, &processed0, &maxLatency);
+	for (i = 0; i < 30; i++) {
+		MQTT_Post_Received_Str("cmnd/rxDev/addChannel", "1 1");
+	}
+	MQTT_GetReceiveStats(&used, &highWater, &dropped, &processed, &maxLatency);
+	SELFTEST_ASSERT(used > 0);
+	SELFTEST_ASSERT(highWater >= used);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(1, 30);
+	MQTT_GetReceiveStats(&used, &highWater, &dropped, &processed, &maxLatency);
+	SELFTEST_ASSERT(used == 0);
+	SELFTEST_ASSERT(dropped == dropped0);
+	SELFTEST_ASSERT(processed - processed0 == 30);
+
+	// binary payload keeps its length
+	g_testRxHits = 0;
+	MQTT_Post_Received("rxDev/scene/bin", strlen("rxDev/scene/bin"), (const unsigned char*)"a\0b", 3);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(g_testRxHits == 1);
+	SELFTEST_ASSERT(g_testRxLastLen == 3);
+
+	// overflow is counted, not silent
+	memset(payload, 'x', sizeof(payload) - 1);
+	payload[sizeof(payload) - 1] = 0;
+	g_testRxHits = 0;
+	MQTT_GetReceiveStats(&used, &highWater, &dropped0, &processed0, &maxLatency);
+	for (i = 0; i < 60; i++) {
+		MQTT_Post_Received_Str("rxDev/scene/big", payload);
+	}
+	Sim_RunFrames(1, false);
+	MQTT_GetReceiveStats(&used, &highWater, &dropped, &processed, &maxLatency);
+	SELFTEST_ASSERT(dropped > dropped0);
+	SELFTEST_ASSERT(g_testRxHits == processed - processed0);
+	SELFTEST_ASSERT(g_testRxHits + dropped - dropped0 == 60);
+	SELFTEST_ASSERT(g_testRxLastLen == 200);
+	SELFTEST_ASSERT(highWater <= MQTT_RX_BUFFER_MAX);
+	SELFTEST_ASSERT(used == 0);
+
+	// retained record stays valid after callback, and later ones still go through
+	MQTT_Post_Received_Str("rxDev/scene/keep", "kept");
+	MQTT_Post_Received_Str("rxDev/scene/other", "12");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_STRING(g_testRxRetained.topic, "rxDev/scene/keep");
+	SELFTEST_ASSERT_STRING((const char*)g_testRxRetained.received, "kept");
+	SELFTEST_ASSERT(g_testRxLastLen == 2);
+	MQTT_GetReceiveStats(&used, &highWater, &dropped, &processed, &maxLatency);
+	SELFTEST_ASSERT(used > 0);
+	// and so does wrapping around it
+	for (i = 0; i < 100; i++) {
+		MQTT_Post_Received_Str("rxDev/scene/big", payload);
+		Sim_RunFrames(1, false);
+	}
+	SELFTEST_ASSERT_STRING((const char*)g_testRxRetained.received, "kept");
+	MQTT_ReleaseRequest(&g_testRxRetained);
+	MQTT_GetReceiveStats(&used, &highWater, &dropped, &processed, &maxLatency);
+	SELFTEST_ASSERT(used == 0);
+
+	MQTT_RemoveCallback(30);
+}
+#else
+void Test_MQTT_ReceiveBurst() {
+
+}
+#endif
+
+#if ENABLE_MQTT
+static int Test_MQTT_Queue_Count() {
+	int queued, slabUsed, coalesced, dropped;
+	MQTT_GetQueueStats(&queued, &slabUsed, &coalesced, &dropped);
+	return queued;
+}
+static void Test_MQTT_Queue_Drain() {
+	int guard = 0;
+	while (Test_MQTT_Queue_Count() > 0 && guard++ < 100) {
+		PublishQueuedItems();
+	}
+	SELFTEST_ASSERT(Test_MQTT_Queue_Count() == 0);
+}
+// 700 bytes, starting with round and index
+static void Test_MQTT_Queue_BigValue(char *out, int round, int index) {
+	char tmp[16];
+	int len = sprintf(tmp, "%i_%i", round, index);
+	memset(out, 'x', 700);
+	out[700] = 0;
+	memcpy(out, tmp, len);
+}
+void Test_MQTT_Queue() {
+	char topic[32];
+	char value[1100];
+	int queued, slabUsed, coalesced, dropped;
+	int coalesced0, dropped0;
+	int i, j;
+
+	SIM_ClearAndPrepareForMQTTTesting("queueDev", "bekens");
+	Test_MQTT_Queue_Drain();
+	CMD_ExecuteCommand("mqtt_queueCoalesce 1", 0);
+	MQTT_GetQueueStats(&queued, &slabUsed, &coalesced0, &dropped0);
+	SELFTEST_ASSERT(slabUsed == 0);
+
+	// fast dimmer slide, only the last value stays in queue
+	for (i = 0; i <= 100; i++) {
+		sprintf(value, "%i", i);
+		MQTT_QueuePublish("queueDev", "dimmer", value, 0);
+	}
+	// more items than old queue could hold
+	for (i = 0; i < 50; i++) {
+		sprintf(topic, "chan%i", i);
+		sprintf(value, "value %i", i);
+		MQTT_QueuePublish("queueDev", topic, value, 0);
+	}
+	// replaced value is longer than first one, so it gets a new record
+	MQTT_QueuePublish("queueDev", "chan0", "much longer replacement value", 0);
+	MQTT_InvokeCommandAtEnd(PublishChannels);
+	MQTT_GetQueueStats(&queued, &slabUsed, &coalesced, &dropped);
+	SELFTEST_ASSERT(queued == 51);
+	SELFTEST_ASSERT(coalesced - coalesced0 == 101);
+	SELFTEST_ASSERT(dropped == dropped0);
+
+	SIM_ClearMQTTHistory();
+	PublishQueuedItems();
+	SELFTEST_ASSERT(Test_MQTT_Queue_Count() == 51 - MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDev/dimmer", "100", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDev/chan0", "much longer replacement value", false);
+	Test_MQTT_Queue_Drain();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDev/chan49", "value 49", false);
+	MQTT_GetQueueStats(&queued, &slabUsed, &coalesced, &dropped);
+	SELFTEST_ASSERT(slabUsed == 0);
+
+	// without coalescing every value is queued
+	CMD_ExecuteCommand("mqtt_queueCoalesce 0", 0);
+	MQTT_QueuePublish("queueDev", "dimmer", "1", 0);
+	MQTT_QueuePublish("queueDev", "dimmer", "2", 0);
+	SELFTEST_ASSERT(Test_MQTT_Queue_Count() == 2);
+	Test_MQTT_Queue_Drain();
+	CMD_ExecuteCommand("mqtt_queueCoalesce 1", 0);
+	// command replies are never coalesced, even when enabled
+	MQTT_QueuePublish("stat/queueDev", "RESULT", "{\"POWER\":\"ON\"}", OBK_PUBLISH_FLAG_FORCE_REMOVE_GET);
+	MQTT_QueuePublish("stat/queueDev", "RESULT", "{\"POWER\":\"OFF\"}", OBK_PUBLISH_FLAG_FORCE_REMOVE_GET);
+	SELFTEST_ASSERT(Test_MQTT_Queue_Count() == 2);
+	Test_MQTT_Queue_Drain();
+
+	// large values wrap around the slab many times, with some items left
+	// in queue between rounds, so these are coalesced into old records
+	for (j = 0; j < 20; j++) {
+		for (i = 0; i < 20; i++) {
+			sprintf(topic, "big%i", i);
+			Test_MQTT_Queue_BigValue(value, j, i);
+			MQTT_QueuePublish("queueDev", topic, value, 0);
+		}
+		SIM_ClearMQTTHistory();
+		PublishQueuedItems();
+		SELFTEST_ASSERT(Test_MQTT_Queue_Count() == 20 - MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE);
+		Test_MQTT_Queue_BigValue(value, j, 0);
+		SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDev/big0", value, false);
+	}
+	Test_MQTT_Queue_Drain();
+	Test_MQTT_Queue_BigValue(value, 19, 19);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("queueDev/big19", value, false);
+	MQTT_GetQueueStats(&queued, &slabUsed, &coalesced, &dropped);
+	SELFTEST_ASSERT(dropped == dropped0);
+	SELFTEST_ASSERT(slabUsed == 0);
+
+	// more than the slab can hold is dropped, rest is still fine
+	MQTT_GetQueueStats(&queued, &slabUsed, &coalesced, &dropped0);
+	for (i = 0; i < 30; i++) {
+		sprintf(topic, "huge%i", i);
+		Test_MQTT_Queue_BigValue(value, 0, i);
+		MQTT_QueuePublish("queueDev", topic, value, 0);
+	}
+	MQTT_GetQueueStats(&queued, &slabUsed, &coalesced, &dropped);
+	SELFTEST_ASSERT(queued > 10);
+	SELFTEST_ASSERT(dropped - dropped0 == 30 - queued);
+	SELFTEST_ASSERT(slabUsed <= MQTT_QUEUE_SLAB_SIZE);
+	Test_MQTT_Queue_Drain();
+	MQTT_GetQueueStats(&queued, &slabUsed, &coalesced, &dropped);
+	SELFTEST_ASSERT(slabUsed == 0);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("mqtt_queueCoalesce 0", 0);
+}
+#else
+void Test_MQTT_Queue() {
+
+}
+#endif
+
+#if ENABLE_MQTT
+static void Test_MQTT_Egress_PublishTele(int first, int count) {
+	char name[16];
+	char value[16];
+	int i;
+
+	for (i = first; i < first + count; i++) {
+		snprintf(name, sizeof(name), "T%i", i);
+		snprintf(value, sizeof(value), "%i", i);
+		MQTT_PublishTele(name, value);
+	}
+}
+void Test_MQTT_Egress() {
+	int sent, deferred, deferred0, queued, maxWait;
+	int dropped, dropped0;
+	OBK_Publish_Result res = OBK_PUBLISH_OK;
+	char name[16];
+	char *big;
+	int i;
+
+	SIM_ClearAndPrepareForMQTTTesting("egDev", "bekens");
+	Test_MQTT_Queue_Drain();
+	MQTT_GetEgressStats(MQTT_EGRESS_TELE, &sent, &deferred0, &queued, &maxWait);
+
+	// tele limited to 2 per second, rest waits in queue
+	CMD_ExecuteCommand("mqtt_egress tele 2 2", 0);
+	SIM_ClearMQTTHistory();
+	Test_MQTT_Egress_PublishTele(0, 5);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/egDev/T1", "1", false);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("tele/egDev/T2", "2", false));
+	SELFTEST_ASSERT(Test_MQTT_Queue_Count() == 3);
+	// command reply is not held back
+	MQTT_PublishStat("EGRESS", "ok");
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("stat/egDev/EGRESS", "ok", false);
+	// one more every 500 ms, in order
+	Sim_RunMiliseconds(600, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/egDev/T2", "2", false);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("tele/egDev/T3", "3", false));
+	Sim_RunMiliseconds(1000, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/egDev/T4", "4", false);
+	MQTT_GetEgressStats(MQTT_EGRESS_TELE, &sent, &deferred, &queued, &maxWait);
+	SELFTEST_ASSERT(deferred - deferred0 == 3);
+	SELFTEST_ASSERT(queued == 0);
+	SELFTEST_ASSERT(maxWait >= 1000);
+
+	// total limit, command reply overdraws it and then state goes before older tele
+	CMD_ExecuteCommand("mqtt_egress tele 0", 0);
+	CMD_ExecuteCommand("mqtt_egress total 2 2", 0);
+	SIM_ClearMQTTHistory();
+	Test_MQTT_Egress_PublishTele(5, 3);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/egDev/T6", "6", false);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("tele/egDev/T7", "7", false));
+	MQTT_PublishStat("EGRESS", "again");
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("stat/egDev/EGRESS", "again", false);
+	MQTT_PublishMain_StringString("egress", "1", 0);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("egDev/egress/get", "1", false));
+	Sim_RunMiliseconds(1100, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("egDev/egress/get", "1", false);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("tele/egDev/T7", "7", false));
+	Sim_RunMiliseconds(600, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/egDev/T7", "7", false);
+	SELFTEST_ASSERT(Test_MQTT_Queue_Count() == 0);
+
+	CMD_ExecuteCommand("mqtt_egress total 0", 0);
+
+	// deferred publish that doesn't fit into queue is reported as failed
+	CMD_ExecuteCommand("mqtt_egress tele 1 1", 0);
+	SIM_ClearMQTTHistory();
+	MQTT_GetQueueStats(&queued, &sent, &deferred, &dropped0);
+	// first one is sent at once, using the burst
+	for (i = 0; i < MQTT_MAX_QUEUE_SIZE + 2; i++) {
+		snprintf(name, sizeof(name), "F%i", i);
+		res = MQTT_PublishTele(name, "x");
+	}
+	SELFTEST_ASSERT(res == OBK_PUBLISH_MEM_FAIL);
+	MQTT_GetQueueStats(&queued, &sent, &deferred, &dropped);
+	SELFTEST_ASSERT(queued == MQTT_MAX_QUEUE_SIZE);
+	SELFTEST_ASSERT(dropped - dropped0 == 1);
+	CMD_ExecuteCommand("mqtt_egress tele 0", 0);
+	Test_MQTT_Queue_Drain();
+
+	// value too long for queue item is sent at once, not dropped
+	CMD_ExecuteCommand("mqtt_egress tele 1 1", 0);
+	MQTT_PublishTele("L0", "x");
+	SIM_ClearMQTTHistory();
+	big = malloc(MQTT_PUBLISH_ITEM_VALUE_LENGTH + 2);
+	memset(big, 'v', MQTT_PUBLISH_ITEM_VALUE_LENGTH + 1);
+	big[MQTT_PUBLISH_ITEM_VALUE_LENGTH + 1] = 0;
+	MQTT_GetQueueStats(&queued, &sent, &deferred, &dropped0);
+	SELFTEST_ASSERT(MQTT_PublishTele("L1", big) == OBK_PUBLISH_OK);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/egDev/L1", big, false);
+	MQTT_GetQueueStats(&queued, &sent, &deferred, &dropped);
+	SELFTEST_ASSERT(dropped == dropped0);
+	free(big);
+	CMD_ExecuteCommand("mqtt_egress tele 0", 0);
+	Test_MQTT_Queue_Drain();
+	SIM_ClearMQTTHistory();
+}
+#else
+void Test_MQTT_Egress() {
+
+}
+#endif
+
+#if ENABLE_MQTT
+void Test_MQTT_PublishStats() {
+	char json[MQTT_STATS_JSON_SIZE];
+	const char* tele;
+
+	SIM_ClearAndPrepareForMQTTTesting("statDev", "bekens");
+	Test_MQTT_Queue_Drain();
+	CMD_ExecuteCommand("mqtt_pubStats reset", 0);
+
+	// direct publishes are accepted and acknowledged at once by fake broker
+	MQTT_PublishMain_StringString("s1", "1", 0);
+	MQTT_PublishMain_StringString("s2", "2", 0);
+	MQTT_PublishMain_StringString("s3", "3", 0);
+	MQTT_GetPublishStatsJSON(json, sizeof(json));
+	SELFTEST_ASSERT(strstr(json, "\"accept\":{\"count\":3,\"avg\":0,\"max\":0,\"hist\":[3,0,0,0,0,0,0,0,0,0]}"));
+	SELFTEST_ASSERT(strstr(json, "\"ack\":{\"count\":3,"));
+	SELFTEST_ASSERT(strstr(json, "\"bounds\":[10,25,50,100,250,500,1000,2500,5000]"));
+
+	// queued ones are measured from the time they were queued
+	CMD_ExecuteCommand("mqtt_egress tele 2 1", 0);
+	MQTT_PublishTele("S1", "1");
+	MQTT_PublishTele("S2", "2");
+	MQTT_PublishTele("S3", "3");
+	MQTT_GetPublishStatsJSON(json, sizeof(json));
+	SELFTEST_ASSERT(strstr(json, "\"queue\":2,\"queueMax\":2,"));
+	Sim_RunMiliseconds(1100, false);
+	MQTT_GetPublishStatsJSON(json, sizeof(json));
+	SELFTEST_ASSERT(strstr(json, "\"queue\":0,\"queueMax\":2,"));
+	// one waited 500 ms, other 1000 ms, bounds are exclusive
+	SELFTEST_ASSERT(strstr(json, "\"accept\":{\"count\":6,"));
+	SELFTEST_ASSERT(strstr(json, "\"hist\":[4,0,0,0,0,0,1,1,0,0]}"));
+	CMD_ExecuteCommand("mqtt_egress tele 0", 0);
+
+	// the same is in /api/info
+	Test_FakeHTTPClientPacket_GET("api/info");
+	SELFTEST_ASSERT_HTML_REPLY_CONTAINS("\"mqttStats\":{\"published\":");
+	SELFTEST_ASSERT_HTML_REPLY_CONTAINS("\"queueMax\":2,");
+
+	// and in tele, together with Tasmota STATE
+	CFG_SetFlag(OBK_FLAG_DO_TASMOTA_TELE_PUBLISHES, true);
+	CMD_ExecuteCommand("TasTeleInterval 3 2", 0);
+	SIM_ClearMQTTHistory();
+	Sim_RunSeconds(3, false);
+	tele = SIM_GetMQTTHistoryString("tele/statDev/MQTT", false);
+	SELFTEST_ASSERT(tele != 0);
+	SELFTEST_ASSERT(strstr(tele, "\"bytesPerSec\":") != 0);
+	SELFTEST_ASSERT(strstr(tele, "\"ack\":{") != 0);
+	CFG_SetFlag(OBK_FLAG_DO_TASMOTA_TELE_PUBLISHES, false);
+	CMD_ExecuteCommand("TasTeleInterval 3 120", 0);
+	SIM_ClearMQTTHistory();
+}
+#else
+void Test_MQTT_PublishStats() {
+
+}
+#endif
+
+#if ENABLE_MQTT && ENABLE_LITTLEFS
+void Test_MQTT_Spool() {
+	char json[MQTT_STATS_JSON_SIZE];
+	char big[300];
+	char tmp[16];
+	int i;
+
+	SIM_ClearAndPrepareForMQTTTesting("spoolDev", "bekens");
+	Test_MQTT_Queue_Drain();
+	CMD_ExecuteCommand("lfs_format", 0);
+	CMD_ExecuteCommand("mqtt_spool 4096 2", 0);
+
+	// broker is gone, publishes are kept in spool
+	SIM_SetMQTTOffline(true);
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringString("temp", "20", 0);
+	MQTT_PublishMain_StringString("temp", "21", 0);
+	MQTT_PublishMain_StringString("hum", "50", 0);
+	MQTT_PublishTele("LOG", "a");
+	MQTT_PublishTele("LOG", "b");
+	MQTT_PublishTele("LOG", "c");
+	Sim_RunSeconds(2, false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("spoolDev/temp/get", false) == 0);
+	MQTT_GetPublishStatsJSON(json, sizeof(json));
+	SELFTEST_ASSERT(strstr(json, "\"records\":6,\"replayed\":0,\"superseded\":0,\"dropped\":0,\"rate\":2}"));
+
+	// back online, live value of hum makes spooled one obsolete
+	SIM_SetMQTTOffline(false);
+	MQTT_PublishMain_StringString("hum", "55", 0);
+	// 2 per second, older temp and hum are skipped
+	Sim_RunSeconds(1, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("spoolDev/temp/get", "21", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/spoolDev/LOG", "a", false);
+	SELFTEST_ASSERT(SIM_CheckMQTTHistoryForString("tele/spoolDev/LOG", "b", false) == false);
+	Sim_RunSeconds(1, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/spoolDev/LOG", "b", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/spoolDev/LOG", "c", false);
+	SELFTEST_ASSERT(SIM_CheckMQTTHistoryForString("spoolDev/temp/get", "20", false) == false);
+	SELFTEST_ASSERT(SIM_CheckMQTTHistoryForString("spoolDev/hum/get", "50", false) == false);
+	MQTT_GetPublishStatsJSON(json, sizeof(json));
+	SELFTEST_ASSERT(strstr(json, "\"spool\":{\"bytes\":0,\"records\":0,\"replayed\":4,\"superseded\":2,\"dropped\":0,"));
+
+	// superseded state records do not fill the spool, it's compacted
+	CMD_ExecuteCommand("mqtt_spool 200", 0);
+	SIM_SetMQTTOffline(true);
+	for (i = 0; i < 20; i++) {
+		snprintf(tmp, sizeof(tmp), "%i", 30 + i);
+		MQTT_PublishMain_StringString("temp", tmp, 0);
+	}
+	MQTT_PublishTele("LOG", "d");
+	MQTT_GetPublishStatsJSON(json, sizeof(json));
+	SELFTEST_ASSERT(strstr(json, "\"dropped\":0,"));
+	SIM_SetMQTTOffline(false);
+	SIM_ClearMQTTHistory();
+	Sim_RunSeconds(2, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("spoolDev/temp/get", "49", false);
+	SELFTEST_ASSERT(SIM_CheckMQTTHistoryForString("spoolDev/temp/get", "48", false) == false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/spoolDev/LOG", "d", false);
+
+	// spool is bounded, too big and over the limit are dropped
+	CMD_ExecuteCommand("mqtt_spool 100", 0);
+	SIM_SetMQTTOffline(true);
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = 0;
+	MQTT_PublishMain_StringString("big", big, 0);
+	MQTT_PublishMain_StringString("t1", "1", 0);
+	MQTT_PublishMain_StringString("t2", "2", 0);
+	MQTT_PublishMain_StringString("t3", "3", 0);
+	MQTT_PublishMain_StringString("t4", "4", 0);
+	MQTT_GetPublishStatsJSON(json, sizeof(json));
+	SELFTEST_ASSERT(strstr(json, "\"records\":3,"));
+	SELFTEST_ASSERT(strstr(json, "\"dropped\":2,"));
+	SIM_SetMQTTOffline(false);
+	Sim_RunSeconds(2, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("spoolDev/t3/get", "3", false);
+
+	CMD_ExecuteCommand("mqtt_spool 0", 0);
+	MQTT_GetPublishStatsJSON(json, sizeof(json));
+	SELFTEST_ASSERT(strstr(json, "\"spool\":") == 0);
+	SIM_ClearMQTTHistory();
+}
+#else
+void Test_MQTT_Spool() {
+
+}
+#endif
+
+#if ENABLE_MQTT
+static void Test_MQTT_SetBrokerOnline(bool bOnline) {
+	SIM_SetMQTTOffline(!bOnline);
+	MQTT_SimulateConnectionStatus(bOnline ? MQTT_CONNECT_ACCEPTED : MQTT_CONNECT_DISCONNECTED);
+}
+static int Test_MQTT_GetConnectAttempts() {
+	int attempts, lastMS, maxMS, reconciled, dnsHits;
+
+	MQTT_GetReconnectStats(&attempts, &lastMS, &maxMS, &reconciled, &dnsHits);
+	return attempts;
+}
+void Test_MQTT_FastReconnect() {
+	int attempts, lastMS, maxMS, reconciled, dnsHits;
+	int doubleTakes;
+
+	SIM_ClearAndPrepareForMQTTTesting("fastDev", "bekens");
+	Test_MQTT_Queue_Drain();
+	doubleTakes = SIM_GetSemaphoreDoubleTakes();
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	PIN_SetPinRoleForPinIndex(10, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(10, 2);
+	CMD_ExecuteCommand("mqtt_fastReconnect 1 200 800", 0);
+	// simulator without SSID opens AP after a few seconds, get WiFi back after that
+	Sim_RunSeconds(6, false);
+	Main_OnWiFiStatusChange(WIFI_STA_CONNECTED);
+
+	// first connect, broker gets both channels
+	Test_MQTT_SetBrokerOnline(true);
+	Sim_RunSeconds(1, false);
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	CMD_ExecuteCommand("setChannel 2 1", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("fastDev/2/get", "1", false);
+
+	// lost connection is retried at once
+	attempts = Test_MQTT_GetConnectAttempts();
+	Test_MQTT_SetBrokerOnline(false);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(Test_MQTT_GetConnectAttempts() == attempts + 1);
+	// then after 200, 400 and 800 ms, each +-25%
+	MQTT_SimulateConnectionStatus(MQTT_CONNECT_TIMEOUT);
+	Sim_RunMiliseconds(140, false);
+	SELFTEST_ASSERT(Test_MQTT_GetConnectAttempts() == attempts + 1);
+	Sim_RunMiliseconds(120, false);
+	SELFTEST_ASSERT(Test_MQTT_GetConnectAttempts() == attempts + 2);
+	MQTT_SimulateConnectionStatus(MQTT_CONNECT_TIMEOUT);
+	Sim_RunMiliseconds(290, false);
+	SELFTEST_ASSERT(Test_MQTT_GetConnectAttempts() == attempts + 2);
+	Sim_RunMiliseconds(220, false);
+	SELFTEST_ASSERT(Test_MQTT_GetConnectAttempts() == attempts + 3);
+	MQTT_SimulateConnectionStatus(MQTT_CONNECT_TIMEOUT);
+	Sim_RunMiliseconds(590, false);
+	SELFTEST_ASSERT(Test_MQTT_GetConnectAttempts() == attempts + 3);
+	Sim_RunMiliseconds(420, false);
+	SELFTEST_ASSERT(Test_MQTT_GetConnectAttempts() == attempts + 4);
+	// no more than max
+	MQTT_SimulateConnectionStatus(MQTT_CONNECT_TIMEOUT);
+	Sim_RunMiliseconds(1210, false);
+	SELFTEST_ASSERT(Test_MQTT_GetConnectAttempts() == attempts + 5);
+
+	// channel 2 changes while offline
+	CMD_ExecuteCommand("setChannel 2 0", 0);
+	SIM_ClearMQTTHistory();
+	Test_MQTT_SetBrokerOnline(true);
+	Sim_RunSeconds(1, false);
+	// only what broker has not acknowledged is sent again
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("fastDev/2/get", "0", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("fastDev/1/get", false) == 0);
+	MQTT_GetReconnectStats(&attempts, &lastMS, &maxMS, &reconciled, &dnsHits);
+	SELFTEST_ASSERT(reconciled == 1);
+	SELFTEST_ASSERT(lastMS >= 3000 && lastMS < 3100);
+	// reconcile publishes must not take MQTT mutex that is already taken
+	SELFTEST_ASSERT(SIM_GetSemaphoreDoubleTakes() == doubleTakes);
+
+	CMD_ExecuteCommand("mqtt_fastReconnect 0", 0);
+	Main_OnWiFiStatusChange(WIFI_STA_DISCONNECTED);
+	SIM_ClearMQTTHistory();
+}
+#else
+void Test_MQTT_FastReconnect() {
+
+}
+#endif
+
+#if ENABLE_MQTT
+static int Test_MQTT_GetDnsCacheHits() {
+	int attempts, lastMS, maxMS, reconciled, dnsHits;
+
+	MQTT_GetReconnectStats(&attempts, &lastMS, &maxMS, &reconciled, &dnsHits);
+	return dnsHits;
+}
+void Test_MQTT_DnsCache() {
+	int hits;
+
+	SIM_ClearAndPrepareForMQTTTesting("dnsDev", "bekens");
+	CFG_SetMQTTHost("127.0.0.1");
+	CMD_ExecuteCommand("mqtt_fastReconnect 1 200 800", 0);
+	Sim_RunSeconds(6, false);
+	Main_OnWiFiStatusChange(WIFI_STA_CONNECTED);
+	Test_MQTT_SetBrokerOnline(true);
+	Sim_RunSeconds(1, false);
+
+	// first attempt after lost session resolves host and remembers it
+	Test_MQTT_SetBrokerOnline(false);
+	MQTT_SimulateConnectionStatus(MQTT_CONNECT_TIMEOUT);
+	hits = Test_MQTT_GetDnsCacheHits();
+	Sim_RunMiliseconds(300, false);
+	SELFTEST_ASSERT(Test_MQTT_GetDnsCacheHits() == hits);
+	// session is up again and lost, next attempt does not ask DNS
+	Test_MQTT_SetBrokerOnline(true);
+	Sim_RunFrames(1, false);
+	Test_MQTT_SetBrokerOnline(false);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(Test_MQTT_GetDnsCacheHits() == hits + 1);
+	// failed connect forgets address, broker may have moved
+	MQTT_SimulateConnectionStatus(MQTT_CONNECT_TIMEOUT);
+	Sim_RunMiliseconds(300, false);
+	SELFTEST_ASSERT(Test_MQTT_GetDnsCacheHits() == hits + 1);
+
+	Test_MQTT_SetBrokerOnline(true);
+	Sim_RunSeconds(1, false);
+	CFG_SetMQTTHost("");
+	CMD_ExecuteCommand("mqtt_fastReconnect 0", 0);
+	Main_OnWiFiStatusChange(WIFI_STA_DISCONNECTED);
+	SIM_ClearMQTTHistory();
+}
+#else
+void Test_MQTT_DnsCache() {
+
+}
+#endif
+
+#if ENABLE_MQTT && MQTT_TLS_OPTIONS
+// simulator has no mbedtls, test reports handshakes like TLS glue does
+void Test_MQTT_Tls() {
+	int handshakes, resumed;
+
+	SIM_ClearAndPrepareForMQTTTesting("tlsDev", "bekens");
+
+	// PSK
+	CMD_ExecuteCommand("mqtt_tlsPsk tlsDev 0123456789abcdef0123456789abcdef", 0);
+	SELFTEST_ASSERT(MQTT_TLS_IsPskSet());
+	SELFTEST_ASSERT(MQTT_TLS_NeedsNewConfig());
+	MQTT_TLS_OnConfigCreated();
+	SELFTEST_ASSERT(MQTT_TLS_NeedsNewConfig() == false);
+	// odd length or longer than 32 bytes is rejected, old key is kept
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_tlsPsk tlsDev 012", 0) == CMD_RES_BAD_ARGUMENT);
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_tlsPsk tlsDev "
+		"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef00", 0) == CMD_RES_BAD_ARGUMENT);
+	SELFTEST_ASSERT(MQTT_TLS_IsPskSet());
+	SELFTEST_ASSERT(MQTT_TLS_NeedsNewConfig() == false);
+	CMD_ExecuteCommand("mqtt_tlsPsk", 0);
+	SELFTEST_ASSERT(MQTT_TLS_IsPskSet() == false);
+	SELFTEST_ASSERT(MQTT_TLS_NeedsNewConfig());
+
+	// session resumption
+	CMD_ExecuteCommand("mqtt_tls 1 0", 0);
+	MQTT_TLS_OnConfigCreated();
+	MQTT_TLS_GetStats(&handshakes, &resumed);
+	SELFTEST_ASSERT(MQTT_TLS_ShouldResume() == false);
+	MQTT_TLS_OnHandshakeStarted();
+	MQTT_TLS_OnHandshakeDone(false, true);
+	SELFTEST_ASSERT(MQTT_TLS_ShouldResume());
+	MQTT_TLS_OnHandshakeStarted();
+	MQTT_TLS_OnHandshakeDone(true, true);
+	SELFTEST_ASSERT(MQTT_TLS_ShouldResume());
+	MQTT_TLS_GetStats(&handshakes, &resumed);
+	SELFTEST_ASSERT(handshakes == 2);
+	SELFTEST_ASSERT(resumed == 1);
+	// failure without handshake running changes nothing
+	MQTT_TLS_OnHandshakeFailed();
+	SELFTEST_ASSERT(MQTT_TLS_ShouldResume());
+	// broker did not like the session, it's not offered again
+	MQTT_TLS_OnHandshakeStarted();
+	MQTT_TLS_OnHandshakeFailed();
+	SELFTEST_ASSERT(MQTT_TLS_ShouldResume() == false);
+	SELFTEST_ASSERT(MQTT_TLS_NeedsNewConfig() == false);
+	// new config drops session of old one
+	MQTT_TLS_OnHandshakeStarted();
+	MQTT_TLS_OnHandshakeDone(false, true);
+	CMD_ExecuteCommand("mqtt_tls 1 0", 0);
+	SELFTEST_ASSERT(MQTT_TLS_NeedsNewConfig());
+	MQTT_TLS_OnConfigCreated();
+	SELFTEST_ASSERT(MQTT_TLS_ShouldResume() == false);
+	// with resume off, session is not offered
+	CMD_ExecuteCommand("mqtt_tls 0", 0);
+	MQTT_TLS_OnConfigCreated();
+	MQTT_TLS_OnHandshakeStarted();
+	MQTT_TLS_OnHandshakeDone(false, false);
+	SELFTEST_ASSERT(MQTT_TLS_ShouldResume() == false);
+
+	// max fragment length is not set below output buffer
+	CMD_ExecuteCommand("mqtt_tls 1 512", 0);
+	SELFTEST_ASSERT(MQTT_TLS_GetMaxFragLen() >= 512);
+	SELFTEST_ASSERT(MQTT_TLS_GetMaxFragLen() >= MQTT_OUTPUT_RINGBUF_SIZE || MQTT_TLS_GetMaxFragLen() == 4096);
+	MQTT_TLS_OnConfigCreated();
+	// broker refuses it, next attempt is without it
+	MQTT_TLS_OnHandshakeStarted();
+	MQTT_TLS_OnHandshakeFailed();
+	SELFTEST_ASSERT(MQTT_TLS_NeedsNewConfig());
+	SELFTEST_ASSERT(MQTT_TLS_GetMaxFragLen() == 0);
+	MQTT_TLS_OnConfigCreated();
+	// that one works, so it stays off
+	MQTT_TLS_OnHandshakeStarted();
+	MQTT_TLS_OnHandshakeDone(false, true);
+	SELFTEST_ASSERT(MQTT_TLS_GetMaxFragLen() == 0);
+	MQTT_TLS_OnHandshakeStarted();
+	MQTT_TLS_OnHandshakeFailed();
+	SELFTEST_ASSERT(MQTT_TLS_GetMaxFragLen() == 0);
+	SELFTEST_ASSERT(MQTT_TLS_NeedsNewConfig() == false);
+	// until set again
+	CMD_ExecuteCommand("mqtt_tls 1 4096", 0);
+	SELFTEST_ASSERT(MQTT_TLS_GetMaxFragLen() == 4096);
+	MQTT_TLS_OnConfigCreated();
+	// failure that was not caused by it, attempt without it fails too, so it's asked for again
+	MQTT_TLS_OnHandshakeStarted();
+	MQTT_TLS_OnHandshakeFailed();
+	SELFTEST_ASSERT(MQTT_TLS_GetMaxFragLen() == 0);
+	MQTT_TLS_OnConfigCreated();
+	MQTT_TLS_OnHandshakeStarted();
+	MQTT_TLS_OnHandshakeFailed();
+	SELFTEST_ASSERT(MQTT_TLS_NeedsNewConfig());
+	SELFTEST_ASSERT(MQTT_TLS_GetMaxFragLen() == 4096);
+
+	CMD_ExecuteCommand("mqtt_tls 1 0", 0);
+	MQTT_TLS_OnConfigCreated();
+}
+#else
+void Test_MQTT_Tls() {
+
+}
+#endif
+
+void Test_MQTT_ChannelBatch() {
+	SIM_ClearOBK(0);
+	SIM_ClearAndPrepareForMQTTTesting("batchDev", "bekens");
+
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	PIN_SetPinRoleForPinIndex(10, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(10, 2);
+	PIN_SetPinRoleForPinIndex(11, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(11, 3);
+	// count change events in channel 10
+	CMD_ExecuteCommand("addEventHandler OnChannelChange 1 addChannel 10 1", 0);
+	CMD_ExecuteCommand("addEventHandler OnChannelChange 2 addChannel 10 1", 0);
+	CMD_ExecuteCommand("addEventHandler OnChannelChange 3 addChannel 10 1", 0);
+	SIM_ClearMQTTHistory();
+
+	CMD_ExecuteCommand("BeginChannelBatch", 0);
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	CMD_ExecuteCommand("setChannel 2 1", 0);
+	// nested batch, inner commit does nothing
+	CMD_ExecuteCommand("BeginChannelBatch", 0);
+	CMD_ExecuteCommand("setChannel 3 1", 0);
+	CMD_ExecuteCommand("CommitChannelBatch", 0);
+	// net change of channel 2 is zero
+	CMD_ExecuteCommand("setChannel 2 0", 0);
+	// pins follow at once
+	SELFTEST_ASSERT_PIN_BOOLEAN(9, true);
+	SELFTEST_ASSERT_PIN_BOOLEAN(10, false);
+	SELFTEST_ASSERT_PIN_BOOLEAN(11, true);
+	// but nothing was published and no event was fired
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("batchDev/1/get", false) == 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("batchDev/3/get", false) == 0);
+	SELFTEST_ASSERT_CHANNEL(10, 0);
+	SELFTEST_ASSERT(CHANNEL_IsBatchActive());
+
+	CMD_ExecuteCommand("CommitChannelBatch", 0);
+	SELFTEST_ASSERT(CHANNEL_IsBatchActive() == false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDev/1/get", "1", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDev/3/get", "1", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("batchDev/2/get", false) == 0);
+	// one event for channel 1 and one for channel 3
+	SELFTEST_ASSERT_CHANNEL(10, 2);
+	// commit without batch is an error
+	SELFTEST_ASSERT(CMD_ExecuteCommand("CommitChannelBatch", 0) == CMD_RES_ERROR);
+
+	// SetAll is batched too
+	SIM_ClearMQTTHistory();
+	CHANNEL_SetAll(0, 0);
+	SELFTEST_ASSERT_PIN_BOOLEAN(9, false);
+	SELFTEST_ASSERT_PIN_BOOLEAN(11, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDev/1/get", "0", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDev/3/get", "0", false);
+	SELFTEST_ASSERT_CHANNEL(10, 4);
+
+	// batch that is never committed is flushed after timeout
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("BeginChannelBatch", 0);
+	CMD_ExecuteCommand("setChannel 2 1", 0);
+	SELFTEST_ASSERT_PIN_BOOLEAN(10, true);
+	Sim_RunSeconds(CHANNEL_BATCH_TIMEOUT_SECONDS - 2, false);
+	SELFTEST_ASSERT(CHANNEL_IsBatchActive());
+	Sim_RunSeconds(3, false);
+	SELFTEST_ASSERT(CHANNEL_IsBatchActive() == false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDev/2/get", "1", false);
+	SELFTEST_ASSERT_CHANNEL(10, 5);
+
+	// batch opened by change handler during commit is flushed too
+	CMD_ExecuteCommand("addEventHandler OnChannelChange 4 addChannel 10 1", 0);
+	CMD_ExecuteCommand("addEventHandler OnChannelChange 1 backlog BeginChannelBatch; setChannel 4 1; CommitChannelBatch", 0);
+	CMD_ExecuteCommand("BeginChannelBatch", 0);
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	CMD_ExecuteCommand("setChannel 3 1", 0);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("CommitChannelBatch", 0);
+	SELFTEST_ASSERT_CHANNEL(4, 1);
+	// channel 3 is not lost by batch of handler
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("batchDev/3/get", "1", false);
+	// events for channels 1, 3 and 4
+	SELFTEST_ASSERT_CHANNEL(10, 8);
+	SELFTEST_ASSERT(CHANNEL_IsBatchActive() == false);
+}
+
 void Test_MQTT(){
 	Test_MQTT_Misc();
 	Test_MQTT_Get_And_Reply();
@@ -743,6 +1732,18 @@ void Test_MQTT(){
 	Test_MQTT_Topic_With_Slash();
 	Test_MQTT_Topic_With_Slashes();
 	Test_MQTT_Average();
+	Test_MQTT_Queue();
+	Test_MQTT_Callbacks();
+	Test_MQTT_ReceiveBurst();
+	Test_MQTT_Dedup();
+	Test_MQTT_StateJSON();
+	Test_MQTT_Egress();
+	Test_MQTT_PublishStats();
+	Test_MQTT_Spool();
+	Test_MQTT_FastReconnect();
+	Test_MQTT_DnsCache();
+	Test_MQTT_Tls();
+	Test_MQTT_ChannelBatch();
 }
 
 #endif
@@ -84,6 +84,28 @@ void Test_MultiplePinsOnChannel() {
 	SELFTEST_ASSERT_PIN_BOOLEAN(PIN_LED_n, false);
 	SELFTEST_ASSERT_PIN_BOOLEAN(PIN_RELAY, true);
 	SELFTEST_ASSERT_PIN_BOOLEAN(PIN_RELAY_n, false);
+
+	// move relay to other channel and remove inverted relay,
+	// channel 1 must not drive them anymore
+	PIN_SetPinChannelForPinIndex(PIN_RELAY, 2);
+	PIN_SetPinRoleForPinIndex(PIN_RELAY_n, IOR_None);
+	SELFTEST_ASSERT(PIN_CountPinsWithRole(IOR_Relay) == 1);
+	SELFTEST_ASSERT(PIN_CountPinsWithRole(IOR_Relay_n) == 0);
+	SELFTEST_ASSERT(PIN_FindPinIndexForRole(IOR_Relay, -1) == PIN_RELAY);
+	SELFTEST_ASSERT(h_isChannelRelay(1));
+	SELFTEST_ASSERT(h_isChannelRelay(2));
+	SELFTEST_ASSERT(CHANNEL_IsPowerRelayChannel(1) == false);
+	SELFTEST_ASSERT(CHANNEL_ShouldBePublished(2));
+	CMD_ExecuteCommand("setChannel 1 0", 0);
+	SELFTEST_ASSERT_PIN_BOOLEAN(PIN_LED_n, true);
+	SELFTEST_ASSERT_PIN_BOOLEAN(PIN_RELAY, true);
+	SELFTEST_ASSERT_PIN_BOOLEAN(PIN_RELAY_n, false);
+	CMD_ExecuteCommand("setChannel 2 1", 0);
+	CMD_ExecuteCommand("setChannel 2 0", 0);
+	SELFTEST_ASSERT_PIN_BOOLEAN(PIN_RELAY, false);
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	SELFTEST_ASSERT_PIN_BOOLEAN(PIN_LED_n, false);
+	SELFTEST_ASSERT_PIN_BOOLEAN(PIN_RELAY, false);
 }
 
 
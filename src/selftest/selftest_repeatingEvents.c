@@ -2,6 +2,55 @@
 
 #include "selftest_local.h"
 
+void Test_RepeatingEvents_Deadlines() {
+	int i;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetNextFireMS(), -1);
+
+	// interval is not a multiple of tick, but deadlines must not drift
+	CMD_ExecuteCommand("addRepeatingEvent 0.3 -1 addChannel 12 1", 0);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetNextFireMS(), 300);
+	for (i = 0; i < 4286; i++) {
+		RepeatingEvents_RunUpdate(7);
+	}
+	SELFTEST_ASSERT_CHANNEL(12, 100);
+
+	// next fire time is the earliest deadline
+	CMD_ExecuteCommand("addRepeatingEventID 5 -1 50 addChannel 13 1", 0);
+	CMD_ExecuteCommand("addRepeatingEventID 0.1 -1 51 addChannel 14 1", 0);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetActiveCount(), 3);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetNextFireMS(), 100);
+	CMD_ExecuteCommand("cancelRepeatingEvent 51", 0);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetActiveCount(), 2);
+	SELFTEST_ASSERT(RepeatingEvents_GetNextFireMS() <= 300);
+	CMD_ExecuteCommand("cancelRepeatingEvent 255", 0);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetNextFireMS(), 5000);
+	// cancelled slots are reused
+	CMD_ExecuteCommand("addRepeatingEventID 0.1 2 52 addChannel 14 1", 0);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetActiveCount(), 2);
+	for (i = 0; i < 100; i++) {
+		RepeatingEvents_RunUpdate(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(14, 2);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetActiveCount(), 1);
+
+	// big freeze fires event once, not once per missed interval
+	RepeatingEvents_RunUpdate(60000);
+	SELFTEST_ASSERT_CHANNEL(13, 1);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetNextFireMS(), 5000);
+
+	// event can cancel itself, or clear everything, from its own command
+	CMD_ExecuteCommand("addRepeatingEventID 1 -1 60 backlog addChannel 15 1; cancelRepeatingEvent 60", 0);
+	Sim_RunSeconds(4.0f, false);
+	SELFTEST_ASSERT_CHANNEL(15, 1);
+	CMD_ExecuteCommand("addRepeatingEvent 1 -1 backlog addChannel 16 1; clearRepeatingEvents", 0);
+	Sim_RunSeconds(4.0f, false);
+	SELFTEST_ASSERT_CHANNEL(16, 1);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetActiveCount(), 0);
+	SELFTEST_ASSERT_INTEGER(RepeatingEvents_GetNextFireMS(), -1);
+}
 void Test_RepeatingEvents() {
 	// reset whole device
 	SIM_ClearOBK(0);
@@ -20,6 +69,8 @@ void Test_RepeatingEvents() {
 	SELFTEST_ASSERT_CHANNEL(11, 2);
 	Sim_RunSeconds(6.0f, false);
 	SELFTEST_ASSERT_CHANNEL(11, 2);
+
+	Test_RepeatingEvents_Deadlines();
 }
 
 
@@ -58,6 +58,23 @@ const char *demo_startScript =
 "    return\r\n";
 
 
+const char *demo_comments_and_labels =
+"// comment at start\r\n"
+"\r\n"
+"setChannel 12 0\r\n"
+"   // indented comment\r\n"
+"goto second\r\n"
+"first:\r\n"
+"    addChannel 12 100\r\n"
+"    goto done\r\n"
+"second:   \r\n"
+"\t\r\n"
+"    addChannel 12 5   \r\n"
+"    goto first\r\n"
+"done:\r\n"
+"    goto missingLabel\r\n"
+"    setChannel 12 666\r\n";
+
 const char *demo_waiting_for_smth =
 "setChannel 20 0\r\n"
 "setChannel 21 0\r\n"
@@ -272,6 +289,89 @@ void Test_Scripting_ClickEventAndBacklog() {
 	}
 
 }
+void Test_Scripting_CommentsAndLabels() {
+	// reset whole device
+	SIM_ClearOBK(0);
+	CMD_ExecuteCommand("lfs_format", 0);
+
+	Test_FakeHTTPClientPacket_POST("api/lfs/labels.txt", demo_comments_and_labels);
+
+	CMD_ExecuteCommand("startScript labels.txt", 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 1);
+	Sim_RunFrames(5, false);
+	// missing label ends the thread, so last line is never reached
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_CHANNEL(12, 105);
+
+	// start directly at label
+	CMD_ExecuteCommand("startScript labels.txt first", 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_CHANNEL(12, 205);
+}
+const char *demo_sleepers =
+"again:\r\n"
+"    addChannel 10 1\r\n"
+"    delay_ms 100\r\n"
+"    goto again\r\n";
+
+void Test_Scripting_Scheduler() {
+	int wakeups, late, maxLate, budgetHits;
+	int wakeups2, late2, maxLate2, budgetHits2;
+	int i;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+	CMD_ExecuteCommand("lfs_format", 0);
+
+	Test_FakeHTTPClientPacket_POST("api/lfs/sleepers.txt", demo_sleepers);
+
+	// many threads that mostly sleep
+	for (i = 0; i < 15; i++) {
+		CMD_ExecuteCommand("startScript sleepers.txt * 1", 0);
+	}
+	CMD_ExecuteCommand("startScript sleepers.txt * 2", 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 16);
+	SVM_GetSchedulerStats(&wakeups, &late, &maxLate, &budgetHits);
+
+	// each thread runs at 5, 105, ..., 905 ms
+	for (i = 0; i < 200; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(10, 16 * 10);
+	SVM_GetSchedulerStats(&wakeups2, &late2, &maxLate2, &budgetHits2);
+	SELFTEST_ASSERT_INTEGER(wakeups2 - wakeups, 16 * 9);
+	SELFTEST_ASSERT_INTEGER(late2 - late, 0);
+
+	// sleeping thread is removed from the schedule when stopped
+	CMD_ExecuteCommand("stopScript 2", 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 15);
+	for (i = 0; i < 20; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(10, 16 * 10 + 15);
+
+	// a long freeze makes every wakeup late
+	SVM_GetSchedulerStats(&wakeups, &late, &maxLate, &budgetHits);
+	SVM_RunThreads(1000);
+	SELFTEST_ASSERT_CHANNEL(10, 16 * 10 + 15 + 15);
+	SVM_GetSchedulerStats(&wakeups2, &late2, &maxLate2, &budgetHits2);
+	SELFTEST_ASSERT_INTEGER(wakeups2 - wakeups, 15);
+	SELFTEST_ASSERT_INTEGER(late2 - late, 15);
+	SELFTEST_ASSERT(maxLate2 >= 900);
+
+	// stopped thread slot is reused and scheduled again
+	CMD_ExecuteCommand("stopAllScripts", 0);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	CMD_ExecuteCommand("setChannel 10 0", 0);
+	CMD_ExecuteCommand("startScript sleepers.txt * 3", 0);
+	for (i = 0; i < 40; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(10, 2);
+	CMD_ExecuteCommand("scriptStats", 0);
+	CMD_ExecuteCommand("setScriptBudget 10", 0);
+}
 void Test_Scripting() {
 	Test_Scripting_Loop1();
 	Test_Scripting_Loop2();
@@ -280,6 +380,8 @@ void Test_Scripting() {
 	Test_Scripting_StartScript();
 	Test_Scripting_WaitingForSmth();
 	Test_Scripting_ClickEventAndBacklog();
+	Test_Scripting_CommentsAndLabels();
+	Test_Scripting_Scheduler();
 }
 
 #endif
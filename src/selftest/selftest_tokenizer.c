@@ -2,6 +2,63 @@
 
 #include "selftest_local.h"
 
+static int g_nestedResult;
+static tokenizer_t *g_nestedContext;
+// tokenizes own args, runs nested command and checks that own args survived
+static commandResult_t Test_NestedTokenizerCommand(const void *context, const char *cmd, const char *args, int cmdFlags) {
+	Tokenizer_TokenizeString(args, 0);
+	g_nestedContext = Tokenizer_GetCurrentContext();
+	CMD_ExecuteCommand("setChannel 3 $CH2", 0);
+	g_nestedResult = 0;
+	if (Tokenizer_GetArgsCount() == 3 && !strcmp(Tokenizer_GetArg(0), "first")
+		&& Tokenizer_GetArgInteger(2) == 33) {
+		g_nestedResult = 1;
+	}
+	return CMD_RES_OK;
+}
+static void Test_Tokenizer_Contexts() {
+	tokenizer_t *a;
+	tokenizer_t *b;
+
+	SIM_ClearOBK(0);
+	CMD_RegisterCommand("testNestedTokenizer", Test_NestedTokenizerCommand, NULL);
+	CMD_ExecuteCommand("setChannel 2 15", 0);
+	g_nestedResult = -1;
+	CMD_ExecuteCommand("testNestedTokenizer first second 33", 0);
+	SELFTEST_ASSERT(g_nestedResult == 1);
+	SELFTEST_ASSERT_CHANNEL(3, 15);
+	// also when nested one level deeper
+	g_nestedResult = -1;
+	CMD_ExecuteCommand("backlog setChannel 4 1; testNestedTokenizer first x 33; setChannel 5 2", 0);
+	SELFTEST_ASSERT(g_nestedResult == 1);
+	SELFTEST_ASSERT_CHANNEL(5, 2);
+	// nested level had its own context, back to static one after outermost command
+	SELFTEST_ASSERT(g_nestedContext != Tokenizer_GetCurrentContext());
+
+	// explicit contexts are independent from each other and from the implicit one
+	a = malloc(sizeof(tokenizer_t));
+	b = malloc(sizeof(tokenizer_t));
+	TokenizerCtx_TokenizeString(a, "one two $CH2", 0);
+	TokenizerCtx_TokenizeString(b, "\"quoted arg\" 5*2", TOKENIZER_ALLOW_QUOTES);
+	Tokenizer_TokenizeString("other", 0);
+	SELFTEST_ASSERT(TokenizerCtx_GetArgsCount(a) == 3);
+	SELFTEST_ASSERT_STRING(TokenizerCtx_GetArg(a, 1), "two");
+	SELFTEST_ASSERT_STRING(TokenizerCtx_GetArg(a, 2), "15");
+	SELFTEST_ASSERT(TokenizerCtx_GetArgInteger(a, 2) == 15);
+	SELFTEST_ASSERT_STRING(TokenizerCtx_GetArgFrom(a, 1), "two $CH2");
+	SELFTEST_ASSERT(TokenizerCtx_GetArgsCount(b) == 2);
+	SELFTEST_ASSERT_STRING(TokenizerCtx_GetArg(b, 0), "quoted arg");
+	SELFTEST_ASSERT(TokenizerCtx_GetArgInteger(b, 1) == 10);
+	// out of range args are not read from previous tokenization
+	SELFTEST_ASSERT(TokenizerCtx_GetArg(b, 2) == 0);
+	SELFTEST_ASSERT(TokenizerCtx_GetArgInteger(b, 2) == 0);
+	SELFTEST_ASSERT(TokenizerCtx_GetArgIntegerDefault(b, 2, 7) == 7);
+	SELFTEST_ASSERT_ARGUMENTS_COUNT(1);
+	SELFTEST_ASSERT_ARGUMENT(0, "other");
+	free(a);
+	free(b);
+}
+
 void Test_Tokenizer() {
 	// reset whole device
 	SIM_ClearOBK(0);
@@ -135,6 +192,8 @@ void Test_Tokenizer() {
 	SELFTEST_ASSERT_ARGUMENT(2, "level=77");
 	SELFTEST_ASSERT_ARGUMENT(3, "0");
 	SELFTEST_ASSERT_STRING(Tokenizer_GetArgFrom(2), "level=$CH5 $CH6")
+
+	Test_Tokenizer_Contexts();
 }
 
 #endif
@@ -417,6 +417,84 @@ void Test_WaitFor_ChannelValue() {
 	SELFTEST_ASSERT_CHANNEL(1, 123);
 	SELFTEST_ASSERT_CHANNEL(2, 234);
 }
+void Test_WaitFor_ManyThreads() {
+	int i;
+
+	// reset whole device
+	SIM_ClearOBK(0);
+
+	Test_FakeHTTPClientPacket_POST("api/lfs/testScript.txt",
+		"mqtt:\n"
+		"waitFor MQTTState 1\n"
+		"addChannel 1 1\n"
+		"goto done\n"
+		"ping:\n"
+		"waitFor NoPingTime > 10\n"
+		"addChannel 2 1\n"
+		"goto done\n"
+		"channel:\n"
+		"waitFor Channel5 ! 0\n"
+		"addChannel 3 1\n"
+		"done:\n");
+
+	// many parallel threads, each parked on its event
+	for (i = 0; i < 10; i++) {
+		CMD_ExecuteCommand("startScript testScript.txt mqtt 11", 0);
+		CMD_ExecuteCommand("startScript testScript.txt ping 12", 0);
+		CMD_ExecuteCommand("startScript testScript.txt channel 13", 0);
+	}
+	for (i = 0; i < 5; i++) {
+		SVM_RunThreads(5);
+	}
+	// unrelated events and non-matching arguments wake nobody
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_MQTT_STATE, 0);
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME, 10);
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_CHANGE_CHANNEL0 + 4, 1);
+	for (i = 0; i < 5; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(1, 0);
+	SELFTEST_ASSERT_CHANNEL(2, 0);
+	SELFTEST_ASSERT_CHANNEL(3, 0);
+
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME, 11);
+	for (i = 0; i < 5; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(1, 0);
+	SELFTEST_ASSERT_CHANNEL(2, 10);
+	SELFTEST_ASSERT_CHANNEL(3, 0);
+	// woken threads are no longer on the list
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_CHANGE_NOPINGTIME, 12);
+	for (i = 0; i < 5; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(2, 10);
+
+	// stopped threads must not stay parked, and their slots must be usable again
+	CMD_ExecuteCommand("stopScript 11", 0);
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_MQTT_STATE, 1);
+	for (i = 0; i < 5; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(1, 0);
+	CMD_ExecuteCommand("startScript testScript.txt mqtt 11", 0);
+	for (i = 0; i < 5; i++) {
+		SVM_RunThreads(5);
+	}
+	CMD_Script_ProcessWaitersForEvent(CMD_EVENT_MQTT_STATE, 1);
+	for (i = 0; i < 5; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(1, 1);
+
+	CMD_ExecuteCommand("setChannel 5 1", 0);
+	for (i = 0; i < 5; i++) {
+		SVM_RunThreads(5);
+	}
+	SELFTEST_ASSERT_CHANNEL(3, 10);
+}
+
 void Test_WaitFor() {
 	Test_WaitFor_MQTTState();
 	Test_WaitFor_NoPingTime();
@@ -427,6 +505,7 @@ void Test_WaitFor() {
 	Test_WaitFor_OperatorLess2();
 	Test_WaitFor_OperatorNotEqual();
 	Test_WaitFor_ChannelValue();
+	Test_WaitFor_ManyThreads();
 }
 
 #endif
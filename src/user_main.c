@@ -588,6 +588,7 @@ void Main_OnEverySecond()
 		}
 	}
 #endif
+	CHANNEL_CheckBatchTimeout();
 	if (g_newWiFiStatus != g_prevWiFiStatus) {
 		g_prevWiFiStatus = g_newWiFiStatus;
 		// Argument type here is HALWifiStatus_t enumeration
@@ -605,6 +606,7 @@ void Main_OnEverySecond()
 	g_noMQTTTime = i;
 
 
+	LOG_RunEverySecond();
 #if ENABLE_MQTT
 	MQTT_Dedup_Tick();
 #endif
@@ -945,7 +947,7 @@ void QuickTick(void* param)
 	extern void Berry_RunThreads(int deltaMS);
 	Berry_RunThreads(g_deltaTimeMS);
 #endif
-	RepeatingEvents_RunUpdate(g_deltaTimeMS * 0.001f);
+	RepeatingEvents_RunUpdate(g_deltaTimeMS);
 #ifndef OBK_DISABLE_ALL_DRIVERS
 	DRV_RunQuickTick();
 #endif
@@ -1268,6 +1270,7 @@ void Main_Init_Before_Delay()
 	ADDLOGF_INFO("%s", __func__);
 	// read or initialise the boot count flash area
 	HAL_FlashVars_IncreaseBootCount();
+	CHANNEL_InitBatch();
 
 #if defined(PLATFORM_BEKEN)
 	// this just increments our idle counter variable.
@@ -7,6 +7,7 @@
  * and only one cipher enabled:
  * TSL VERSION: TLSv1.2
  * TSL CIPHER : TLS-ECDHE-RSA-WITH-AES-128-GCM-SHA256
+ * (and TLS-PSK-WITH-AES-128-GCM-SHA256, if PSK is set by mqtt_tlsPsk)
  *
  * This is a common configuration supported by the mosquitto MQTT server
  *
@@ -129,7 +130,7 @@
 #define MBEDTLS_ECDH_C
 #undef  MBEDTLS_ECDSA_C
 #undef  MBEDTLS_ECJPAKE_C
-#undef  MBEDTLS_KEY_EXCHANGE_PSK_ENABLED
+#define MBEDTLS_KEY_EXCHANGE_PSK_ENABLED  // mqtt_tlsPsk
 #undef  MBEDTLS_KEY_EXCHANGE_DHE_PSK_ENABLED
 #define MBEDTLS_KEY_EXCHANGE_ECDHE_PSK_ENABLED
 #undef  MBEDTLS_KEY_EXCHANGE_RSA_PSK_ENABLED
@@ -166,6 +167,12 @@
 #undef  MBEDTLS_MEMORY_BACKTRACE
 #endif
 
+// Cheaper reconnect, see mqtt_tls
+#define MBEDTLS_SSL_SESSION_TICKETS
+#define MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+// buffers shrink to negotiated fragment length after handshake (mbedTLS 2.23+)
+#define MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH
+
 //Disabled functions
 #undef  MBEDTLS_SSL_KEEP_PEER_CERTIFICATE
 #undef  MBEDTLS_PKCS1_V21
@@ -60,6 +60,11 @@ extern int g_bDoingUnitTestsNow;
 bool MQTT_IsFakingOnlineMQTT() {
 	return g_bDoingUnitTestsNow;
 }
+// self tests can simulate lost broker connection
+static bool g_bSimMQTTOffline = false;
+void SIM_SetMQTTOffline(bool bOffline) {
+	g_bSimMQTTOffline = bOffline;
+}
 /**
  * MQTT connect flags, only used in CONNECT message
  */
@@ -742,7 +747,7 @@ mqtt_client_t *mqtt_client_new(void) {
 /** Check connection status */
 u8_t mqtt_client_is_connected(mqtt_client_t *client) {
 	if (MQTT_IsFakingOnlineMQTT())
-		return 1;
+		return !g_bSimMQTTOffline;
 	return client->conn_state == MQTT_CONNECTED;
 }
 
@@ -946,6 +951,10 @@ err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload
 	if (MQTT_IsFakingOnlineMQTT()) {
 		// on Windows simulator, forward MQTT publish for unit testing
 		SIM_OnMQTTPublish(topic, payload, payload_length, qos, retain);
+		// fake broker acknowledges at once
+		if (qos > 0 && cb) {
+			cb(arg, ERR_OK);
+		}
 		return 0;
 	}
 
@@ -25,14 +25,50 @@
 
 DWORD startTime = 0;
 
+// Simulator is single threaded, so semaphores never block, but they are tracked,
+// so selftests see a take of one that is already taken. On device, that waits
+// for the timeout and fails (FreeRTOS mutexes are not recursive).
+#define SIM_MAX_SEMAPHORES 64
+static char g_simSemaphoreTaken[SIM_MAX_SEMAPHORES + 1];
+static int g_simSemaphoresCreated = 0;
+static int g_simSemaphoreDoubleTakes = 0;
+
+static int SIM_CreateSemaphore(bool bTaken) {
+	if (g_simSemaphoresCreated >= SIM_MAX_SEMAPHORES) {
+		// not tracked
+		return 0;
+	}
+	g_simSemaphoresCreated++;
+	g_simSemaphoreTaken[g_simSemaphoresCreated] = bTaken;
+	return g_simSemaphoresCreated;
+}
+int SIM_GetSemaphoreDoubleTakes() {
+	return g_simSemaphoreDoubleTakes;
+}
 int xSemaphoreTake(int semaphore, int blockTime) {
+	if (semaphore <= 0 || semaphore > g_simSemaphoresCreated) {
+		return 1;
+	}
+	if (g_simSemaphoreTaken[semaphore]) {
+		g_simSemaphoreDoubleTakes++;
+		return 0;
+	}
+	g_simSemaphoreTaken[semaphore] = 1;
 	return 1;
 }
 int xSemaphoreCreateMutex() {
-	return 0;
+	return SIM_CreateSemaphore(false);
+}
+int xSemaphoreCreateBinary() {
+	// like in FreeRTOS, it has to be given first
+	return SIM_CreateSemaphore(true);
 }
 int xSemaphoreGive(int semaphore) {
-	return 0;
+	if (semaphore <= 0 || semaphore > g_simSemaphoresCreated) {
+		return 1;
+	}
+	g_simSemaphoreTaken[semaphore] = 0;
+	return 1;
 }
 extern int g_selfTestsMode;
 int rtos_delay_milliseconds(int sec) {
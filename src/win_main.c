@@ -180,6 +180,8 @@ void Win_DoUnitTests() {
 	Test_Demo_ConditionalRelay();
 	Test_Expressions_RunTests_Braces();
 	Test_Expressions_RunTests_Basic();
+	Test_Expressions_RunTests_Compiled();
+	Test_Expressions_RunTests_Constants();
 	//Test_Enums();
 	Test_Backlog();
 	Test_DoorSensor();
@@ -250,6 +252,7 @@ void Win_DoUnitTests() {
 	Test_Commands_Channels();
 	Test_Command_If();
 	Test_Tokenizer();
+	Test_Logging();
 	Test_Http();
 	Test_Http_LED();
 	Test_DeviceGroups();